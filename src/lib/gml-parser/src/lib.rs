@@ -28,11 +28,15 @@ graph [
 
 pub mod gml;
 mod parser;
+mod reader;
+
+pub use reader::GmlReader;
 
 use nom::Finish;
 
 /// Parse the graph string into a [`gml::Gml`] object. If the graph contains syntax errors, a
-/// human-readable error message will be returned.
+/// human-readable error message will be returned. For large graphs, prefer [`GmlReader`] which
+/// parses the graph incrementally.
 /// ```
 /// let graph = r#"
 /// graph [
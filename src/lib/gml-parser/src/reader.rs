@@ -0,0 +1,339 @@
+/*!
+An incremental GML reader that parses a graph one item at a time.
+*/
+
+use std::collections::HashSet;
+use std::io::BufRead;
+
+use nom::Finish;
+
+use crate::gml::GmlItem;
+use crate::parser;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum State {
+    /// Waiting for the opening `graph [`.
+    Header,
+    /// Reading the items within the graph.
+    Body,
+    /// The graph's closing `]` has been read.
+    Done,
+}
+
+/// Reads a GML graph from a [`BufRead`] one item (`node [ ... ]`, `edge [ ... ]`, `directed 1`,
+/// etc.) at a time, so that neither the graph text nor the full [`crate::gml::Gml`] ever need to
+/// be held in memory. Only the text of the current item is buffered.
+///
+/// Each item is parsed with the same grammar as [`crate::parse`]. The reader yields items in the
+/// order they appear in the graph, and stops after the graph's closing `]`.
+///
+/// ```
+/// use gml_parser::gml::GmlItem;
+///
+/// let graph = r#"
+/// graph [
+///   node [
+///     id 0
+///   ]
+///   edge [
+///     source 0
+///     target 0
+///   ]
+/// ]"#;
+/// let mut nodes = 0;
+/// for item in gml_parser::GmlReader::new(graph.as_bytes()) {
+///     match item {
+///         Ok(GmlItem::Node(_)) => nodes += 1,
+///         Ok(_) => {}
+///         Err(e) => panic!("Could not parse graph: {}", e),
+///     }
+/// }
+/// assert_eq!(nodes, 1);
+/// ```
+pub struct GmlReader<R> {
+    reader: R,
+    state: State,
+    /// The current input line.
+    line: String,
+    /// The 1-based number of the current input line.
+    line_num: usize,
+    /// Text of the item currently being read.
+    item: String,
+    /// The line number that the current item started on.
+    item_line_num: usize,
+    /// Bracket nesting depth, where the graph itself is depth 1.
+    depth: usize,
+    in_string: bool,
+    directed_seen: bool,
+    other_keys: HashSet<String>,
+}
+
+impl<R: BufRead> GmlReader<R> {
+    pub fn new(reader: R) -> Self {
+        Self {
+            reader,
+            state: State::Header,
+            line: String::new(),
+            line_num: 0,
+            item: String::new(),
+            item_line_num: 0,
+            depth: 0,
+            in_string: false,
+            directed_seen: false,
+            other_keys: HashSet::new(),
+        }
+    }
+
+    /// Read the next item from the graph. Returns `Ok(None)` once the end of the graph has been
+    /// reached. If the graph contains syntax errors or the underlying reader fails, a
+    /// human-readable error message will be returned.
+    pub fn next_item(&mut self) -> Result<Option<GmlItem<'static>>, String> {
+        loop {
+            if self.state == State::Done {
+                return Ok(None);
+            }
+
+            self.line.clear();
+            let len = self
+                .reader
+                .read_line(&mut self.line)
+                .map_err(|e| format!("Failed to read line {}: {}", self.line_num + 1, e))?;
+            if len == 0 {
+                return Err(match self.state {
+                    State::Header => "Expected 'graph [' but reached the end of the input".into(),
+                    _ => "The graph is missing its closing ']'".into(),
+                });
+            }
+            self.line_num += 1;
+
+            if self.item.trim().is_empty() {
+                self.item_line_num = self.line_num;
+            }
+
+            // find where (if anywhere) this line ends the current item or the graph
+            let mut boundary = None;
+            for (pos, c) in self.line.char_indices() {
+                // the string grammar has no usable escapes, so a string always ends at the next
+                // quote
+                if self.in_string {
+                    if c == '"' {
+                        self.in_string = false;
+                    }
+                    continue;
+                }
+
+                match c {
+                    '"' => self.in_string = true,
+                    '[' => self.depth += 1,
+                    ']' if self.depth == 0 => {
+                        return Err(format!("Line {}: Unexpected ']'", self.line_num))
+                    }
+                    ']' => {
+                        self.depth -= 1;
+                        if self.depth == 0 {
+                            boundary = Some(pos);
+                            break;
+                        }
+                    }
+                    _ => {}
+                }
+
+                if self.state == State::Header && self.depth == 1 {
+                    boundary = Some(pos + c.len_utf8());
+                    break;
+                }
+            }
+
+            match (self.state, boundary) {
+                (State::Header, Some(end)) => {
+                    self.item.push_str(&self.line[..end]);
+                    self.check_header(&self.line[end..])?;
+                    self.item.clear();
+                    self.state = State::Body;
+                }
+                (State::Header, None) => self.item.push_str(&self.line),
+                (State::Body, Some(end)) => {
+                    // the graph's closing bracket; any trailing text is ignored
+                    self.item.push_str(&self.line[..end]);
+                    self.state = State::Done;
+                    if !self.item.trim().is_empty() {
+                        return self.parse_item().map(Some);
+                    }
+                }
+                (State::Body, None) => {
+                    self.item.push_str(&self.line);
+                    if self.depth == 1 && !self.in_string && !self.item.trim().is_empty() {
+                        return self.parse_item().map(Some);
+                    }
+                }
+                (State::Done, _) => unreachable!(),
+            }
+        }
+    }
+
+    /// Check that the buffered text is a valid graph header, and that nothing but whitespace
+    /// follows it on the same line.
+    fn check_header(&self, rest_of_line: &str) -> Result<(), String> {
+        let header = self
+            .item
+            .trim_start()
+            .strip_prefix("graph")
+            .map(|x| x.trim_start_matches([' ', '\t']));
+        if header != Some("[") {
+            return Err(format!(
+                "Line {}: Expected 'graph [' at the start of the input",
+                self.item_line_num
+            ));
+        }
+        if !rest_of_line.trim().is_empty() || !rest_of_line.ends_with('\n') {
+            return Err(format!(
+                "Line {}: Expected a newline after 'graph ['",
+                self.line_num
+            ));
+        }
+        Ok(())
+    }
+
+    /// Parse the buffered text as a single item, and clear the buffer.
+    fn parse_item(&mut self) -> Result<GmlItem<'static>, String> {
+        let text = self.item.trim_start();
+        let item = match parser::item::<nom::error::VerboseError<&str>>(text).finish() {
+            Ok((remaining, item)) if remaining.trim().is_empty() => item.upgrade_to_owned(),
+            Ok(_) => {
+                return Err(format!(
+                    "Line {}: Each item must be followed by a newline",
+                    self.item_line_num
+                ))
+            }
+            Err(e) => {
+                return Err(format!(
+                    "Line {}: {}",
+                    self.item_line_num,
+                    nom::error::convert_error(text, e)
+                ))
+            }
+        };
+        self.item.clear();
+
+        match &item {
+            GmlItem::Directed(_) if self.directed_seen => {
+                return Err("The 'directed' key must only be specified once".into())
+            }
+            GmlItem::Directed(_) => self.directed_seen = true,
+            GmlItem::KeyValue((name, _)) => {
+                if !self.other_keys.insert(name.to_string()) {
+                    return Err("Duplicate keys are not supported".into());
+                }
+            }
+            GmlItem::Node(_) | GmlItem::Edge(_) => {}
+        }
+
+        Ok(item)
+    }
+}
+
+impl<R: BufRead> Iterator for GmlReader<R> {
+    type Item = Result<GmlItem<'static>, String>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        let rv = self.next_item().transpose();
+        if let Some(Err(_)) = rv {
+            // don't continue reading after an error
+            self.state = State::Done;
+        }
+        rv
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::gml::Value;
+
+    fn read_all(graph: &str) -> Result<Vec<GmlItem<'static>>, String> {
+        GmlReader::new(graph.as_bytes()).collect()
+    }
+
+    #[test]
+    fn matches_parse() {
+        let graph = r#"
+            graph [
+              directed 1
+              label "a ] [ b"
+              node [
+                id 0
+                label "multi
+line ]"
+              ]
+              node [
+                id 1
+              ]
+              edge [
+                source 0
+                target 1
+                latency "5 ms"
+                packet_loss 0.5
+              ]
+            ]
+            trailing text"#;
+
+        let expected = crate::parse(graph).unwrap();
+        let items = read_all(graph).unwrap();
+
+        let nodes: Vec<_> = items
+            .iter()
+            .filter_map(|x| match x {
+                GmlItem::Node(x) => Some(x.clone()),
+                _ => None,
+            })
+            .collect();
+        let edges: Vec<_> = items
+            .iter()
+            .filter_map(|x| match x {
+                GmlItem::Edge(x) => Some(x.clone()),
+                _ => None,
+            })
+            .collect();
+
+        assert_eq!(nodes, expected.nodes);
+        assert_eq!(edges, expected.edges);
+        assert!(items.contains(&GmlItem::Directed(true)));
+        assert!(items.contains(&GmlItem::KeyValue((
+            "label".into(),
+            Value::Str("a ] [ b".into())
+        ))));
+    }
+
+    #[test]
+    fn empty_graph() {
+        assert_eq!(read_all("graph [\n]").unwrap(), vec![]);
+        assert_eq!(read_all("\n\n  graph\t[  \n\n  ]\n").unwrap(), vec![]);
+    }
+
+    #[test]
+    fn syntax_errors() {
+        // missing header
+        read_all("").unwrap_err();
+        read_all("node [\nid 0\n]\n").unwrap_err();
+        read_all("graph [ node [\nid 0\n]\n]").unwrap_err();
+        // missing closing bracket
+        read_all("graph [\nnode [\nid 0\n]\n").unwrap_err();
+        // two items on the same line
+        read_all("graph [\ndirected 1 directed 1\n]").unwrap_err();
+        // invalid items
+        read_all("graph [\nnode [\nid \"a\"\n]\n]").unwrap_err();
+        read_all("graph [\nedge [\nsource 0\n]\n]").unwrap_err();
+        read_all("graph [\ndirected 2\n]").unwrap_err();
+        // duplicate keys
+        read_all("graph [\ndirected 1\ndirected 1\n]").unwrap_err();
+        read_all("graph [\nabc 1\nabc 2\n]").unwrap_err();
+        read_all("graph [\nnode [\nid 0\nid 1\n]\n]").unwrap_err();
+    }
+
+    #[test]
+    fn stops_after_error() {
+        let mut reader = GmlReader::new("graph [\ndirected 2\nnode [\nid 0\n]\n]".as_bytes());
+        assert!(reader.next().unwrap().is_err());
+        assert!(reader.next().is_none());
+    }
+}
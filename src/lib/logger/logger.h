@@ -18,16 +18,33 @@
 
 #include "lib/logger/log_level.h"
 
+/*
+ * A program may define LOGGER_THREAD_LEVEL (for example with `-DLOGGER_THREAD_LEVEL=foo`) to the
+ * name of a thread-local LogLevel that is an upper bound on the levels enabled on the current
+ * thread. The convenience macros below then skip disabled messages with a single load and
+ * branch, without evaluating their arguments or calling into the logger. The shim doesn't define
+ * it since it avoids native thread-local storage.
+ */
+#ifdef LOGGER_THREAD_LEVEL
+extern __thread LogLevel LOGGER_THREAD_LEVEL;
+#define logger_maybeEnabled(level) ((level) <= LOGGER_THREAD_LEVEL)
+#else
+#define logger_maybeEnabled(level) true
+#endif
+
 /* convenience macros for logging messages at various levels */
 // clang-format off
 
+#define _logger_log_at(level, ...) \
+    (logger_maybeEnabled(level) ? logger_log(logger_getDefault(), level, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__) : (void)0)
+
 #define panic(...)    { logger_log(logger_getDefault(), LOGLEVEL_ERROR, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__); abort(); }
 #define error(...)      logger_log(logger_getDefault(), LOGLEVEL_ERROR, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-#define warning(...)    logger_log(logger_getDefault(), LOGLEVEL_WARNING, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-#define info(...)       logger_log(logger_getDefault(), LOGLEVEL_INFO, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-#define debug(...)      logger_log(logger_getDefault(), LOGLEVEL_DEBUG, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+#define warning(...)    _logger_log_at(LOGLEVEL_WARNING, __VA_ARGS__)
+#define info(...)       _logger_log_at(LOGLEVEL_INFO, __VA_ARGS__)
+#define debug(...)      _logger_log_at(LOGLEVEL_DEBUG, __VA_ARGS__)
 #ifdef DEBUG
-#define trace(...)      logger_log(logger_getDefault(), LOGLEVEL_TRACE, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+#define trace(...)      _logger_log_at(LOGLEVEL_TRACE, __VA_ARGS__)
 #else
 #define trace(...)
 #endif
@@ -1,6 +1,7 @@
 use crate::HostId;
 use libc::{siginfo_t, stack_t};
 use nix::sys::signal::Signal;
+use std::sync::atomic::AtomicU64;
 use vasi::VirtualAddressSpaceIndependent;
 
 use crate::{
@@ -219,12 +220,23 @@ pub struct ThreadShmem {
     host_id: HostId,
 
     protected: RootedRefCell<ThreadShmemProtected>,
+
+    // Size of the syscall-argument scratch area that immediately follows this
+    // struct in the same shared memory block, or 0 if there isn't one.
+    scratch_len: usize,
+
+    // Address of the scratch area in the managed thread's address space, as
+    // registered by the shim once it has mapped this block. 0 if not (yet)
+    // registered.
+    plugin_scratch: AtomicU64,
 }
 
 impl ThreadShmem {
-    pub fn new(host: &HostShmemProtected) -> Self {
+    pub fn new(host: &HostShmemProtected, scratch_len: usize) -> Self {
         Self {
             host_id: host.host_id,
+            scratch_len,
+            plugin_scratch: AtomicU64::new(0),
             protected: RootedRefCell::new(
                 &host.root,
                 ThreadShmemProtected {
@@ -616,13 +628,48 @@ pub mod export {
     pub unsafe extern "C" fn shimshmemthread_init(
         thread_mem: *mut ShimShmemThread,
         lock: *const ShimShmemHostLock,
+        scratch_len: usize,
     ) {
         let lock = unsafe { lock.as_ref().unwrap() };
-        let t = ThreadShmem::new(&lock);
+        let t = ThreadShmem::new(&lock, scratch_len);
         assert_shmem_safe!(ThreadShmem, _test_thread_shmem);
         unsafe { thread_mem.write(t) }
     }
 
+    /// Size of the scratch area following the thread's shared memory, or 0 if
+    /// it doesn't have one. The scratch area starts `shimshmemthread_size()`
+    /// bytes after the start of `thread`.
+    #[no_mangle]
+    pub unsafe extern "C" fn shimshmem_getThreadScratchLen(
+        thread: *const ShimShmemThread,
+    ) -> usize {
+        let thread_mem = unsafe { thread.as_ref().unwrap() };
+        thread_mem.scratch_len
+    }
+
+    /// Address of the scratch area in the managed thread's address space, or 0
+    /// if the shim hasn't registered it yet.
+    #[no_mangle]
+    pub unsafe extern "C" fn shimshmem_getThreadPluginScratch(
+        thread: *const ShimShmemThread,
+    ) -> u64 {
+        let thread_mem = unsafe { thread.as_ref().unwrap() };
+        thread_mem.plugin_scratch.load(Ordering::Relaxed)
+    }
+
+    /// Register the address of the scratch area in the managed thread's address
+    /// space. Should only be called from the shim.
+    #[no_mangle]
+    pub unsafe extern "C" fn shimshmem_setThreadPluginScratch(
+        thread: *const ShimShmemThread,
+        plugin_scratch: u64,
+    ) {
+        let thread_mem = unsafe { thread.as_ref().unwrap() };
+        thread_mem
+            .plugin_scratch
+            .store(plugin_scratch, Ordering::Relaxed);
+    }
+
     #[no_mangle]
     pub unsafe extern "C" fn shimshmem_getThreadPendingSignals(
         lock: *const ShimShmemHostLock,
@@ -32,6 +32,7 @@
 #include "lib/shim/shim_sys.h"
 #include "lib/shim/shim_syscall.h"
 #include "lib/shim/shim_tls.h"
+#include "lib/shim/shim_zygote.h"
 #include "main/host/syscall_numbers.h" // for SYS_shadow_* defs
 
 // Whether Shadow is using the shim-side syscall handler optimization.
@@ -309,6 +310,23 @@ static void _shim_parent_init_process_shm() {
     assert(shim_processSharedMem());
 }
 
+// Tell Shadow where the thread's syscall-argument scratch area (if any) is
+// mapped in our address space.
+static void _shim_register_thread_scratch() {
+    if (shimshmem_getThreadScratchLen(shim_threadSharedMem()) > 0) {
+        shimshmem_setThreadPluginScratch(shim_threadSharedMem(), (uintptr_t)shim_threadScratch());
+    }
+}
+
+void* shim_threadScratch() {
+    return (char*)shim_threadSharedMem() + shimshmemthread_size();
+}
+
+size_t shim_threadScratchLen() {
+    ShimShmemThread* thread_mem = shim_threadSharedMem();
+    return thread_mem ? shimshmem_getThreadScratchLen(thread_mem) : 0;
+}
+
 static void _shim_parent_init_thread_shm() {
     const char* shm_blk_buf = getenv("SHADOW_SHM_THREAD_BLK");
     assert(shm_blk_buf);
@@ -318,6 +336,7 @@ static void _shim_parent_init_thread_shm() {
 
     *_shim_thread_shared_mem_blk() = shmemserializer_globalBlockDeserialize(&shm_blk_serialized);
     assert(shim_threadSharedMem());
+    _shim_register_thread_scratch();
 }
 
 static void _shim_child_init_thread_shm() {
@@ -332,6 +351,7 @@ static void _shim_child_init_thread_shm() {
 
     *_shim_thread_shared_mem_blk() = shmemserializer_globalBlockDeserialize(&shm_blk_serialized);
     assert(shim_threadSharedMem());
+    _shim_register_thread_scratch();
 }
 
 static void _shim_parent_init_ipc() {
@@ -442,6 +462,9 @@ static void _shim_parent_init_preload() {
 
     shim_install_hardware_error_handlers();
     patch_vdso((void*)getauxval(AT_SYSINFO_EHDR));
+    // Only returns in a zygote's forked children, which continue initializing
+    // with the environment that Shadow sent for them.
+    shim_zygote_maybe_run();
     _shim_parent_init_host_shm();
     _shim_parent_init_process_shm();
     _shim_parent_init_thread_shm();
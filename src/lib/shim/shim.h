@@ -56,6 +56,12 @@ void shim_newThreadChildInitd();
     (SHIM_SIGNAL_STACK_GUARD_OVERHEAD + SHIM_SIGNAL_STACK_MIN_USABLE_SIZE)
 
 ShimShmemThread* shim_threadSharedMem();
+
+// Scratch area following the thread's shared memory, in which large syscall
+// buffers can be staged so that Shadow can access them without a
+// cross-process copy. Only valid if shim_threadScratchLen() is non-zero.
+void* shim_threadScratch();
+size_t shim_threadScratchLen();
 ShimShmemProcess* shim_processSharedMem();
 ShimShmemHost* shim_hostSharedMem();
 
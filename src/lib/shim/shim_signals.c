@@ -2,11 +2,21 @@
 
 #include "lib/logger/logger.h"
 #include "lib/shim/shim.h"
+#include "lib/shim/shim_tls.h"
 
 #include <errno.h>
+#include <setjmp.h>
+#include <stdint.h>
 #include <string.h>
 #include <ucontext.h>
 
+// Where to jump to if the shim faults while accessing memory that may be
+// invalid, or NULL if a fault in the shim is fatal.
+static sigjmp_buf** _shim_fault_recovery_point() {
+    static ShimTlsVar v = {0};
+    return shimtlsvar_ptr(&v, sizeof(sigjmp_buf*));
+}
+
 static void _call_signal_handler(const struct shd_kernel_sigaction* action, int signo,
                                  siginfo_t* siginfo, ucontext_t* ucontext) {
     shim_swapAllowNativeSyscalls(false);
@@ -155,6 +165,12 @@ bool shim_process_signals(ShimShmemHostLock* host_lock, ucontext_t* ucontext) {
 }
 
 void shim_handle_hardware_error_signal(int signo, siginfo_t* info, void* void_ucontext) {
+    sigjmp_buf* recovery_point = *_shim_fault_recovery_point();
+    if (recovery_point && (signo == SIGSEGV || signo == SIGBUS)) {
+        // Raised from `shim_tryMemcpy` or `shim_probeWritable`.
+        siglongjmp(*recovery_point, 1);
+    }
+
     bool oldNativeSyscallFlag = shim_swapAllowNativeSyscalls(true);
     if (oldNativeSyscallFlag) {
         // Error was raised from shim code.
@@ -202,4 +218,54 @@ void shim_install_hardware_error_handlers() {
             panic("sigaction: %s", strerror(errno));
         }
     }
-}
\ No newline at end of file
+}
+
+bool shim_tryMemcpy(void* dst, const void* src, size_t n) {
+    sigjmp_buf** recovery_point = _shim_fault_recovery_point();
+    sigjmp_buf* prev = *recovery_point;
+
+    // Don't save the signal mask; that would cost a syscall, and our handlers
+    // use SA_NODEFER so there's nothing to restore.
+    sigjmp_buf jmp;
+    if (sigsetjmp(jmp, 0)) {
+        *recovery_point = prev;
+        return false;
+    }
+
+    *recovery_point = &jmp;
+    // Keep the compiler from moving these stores across the copy, since it
+    // doesn't know that the copy can "return" through the signal handler.
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    memcpy(dst, src, n);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    *recovery_point = prev;
+    return true;
+}
+
+bool shim_probeWritable(void* buf, size_t n) {
+    if (n == 0) {
+        return true;
+    }
+
+    sigjmp_buf** recovery_point = _shim_fault_recovery_point();
+    sigjmp_buf* prev = *recovery_point;
+
+    sigjmp_buf jmp;
+    if (sigsetjmp(jmp, 0)) {
+        *recovery_point = prev;
+        return false;
+    }
+
+    *recovery_point = &jmp;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    // Touch one byte in every page with an atomic no-op, which needs write
+    // access but can't clobber a concurrent write from another thread.
+    const uintptr_t page = 4096;
+    uintptr_t end = (uintptr_t)buf + n;
+    for (uintptr_t p = (uintptr_t)buf; p < end; p = (p & ~(page - 1)) + page) {
+        __atomic_fetch_or((char*)p, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    *recovery_point = prev;
+    return true;
+}
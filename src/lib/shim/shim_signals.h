@@ -2,6 +2,7 @@
 #define LIB_SHIM_SHIM_SIGNALS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "lib/shadow-shim-helper-rs/shim_helper.h"
 
@@ -28,4 +29,11 @@ void shim_install_hardware_error_handlers();
 // caused by an rdtsc instruction)
 void shim_handle_hardware_error_signal(int, siginfo_t*, void*);
 
+// Like memcpy, but returns false instead of raising SIGSEGV or SIGBUS if either
+// buffer isn't accessible, in which case `dst` may have been partially written.
+bool shim_tryMemcpy(void* dst, const void* src, size_t n);
+
+// Returns whether all `n` bytes at `buf` are writable, without changing them.
+bool shim_probeWritable(void* buf, size_t n);
+
 #endif
\ No newline at end of file
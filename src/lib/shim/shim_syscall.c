@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/syscall.h>
 
 #include "lib/logger/logger.h"
@@ -225,6 +226,31 @@ static SysCallReg _shim_emulated_syscall_event(const ShimEvent* syscall_event) {
     }
 }
 
+// Buffers smaller than this aren't worth staging in the scratch area; the
+// memcpy would cost about as much as Shadow's cross-process copy.
+#define SHIM_SCRATCH_MIN_NBYTES ((size_t)4096)
+
+// Returns the index of the buffer argument of syscall `n` if it's one whose
+// buffer we can stage in the thread's scratch area, or -1 otherwise. The
+// buffer length is always the following argument.
+static int _shim_scratch_buf_arg(long n, bool* is_output) {
+    switch (n) {
+        case SYS_write:
+        case SYS_sendto: *is_output = false; return 1;
+        case SYS_recvfrom: *is_output = true; return 1;
+        default: return -1;
+    }
+}
+
+// Whether this thread's scratch area holds the buffer of a syscall in
+// progress. Signal handlers can run and make their own syscalls before that
+// syscall is restarted or its result copied back, so they must not stage their
+// buffers in the scratch area too.
+static bool* _shim_scratch_in_use() {
+    static ShimTlsVar v = {0};
+    return shimtlsvar_ptr(&v, sizeof(bool));
+}
+
 long shim_emulated_syscallv(long n, va_list args) {
     bool oldNativeSyscallFlag = shim_swapAllowNativeSyscalls(true);
 
@@ -242,8 +268,39 @@ long shim_emulated_syscallv(long n, va_list args) {
         regs[i].as_u64 = va_arg(args, uint64_t);
     }
 
+    // Stage large buffers in the scratch area shared with Shadow, so that
+    // Shadow can access them in place instead of copying across processes.
+    void* plugin_buf = NULL;
+    bool is_output = false;
+    bool* scratch_in_use = _shim_scratch_in_use();
+    int buf_arg = *scratch_in_use ? -1 : _shim_scratch_buf_arg(n, &is_output);
+    if (buf_arg >= 0) {
+        void* buf = (void*)regs[buf_arg].as_u64;
+        size_t len = regs[buf_arg + 1].as_u64;
+        if (len >= SHIM_SCRATCH_MIN_NBYTES && len <= shim_threadScratchLen() && buf != NULL) {
+            // If the plugin's buffer isn't accessible, pass it through
+            // unchanged so that Shadow returns EFAULT as usual.
+            bool accessible = is_output ? shim_probeWritable(buf, len)
+                                        : shim_tryMemcpy(shim_threadScratch(), buf, len);
+            if (accessible) {
+                plugin_buf = buf;
+                regs[buf_arg].as_u64 = (uintptr_t)shim_threadScratch();
+                *scratch_in_use = true;
+            }
+        }
+    }
+
     SysCallReg retval = _shim_emulated_syscall_event(&e);
 
+    if (plugin_buf) {
+        if (is_output && retval.as_i64 > 0 &&
+            !shim_tryMemcpy(plugin_buf, shim_threadScratch(), retval.as_i64)) {
+            // Another thread unmapped the buffer during the syscall.
+            retval.as_i64 = -EFAULT;
+        }
+        *scratch_in_use = false;
+    }
+
     shim_swapAllowNativeSyscalls(oldNativeSyscallFlag);
 
     return retval.as_i64;
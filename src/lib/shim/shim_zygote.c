@@ -0,0 +1,126 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#include "lib/shim/shim_zygote.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "lib/logger/logger.h"
+#include "main/host/zygote.h"
+
+// Holds the request being served. In the children this is where their
+// environment strings live, so it must never be freed or reused there.
+static char _request[ZYGOTE_MAX_REQUEST_LEN];
+
+// Replace the environment and working directory with those from the request.
+static void _shim_zygote_apply_request(size_t len) {
+    const char* workingDir = _request;
+    size_t pos = strlen(workingDir) + 1;
+
+    if (clearenv() != 0) {
+        panic("clearenv failed");
+    }
+    while (pos < len) {
+        char* entry = &_request[pos];
+        pos += strlen(entry) + 1;
+        if (putenv(entry) != 0) {
+            panic("putenv: %s", strerror(errno));
+        }
+    }
+
+    if (chdir(workingDir) < 0) {
+        panic("chdir %s: %s", workingDir, strerror(errno));
+    }
+}
+
+void shim_zygote_maybe_run() {
+    const char* sockStr = getenv(ZYGOTE_FD_ENV_VAR);
+    if (sockStr == NULL) {
+        return;
+    }
+    int sock = atoi(sockStr);
+
+    // Don't outlive Shadow if it dies without closing the socket. Note that the
+    // "parent" here is the Shadow worker thread that started the zygote, so
+    // Shadow must shut its zygotes down before its worker threads exit.
+    if (prctl(PR_SET_PDEATHSIG, SIGKILL)) {
+        panic("prctl: %s", strerror(errno));
+    }
+
+    while (true) {
+        struct iovec iov = {.iov_base = _request, .iov_len = sizeof(_request)};
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(int))];
+        } control = {0};
+        struct msghdr header = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control.buf,
+            .msg_controllen = sizeof(control.buf),
+        };
+
+        ssize_t len = recvmsg(sock, &header, 0);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len < 0) {
+            panic("recvmsg: %s", strerror(errno));
+        }
+        if (len == 0) {
+            // Shadow closed the socket. Don't run any of the plugin's exit
+            // handlers, since the plugin never ran.
+            _exit(EXIT_SUCCESS);
+        }
+
+        // The write end of Shadow's childpidwatcher pipe for the new process.
+        int watchFd = -1;
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&watchFd, CMSG_DATA(cmsg), sizeof(int));
+        }
+
+        int32_t response;
+        if (watchFd < 0 || (header.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+            _request[len - 1] != '\0') {
+            response = -EINVAL;
+        } else {
+            // CLONE_PARENT makes the child a child of Shadow rather than of the
+            // zygote, so that Shadow can wait on it, and so that it passes the
+            // shim's parent pid check. glibc's fork doesn't support this, so we
+            // make the syscall directly; the zygote is single-threaded and
+            // hasn't registered any atfork handlers of its own at this point.
+            long pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, 0);
+            if (pid == 0) {
+                // child
+                close(sock);
+                _shim_zygote_apply_request(len);
+                return;
+            }
+            response = pid < 0 ? -errno : (int32_t)pid;
+        }
+
+        // Only the child should hold the pipe, so that Shadow is notified
+        // when the child exits.
+        if (watchFd >= 0) {
+            close(watchFd);
+        }
+
+        if (send(sock, &response, sizeof(response), MSG_NOSIGNAL) != sizeof(response)) {
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
@@ -0,0 +1,17 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#ifndef SRC_LIB_SHIM_SHIM_ZYGOTE_H_
+#define SRC_LIB_SHIM_SHIM_ZYGOTE_H_
+
+// If this process was started as a zygote, serve spawn requests from Shadow
+// until Shadow closes the zygote's socket, and then exit. Returns only in the
+// forked children, after their environment and working directory have been
+// set from the request, or if this process isn't a zygote.
+//
+// Must be called before anything reads the per-process environment variables.
+void shim_zygote_maybe_run();
+
+#endif // SRC_LIB_SHIM_SHIM_ZYGOTE_H_
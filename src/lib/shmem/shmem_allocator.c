@@ -6,7 +6,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <errno.h>
+#include <linux/mempolicy.h>
 #include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "lib/logger/logger.h"
 #include "lib/shmem/buddy.h"
@@ -15,10 +19,27 @@
 
 #define SHD_SHMEM_ALLOCATOR_POOL_NBYTES (1 << 20)
 
+// Each new pool is twice the size of the previous one, up to this limit, so
+// that a growing allocator needs progressively fewer shm files (and so fewer
+// ftruncate and mmap calls, both here and in every process that maps them).
+#define SHD_SHMEM_ALLOCATOR_POOL_MAX_NBYTES (1 << 25)
+
 // when to change allocation strategies
 #define SHD_SHMEM_ALLOCATOR_CUTOVER_NBYTES                                                         \
     (SHD_SHMEM_ALLOCATOR_POOL_NBYTES / 2 - sizeof(BuddyControlBlock))
 
+// Little blocks are binned into size classes by the order of the buddy block
+// that backs them. Freed blocks of the classes below are kept in a small
+// per-thread cache and handed back out by later allocations of the same class
+// without taking the allocator lock. This covers the fixed-size IPC and
+// Shim*Shmem blocks that are freed and reallocated on every thread and process
+// exit and creation.
+#define SHD_SHMEM_ALLOCATOR_CACHE_MIN_ORDER SHD_BUDDY_PART_MIN_ORDER
+#define SHD_SHMEM_ALLOCATOR_CACHE_MAX_ORDER 17 // 128 KiB
+#define SHD_SHMEM_ALLOCATOR_CACHE_NCLASSES                                                         \
+    (SHD_SHMEM_ALLOCATOR_CACHE_MAX_ORDER - SHD_SHMEM_ALLOCATOR_CACHE_MIN_ORDER + 1)
+#define SHD_SHMEM_ALLOCATOR_CACHE_DEPTH 8
+
 typedef struct _ShMemFileNode {
     struct _ShMemFileNode *prv, *nxt;
     ShMemFile shmf;
@@ -62,13 +83,47 @@ static const ShMemFileNode* _shmemfilenode_findName(const ShMemFileNode* file_no
 
 typedef struct _ShMemPoolNode {
     ShMemFileNode file_node;
+    // The NUMA node that the pool's memory is bound to, or -1 if it isn't.
+    int numa_node;
     uint8_t meta[SHD_BUDDY_META_MAX_NBYTES];
 } ShMemPoolNode;
 
-static ShMemPoolNode* _shmempoolnode_create() {
+// The NUMA node that the calling thread's allocations should come from, or -1
+// for no preference.
+static __thread int _thread_numa_node = -1;
+
+// Ask the kernel to place the pages of the mapping on `numa_node`. This only
+// affects pages that haven't been touched yet, so must be called before the
+// memory is initialized. Failure isn't fatal: the memory still works, it's
+// just placed wherever the kernel chooses.
+static void _shmem_bindToNumaNode(void* p, size_t nbytes, int numa_node) {
+    if (numa_node < 0) {
+        return;
+    }
+
+    enum { NODEMASK_NBITS = 8 * sizeof(unsigned long) };
+    if (numa_node >= NODEMASK_NBITS) {
+        warning("NUMA node %d is too large; not binding shared memory", numa_node);
+        return;
+    }
+    unsigned long nodemask = 1UL << numa_node;
+
+    // glibc doesn't have a wrapper, and we don't want to depend on libnuma for
+    // a single syscall. MPOL_PREFERRED rather than MPOL_BIND, so that we fall
+    // back to other nodes instead of failing when this node is out of memory.
+    if (syscall(SYS_mbind, p, nbytes, MPOL_PREFERRED, &nodemask, NODEMASK_NBITS + 1, 0) != 0) {
+        warning("mbind to NUMA node %d failed: %s", numa_node, strerror(errno));
+    }
+}
+
+static uint32_t _shmempoolnode_nbytes(const ShMemPoolNode* node) {
+    return node->file_node.shmf.nbytes;
+}
+
+static ShMemPoolNode* _shmempoolnode_create(size_t pool_nbytes, int numa_node) {
 
     ShMemFile shmf;
-    int rc = shmemfile_alloc(SHD_SHMEM_ALLOCATOR_POOL_NBYTES, &shmf);
+    int rc = shmemfile_alloc(pool_nbytes, &shmf);
 
     if (rc == -1) {
         return NULL;
@@ -80,9 +135,13 @@ static ShMemPoolNode* _shmempoolnode_create() {
         ret->file_node.nxt = (ShMemFileNode*)ret;
         ret->file_node.prv = (ShMemFileNode*)ret;
         ret->file_node.shmf = shmf;
+        ret->numa_node = numa_node;
+
+        // must happen before the buddy init below touches the pool
+        _shmem_bindToNumaNode(shmf.p, pool_nbytes, numa_node);
 
-        buddy_poolInit(ret->file_node.shmf.p, SHD_SHMEM_ALLOCATOR_POOL_NBYTES);
-        buddy_metaInit(ret->meta, ret->file_node.shmf.p, SHD_SHMEM_ALLOCATOR_POOL_NBYTES);
+        buddy_poolInit(ret->file_node.shmf.p, pool_nbytes);
+        buddy_metaInit(ret->meta, ret->file_node.shmf.p, pool_nbytes);
 
         return ret;
     } else {
@@ -101,9 +160,148 @@ static void _shmempoolnode_destroy(ShMemPoolNode* node) {
 struct _ShMemAllocator {
     ShMemFileNode* big_alloc_nodes;
     ShMemPoolNode* little_alloc_nodes;
+    size_t next_pool_nbytes;
+    // Unique for the lifetime of the program; identifies the owner of a
+    // thread's block cache.
+    uint64_t id;
+    // Next allocator in `_live_allocators`.
+    struct _ShMemAllocator* next_live;
     pthread_mutex_t mtx;
 };
 
+typedef struct _ShMemBlockCache {
+    // Id of the allocator that the cached blocks belong to, or 0 if unbound.
+    uint64_t allocator_id;
+    size_t counts[SHD_SHMEM_ALLOCATOR_CACHE_NCLASSES];
+    void* blocks[SHD_SHMEM_ALLOCATOR_CACHE_NCLASSES][SHD_SHMEM_ALLOCATOR_CACHE_DEPTH];
+} ShMemBlockCache;
+
+static __thread ShMemBlockCache _block_cache = {0};
+
+static _Atomic uint64_t _next_allocator_id = 1;
+
+// Allocators that haven't been destroyed, so that a thread's cached blocks can
+// be returned to their allocator when the thread exits. Lock ordering:
+// `_live_allocators_mtx` before any allocator's `mtx`.
+static pthread_mutex_t _live_allocators_mtx = PTHREAD_MUTEX_INITIALIZER;
+static ShMemAllocator* _live_allocators = NULL;
+
+// Set to the thread's `_block_cache` once it holds blocks, so that the cache is
+// drained when the thread exits.
+static pthread_key_t _block_cache_key;
+static pthread_once_t _block_cache_key_once = PTHREAD_ONCE_INIT;
+
+static void _shmemallocator_addLive(ShMemAllocator* allocator) {
+    pthread_mutex_lock(&_live_allocators_mtx);
+    allocator->next_live = _live_allocators;
+    _live_allocators = allocator;
+    pthread_mutex_unlock(&_live_allocators_mtx);
+}
+
+static void _shmemallocator_removeLive(ShMemAllocator* allocator) {
+    pthread_mutex_lock(&_live_allocators_mtx);
+    for (ShMemAllocator** link = &_live_allocators; *link != NULL; link = &(*link)->next_live) {
+        if (*link == allocator) {
+            *link = allocator->next_live;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_live_allocators_mtx);
+}
+
+static void _shmemallocator_littleFree(ShMemAllocator* allocator, ShMemBlock* blk);
+
+// Thread-exit destructor for `_block_cache_key`. Returns the exiting thread's
+// cached blocks to their allocator, unless it has already been destroyed.
+static void _shmemblockcache_drain(void* cache_ptr) {
+    ShMemBlockCache* cache = cache_ptr;
+
+    pthread_mutex_lock(&_live_allocators_mtx);
+
+    ShMemAllocator* allocator = _live_allocators;
+    while (allocator != NULL && allocator->id != cache->allocator_id) {
+        allocator = allocator->next_live;
+    }
+
+    if (allocator != NULL) {
+        pthread_mutex_lock(&allocator->mtx);
+        for (int cls = 0; cls < SHD_SHMEM_ALLOCATOR_CACHE_NCLASSES; ++cls) {
+            for (size_t i = 0; i < cache->counts[cls]; ++i) {
+                // littleFree only needs the block's address
+                ShMemBlock blk = {.p = cache->blocks[cls][i]};
+                _shmemallocator_littleFree(allocator, &blk);
+            }
+        }
+        pthread_mutex_unlock(&allocator->mtx);
+    }
+
+    pthread_mutex_unlock(&_live_allocators_mtx);
+
+    memset(cache, 0, sizeof(*cache));
+}
+
+static void _shmemblockcache_createKey() {
+    int rv = pthread_key_create(&_block_cache_key, _shmemblockcache_drain);
+    if (rv != 0) {
+        panic("pthread_key_create: %s", strerror(rv));
+    }
+}
+
+// Returns the cache class for a little allocation of `nbytes`, or -1 if blocks
+// of that size aren't cached.
+static int _shmemblockcache_class(size_t nbytes) {
+    uint32_t order =
+        shmem_util_uintLog2(shmem_util_roundUpPow2(nbytes + sizeof(BuddyControlBlock)));
+    if (order > SHD_SHMEM_ALLOCATOR_CACHE_MAX_ORDER) {
+        return -1;
+    }
+    return order - SHD_SHMEM_ALLOCATOR_CACHE_MIN_ORDER;
+}
+
+static bool _shmemblockcache_isEmpty(const ShMemBlockCache* cache) {
+    for (int cls = 0; cls < SHD_SHMEM_ALLOCATOR_CACHE_NCLASSES; ++cls) {
+        if (cache->counts[cls] > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void* _shmemblockcache_take(ShMemAllocator* allocator, size_t nbytes) {
+    ShMemBlockCache* cache = &_block_cache;
+    int cls = _shmemblockcache_class(nbytes);
+    if (cls < 0 || cache->allocator_id != allocator->id || cache->counts[cls] == 0) {
+        return NULL;
+    }
+    return cache->blocks[cls][--cache->counts[cls]];
+}
+
+static bool _shmemblockcache_put(ShMemAllocator* allocator, const ShMemBlock* blk) {
+    ShMemBlockCache* cache = &_block_cache;
+    int cls = _shmemblockcache_class(blk->nbytes);
+    if (cls < 0) {
+        return false;
+    }
+    if (cache->allocator_id != allocator->id) {
+        // Only rebind the cache if it doesn't hold any blocks of another allocator.
+        if (cache->allocator_id != 0 && !_shmemblockcache_isEmpty(cache)) {
+            return false;
+        }
+        cache->allocator_id = allocator->id;
+    }
+    if (cache->counts[cls] == SHD_SHMEM_ALLOCATOR_CACHE_DEPTH) {
+        return false;
+    }
+    if (_shmemblockcache_isEmpty(cache)) {
+        // Arrange for the blocks to be returned when this thread exits. This
+        // is only needed once per thread, but is cheap enough to repeat.
+        pthread_once(&_block_cache_key_once, _shmemblockcache_createKey);
+        pthread_setspecific(_block_cache_key, cache);
+    }
+    cache->blocks[cls][cache->counts[cls]++] = blk->p;
+    return true;
+}
+
 struct _ShMemSerializer {
     ShMemFileNode* nodes;
     pthread_mutex_t mtx;
@@ -162,7 +360,10 @@ ShMemAllocator* shmemallocator_create() {
     ShMemAllocator* allocator = calloc(1, sizeof(ShMemAllocator));
 
     if (allocator) {
+        allocator->next_pool_nbytes = SHD_SHMEM_ALLOCATOR_POOL_NBYTES;
+        allocator->id = _next_allocator_id++;
         pthread_mutex_init(&allocator->mtx, NULL);
+        _shmemallocator_addLive(allocator);
     }
 
     return allocator;
@@ -171,6 +372,14 @@ ShMemAllocator* shmemallocator_create() {
 void shmemallocator_destroy(ShMemAllocator* allocator) {
     assert(allocator);
 
+    // Blocks cached by other threads are never handed out again, since the
+    // allocator's id is never reused, and they won't be returned once it's no
+    // longer live; but we can at least release ours.
+    _shmemallocator_removeLive(allocator);
+    if (_block_cache.allocator_id == allocator->id) {
+        memset(&_block_cache, 0, sizeof(_block_cache));
+    }
+
     ShMemPoolNode* node = allocator->little_alloc_nodes;
 
     if (node) {
@@ -189,6 +398,11 @@ void shmemallocator_destroy(ShMemAllocator* allocator) {
 void shmemallocator_destroyNoShmDelete(ShMemAllocator* allocator) {
     assert(allocator);
 
+    _shmemallocator_removeLive(allocator);
+    if (_block_cache.allocator_id == allocator->id) {
+        memset(&_block_cache, 0, sizeof(_block_cache));
+    }
+
     ShMemPoolNode* node = allocator->little_alloc_nodes;
 
     if (node != NULL) {
@@ -216,6 +430,8 @@ static ShMemBlock _shmemallocator_bigAlloc(ShMemAllocator* allocator, size_t nby
         ShMemFileNode* file_node = calloc(1, sizeof(ShMemFileNode));
 
         if (file_node) {
+            _shmem_bindToNumaNode(shmf.p, good_size_nbytes, _thread_numa_node);
+
             blk.p = shmf.p;
             blk.nbytes = nbytes;
 
@@ -244,23 +460,38 @@ static ShMemBlock _shmemallocator_littleAlloc(ShMemAllocator* allocator, size_t
     ShMemBlock blk;
     memset(&blk, 0, sizeof(ShMemBlock));
 
+    const int numa_node = _thread_numa_node;
+
     if (allocator->little_alloc_nodes == NULL) {
-        allocator->little_alloc_nodes = _shmempoolnode_create();
+        allocator->little_alloc_nodes =
+            _shmempoolnode_create(allocator->next_pool_nbytes, numa_node);
+        if (allocator->little_alloc_nodes == NULL) {
+            return blk;
+        }
     }
 
     ShMemPoolNode* pool_node = allocator->little_alloc_nodes;
     void* p = NULL;
 
-    do { // try to make the alloc in the pool
+    do { // try to make the alloc in each of the pools, newest first
 
-        p = buddy_alloc(
-            nbytes, pool_node->meta, pool_node->file_node.shmf.p, SHD_SHMEM_ALLOCATOR_POOL_NBYTES);
+        // if the thread has a node, only use pools on that node
+        if (numa_node < 0 || pool_node->numa_node == numa_node) {
+            p = buddy_alloc(nbytes, pool_node->meta, pool_node->file_node.shmf.p,
+                            _shmempoolnode_nbytes(pool_node));
+        }
+        pool_node = (ShMemPoolNode*)pool_node->file_node.nxt;
 
     } while (pool_node != allocator->little_alloc_nodes && p == NULL);
 
     if (p == NULL) {
-        // If we couldn't make an allocation, create a new pool and try again.
-        ShMemFileNode* new_head = (ShMemFileNode*)_shmempoolnode_create();
+        // If we couldn't make an allocation, create a new, bigger pool and try again.
+        if (allocator->next_pool_nbytes < SHD_SHMEM_ALLOCATOR_POOL_MAX_NBYTES) {
+            allocator->next_pool_nbytes *= 2;
+        }
+
+        ShMemFileNode* new_head =
+            (ShMemFileNode*)_shmempoolnode_create(allocator->next_pool_nbytes, numa_node);
 
         if (new_head == NULL) {
             return blk;
@@ -283,6 +514,8 @@ static ShMemBlock _shmemallocator_littleAlloc(ShMemAllocator* allocator, size_t
     }
 }
 
+void shmemallocator_setThreadNumaNode(int numa_node) { _thread_numa_node = numa_node; }
+
 ShMemBlock shmemallocator_alloc(ShMemAllocator* allocator, size_t nbytes) {
     assert(allocator);
 
@@ -293,6 +526,15 @@ ShMemBlock shmemallocator_alloc(ShMemAllocator* allocator, size_t nbytes) {
         return blk;
     }
 
+    if (nbytes <= SHD_SHMEM_ALLOCATOR_CUTOVER_NBYTES) {
+        void* p = _shmemblockcache_take(allocator, nbytes);
+        if (p != NULL) {
+            blk.p = p;
+            blk.nbytes = nbytes;
+            return blk;
+        }
+    }
+
     pthread_mutex_lock(&allocator->mtx);
 
     if (nbytes > SHD_SHMEM_ALLOCATOR_CUTOVER_NBYTES) {
@@ -342,12 +584,17 @@ static void _shmemallocator_littleFree(ShMemAllocator* allocator, ShMemBlock* bl
     assert(pool_node);
 
     buddy_free(
-        blk->p, pool_node->meta, pool_node->file_node.shmf.p, SHD_SHMEM_ALLOCATOR_POOL_NBYTES);
+        blk->p, pool_node->meta, pool_node->file_node.shmf.p, _shmempoolnode_nbytes(pool_node));
 }
 
 void shmemallocator_free(ShMemAllocator* allocator, ShMemBlock* blk) {
     assert(allocator && blk);
 
+    if (blk->nbytes <= SHD_SHMEM_ALLOCATOR_CUTOVER_NBYTES &&
+        _shmemblockcache_put(allocator, blk)) {
+        return;
+    }
+
     pthread_mutex_lock(&allocator->mtx);
 
     if (blk->nbytes > SHD_SHMEM_ALLOCATOR_CUTOVER_NBYTES) {
@@ -121,6 +121,16 @@ void shmemallocator_destroyNoShmDelete(ShMemAllocator* allocator);
  */
 ShMemBlock shmemallocator_alloc(ShMemAllocator* allocator, size_t nbytes);
 
+/*
+ * Set the NUMA node that later allocations made by the calling thread should
+ * come from, or -1 (the default) for no preference. Little allocations are
+ * then made only from pools whose memory is bound to that node, and new pools
+ * and big allocations are bound to it.
+ *
+ * THREAD SAFETY: thread-safe; only affects the calling thread.
+ */
+void shmemallocator_setThreadNumaNode(int numa_node);
+
 static inline ShMemBlock shmemallocator_globalAlloc(size_t nbytes) {
     return shmemallocator_alloc(shmemallocator_getGlobal(), nbytes);
 }
@@ -12,6 +12,7 @@
 #include <string.h>
 
 #include <glib.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -295,6 +296,179 @@ static void shmemallocator_testAlloc() {
     free(blks);
 }
 
+static void shmemallocator_testBlockCache() {
+    ShMemAllocator* allocator = shmemallocator_create();
+    g_assert_nonnull(allocator);
+
+    // A freed block should be handed back out to the next allocation of the
+    // same size class on this thread.
+    ShMemBlock x = shmemallocator_alloc(allocator, 1000);
+    void* p = x.p;
+    shmemallocator_free(allocator, &x);
+
+    ShMemBlock y = shmemallocator_alloc(allocator, 900);
+    g_assert_true(y.p == p);
+    g_assert_cmpint(y.nbytes, ==, 900);
+    memset(y.p, 255, y.nbytes);
+
+    // ...and still be serializable.
+    ShMemBlockSerialized serial = shmemallocator_blockSerialize(allocator, &y);
+    ShMemBlock z = shmemallocator_blockDeserialize(allocator, &serial);
+    g_assert_true(y.p == z.p);
+    g_assert_cmpint(y.nbytes, ==, z.nbytes);
+
+    shmemallocator_free(allocator, &y);
+    shmemallocator_destroy(allocator);
+}
+
+typedef struct _ShMemFreeArgs {
+    ShMemAllocator* allocator;
+    ShMemBlock* blks;
+    size_t nblks;
+} ShMemFreeArgs;
+
+// Frees some blocks on another thread, which caches what it can until it exits.
+static void* _shmemallocator_freeThread(void* arg) {
+    ShMemFreeArgs* args = arg;
+    for (size_t idx = 0; idx < args->nblks; ++idx) {
+        shmemallocator_free(args->allocator, &args->blks[idx]);
+    }
+    return NULL;
+}
+
+static void _shmemallocator_freeOnThread(ShMemAllocator* allocator, ShMemBlock* blks,
+                                         size_t nblks) {
+    ShMemFreeArgs args = {.allocator = allocator, .blks = blks, .nblks = nblks};
+    pthread_t thread;
+    g_assert_cmpint(pthread_create(&thread, NULL, _shmemallocator_freeThread, &args), ==, 0);
+    g_assert_cmpint(pthread_join(thread, NULL), ==, 0);
+}
+
+static bool _shmemallocator_hasName(char names[][SHD_SHMEM_FILE_NAME_NBYTES], size_t nnames,
+                                    const char* name) {
+    for (size_t idx = 0; idx < nnames; ++idx) {
+        if (strcmp(names[idx], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void shmemallocator_testPoolGrowth() {
+    enum { kNumBlocks = 64 };
+    const size_t nbytes = 100000;
+
+    ShMemAllocator* allocator = shmemallocator_create();
+    g_assert_nonnull(allocator);
+
+    // Enough to need several pools.
+    ShMemBlock blks[kNumBlocks];
+    for (size_t idx = 0; idx < kNumBlocks; ++idx) {
+        blks[idx] = shmemallocator_alloc(allocator, nbytes);
+        g_assert_nonnull(blks[idx].p);
+        memset(blks[idx].p, idx, nbytes);
+    }
+
+    char pool_names[kNumBlocks][SHD_SHMEM_FILE_NAME_NBYTES];
+    size_t npools = 0;
+    size_t max_pool_nbytes = 0;
+
+    for (size_t idx = 0; idx < kNumBlocks; ++idx) {
+        ShMemBlockSerialized serial = shmemallocator_blockSerialize(allocator, &blks[idx]);
+        if (idx == 0) {
+            g_assert_cmpint(serial.nbytes, ==, 1 << 20);
+        }
+        // Pools grow geometrically, so none should be smaller than the first.
+        g_assert_cmpint(serial.nbytes, >=, 1 << 20);
+        max_pool_nbytes = MAX(max_pool_nbytes, serial.nbytes);
+        if (!_shmemallocator_hasName(pool_names, npools, serial.name)) {
+            strcpy(pool_names[npools++], serial.name);
+        }
+        g_assert_cmpint(((uint8_t*)blks[idx].p)[nbytes - 1], ==, (uint8_t)idx);
+    }
+
+    g_assert_cmpint(npools, >=, 2);
+    g_assert_cmpint(max_pool_nbytes, >, 1 << 20);
+
+    // Blocks freed on another thread should be reused rather than growing the
+    // allocator again, including the ones it had cached when it exited.
+    _shmemallocator_freeOnThread(allocator, blks, kNumBlocks);
+
+    for (size_t idx = 0; idx < kNumBlocks; ++idx) {
+        blks[idx] = shmemallocator_alloc(allocator, nbytes);
+        g_assert_nonnull(blks[idx].p);
+        ShMemBlockSerialized serial = shmemallocator_blockSerialize(allocator, &blks[idx]);
+        g_assert_true(_shmemallocator_hasName(pool_names, npools, serial.name));
+    }
+
+    for (size_t idx = 0; idx < kNumBlocks; ++idx) {
+        shmemallocator_free(allocator, &blks[idx]);
+    }
+    shmemallocator_destroy(allocator);
+}
+
+static void shmemallocator_testThreadExit() {
+    enum { kNumBlocks = 8 };
+
+    ShMemAllocator* allocator = shmemallocator_create();
+    g_assert_nonnull(allocator);
+
+    ShMemBlock blks[kNumBlocks];
+    void* ptrs[kNumBlocks];
+    for (size_t idx = 0; idx < kNumBlocks; ++idx) {
+        blks[idx] = shmemallocator_alloc(allocator, 1000);
+        g_assert_nonnull(blks[idx].p);
+        ptrs[idx] = blks[idx].p;
+    }
+
+    // These all fit in the other thread's cache, so they only get back to the
+    // allocator when that thread exits. Once they do, the allocator is in the
+    // same state as before, and hands out the same blocks in the same order.
+    _shmemallocator_freeOnThread(allocator, blks, kNumBlocks);
+
+    for (size_t idx = 0; idx < kNumBlocks; ++idx) {
+        blks[idx] = shmemallocator_alloc(allocator, 1000);
+        g_assert_true(blks[idx].p == ptrs[idx]);
+    }
+
+    for (size_t idx = 0; idx < kNumBlocks; ++idx) {
+        shmemallocator_free(allocator, &blks[idx]);
+    }
+    shmemallocator_destroy(allocator);
+}
+
+static void shmemallocator_testNumaNode() {
+    ShMemAllocator* allocator = shmemallocator_create();
+    g_assert_nonnull(allocator);
+
+    ShMemBlock x = shmemallocator_alloc(allocator, 1000);
+    g_assert_nonnull(x.p);
+
+    // Allocations for a node shouldn't come from a pool without one, even
+    // though it has plenty of room. Binding may fail on a kernel without NUMA
+    // support, but the allocation should still succeed.
+    shmemallocator_setThreadNumaNode(0);
+    ShMemBlock y = shmemallocator_alloc(allocator, 1000);
+    g_assert_nonnull(y.p);
+    memset(y.p, 255, y.nbytes);
+
+    ShMemBlockSerialized x_serial = shmemallocator_blockSerialize(allocator, &x);
+    ShMemBlockSerialized y_serial = shmemallocator_blockSerialize(allocator, &y);
+    g_assert_cmpstr(x_serial.name, !=, y_serial.name);
+
+    // ...but later allocations for the same node can share its pool.
+    ShMemBlock z = shmemallocator_alloc(allocator, 1000);
+    ShMemBlockSerialized z_serial = shmemallocator_blockSerialize(allocator, &z);
+    g_assert_cmpstr(y_serial.name, ==, z_serial.name);
+
+    shmemallocator_setThreadNumaNode(-1);
+
+    shmemallocator_free(allocator, &x);
+    shmemallocator_free(allocator, &y);
+    shmemallocator_free(allocator, &z);
+    shmemallocator_destroy(allocator);
+}
+
 static void shmemallocator_implTestSerial(ShMemAllocator* allocator) {
     ShMemBlock x = shmemallocator_alloc(allocator, 1024);
     ShMemBlockSerialized serial = shmemallocator_blockSerialize(allocator, &x);
@@ -552,6 +726,18 @@ int main(int argc, char** argv) {
     g_test_add(
         "/shmem/shmemallocator_testSerial", void, NULL, NULL, shmemallocator_testSerial, NULL);
 
+    g_test_add("/shmem/shmemallocator_testBlockCache", void, NULL, NULL,
+               shmemallocator_testBlockCache, NULL);
+
+    g_test_add("/shmem/shmemallocator_testPoolGrowth", void, NULL, NULL,
+               shmemallocator_testPoolGrowth, NULL);
+
+    g_test_add("/shmem/shmemallocator_testThreadExit", void, NULL, NULL,
+               shmemallocator_testThreadExit, NULL);
+
+    g_test_add("/shmem/shmemallocator_testNumaNode", void, NULL, NULL,
+               shmemallocator_testNumaNode, NULL);
+
     g_test_add("/shmem/shmemblockserialized_testString", void, NULL, NULL,
                shmemblockserialized_testString, NULL);
 
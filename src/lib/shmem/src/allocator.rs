@@ -251,6 +251,13 @@ impl Allocator {
     }
 }
 
+/// Set the NUMA node that later allocations made by the calling thread should come from, or `None`
+/// for no preference. This applies to all allocators.
+pub fn set_thread_numa_node(node: Option<u32>) {
+    let node = node.map(|x| i32::try_from(x).unwrap()).unwrap_or(-1);
+    unsafe { c_bindings::shmemallocator_setThreadNumaNode(node) };
+}
+
 /// Transforms `ShMemBlockSerialized` to `ShMemBlockAlias`.
 pub struct Serializer {
     internal: *mut crate::c_bindings::ShMemSerializer,
@@ -95,7 +95,7 @@ pub fn log_syscall(args: TokenStream, input: TokenStream) -> TokenStream {
 
             // make sure to include the full path to all used types
             use crate::core::worker::Worker;
-            use crate::host::syscall::format::{{SyscallArgsFmt, SyscallResultFmt, write_syscall}};
+            use crate::host::syscall::format::{{SyscallArgsFmt, SyscallResultFmt}};
 
             let syscall_args = <SyscallArgsFmt::<{syscall_args}>>::new(args, strace_fmt_options, ctx.process.memory());
             // need to convert to a string so that we read the plugin's memory before we potentially
@@ -109,16 +109,13 @@ pub fn log_syscall(args: TokenStream, input: TokenStream) -> TokenStream {
             let syscall_rv = SyscallResultFmt::<{syscall_rv}>::new(&rv, strace_fmt_options, ctx.process.memory());
 
             if let Some(ref syscall_rv) = syscall_rv {{
-                ctx.process.with_strace_file(|file| {{
-                    write_syscall(
-                        file,
-                        &Worker::current_time().unwrap(),
-                        ctx.thread.id(),
-                        "{syscall_name}",
-                        &syscall_args,
-                        syscall_rv,
-                    ).unwrap();
-                }});
+                ctx.process.write_strace(
+                    &Worker::current_time().unwrap(),
+                    ctx.thread.id(),
+                    "{syscall_name}",
+                    syscall_args,
+                    syscall_rv,
+                ).unwrap();
             }}
 
             rv
@@ -38,6 +38,28 @@ impl Tsc {
         }
     }
 
+    /// Reads the host system's native TSC. This is much cheaper than reading a system clock, and
+    /// is useful for measuring short wall-clock durations.
+    #[inline]
+    pub fn native_rdtsc() -> u64 {
+        unsafe { std::arch::x86_64::_rdtsc() }
+    }
+
+    /// Measures the host system's native TSC rate by comparing it to the system's monotonic
+    /// clock over `duration`. Unlike [`Tsc::native_cycles_per_second`], this works on all CPUs
+    /// with an invariant TSC, but it's only an estimate and blocks for `duration`.
+    pub fn measure_native_cycles_per_second(duration: std::time::Duration) -> u64 {
+        let start_time = std::time::Instant::now();
+        let start_cycles = Self::native_rdtsc();
+        std::thread::sleep(duration);
+        let cycles = Self::native_rdtsc().wrapping_sub(start_cycles);
+        let elapsed = start_time.elapsed();
+
+        (u128::from(cycles) * 1_000_000_000 / elapsed.as_nanos().max(1))
+            .try_into()
+            .unwrap()
+    }
+
     pub fn new(cycles_per_second: u64) -> Self {
         Self {
             cyclesPerSecond: cycles_per_second,
@@ -179,6 +201,13 @@ mod test {
         );
     }
 
+    #[test]
+    fn native_rdtsc_increases() {
+        let a = Tsc::native_rdtsc();
+        let b = Tsc::native_rdtsc();
+        assert!(b >= a);
+    }
+
     #[test]
     fn large_cycle_count() {
         let one_year_in_seconds: u64 = 365 * 24 * 60 * 60;
@@ -206,6 +235,12 @@ mod export {
         Tsc::native_cycles_per_second().unwrap_or(0)
     }
 
+    /// Reads the host system's native TSC.
+    #[no_mangle]
+    pub extern "C" fn Tsc_nativeRdtsc() -> u64 {
+        Tsc::native_rdtsc()
+    }
+
     /// Instantiate a TSC with the given clock rate.
     #[no_mangle]
     pub extern "C" fn Tsc_create(cycles_per_second: u64) -> Tsc {
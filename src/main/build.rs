@@ -114,6 +114,7 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .header("host/syscall_types.h")
         .header("host/thread.h")
         .header("host/tracker.h")
+        .header("host/zygote.h")
         .header("routing/packet.h")
         .header("utility/rpath.h")
         .header("utility/utility.h")
@@ -147,10 +148,12 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .allowlist_function("scanRpathForLib")
         .allowlist_function("runConfigHandlers")
         .allowlist_function("rustlogger_new")
+        .allowlist_function("rustlogger_setThreadLevel")
         .allowlist_function("dns_.*")
         .allowlist_function("address_.*")
         .allowlist_function("compatsocket_getSocketName")
         .allowlist_function("workerpool_updateMinHostRunahead")
+        .allowlist_function("zygote_shutdownAll")
         .allowlist_function("process_.*")
         .allowlist_function("shadow_logger_getDefault")
         .allowlist_function("shadow_logger_shouldFilter")
@@ -206,7 +209,7 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .blocklist_type("Logger")
         .blocklist_type("Timer")
         .blocklist_type("Controller")
-        .blocklist_type("Counter")
+        .blocklist_type("SyscallCounter")
         .blocklist_type("Descriptor")
         .blocklist_type("HostId")
         .blocklist_type("TaskRef")
@@ -220,6 +223,7 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .raw_line("/* automatically generated by rust-bindgen */")
         .raw_line("use crate::core::main::ShadowBuildInfo;")
         .raw_line("use crate::core::support::configuration::ConfigOptions;")
+        .raw_line("use crate::core::sim_stats::SyscallCounter;")
         .raw_line("use crate::core::support::configuration::QDiscMode;")
         .raw_line("use crate::host::descriptor::descriptor_table::DescriptorTable;")
         .raw_line("use crate::host::descriptor::File;")
@@ -229,7 +233,7 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .raw_line("use crate::host::syscall::format::StraceFmtMode;")
         .raw_line("use crate::host::syscall::handler::SyscallHandler;")
         .raw_line("use crate::host::timer::Timer;")
-        .raw_line("use crate::utility::counter::Counter;")
+        .raw_line("use crate::network::pcap_capture::PcapInterface;")
         .raw_line("use logger::Logger;")
         .raw_line("use shadow_shim_helper_rs::HostId;")
         //# used to generate #[must_use] annotations)
@@ -260,6 +264,10 @@ fn build_remora(build_common: &ShadowBuildCommon) {
 fn build_shadow_c(build_common: &ShadowBuildCommon) {
     let mut build = build_common.cc_build();
 
+    // let the logging macros skip disabled messages using the level cached for the current
+    // thread (see `rustlogger_setThreadLevel`)
+    build.define("LOGGER_THREAD_LEVEL", "rustlogger_threadLevel");
+
     build.files(&[
         "core/logger/log_wrapper.c",
         "core/support/config_handlers.c",
@@ -307,6 +315,7 @@ fn build_shadow_c(build_common: &ShadowBuildCommon) {
         "host/network_interface.c",
         "host/network_queuing_disciplines.c",
         "host/tracker.c",
+        "host/zygote.c",
         "routing/payload.c",
         "routing/packet.c",
         "routing/address.c",
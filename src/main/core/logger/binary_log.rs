@@ -0,0 +1,236 @@
+//! An optional binary log format for records logged by hosts.
+//!
+//! Formatting and queueing text log lines for the logger thread is expensive when hosts log at
+//! debug or trace level. In binary mode, each thread instead appends fixed-width records to its own
+//! file in the log directory, without going through the shared record queue. Static strings (file
+//! names, module paths, and messages without arguments) are written once per file and referred to
+//! by id, and host names and addresses are written once per file and referred to by host id.
+//! `src/tools/shadow-log-decode.py` converts the files back to Shadow's text log format.
+//!
+//! All integers are little-endian. Each file starts with:
+//!
+//! ```text
+//! magic: [u8; 8] = b"SHDWLOG\0"
+//! version: u32 = 1
+//! thread_name_len: u32
+//! thread_name: [u8; thread_name_len]
+//! ```
+//!
+//! which is followed by entries that each start with a `u8` tag:
+//!
+//! ```text
+//! TAG_STRING: id: u32, len: u32, bytes: [u8; len]
+//! TAG_HOST:   host_id: u32, ip: u32 (big-endian), name_len: u32, name: [u8; name_len]
+//! TAG_RECORD: level: u8, wall_time_micros: u64, sim_time_nanos: u64, thread_id: u32,
+//!             host_id: u32, file_id: u32, module_id: u32, line: u32, message_id: u32,
+//!             [message_len: u32, message: [u8; message_len]] (only if message_id == NONE)
+//! ```
+//!
+//! A `sim_time_nanos` of `u64::MAX` and any id or line of `NONE` mean "n/a".
+
+use std::cell::RefCell;
+use std::collections::{HashMap, HashSet};
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::time::Duration;
+
+use log::Record;
+use once_cell::sync::OnceCell;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+
+use crate::host::host::HostInfo;
+
+const MAGIC: &[u8; 8] = b"SHDWLOG\0";
+const VERSION: u32 = 1;
+
+const TAG_STRING: u8 = 1;
+const TAG_HOST: u8 = 2;
+const TAG_RECORD: u8 = 3;
+
+/// An absent id or line number.
+const NONE: u32 = u32::MAX;
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static LOG_DIR: OnceCell<PathBuf> = OnceCell::new();
+
+thread_local!(static THREAD_LOG: RefCell<Option<ThreadLog>> = RefCell::new(None));
+
+/// Write host log records to binary files in `dir` instead of to stdout. The directory must not
+/// already exist.
+pub fn enable(dir: &Path) -> std::io::Result<()> {
+    std::fs::create_dir(dir)?;
+    LOG_DIR
+        .set(dir.to_path_buf())
+        .expect("Binary logging was already enabled");
+    ENABLED.store(true, Ordering::Release);
+    Ok(())
+}
+
+#[inline]
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Write the record to this thread's binary log file. Returns `false` if the record couldn't be
+/// written, in which case it should be logged normally.
+pub fn log(
+    record: &Record,
+    host: &HostInfo,
+    wall_time: Duration,
+    emu_time: Option<EmulatedTime>,
+    thread_name: impl FnOnce() -> String,
+    thread_id: nix::unistd::Pid,
+) -> bool {
+    THREAD_LOG
+        .try_with(|log| {
+            let mut log = log.borrow_mut();
+
+            if log.is_none() {
+                match ThreadLog::new(&thread_name(), thread_id) {
+                    Ok(x) => *log = Some(x),
+                    Err(e) => {
+                        eprintln!("WARNING: Couldn't create binary log file: {e}");
+                        // fall back to text logging for all threads rather than retrying for
+                        // every record
+                        ENABLED.store(false, Ordering::Relaxed);
+                        return false;
+                    }
+                }
+            }
+
+            let log = log.as_mut().unwrap();
+            match log.write_record(record, host, wall_time, emu_time, thread_id) {
+                Ok(()) => true,
+                Err(e) => {
+                    eprintln!("WARNING: Couldn't write to binary log file: {e}");
+                    false
+                }
+            }
+        })
+        .unwrap_or(false)
+}
+
+/// Flush this thread's binary log file, if it has one. Worker threads call this at the end of each
+/// round, and each thread's file is also flushed when the thread exits.
+pub fn flush_thread() {
+    THREAD_LOG
+        .try_with(|log| {
+            // the file is already borrowed if we're panicking while writing a record to it
+            let Ok(mut log) = log.try_borrow_mut() else {
+                return;
+            };
+            if let Some(log) = log.as_mut() {
+                log.writer.flush().unwrap_or_else(|e| {
+                    eprintln!("WARNING: Couldn't flush binary log file: {e}");
+                });
+            }
+        })
+        .ok();
+}
+
+struct ThreadLog {
+    writer: std::io::BufWriter<std::fs::File>,
+    /// Ids of the static strings written to this file, keyed by the string's address and length.
+    strings: HashMap<(usize, usize), u32>,
+    /// Hosts whose info has been written to this file.
+    hosts: HashSet<u32>,
+    /// Reused buffer for building records.
+    buf: Vec<u8>,
+}
+
+impl ThreadLog {
+    fn new(thread_name: &str, thread_id: nix::unistd::Pid) -> std::io::Result<Self> {
+        let dir = LOG_DIR.get().unwrap();
+        let path = dir.join(format!("{thread_name}-{thread_id}.bin"));
+        let mut writer = std::io::BufWriter::new(std::fs::File::create(path)?);
+
+        writer.write_all(MAGIC)?;
+        writer.write_all(&VERSION.to_le_bytes())?;
+        writer.write_all(&u32::try_from(thread_name.len()).unwrap().to_le_bytes())?;
+        writer.write_all(thread_name.as_bytes())?;
+
+        Ok(Self {
+            writer,
+            strings: HashMap::new(),
+            hosts: HashSet::new(),
+            buf: Vec::new(),
+        })
+    }
+
+    /// Get the id of a static string, writing it to the file if it hasn't been written yet.
+    fn string_id(&mut self, s: Option<&'static str>) -> std::io::Result<u32> {
+        let Some(s) = s else {
+            return Ok(NONE);
+        };
+
+        let key = (s.as_ptr() as usize, s.len());
+        if let Some(id) = self.strings.get(&key) {
+            return Ok(*id);
+        }
+
+        let id = u32::try_from(self.strings.len()).unwrap();
+        self.writer.write_all(&[TAG_STRING])?;
+        self.writer.write_all(&id.to_le_bytes())?;
+        self.writer
+            .write_all(&u32::try_from(s.len()).unwrap().to_le_bytes())?;
+        self.writer.write_all(s.as_bytes())?;
+
+        self.strings.insert(key, id);
+        Ok(id)
+    }
+
+    fn write_record(
+        &mut self,
+        record: &Record,
+        host: &HostInfo,
+        wall_time: Duration,
+        emu_time: Option<EmulatedTime>,
+        thread_id: nix::unistd::Pid,
+    ) -> std::io::Result<()> {
+        let host_id = u32::from(host.id);
+        if self.hosts.insert(host_id) {
+            self.writer.write_all(&[TAG_HOST])?;
+            self.writer.write_all(&host_id.to_le_bytes())?;
+            self.writer.write_all(&host.default_ip.octets())?;
+            self.writer
+                .write_all(&u32::try_from(host.name.len()).unwrap().to_le_bytes())?;
+            self.writer.write_all(host.name.as_bytes())?;
+        }
+
+        let file_id = self.string_id(record.file_static())?;
+        let module_id = self.string_id(record.module_path_static())?;
+        // messages without any arguments don't need to be formatted
+        let message_id = self.string_id(record.args().as_str())?;
+
+        let sim_time = emu_time
+            .map(|x| {
+                u64::try_from(x.duration_since(&EmulatedTime::SIMULATION_START).as_nanos()).unwrap()
+            })
+            .unwrap_or(u64::MAX);
+
+        let buf = &mut self.buf;
+        buf.clear();
+        buf.push(TAG_RECORD);
+        buf.push(record.level() as u8);
+        buf.extend_from_slice(&u64::try_from(wall_time.as_micros()).unwrap().to_le_bytes());
+        buf.extend_from_slice(&sim_time.to_le_bytes());
+        buf.extend_from_slice(&(thread_id.as_raw() as u32).to_le_bytes());
+        buf.extend_from_slice(&host_id.to_le_bytes());
+        buf.extend_from_slice(&file_id.to_le_bytes());
+        buf.extend_from_slice(&module_id.to_le_bytes());
+        buf.extend_from_slice(&record.line().unwrap_or(NONE).to_le_bytes());
+        buf.extend_from_slice(&message_id.to_le_bytes());
+
+        if message_id == NONE {
+            // reserve space for the length, and format the message directly into the buffer
+            let len_pos = buf.len();
+            buf.extend_from_slice(&[0; 4]);
+            buf.write_fmt(*record.args())?;
+            let len = u32::try_from(buf.len() - len_pos - 4).unwrap();
+            buf[len_pos..(len_pos + 4)].copy_from_slice(&len.to_le_bytes());
+        }
+
+        self.writer.write_all(buf)
+    }
+}
@@ -3,6 +3,10 @@
 #include "lib/logger/logger.h"
 #include "main/bindings/c/bindings.h"
 
+__thread LogLevel rustlogger_threadLevel = LOGLEVEL_TRACE;
+
+void rustlogger_setThreadLevel(LogLevel level) { rustlogger_threadLevel = level; }
+
 static void _log(Logger* logger, LogLevel level, const char* fileName, const char* functionName,
                  const int lineNumber, const char* format, va_list vargs) {
     rustlogger_log(level, fileName, functionName, lineNumber, format, vargs);
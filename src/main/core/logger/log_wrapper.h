@@ -3,4 +3,9 @@
 // Create a logger that delegates to Rust's `log` crate.
 Logger* rustlogger_new();
 
-void rustlogger_destroy(Logger* logger);
\ No newline at end of file
+void rustlogger_destroy(Logger* logger);
+
+// Set the noisiest level that may be enabled on the current thread. This is an upper bound used by
+// the logging macros in "lib/logger/logger.h" (see `LOGGER_THREAD_LEVEL`) to skip disabled
+// messages without calling into the logger; the logger still does its own filtering.
+void rustlogger_setThreadLevel(LogLevel level);
\ No newline at end of file
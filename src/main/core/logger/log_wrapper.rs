@@ -34,6 +34,18 @@ pub fn c_to_rust_log_level(level: logger::LogLevel) -> Option<log::Level> {
     }
 }
 
+pub fn rust_to_c_log_level_filter(level: log::LevelFilter) -> logger::LogLevel {
+    use log::LevelFilter::*;
+    match level {
+        Off => logger::_LogLevel_LOGLEVEL_UNSET,
+        Error => logger::_LogLevel_LOGLEVEL_ERROR,
+        Warn => logger::_LogLevel_LOGLEVEL_WARNING,
+        Info => logger::_LogLevel_LOGLEVEL_INFO,
+        Debug => logger::_LogLevel_LOGLEVEL_DEBUG,
+        Trace => logger::_LogLevel_LOGLEVEL_TRACE,
+    }
+}
+
 /// Set the max (noisiest) logging level to `level`.
 #[no_mangle]
 pub unsafe extern "C" fn rustlogger_setLevel(level: logger::LogLevel) {
@@ -1,2 +1,3 @@
+pub mod binary_log;
 pub mod log_wrapper;
 pub mod shadow_logger;
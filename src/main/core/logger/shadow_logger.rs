@@ -1,27 +1,36 @@
+use crate::core::logger::{binary_log, log_wrapper};
+use crate::core::support::configuration::LogSharding;
 use crate::core::worker::Worker;
+use crate::cshadow;
 use crate::host::host::HostInfo;
 use crate::utility::time::TimeParts;
-use crossbeam::queue::ArrayQueue;
-use log::{Level, Log, Metadata, Record, SetLoggerError};
+use crossbeam::queue::SegQueue;
+use log::{Level, LevelFilter, Log, Metadata, Record, SetLoggerError};
 use logger as c_log;
 use once_cell::sync::Lazy;
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
-use std::cell::RefCell;
+use std::cell::{Cell, RefCell};
+use std::collections::HashMap;
+use std::io::Write;
+use std::path::{Path, PathBuf};
 use std::sync::mpsc::{Receiver, Sender};
 use std::sync::Arc;
 use std::sync::{Mutex, RwLock};
 use std::time::Duration;
 
-/// Trigger an asynchronous flush when this many lines are queued.
-const ASYNC_FLUSH_QD_LINES_THRESHOLD: usize = 100_000;
+/// Trigger an asynchronous flush when a thread has this many lines queued.
+const ASYNC_FLUSH_QD_LINES_THRESHOLD: usize = 20_000;
 
-/// Performs a *synchronous* flush when this many lines are queued.  i.e. if
-/// after reaching the `ASYNC_FLUSH_QD_LINES_THRESHOLD`, log lines are still
-/// coming in faster than they can actually be flushed, when we reach this limit
-/// we'll pause and let it finish flushing rather than letting the queue
-/// continue growing.
+/// Performs a *synchronous* flush when a thread has this many lines queued.
+/// i.e. if after reaching the `ASYNC_FLUSH_QD_LINES_THRESHOLD`, a thread is
+/// still logging faster than its lines can actually be flushed, when we reach
+/// this limit the thread will pause and let it finish flushing rather than
+/// letting its queue continue growing. Other threads aren't affected.
 const SYNC_FLUSH_QD_LINES_THRESHOLD: usize = 10 * ASYNC_FLUSH_QD_LINES_THRESHOLD;
 
+/// The most sharded log files that the logger keeps open at once.
+const MAX_OPEN_SHARD_FILES: usize = 256;
+
 /// Logging thread flushes at least this often.
 const MIN_FLUSH_FREQUENCY: Duration = Duration::from_secs(10);
 
@@ -45,7 +54,11 @@ pub fn init() -> Result<(), SetLoggerError> {
         // a command to the logger thread (because our thread-local sender
         // may have already been destructed, and because the logger thread
         // itself may be in a bad state), and ignore errors.
-        SHADOW_LOGGER.flush_records(None).ok();
+        // Nothing may flush after this, so write out every record, however
+        // recent.
+        SHADOW_LOGGER.flush_records_until(Duration::MAX, None).ok();
+        // Other threads' binary logs were flushed at the end of the last round.
+        binary_log::flush_thread();
         default_panic_handler(panic_info);
     }));
 
@@ -68,16 +81,30 @@ pub struct ShadowLogger {
     // it locked for as long as it's running.
     command_receiver: Mutex<Receiver<LoggerCommand>>,
 
-    // A lock-free queue for individual log records. We don't put the records
-    // themselves in the `command_sender`, because `Sender` doesn't support
-    // getting the queue length. Conversely we don't put commands in this queue
-    // because it doesn't support blocking operations.
+    // Each thread's lock-free queue of individual log records, which is added
+    // the first time the thread logs. Each queue only has a single producer, so
+    // threads don't contend with each other when logging. We don't put the
+    // records themselves in the `command_sender`, because `Sender` doesn't
+    // support getting the queue length. Conversely we don't put commands in
+    // these queues because they don't support blocking operations.
     //
-    // The size is roughly SYNC_FLUSH_QD_LINES_THRESHOLD *
-    // size_of<ShadowLogRecord>; we might want to consider SegQueue (which grows
-    // and shrinks dynamically) instead if we ever make SYNC_FLUSH_QD_LINES_THRESHOLD very
-    // large.
-    records: ArrayQueue<ShadowLogRecord>,
+    // The Mutex is only locked once per thread to add its queue, and by the
+    // logger thread when flushing.
+    thread_records: Mutex<Vec<Arc<SegQueue<ShadowLogRecord>>>>,
+
+    // Records from threads whose thread-local queue has already been
+    // destructed.
+    orphan_records: SegQueue<ShadowLogRecord>,
+
+    // Records that a flush took from the queues but that were created after
+    // the flush started. They're merged into the next flush, so that they're
+    // written in order with records from other threads that hadn't been queued
+    // yet.
+    pending_records: Mutex<Vec<ShadowLogRecord>>,
+
+    // Where to write records from hosts, if not to stdout. Only locked when
+    // flushing, and while the sharding is being set.
+    shards: Mutex<Option<ShardedFiles>>,
 
     // When false, sends a (still-asynchronous) flush command to the logger
     // thread every time a record is pushed into `records`.
@@ -85,9 +112,18 @@ pub struct ShadowLogger {
 }
 
 thread_local!(static SENDER: RefCell<Option<Sender<LoggerCommand>>> = RefCell::new(None));
+// The log level of the host running on this thread, if it has one. Cached here so that filtering
+// records doesn't need to look up the active host.
+thread_local!(static HOST_LOG_LEVEL: Cell<Option<LevelFilter>> = Cell::new(None));
+thread_local!(static RECORDS: RefCell<Option<Arc<SegQueue<ShadowLogRecord>>>> = RefCell::new(None));
 thread_local!(static THREAD_NAME: Lazy<String> = Lazy::new(|| { get_thread_name() }));
 thread_local!(static THREAD_ID: Lazy<nix::unistd::Pid> = Lazy::new(|| { nix::unistd::gettid() }));
 
+/// The wall time since the logger started, as recorded in log records.
+fn wall_time_now() -> Duration {
+    Duration::from_micros(unsafe { u64::try_from(c_log::logger_elapsed_micros()).unwrap() })
+}
+
 fn get_thread_name() -> String {
     let mut thread_name = Vec::<i8>::with_capacity(16);
     let res = unsafe {
@@ -121,7 +157,10 @@ impl ShadowLogger {
         let (sender, receiver) = std::sync::mpsc::channel();
 
         ShadowLogger {
-            records: ArrayQueue::new(SYNC_FLUSH_QD_LINES_THRESHOLD),
+            thread_records: Mutex::new(Vec::new()),
+            orphan_records: SegQueue::new(),
+            pending_records: Mutex::new(Vec::new()),
+            shards: Mutex::new(None),
             command_sender: Mutex::new(sender),
             command_receiver: Mutex::new(receiver),
             buffering_enabled: RwLock::new(false),
@@ -146,91 +185,101 @@ impl ShadowLogger {
         }
     }
 
-    // Function called by the logger's helper thread to flush the contents of
-    // self.records. If `done_sender` is provided, it's notified after the flush
+    // Function called by the logger's helper thread to flush the queued
+    // records. If `done_sender` is provided, it's notified after the flush
     // has completed.
     fn flush_records(&self, done_sender: Option<Sender<()>>) -> std::io::Result<()> {
-        use std::io::Write;
+        self.flush_records_until(wall_time_now(), done_sender)
+    }
 
-        // Only flush records that are already in the queue, not ones that
+    // Flush the queued records that were created at or before `cutoff`.
+    fn flush_records_until(
+        &self,
+        cutoff: Duration,
+        done_sender: Option<Sender<()>>,
+    ) -> std::io::Result<()> {
+        // Only flush records that are already in the queues, not ones that
         // arrive while we're flushing. Otherwise callers who perform a
         // synchronous flush (whether this flush operation or another one that
         // arrives while we're flushing) will be left waiting longer than
         // necessary. Also keeps us from holding the stdout lock indefinitely.
-        let mut toflush = self.records.len();
+        //
+        // Don't panic if a panicking thread was holding the lock.
+        let mut records = std::mem::take(
+            &mut *self
+                .pending_records
+                .lock()
+                .unwrap_or_else(|e| e.into_inner()),
+        );
+        {
+            // don't panic if a panicking thread was holding the lock
+            let mut thread_records = self
+                .thread_records
+                .lock()
+                .unwrap_or_else(|e| e.into_inner());
+            for queue in thread_records
+                .iter()
+                .map(|x| &**x)
+                .chain([&self.orphan_records])
+            {
+                for _ in 0..queue.len() {
+                    match queue.pop() {
+                        Some(r) => records.push(r),
+                        None => {
+                            // This can happen if another thread panics while the
+                            // logging thread is flushing. In that case both threads
+                            // will be consuming from the queue.
+                            break;
+                        }
+                    }
+                }
+            }
+
+            // forget the queues of threads that have exited
+            thread_records.retain(|x| Arc::strong_count(x) > 1 || !x.is_empty());
+        }
+
+        // Each thread's records are already in order, so this (stable) sort
+        // only needs to merge them.
+        records.sort_by_key(|r| r.wall_time);
+
+        // A record created after the flush started may be ahead of an earlier
+        // record from another thread that hasn't been queued yet, so hold it
+        // back until the next flush.
+        let later = records.split_off(records.partition_point(|r| r.wall_time <= cutoff));
+        self.pending_records
+            .lock()
+            .unwrap_or_else(|e| e.into_inner())
+            .extend(later);
+
+        // If a panicking thread and the logger thread flush at the same time,
+        // one waits for the other so that host records still go to their
+        // shard files. Don't panic if a panicking thread was holding the lock.
+        let mut shards = self.shards.lock().unwrap_or_else(|e| e.into_inner());
+        let shards = shards.as_mut();
 
         let stdout_unlocked = std::io::stdout();
         let stdout_locked = stdout_unlocked.lock();
         let mut stdout = std::io::BufWriter::new(stdout_locked);
-        while toflush > 0 {
-            let record = match self.records.pop() {
-                Some(r) => r,
-                None => {
-                    // This can happen if another thread panics while the
-                    // logging thread is flushing. In that case both threads
-                    // will be consuming from the queue.
-                    break;
+
+        match shards {
+            Some(shards) => {
+                for record in &records {
+                    match shards.writer(record)? {
+                        Some(writer) => write_record(writer, record)?,
+                        None => write_record(&mut stdout, record)?,
+                    }
                 }
-            };
-            toflush -= 1;
-            {
-                let parts = TimeParts::from_nanos(record.wall_time.as_nanos());
-                write!(
-                    stdout,
-                    "{:02}:{:02}:{:02}.{:06}",
-                    parts.hours,
-                    parts.mins,
-                    parts.secs,
-                    parts.nanos / 1000
-                )?;
-            }
-            write!(stdout, " [{}:{}]", record.thread_id, record.thread_name)?;
-            if let Some(emu_time) = record.emu_time {
-                let sim_time = emu_time.duration_since(&EmulatedTime::SIMULATION_START);
-                let parts = TimeParts::from_nanos(sim_time.as_nanos());
-                write!(
-                    stdout,
-                    " {:02}:{:02}:{:02}.{:09}",
-                    parts.hours, parts.mins, parts.secs, parts.nanos
-                )?;
-            } else {
-                write!(stdout, " n/a")?;
+                shards.flush()?;
             }
-            write!(stdout, " [{level}]", level = record.level)?;
-            if let Some(host) = record.host_info {
-                write!(
-                    stdout,
-                    " [{hostname}:{ip}]",
-                    hostname = host.name,
-                    ip = host.default_ip,
-                )?;
-            } else {
-                write!(stdout, " [n/a]",)?;
-            }
-            write!(
-                stdout,
-                " [{file}:",
-                file = record
-                    .file
-                    .map(|f| if let Some(sep_pos) = f.rfind('/') {
-                        &f[(sep_pos + 1)..]
-                    } else {
-                        f
-                    })
-                    .unwrap_or("n/a"),
-            )?;
-            if let Some(line) = record.line {
-                write!(stdout, "{line}", line = line)?;
-            } else {
-                write!(stdout, "n/a")?;
+            None => {
+                for record in &records {
+                    write_record(&mut stdout, record)?;
+                }
             }
-            writeln!(
-                stdout,
-                "] [{module}] {msg}",
-                module = record.module_path.unwrap_or("n/a"),
-                msg = record.message
-            )?;
         }
+        stdout.flush()?;
+
         if let Some(done_sender) = done_sender {
             // We can't log from this thread without risking deadlock, so in the
             // unlikely case that the calling thread has gone away, just print
@@ -246,6 +295,21 @@ impl ShadowLogger {
         Ok(())
     }
 
+    /// Write records from hosts to sharded files under `data_path` rather
+    /// than to stdout. Records that aren't from a host are still written to
+    /// stdout.
+    pub fn set_sharding(&self, sharding: LogSharding, data_path: &Path) {
+        let shards = match sharding {
+            LogSharding::Off => None,
+            LogSharding::Thread | LogSharding::Host => Some(ShardedFiles {
+                sharding,
+                data_path: data_path.to_path_buf(),
+                files: HashMap::new(),
+            }),
+        };
+        *self.shards.lock().unwrap() = shards;
+    }
+
     /// When disabled, the logger thread is notified to write each record as
     /// soon as it's created.  The calling thread still isn't blocked on the
     /// record actually being written, though.
@@ -299,10 +363,11 @@ impl ShadowLogger {
 
 impl Log for ShadowLogger {
     fn enabled(&self, metadata: &Metadata) -> bool {
-        let filter = match Worker::with_active_host(|host| host.info().log_level) {
-            Some(Some(level)) => level,
-            _ => log::max_level(),
-        };
+        let filter = HOST_LOG_LEVEL
+            .try_with(|x| x.get())
+            .ok()
+            .flatten()
+            .unwrap_or_else(log::max_level);
         metadata.level() <= filter
     }
 
@@ -311,19 +376,41 @@ impl Log for ShadowLogger {
             return;
         }
 
+        // in binary mode, records from hosts are written to this thread's binary log file (except
+        // for errors, which should still be shown immediately)
+        if binary_log::is_enabled() && record.level() != Level::Error {
+            let written = Worker::with_active_host(|host| {
+                binary_log::log(
+                    record,
+                    host.info(),
+                    wall_time_now(),
+                    Worker::current_time(),
+                    || {
+                        THREAD_NAME
+                            .try_with(|name| (*name).clone())
+                            .unwrap_or_else(|_| get_thread_name())
+                    },
+                    THREAD_ID
+                        .try_with(|id| **id)
+                        .unwrap_or_else(|_| nix::unistd::gettid()),
+                )
+            });
+            if written == Some(true) {
+                return;
+            }
+        }
+
         let message = std::fmt::format(*record.args());
 
         let host_info = Worker::with_active_host(|host| host.info().clone());
 
-        let mut shadowrecord = ShadowLogRecord {
+        let shadowrecord = ShadowLogRecord {
             level: record.level(),
             file: record.file_static(),
             module_path: record.module_path_static(),
             line: record.line(),
             message,
-            wall_time: Duration::from_micros(unsafe {
-                u64::try_from(c_log::logger_elapsed_micros()).unwrap()
-            }),
+            wall_time: wall_time_now(),
 
             emu_time: Worker::current_time(),
             thread_name: THREAD_NAME
@@ -335,25 +422,33 @@ impl Log for ShadowLogger {
             host_info,
         };
 
-        loop {
-            match self.records.push(shadowrecord) {
-                Ok(()) => break,
-                Err(r) => {
-                    // Queue is full. Flush it and try again.
-                    shadowrecord = r;
-                    self.flush_sync();
-                }
-            }
-        }
+        // pushed to the orphan queue if our thread-local queue has already been destructed
+        let mut shadowrecord = Some(shadowrecord);
+
+        let queued = RECORDS
+            .try_with(|queue| {
+                let mut queue = queue.borrow_mut();
+                let queue = queue.get_or_insert_with(|| {
+                    let queue = Arc::new(SegQueue::new());
+                    self.thread_records.lock().unwrap().push(Arc::clone(&queue));
+                    queue
+                });
+                queue.push(shadowrecord.take().unwrap());
+                queue.len()
+            })
+            .unwrap_or_else(|_| {
+                self.orphan_records.push(shadowrecord.take().unwrap());
+                self.orphan_records.len()
+            });
 
-        if record.level() == Level::Error {
+        if record.level() == Level::Error || queued >= SYNC_FLUSH_QD_LINES_THRESHOLD {
             // Unlike in Shadow's C code, we don't abort the program on Error
             // logs. In Rust the same purpose is filled with `panic` and
             // `unwrap`. C callers will still exit or abort via the lib/logger wrapper.
             //
             // Flush *synchronously*, since we're likely about to crash one way or another.
             self.flush_sync();
-        } else if self.records.len() > ASYNC_FLUSH_QD_LINES_THRESHOLD
+        } else if queued > ASYNC_FLUSH_QD_LINES_THRESHOLD
             || !*self.buffering_enabled.read().unwrap()
         {
             self.flush_async();
@@ -361,6 +456,7 @@ impl Log for ShadowLogger {
     }
 
     fn flush(&self) {
+        binary_log::flush_thread();
         self.flush_sync();
     }
 }
@@ -379,6 +475,126 @@ struct ShadowLogRecord {
     host_info: Option<Arc<HostInfo>>,
 }
 
+/// Write the record as a line of text.
+fn write_record(out: &mut impl Write, record: &ShadowLogRecord) -> std::io::Result<()> {
+    {
+        let parts = TimeParts::from_nanos(record.wall_time.as_nanos());
+        write!(
+            out,
+            "{:02}:{:02}:{:02}.{:06}",
+            parts.hours,
+            parts.mins,
+            parts.secs,
+            parts.nanos / 1000
+        )?;
+    }
+    write!(out, " [{}:{}]", record.thread_id, record.thread_name)?;
+    if let Some(emu_time) = record.emu_time {
+        let sim_time = emu_time.duration_since(&EmulatedTime::SIMULATION_START);
+        let parts = TimeParts::from_nanos(sim_time.as_nanos());
+        write!(
+            out,
+            " {:02}:{:02}:{:02}.{:09}",
+            parts.hours, parts.mins, parts.secs, parts.nanos
+        )?;
+    } else {
+        write!(out, " n/a")?;
+    }
+    write!(out, " [{level}]", level = record.level)?;
+    if let Some(host) = &record.host_info {
+        write!(
+            out,
+            " [{hostname}:{ip}]",
+            hostname = host.name,
+            ip = host.default_ip,
+        )?;
+    } else {
+        write!(out, " [n/a]",)?;
+    }
+    write!(
+        out,
+        " [{file}:",
+        file = record
+            .file
+            .map(|f| if let Some(sep_pos) = f.rfind('/') {
+                &f[(sep_pos + 1)..]
+            } else {
+                f
+            })
+            .unwrap_or("n/a"),
+    )?;
+    if let Some(line) = record.line {
+        write!(out, "{line}", line = line)?;
+    } else {
+        write!(out, "n/a")?;
+    }
+    writeln!(
+        out,
+        "] [{module}] {msg}",
+        module = record.module_path.unwrap_or("n/a"),
+        msg = record.message
+    )
+}
+
+/// Log files for records from hosts, sharded by thread or by host.
+struct ShardedFiles {
+    sharding: LogSharding,
+    data_path: PathBuf,
+    /// The open files, keyed by path. Files are opened in append mode, so they can be closed and
+    /// reopened later if too many are open.
+    files: HashMap<PathBuf, std::io::BufWriter<std::fs::File>>,
+}
+
+impl ShardedFiles {
+    /// The file to write the record to, or `None` if it should be written to stdout.
+    fn writer(
+        &mut self,
+        record: &ShadowLogRecord,
+    ) -> std::io::Result<Option<&mut std::io::BufWriter<std::fs::File>>> {
+        let Some(host) = &record.host_info else {
+            return Ok(None);
+        };
+
+        let path = match self.sharding {
+            LogSharding::Off => return Ok(None),
+            LogSharding::Thread => self.data_path.join(format!(
+                "shadow.{}.{}.log",
+                record.thread_name, record.thread_id
+            )),
+            LogSharding::Host => self
+                .data_path
+                .join("hosts")
+                .join(&host.name)
+                .join(format!("{}.shadow.log", host.name)),
+        };
+
+        if !self.files.contains_key(&path) && self.files.len() >= MAX_OPEN_SHARD_FILES {
+            self.flush()?;
+            self.files.clear();
+        }
+
+        let writer = match self.files.entry(path) {
+            std::collections::hash_map::Entry::Occupied(x) => x.into_mut(),
+            std::collections::hash_map::Entry::Vacant(x) => {
+                let file = std::fs::OpenOptions::new()
+                    .create(true)
+                    .append(true)
+                    .open(x.key())?;
+                x.insert(std::io::BufWriter::new(file))
+            }
+        };
+
+        Ok(Some(writer))
+    }
+
+    fn flush(&mut self) -> std::io::Result<()> {
+        for file in self.files.values_mut() {
+            file.flush()?;
+        }
+        Ok(())
+    }
+}
+
 enum LoggerCommand {
     // Flush; takes an optional one-shot channel to notify that the flush has completed.
     Flush(Option<Sender<()>>),
@@ -388,6 +604,21 @@ pub fn set_buffering_enabled(buffering_enabled: bool) {
     SHADOW_LOGGER.set_buffering_enabled(buffering_enabled);
 }
 
+pub fn set_sharding(sharding: LogSharding, data_path: &Path) {
+    SHADOW_LOGGER.set_sharding(sharding, data_path);
+}
+
+/// Set the log level of the host running on the current thread, or `None` when the thread stops
+/// running a host. This must be called whenever the thread's active host changes.
+pub fn set_host_log_level(level: Option<LevelFilter>) {
+    HOST_LOG_LEVEL.with(|x| x.set(level));
+
+    // the C logging macros can skip anything above the max level, which is checked before the
+    // host's level
+    let c_level = std::cmp::min(level.unwrap_or_else(log::max_level), log::max_level());
+    unsafe { cshadow::rustlogger_setThreadLevel(log_wrapper::rust_to_c_log_level_filter(c_level)) };
+}
+
 mod export {
     use super::*;
 
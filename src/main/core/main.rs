@@ -14,10 +14,16 @@ use crate::core::sim_config::SimConfig;
 use crate::core::support::configuration::{CliOptions, ConfigFileOptions, ConfigOptions};
 use crate::core::worker;
 use crate::cshadow as c;
-use crate::utility::shm_cleanup;
+use crate::utility::{self, shm_cleanup};
 
 /// Main entry point for the simulator.
 pub fn run_shadow<'a>(build_info: &ShadowBuildInfo, args: Vec<&'a OsStr>) -> anyhow::Result<()> {
+    worker::with_global_sim_stats(|stats| {
+        let mut startup = stats.startup.lock().unwrap();
+        startup.shadow_start = Some(std::time::Instant::now());
+        startup.shadow_start_rss_bytes = utility::resident_set_bytes();
+    });
+
     if unsafe { c::main_checkGlibVersion() } != 0 {
         return Err(anyhow::anyhow!("Unsupported GLib version"));
     }
@@ -171,8 +177,18 @@ pub fn run_shadow<'a>(build_info: &ShadowBuildInfo, args: Vec<&'a OsStr>) -> any
         pause_for_gdb_attach().context("Could not pause shadow to allow gdb to attach")?;
     }
 
+    let sim_config_start = std::time::Instant::now();
     let sim_config = SimConfig::new(&shadow_config, &options.debug_hosts.unwrap_or_default())
         .context("Failed to initialize the simulation")?;
+    worker::with_global_sim_stats(|stats| {
+        let mut startup = stats.startup.lock().unwrap();
+        startup.sim_config_secs = sim_config_start.elapsed().as_secs_f64();
+        startup.config_rss_bytes = startup
+            .shadow_start_rss_bytes
+            .zip(utility::resident_set_bytes())
+            .map(|(start, now)| now.saturating_sub(start))
+            .unwrap_or_default();
+    });
 
     // allocate and initialize our main simulation driver
     let controller = Controller::new(sim_config, &shadow_config);
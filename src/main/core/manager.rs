@@ -3,7 +3,7 @@ use std::ffi::{CStr, CString, OsStr, OsString};
 use std::os::unix::ffi::OsStrExt;
 use std::path::PathBuf;
 use std::sync::atomic::AtomicU32;
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
 use std::time::Duration;
 
 use anyhow::{self, Context};
@@ -11,18 +11,26 @@ use atomic_refcell::AtomicRefCell;
 use log::warn;
 use rand::seq::SliceRandom;
 use rand_xoshiro::Xoshiro256PlusPlus;
+use rayon::iter::{IntoParallelRefIterator, ParallelIterator};
 use shadow_shim_helper_rs::HostId;
 
 use crate::core::controller::{Controller, ShadowStatusBarState, SimController};
+use crate::core::logger::{binary_log, shadow_logger};
 use crate::core::scheduler::runahead::Runahead;
-use crate::core::scheduler::{HostIter, Scheduler, ThreadPerCoreSched, ThreadPerHostSched};
+use crate::core::scheduler::{
+    HostIter, Scheduler, ThreadPerCoreLptSched, ThreadPerCoreSched, ThreadPerHostSched,
+};
 use crate::core::sim_config::{Bandwidth, HostInfo};
 use crate::core::sim_stats;
 use crate::core::support::configuration::{self, ConfigOptions, Flatten, LogLevel};
+use crate::core::timeline;
 use crate::core::worker;
 use crate::cshadow as c;
 use crate::host::host::{Host, HostParameters};
+use crate::host::syscall::strace_writer;
+use crate::host::tracker_metrics;
 use crate::network::graph::{IpAssignment, RoutingInfo};
+use crate::network::pcap_capture;
 use crate::utility::childpid_watcher::ChildPidWatcher;
 use crate::utility::status_bar::Status;
 use crate::utility::{self, SyncSendPointer};
@@ -52,6 +60,10 @@ pub struct Manager<'a> {
 
     check_fd_usage: bool,
     check_mem_usage: bool,
+
+    // environments generated by `generate_env_vars`, shared between processes with the same
+    // environment option and log level
+    env_cache: Mutex<HashMap<(Arc<str>, LogLevel), Arc<[CString]>>>,
 }
 
 impl<'a> Manager<'a> {
@@ -178,6 +190,17 @@ impl<'a> Manager<'a> {
             })?;
         }
 
+        shadow_logger::set_sharding(config.experimental.log_sharding.unwrap(), &data_path);
+        pcap_capture::init(config.experimental.pcap_format.unwrap(), &data_path);
+        tracker_metrics::init(&data_path);
+
+        if config.experimental.use_binary_log.unwrap() {
+            let log_path = data_path.clone().join("shadow-log");
+            binary_log::enable(&log_path).with_context(|| {
+                format!("Failed to create log directory '{}'", log_path.display())
+            })?;
+        }
+
         // save the processed config as yaml
         let config_out_filename = data_path.clone().join("processed-config.yaml");
         let config_out_file = std::fs::File::create(&config_out_filename).with_context(|| {
@@ -206,6 +229,7 @@ impl<'a> Manager<'a> {
             preload_openssl_crypto_path,
             check_fd_usage: true,
             check_mem_usage: true,
+            env_cache: Mutex::new(HashMap::new()),
         })
     }
 
@@ -247,35 +271,13 @@ impl<'a> Manager<'a> {
             .try_into()
             .unwrap();
 
-        // note: there are several return points before we add these hosts to the scheduler and we
-        // would leak memory if we return before then, but not worrying about that since the issues
-        // will go away when we move the hosts to rust, and if we don't add them to the scheduler
-        // then it means there was an error and we're going to exit anyways
-        let mut hosts: Vec<_> = manager_config
-            .hosts
-            .iter()
-            .enumerate()
-            .map(|(i, x)| {
-                self.build_host(HostId::from(u32::try_from(i).unwrap()), x, dns)
-                    .with_context(|| format!("Failed to build host '{}'", x.name))
-            })
-            .collect::<anyhow::Result<_>>()?;
-
-        // shuffle the list of hosts to make sure that they are randomly assigned by the scheduler
-        hosts.shuffle(&mut manager_config.random);
+        let use_cpu_pinning = self.config.experimental.use_cpu_pinning.unwrap();
+        let use_scheduler_trace = self.config.experimental.use_scheduler_trace.unwrap();
 
-        // the configuration file's yaml format generally prevents duplicate hostnames, but using
-        // the `quantity` field can lead to hosts with the same name
-        let duplicate_hostnames = find_duplicates(hosts.iter().map(|x| x.name()));
-        if duplicate_hostnames.len() > 0 {
-            return Err(anyhow::anyhow!(
-                "Duplicate hostnames: {:?}",
-                duplicate_hostnames
-            ));
+        if use_scheduler_trace {
+            timeline::enable();
         }
 
-        let use_cpu_pinning = self.config.experimental.use_cpu_pinning.unwrap();
-
         // an infinite iterator that always returns `<Option<Option<u32>>>::Some`
         let cpu_iter =
             std::iter::from_fn(|| {
@@ -296,6 +298,109 @@ impl<'a> Manager<'a> {
         }
         assert_eq!(cpus.len(), parallelism);
 
+        let use_numa_placement =
+            use_cpu_pinning && self.config.experimental.use_numa_placement.unwrap();
+
+        // the NUMA node of each worker thread, if we're keeping their work on their nodes
+        let numa_nodes: Vec<Option<u32>> = cpus
+            .iter()
+            .map(|cpu| {
+                cpu.filter(|_| use_numa_placement)
+                    .and_then(numa_node_of_cpu)
+            })
+            .collect();
+        if use_numa_placement {
+            log::debug!("Worker NUMA nodes: {:?}", numa_nodes);
+        }
+
+        // the order of the hosts given to the scheduler; shuffled to make sure that they are
+        // randomly assigned to threads by the scheduler
+        let mut host_order: Vec<usize> = (0..manager_config.hosts.len()).collect();
+        host_order.shuffle(&mut manager_config.random);
+
+        // note: there are several return points before we add these hosts to the scheduler and we
+        // would leak memory if we return before then, but not worrying about that since the issues
+        // will go away when we move the hosts to rust, and if we don't add them to the scheduler
+        // then it means there was an error and we're going to exit anyways
+        //
+        // hosts are built in parallel since this is slow for large simulations; the only state
+        // shared between hosts during construction is the DNS, which has an internal mutex
+        let host_build_start = std::time::Instant::now();
+        let host_build_start_rss = utility::resident_set_bytes();
+        let dns_ptr = unsafe { SyncSendPointer::new(dns) };
+        let build_host = |i: usize| {
+            let host_info = &manager_config.hosts[i];
+            self.build_host(
+                HostId::from(u32::try_from(i).unwrap()),
+                host_info,
+                dns_ptr.ptr(),
+            )
+            .with_context(|| format!("Failed to build host '{}'", host_info.name))
+        };
+        let mut host_build_pool = rayon::ThreadPoolBuilder::new()
+            .num_threads(parallelism)
+            .thread_name(|i| format!("host-build-{i}"));
+        if use_numa_placement {
+            let cpus = cpus.clone();
+            let numa_nodes = numa_nodes.clone();
+            host_build_pool = host_build_pool.start_handler(move |i| {
+                // run on the same node as the worker thread with the same index
+                let cpu = i32::try_from(cpus[i].unwrap()).unwrap();
+                unsafe {
+                    c::affinity_setProcessNodeAffinity(0, cpu, /* AFFINITY_UNINIT */ -1)
+                };
+                shadow_shmem::allocator::set_thread_numa_node(numa_nodes[i]);
+            });
+        }
+        let host_build_pool = host_build_pool
+            .build()
+            .context("Failed to create the thread pool for building hosts")?;
+        let hosts: Vec<Box<Host>> = if use_numa_placement {
+            // the work-stealing schedulers assign hosts to worker threads in a round-robin manner,
+            // so each build thread builds the hosts that the worker with the same index will run,
+            // and the hosts' memory is first touched on that worker's node
+            let built: Vec<Vec<(usize, anyhow::Result<Box<Host>>)>> =
+                host_build_pool.broadcast(|ctx| {
+                    host_order
+                        .iter()
+                        .enumerate()
+                        .skip(ctx.index())
+                        .step_by(ctx.num_threads())
+                        .map(|(pos, i)| (pos, build_host(*i)))
+                        .collect()
+                });
+            let mut built: Vec<_> = built.into_iter().flatten().collect();
+            built.sort_unstable_by_key(|(pos, _)| *pos);
+            built
+                .into_iter()
+                .map(|(_, host)| host)
+                .collect::<anyhow::Result<_>>()?
+        } else {
+            host_build_pool.install(|| {
+                host_order
+                    .par_iter()
+                    .map(|i| build_host(*i))
+                    .collect::<anyhow::Result<_>>()
+            })?
+        };
+        drop(host_build_pool);
+        let host_build_secs = host_build_start.elapsed().as_secs_f64();
+        let host_build_rss_bytes = host_build_start_rss
+            .zip(utility::resident_set_bytes())
+            .map(|(start, now)| now.saturating_sub(start))
+            .unwrap_or_default();
+        log::debug!("Built {} hosts in {host_build_secs} seconds", hosts.len());
+
+        // the configuration file's yaml format generally prevents duplicate hostnames, but using
+        // the `quantity` field can lead to hosts with the same name
+        let duplicate_hostnames = find_duplicates(hosts.iter().map(|x| x.name()));
+        if duplicate_hostnames.len() > 0 {
+            return Err(anyhow::anyhow!(
+                "Duplicate hostnames: {:?}",
+                duplicate_hostnames
+            ));
+        }
+
         // set the simulation's global state
         worker::WORKER_SHARED
             .borrow_mut()
@@ -328,19 +433,34 @@ impl<'a> Manager<'a> {
                 configuration::Scheduler::ThreadPerHost => {
                     Scheduler::ThreadPerHost(ThreadPerHostSched::new(&cpus, hosts))
                 }
-                configuration::Scheduler::ThreadPerCore => {
-                    Scheduler::ThreadPerCore(ThreadPerCoreSched::new(&cpus, hosts))
-                }
+                configuration::Scheduler::ThreadPerCore => Scheduler::ThreadPerCore(
+                    ThreadPerCoreSched::new_with_numa_nodes(&cpus, &numa_nodes, hosts),
+                ),
+                configuration::Scheduler::ThreadPerCoreLpt => Scheduler::ThreadPerCoreLpt(
+                    ThreadPerCoreLptSched::new_with_numa_nodes(&cpus, &numa_nodes, hosts),
+                ),
             };
 
             // initialize the thread-local Worker
             scheduler.scope(|s| {
-                s.run(|thread_id| unsafe {
-                    worker::Worker::new_for_this_thread(worker::WorkerThreadID(thread_id as u32))
+                s.run(|thread_id| {
+                    unsafe {
+                        worker::Worker::new_for_this_thread(worker::WorkerThreadID(
+                            thread_id as u32,
+                        ))
+                    };
+
+                    // allocate the shared memory of this thread's hosts on the thread's node
+                    if use_numa_placement {
+                        let node =
+                            crate::core::scheduler::core_affinity().and_then(numa_node_of_cpu);
+                        shadow_shmem::allocator::set_thread_numa_node(node);
+                    }
                 });
             });
 
             // boot each host
+            let host_boot_start = std::time::Instant::now();
             scheduler.scope(|s| {
                 s.run_with_hosts(move |_, hosts| {
                     for_each_host(hosts, |host| {
@@ -350,8 +470,29 @@ impl<'a> Manager<'a> {
                         host.unlock_shmem();
                         worker::Worker::clear_current_time();
                     });
+                    pcap_capture::flush_thread();
+                    binary_log::flush_thread();
                 });
             });
+            pcap_capture::end_round();
+            tracker_metrics::end_round();
+
+            worker::with_global_sim_stats(|stats| {
+                let mut startup = stats.startup.lock().unwrap();
+                startup.host_build_secs = host_build_secs;
+                startup.host_build_rss_bytes = host_build_rss_bytes;
+                startup.host_boot_secs = host_boot_start.elapsed().as_secs_f64();
+                startup.total_secs = startup
+                    .shadow_start
+                    .map(|x| x.elapsed().as_secs_f64())
+                    .unwrap_or_default();
+                log::info!(
+                    "Finished startup in {} seconds ({} seconds building hosts, {} seconds booting hosts)",
+                    startup.total_secs,
+                    startup.host_build_secs,
+                    startup.host_boot_secs,
+                );
+            });
 
             // the current simulation interval
             let mut window = Some((
@@ -387,6 +528,8 @@ impl<'a> Manager<'a> {
                         state.current = display_time;
                     });
 
+                let round_start = timeline::start_round(window_start, window_end);
+
                 // run the events
                 scheduler.scope(|s| {
                     // run the closure on each of the scheduler's threads
@@ -395,19 +538,24 @@ impl<'a> Manager<'a> {
                         // each call of the closure is given an abstract thread-specific host
                         // iterator, and an element of 'thread_next_event_times'
                         move |_, hosts, next_event_time| {
+                            let thread_round_start = timeline::now();
                             let mut next_event_time = next_event_time.borrow_mut();
 
                             worker::Worker::reset_next_event_time();
                             worker::Worker::set_round_end_time(window_end);
 
                             for_each_host(hosts, |host| {
-                                let host_next_event_time = {
+                                // in large simulations most hosts have nothing to do in most
+                                // rounds, so only lock and execute hosts that have events to run
+                                // (the next event time can be read without locking)
+                                if matches!(host.next_event_time(), Some(t) if t < window_end) {
+                                    let execute_start = timeline::now();
                                     host.lock_shmem();
                                     host.execute(window_end);
-                                    let host_next_event_time = host.next_event_time();
                                     host.unlock_shmem();
-                                    host_next_event_time
-                                };
+                                    timeline::record_execute(host.id(), execute_start);
+                                }
+                                let host_next_event_time = host.next_event_time();
                                 *next_event_time = [*next_event_time, host_next_event_time]
                                     .into_iter()
                                     .filter_map(std::convert::identity)
@@ -420,6 +568,10 @@ impl<'a> Manager<'a> {
                                 .into_iter()
                                 .filter_map(std::convert::identity)
                                 .reduce(std::cmp::min);
+
+                            pcap_capture::flush_thread();
+                            binary_log::flush_thread();
+                            timeline::record_round(thread_round_start);
                         },
                     );
 
@@ -441,6 +593,10 @@ impl<'a> Manager<'a> {
                     }
                 });
 
+                timeline::end_round(round_start);
+                pcap_capture::end_round();
+                tracker_metrics::end_round();
+
                 // get the minimum next event time for all threads (also resets the next event times
                 // to None while we have them borrowed)
                 let min_next_event_time = thread_next_event_times
@@ -472,19 +628,40 @@ impl<'a> Manager<'a> {
                         host.shutdown();
                         worker::Worker::clear_current_time();
                     });
+                    pcap_capture::flush_thread();
+                    binary_log::flush_thread();
                 });
             });
 
             // add each thread's local sim statistics to the global sim statistics.
             scheduler.scope(|s| {
-                s.run(|_| {
+                s.run(|thread_id| {
                     worker::Worker::add_to_global_sim_stats();
+                    // tid 0 is the manager thread
+                    timeline::flush_thread(
+                        format!("shadow-worker-{thread_id}"),
+                        thread_id as u32 + 1,
+                    );
                 });
             });
 
+            // All processes have exited, so the zygotes are no longer needed. This must happen
+            // before the scheduler's threads exit, since a zygote is killed when the thread that
+            // started it exits (see `shim_zygote_maybe_run`).
+            if self.config.experimental.use_zygote_launcher.unwrap() {
+                unsafe { c::zygote_shutdownAll() };
+            }
+
             scheduler.join();
+
+            timeline::flush_thread("shadow-manager", 0);
         }
 
+        // write any remaining captured packets, heartbeat metrics, and deferred syscalls
+        pcap_capture::finish();
+        tracker_metrics::finish();
+        strace_writer::finish();
+
         // simulation is finished, so update the status logger
         worker::WORKER_SHARED
             .borrow()
@@ -532,6 +709,11 @@ impl<'a> Manager<'a> {
             sim_stats::write_stats_to_file(&stats_filename, stats)
         })?;
 
+        if use_scheduler_trace {
+            let trace_filename = self.data_path.clone().join("scheduler-trace.json");
+            timeline::write_to_file(&trace_filename)?;
+        }
+
         Ok(num_plugin_errors)
     }
 
@@ -578,12 +760,16 @@ impl<'a> Manager<'a> {
                     .map(|x| x.to_c_loginfoflag())
                     .reduce(|x, y| x | y)
                     .unwrap_or(c::_LogInfoFlags_LOG_INFO_FLAGS_NONE),
+                heartbeat_format: host_info.heartbeat_format,
                 log_level: host_info
                     .log_level
                     .map(|x| x.to_c_loglevel())
                     .unwrap_or(c::_LogLevel_LOGLEVEL_UNSET),
                 pcap_dir,
                 pcap_capture_size: host_info.pcap_capture_size.try_into().unwrap(),
+                pcap_filter: host_info.pcap_filter.clone(),
+                pcap_flow_packet_limit: host_info.pcap_flow_packet_limit,
+                pcap_sample_probability: host_info.pcap_sample_probability,
                 qdisc: host_info.qdisc,
                 init_sock_recv_buf_size: host_info.recv_buf_size,
                 autotune_recv_buf: host_info.autotune_recv_buf,
@@ -604,9 +790,8 @@ impl<'a> Manager<'a> {
 
         host.lock_shmem();
 
-        for proc in &host_info.processes {
-            let plugin_path =
-                CString::new(proc.plugin.clone().into_os_string().as_bytes()).unwrap();
+        for proc in host_info.processes.iter() {
+            let plugin_path = CString::new(proc.plugin.as_os_str().as_bytes()).unwrap();
             let plugin_name = CString::new(proc.plugin.file_name().unwrap().as_bytes()).unwrap();
             let pause_for_debugging = host_info.pause_for_debugging;
 
@@ -620,11 +805,7 @@ impl<'a> Manager<'a> {
                 .log_level
                 .unwrap_or(self.config.general.log_level.unwrap());
 
-            let envv = self.generate_env_vars(&proc.env, shim_log_level);
-            let envv: Vec<CString> = envv
-                .iter()
-                .map(|x| CString::new(x.as_bytes()).unwrap())
-                .collect();
+            let envv = self.env_vars(&proc.env, shim_log_level);
 
             host.continue_execution_timer();
 
@@ -633,7 +814,7 @@ impl<'a> Manager<'a> {
                 proc.stop_time,
                 &plugin_name,
                 &plugin_path,
-                envv,
+                &envv,
                 &argv,
                 pause_for_debugging,
             );
@@ -646,6 +827,24 @@ impl<'a> Manager<'a> {
         Ok(host)
     }
 
+    /// Get the environment for a process, generating it if no other process has used the same
+    /// environment option and log level.
+    fn env_vars(&self, user_env: &Arc<str>, shim_log_level: LogLevel) -> Arc<[CString]> {
+        let key = (Arc::clone(user_env), shim_log_level);
+        if let Some(envv) = self.env_cache.lock().unwrap().get(&key) {
+            return Arc::clone(envv);
+        }
+
+        // generate outside of the lock; if another thread races us, both results are the same
+        let envv: Arc<[CString]> = self
+            .generate_env_vars(user_env, shim_log_level)
+            .iter()
+            .map(|x| CString::new(x.as_bytes()).unwrap())
+            .collect();
+
+        Arc::clone(self.env_cache.lock().unwrap().entry(key).or_insert(envv))
+    }
+
     // assume that the provided env variables are UTF-8, since working with str instead of OsStr is
     // much less painful
     fn generate_env_vars(&self, user_env: &str, shim_log_level: LogLevel) -> Vec<OsString> {
@@ -733,7 +932,8 @@ impl<'a> Manager<'a> {
 
         env.insert("LD_PRELOAD".into(), Some(preload));
 
-        env.into_iter()
+        let mut env: Vec<OsString> = env
+            .into_iter()
             .map(|(mut x, y)| {
                 if let Some(y) = y {
                     x.push("=");
@@ -743,7 +943,13 @@ impl<'a> Manager<'a> {
                     x
                 }
             })
-            .collect()
+            .collect();
+
+        // the hash map's order is random; sort so that every process with the same environment
+        // sees it in the same order
+        env.sort();
+
+        env
     }
 
     fn log_heartbeat(&self, now: EmulatedTime) {
@@ -879,6 +1085,12 @@ fn for_each_host(host_iter: &mut HostIter, mut f: impl FnMut(&Host)) {
     });
 }
 
+/// The NUMA node of a CPU, if known.
+fn numa_node_of_cpu(cpu: u32) -> Option<u32> {
+    let cpu = i32::try_from(cpu).unwrap();
+    u32::try_from(unsafe { c::affinity_getCPUNode(cpu) }).ok()
+}
+
 /// Get the raw speed of the experiment machine.
 fn get_raw_cpu_frequency_hz() -> anyhow::Result<u64> {
     const CONFIG_CPU_MAX_FREQ_FILE: &str = "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq";
@@ -6,5 +6,6 @@ pub mod scheduler;
 pub mod sim_config;
 pub mod sim_stats;
 pub mod support;
+pub mod timeline;
 pub mod work;
 pub mod worker;
@@ -2,11 +2,13 @@ pub mod runahead;
 
 // re-export schedulers
 pub use thread_per_core::ThreadPerCoreSched;
+pub use thread_per_core_lpt::ThreadPerCoreLptSched;
 pub use thread_per_host::ThreadPerHostSched;
 
 mod logical_processor;
 pub mod pools;
 mod thread_per_core;
+mod thread_per_core_lpt;
 mod thread_per_host;
 
 use std::cell::RefCell;
@@ -26,11 +28,28 @@ pub fn core_affinity() -> Option<u32> {
     CORE_AFFINITY.with(|x| *x.borrow())
 }
 
+/// The order in which thread `thread` of a work-stealing scheduler should take hosts from the
+/// threads' queues: its own queue first, then those of threads on the same NUMA node, then the
+/// rest. Each group is in round-robin order starting from the next thread, so that threads don't
+/// all steal from the same thread. Threads with an unknown node (`None`) aren't grouped.
+fn queue_order(thread: usize, numa_nodes: &[Option<u32>]) -> Vec<usize> {
+    let num_threads = numa_nodes.len();
+    let node = numa_nodes[thread];
+
+    let (mut order, other_nodes): (Vec<usize>, Vec<usize>) = (0..num_threads)
+        .map(|x| (thread + x) % num_threads)
+        .partition(|x| *x == thread || (node.is_some() && numa_nodes[*x] == node));
+
+    order.extend(other_nodes);
+    order
+}
+
 /// A wrapper for different host schedulers. It would have been nice to make this a trait, but would
 /// require support for GATs.
 pub enum Scheduler {
     ThreadPerHost(thread_per_host::ThreadPerHostSched),
     ThreadPerCore(thread_per_core::ThreadPerCoreSched<Box<Host>>),
+    ThreadPerCoreLpt(thread_per_core_lpt::ThreadPerCoreLptSched<Box<Host>>),
 }
 
 impl Scheduler {
@@ -39,6 +58,7 @@ impl Scheduler {
         match self {
             Self::ThreadPerHost(sched) => sched.parallelism(),
             Self::ThreadPerCore(sched) => sched.parallelism(),
+            Self::ThreadPerCoreLpt(sched) => sched.parallelism(),
         }
     }
 
@@ -51,6 +71,9 @@ impl Scheduler {
         match self {
             Self::ThreadPerHost(sched) => sched.scope(move |s| f(SchedulerScope::ThreadPerHost(s))),
             Self::ThreadPerCore(sched) => sched.scope(move |s| f(SchedulerScope::ThreadPerCore(s))),
+            Self::ThreadPerCoreLpt(sched) => {
+                sched.scope(move |s| f(SchedulerScope::ThreadPerCoreLpt(s)))
+            }
         }
     }
 
@@ -59,13 +82,15 @@ impl Scheduler {
         match self {
             Self::ThreadPerHost(sched) => sched.join(),
             Self::ThreadPerCore(sched) => sched.join(),
+            Self::ThreadPerCoreLpt(sched) => sched.join(),
         }
     }
 }
 
 pub enum SchedulerScope<'sched, 'pool, 'scope> {
-    ThreadPerHost(thread_per_host::SchedulerScope<'pool, 'scope>),
+    ThreadPerHost(thread_per_host::SchedulerScope<'sched, 'pool, 'scope>),
     ThreadPerCore(thread_per_core::SchedulerScope<'sched, 'pool, 'scope, Box<Host>>),
+    ThreadPerCoreLpt(thread_per_core_lpt::SchedulerScope<'sched, 'pool, 'scope, Box<Host>>),
 }
 
 impl<'sched, 'pool, 'scope> SchedulerScope<'sched, 'pool, 'scope> {
@@ -75,6 +100,7 @@ impl<'sched, 'pool, 'scope> SchedulerScope<'sched, 'pool, 'scope> {
         match self {
             Self::ThreadPerHost(scope) => scope.run(f),
             Self::ThreadPerCore(scope) => scope.run(f),
+            Self::ThreadPerCoreLpt(scope) => scope.run(f),
         }
     }
 
@@ -94,6 +120,10 @@ impl<'sched, 'pool, 'scope> SchedulerScope<'sched, 'pool, 'scope> {
                 let mut iter = HostIter::ThreadPerCore(iter);
                 f(idx, &mut iter)
             }),
+            Self::ThreadPerCoreLpt(scope) => scope.run_with_hosts(move |idx, iter| {
+                let mut iter = HostIter::ThreadPerCoreLpt(iter);
+                f(idx, &mut iter)
+            }),
         }
     }
 
@@ -127,14 +157,19 @@ impl<'sched, 'pool, 'scope> SchedulerScope<'sched, 'pool, 'scope> {
                 let mut iter = HostIter::ThreadPerCore(iter);
                 f(idx, &mut iter, elem)
             }),
+            Self::ThreadPerCoreLpt(scope) => scope.run_with_data(data, move |idx, iter, elem| {
+                let mut iter = HostIter::ThreadPerCoreLpt(iter);
+                f(idx, &mut iter, elem)
+            }),
         }
     }
 }
 
 /// Supports iterating over all hosts assigned to this thread.
 pub enum HostIter<'a, 'b> {
-    ThreadPerHost(&'a mut thread_per_host::HostIter),
+    ThreadPerHost(&'a mut thread_per_host::HostIter<'b>),
     ThreadPerCore(&'a mut thread_per_core::HostIter<'b, Box<Host>>),
+    ThreadPerCoreLpt(&'a mut thread_per_core_lpt::HostIter<'b, Box<Host>>),
 }
 
 impl<'a, 'b> HostIter<'a, 'b> {
@@ -146,6 +181,7 @@ impl<'a, 'b> HostIter<'a, 'b> {
         match self {
             Self::ThreadPerHost(x) => x.for_each(f),
             Self::ThreadPerCore(x) => x.for_each(f),
+            Self::ThreadPerCoreLpt(x) => x.for_each(f),
         }
     }
 }
@@ -162,3 +198,21 @@ mod export {
             .unwrap_or(-1)
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_queue_order() {
+        // without nodes, threads steal in round-robin order
+        assert_eq!(queue_order(0, &[None, None, None]), [0, 1, 2]);
+        assert_eq!(queue_order(2, &[None, None, None]), [2, 0, 1]);
+
+        // threads steal from their own node first
+        let nodes = [Some(0), Some(1), Some(0), Some(1)];
+        assert_eq!(queue_order(0, &nodes), [0, 2, 1, 3]);
+        assert_eq!(queue_order(1, &nodes), [1, 3, 2, 0]);
+        assert_eq!(queue_order(3, &nodes), [3, 1, 0, 2]);
+    }
+}
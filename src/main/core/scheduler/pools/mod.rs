@@ -1,2 +1 @@
-pub mod bounded;
 pub mod unbounded;
@@ -2,8 +2,9 @@ use std::fmt::Debug;
 
 use crossbeam::queue::ArrayQueue;
 
-use super::CORE_AFFINITY;
+use super::{queue_order, CORE_AFFINITY};
 use crate::core::scheduler::pools::unbounded::{TaskRunner, UnboundedThreadPool};
+use crate::core::timeline;
 
 pub trait Host: Debug + Send {}
 impl<T> Host for T where T: Debug + Send {}
@@ -14,6 +15,8 @@ pub struct ThreadPerCoreSched<HostType: Host> {
     num_threads: usize,
     thread_hosts: Vec<ArrayQueue<HostType>>,
     thread_hosts_processed: Vec<ArrayQueue<HostType>>,
+    /// For each thread, the order in which it takes hosts from the threads' queues.
+    thread_queue_order: Vec<Vec<usize>>,
     hosts_need_swap: bool,
 }
 
@@ -25,6 +28,21 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
         T: IntoIterator<Item = HostType>,
         <T as IntoIterator>::IntoIter: ExactSizeIterator,
     {
+        Self::new_with_numa_nodes(cpu_ids, &vec![None; cpu_ids.len()], hosts)
+    }
+
+    /// Like [`Self::new`], but threads steal hosts from threads on the same NUMA node (as given by
+    /// `numa_nodes`, one per thread) before stealing from threads on other nodes.
+    pub fn new_with_numa_nodes<T>(
+        cpu_ids: &[Option<u32>],
+        numa_nodes: &[Option<u32>],
+        hosts: T,
+    ) -> Self
+    where
+        T: IntoIterator<Item = HostType>,
+        <T as IntoIterator>::IntoIter: ExactSizeIterator,
+    {
+        assert_eq!(cpu_ids.len(), numa_nodes.len());
         let hosts = hosts.into_iter();
 
         let num_threads = cpu_ids.len();
@@ -59,11 +77,16 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
             thread_queue.push(host).unwrap();
         }
 
+        let thread_queue_order = (0..num_threads)
+            .map(|i| queue_order(i, numa_nodes))
+            .collect();
+
         Self {
             pool,
             num_threads,
             thread_hosts,
             thread_hosts_processed: thread_hosts_2,
+            thread_queue_order,
             hosts_need_swap: false,
         }
     }
@@ -90,6 +113,7 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
         // data/references that we'll pass to the scope
         let thread_hosts = &self.thread_hosts;
         let thread_hosts_processed = &self.thread_hosts_processed;
+        let thread_queue_order = &self.thread_queue_order;
         let hosts_need_swap = &mut self.hosts_need_swap;
 
         // we cannot access `self` after calling `pool.scope()` since `SchedulerScope` has a
@@ -99,6 +123,7 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
             let sched_scope = SchedulerScope {
                 thread_hosts,
                 thread_hosts_processed,
+                thread_queue_order,
                 hosts_need_swap,
                 runner: s,
             };
@@ -120,6 +145,7 @@ where
 {
     thread_hosts: &'sched Vec<ArrayQueue<HostType>>,
     thread_hosts_processed: &'sched Vec<ArrayQueue<HostType>>,
+    thread_queue_order: &'sched Vec<Vec<usize>>,
     hosts_need_swap: &'sched mut bool,
     runner: TaskRunner<'pool, 'scope>,
 }
@@ -139,7 +165,7 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
             let mut host_iter = HostIter {
                 thread_hosts_from: &self.thread_hosts,
                 thread_hosts_to: &self.thread_hosts_processed[i],
-                this_thread_index: i,
+                queue_order: &self.thread_queue_order[i],
             };
 
             f(i, &mut host_iter);
@@ -162,7 +188,7 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
             let mut host_iter = HostIter {
                 thread_hosts_from: &self.thread_hosts,
                 thread_hosts_to: &self.thread_hosts_processed[i],
-                this_thread_index: i,
+                queue_order: &self.thread_queue_order[i],
             };
 
             f(i, &mut host_iter, this_elem);
@@ -179,9 +205,9 @@ pub struct HostIter<'a, HostType: Host> {
     thread_hosts_from: &'a [ArrayQueue<HostType>],
     /// The queue to add hosts to when done with them.
     thread_hosts_to: &'a ArrayQueue<HostType>,
-    /// The index of this thread. This is the first queue of `thread_hosts_from` that we take hosts
-    /// from.
-    this_thread_index: usize,
+    /// The indexes of the queues of `thread_hosts_from` to take hosts from, in order. The first is
+    /// this thread's own queue.
+    queue_order: &'a [usize],
 }
 
 impl<'a, HostType: Host> HostIter<'a, HostType> {
@@ -190,17 +216,19 @@ impl<'a, HostType: Host> HostIter<'a, HostType> {
     where
         F: FnMut(HostType) -> HostType,
     {
-        for from_queue in self
-            .thread_hosts_from
-            .iter()
-            .cycle()
-            // start from the current thread index
-            .skip(self.this_thread_index)
-            .take(self.thread_hosts_from.len())
-        {
-            while let Some(host) = from_queue.pop() {
+        let (own_index, other_indexes) = self.queue_order.split_first().unwrap();
+
+        while let Some(host) = self.thread_hosts_from[*own_index].pop() {
+            self.thread_hosts_to.push(f(host)).unwrap();
+        }
+
+        for from_index in other_indexes {
+            let mut num_stolen = 0;
+            while let Some(host) = self.thread_hosts_from[*from_index].pop() {
                 self.thread_hosts_to.push(f(host)).unwrap();
+                num_stolen += 1;
             }
+            timeline::record_steal(*from_index, num_stolen);
         }
     }
 }
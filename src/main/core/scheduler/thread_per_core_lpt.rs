@@ -0,0 +1,565 @@
+use std::cmp::Reverse;
+use std::collections::VecDeque;
+use std::sync::Mutex;
+use std::time::Instant;
+
+use super::thread_per_core::Host;
+use super::{queue_order, CORE_AFFINITY};
+use crate::core::scheduler::pools::unbounded::{TaskRunner, UnboundedThreadPool};
+use crate::core::timeline;
+
+/// Rebalance the hosts between threads when the most loaded thread's estimated load is this many
+/// times the average load.
+const IMBALANCE_THRESHOLD: f64 = 1.25;
+
+/// The minimum number of rounds between rebalances, so that a single noisy round doesn't cause
+/// hosts to move between threads.
+const MIN_ROUNDS_BETWEEN_REBALANCES: u32 = 16;
+
+/// A host and an estimate of how long it takes to run each round.
+#[derive(Debug)]
+struct CostedHost<HostType> {
+    host: HostType,
+    /// An exponentially weighted moving average of the host's execution time per round, in
+    /// nanoseconds. Is 0 if the host hasn't run yet.
+    cost_ns: u64,
+}
+
+impl<HostType> CostedHost<HostType> {
+    fn new(host: HostType) -> Self {
+        Self { host, cost_ns: 0 }
+    }
+
+    /// Run `f` on the host and update the host's cost with the time it took.
+    fn run(self, f: &mut impl FnMut(HostType) -> HostType) -> Self {
+        let start = Instant::now();
+        let host = f(self.host);
+        let elapsed_ns = u64::try_from(start.elapsed().as_nanos()).unwrap_or(u64::MAX);
+
+        let cost_ns = if self.cost_ns == 0 {
+            elapsed_ns
+        } else {
+            // weight the latest round by 1/4
+            self.cost_ns / 4 * 3 + elapsed_ns / 4
+        };
+
+        Self { host, cost_ns }
+    }
+}
+
+/// A host scheduler.
+pub struct ThreadPerCoreLptSched<HostType: Host> {
+    pool: UnboundedThreadPool,
+    num_threads: usize,
+    /// The hosts to run for each thread this round, in decreasing order of cost. A thread runs its
+    /// own hosts from the front, and steals hosts from the back of other threads' queues.
+    thread_hosts: Vec<Mutex<VecDeque<CostedHost<HostType>>>>,
+    /// The hosts that each thread has run this round.
+    thread_hosts_processed: Vec<Mutex<Vec<CostedHost<HostType>>>>,
+    /// For each thread, the order in which it takes hosts from the threads' queues.
+    thread_queue_order: Vec<Vec<usize>>,
+    /// The NUMA node of each thread, if known. Hosts are only rebalanced between threads on the
+    /// same node.
+    numa_nodes: Vec<Option<u32>>,
+    hosts_need_swap: bool,
+    rounds_since_rebalance: u32,
+}
+
+impl<HostType: Host> ThreadPerCoreLptSched<HostType> {
+    /// A new host scheduler with threads that are pinned to the provided OS processors. Each thread
+    /// is assigned many hosts, and threads may steal hosts from other threads. Hosts stay on the
+    /// thread that last ran them, and are periodically rebalanced between threads in longest
+    /// processing time (LPT) order using their measured execution times.
+    pub fn new<T>(cpu_ids: &[Option<u32>], hosts: T) -> Self
+    where
+        T: IntoIterator<Item = HostType>,
+        <T as IntoIterator>::IntoIter: ExactSizeIterator,
+    {
+        Self::new_with_numa_nodes(cpu_ids, &vec![None; cpu_ids.len()], hosts)
+    }
+
+    /// Like [`Self::new`], but threads steal hosts from threads on the same NUMA node (as given by
+    /// `numa_nodes`, one per thread) before stealing from threads on other nodes.
+    pub fn new_with_numa_nodes<T>(
+        cpu_ids: &[Option<u32>],
+        numa_nodes: &[Option<u32>],
+        hosts: T,
+    ) -> Self
+    where
+        T: IntoIterator<Item = HostType>,
+        <T as IntoIterator>::IntoIter: ExactSizeIterator,
+    {
+        assert_eq!(cpu_ids.len(), numa_nodes.len());
+        let hosts = hosts.into_iter();
+
+        let num_threads = cpu_ids.len();
+        let mut pool = UnboundedThreadPool::new(num_threads, "shadow-worker");
+
+        // set the affinity of each thread
+        pool.scope(|s| {
+            s.run(|i| {
+                let cpu_id = cpu_ids[i];
+
+                if let Some(cpu_id) = cpu_id {
+                    let mut cpus = nix::sched::CpuSet::new();
+                    cpus.set(cpu_id as usize).unwrap();
+                    nix::sched::sched_setaffinity(nix::unistd::Pid::from_raw(0), &cpus).unwrap();
+
+                    // update the thread-local core affinity
+                    CORE_AFFINITY.with(|x| *x.borrow_mut() = Some(cpu_id));
+                }
+            });
+        });
+
+        let thread_hosts: Vec<_> = (0..num_threads)
+            .map(|_| Mutex::new(VecDeque::new()))
+            .collect();
+        let thread_hosts_processed: Vec<_> =
+            (0..num_threads).map(|_| Mutex::new(Vec::new())).collect();
+
+        // we don't know the hosts' costs yet, so assign hosts to threads in a round-robin manner
+        for (thread_queue, host) in thread_hosts.iter().cycle().zip(hosts) {
+            thread_queue
+                .lock()
+                .unwrap()
+                .push_back(CostedHost::new(host));
+        }
+
+        let thread_queue_order = (0..num_threads)
+            .map(|i| queue_order(i, numa_nodes))
+            .collect();
+
+        Self {
+            pool,
+            num_threads,
+            thread_hosts,
+            thread_hosts_processed,
+            thread_queue_order,
+            numa_nodes: numa_nodes.to_vec(),
+            hosts_need_swap: false,
+            rounds_since_rebalance: 0,
+        }
+    }
+
+    /// See [`crate::core::scheduler::Scheduler::parallelism`].
+    pub fn parallelism(&self) -> usize {
+        self.num_threads
+    }
+
+    /// See [`crate::core::scheduler::Scheduler::scope`].
+    pub fn scope<'scope>(
+        &'scope mut self,
+        f: impl for<'a, 'b> FnOnce(SchedulerScope<'a, 'b, 'scope, HostType>) + 'scope,
+    ) {
+        // we can't move the hosts after the below `pool.scope()` due to lifetime restrictions, so
+        // we need to do it before instead
+        if self.hosts_need_swap {
+            self.prepare_next_round();
+            self.hosts_need_swap = false;
+        }
+
+        // data/references that we'll pass to the scope
+        let thread_hosts = &self.thread_hosts;
+        let thread_hosts_processed = &self.thread_hosts_processed;
+        let thread_queue_order = &self.thread_queue_order;
+        let hosts_need_swap = &mut self.hosts_need_swap;
+
+        // we cannot access `self` after calling `pool.scope()` since `SchedulerScope` has a
+        // lifetime of `'scope` (which at minimum spans the entire current function)
+
+        self.pool.scope(move |s| {
+            let sched_scope = SchedulerScope {
+                thread_hosts,
+                thread_hosts_processed,
+                thread_queue_order,
+                hosts_need_swap,
+                runner: s,
+            };
+
+            (f)(sched_scope);
+        });
+    }
+
+    /// Move the processed hosts back to the threads' queues for the next round. Hosts stay on the
+    /// thread that ran them unless the threads' loads have become imbalanced.
+    fn prepare_next_round(&mut self) {
+        debug_assert!(self
+            .thread_hosts
+            .iter_mut()
+            .all(|queue| queue.get_mut().unwrap().is_empty()));
+
+        self.rounds_since_rebalance = self.rounds_since_rebalance.saturating_add(1);
+
+        let loads: Vec<u64> = self
+            .thread_hosts_processed
+            .iter_mut()
+            .map(|hosts| hosts.get_mut().unwrap().iter().map(|x| x.cost_ns).sum())
+            .collect();
+
+        let total_load: u64 = loads.iter().sum();
+        let max_load = loads.iter().copied().max().unwrap_or(0);
+        let mean_load = total_load as f64 / self.num_threads as f64;
+
+        if self.num_threads > 1
+            && max_load as f64 > IMBALANCE_THRESHOLD * mean_load
+            && self.rounds_since_rebalance >= MIN_ROUNDS_BETWEEN_REBALANCES
+        {
+            self.rebalance();
+            self.rounds_since_rebalance = 0;
+            return;
+        }
+
+        for (processed, queue) in self
+            .thread_hosts_processed
+            .iter_mut()
+            .zip(self.thread_hosts.iter_mut())
+        {
+            let processed = processed.get_mut().unwrap();
+            // the order is usually unchanged from the previous round, which the sort is fast for
+            processed.sort_by_key(|x| Reverse(x.cost_ns));
+            queue.get_mut().unwrap().extend(processed.drain(..));
+        }
+    }
+
+    /// Assign the processed hosts to threads in decreasing order of cost, each to the least loaded
+    /// thread (the LPT heuristic). A host stays on the thread that last ran it if that thread
+    /// wouldn't exceed its share of the load, to keep the host's data in that core's cache.
+    ///
+    /// Hosts are only moved between threads on the same NUMA node, since their memory was
+    /// allocated on that node. This means that an imbalance between nodes is left for the threads
+    /// to even out by stealing, which is cheaper than running a host on a remote node every round.
+    fn rebalance(&mut self) {
+        let mut hosts: Vec<(usize, CostedHost<HostType>)> = self
+            .thread_hosts_processed
+            .iter_mut()
+            .enumerate()
+            .flat_map(|(thread, hosts)| {
+                hosts.get_mut().unwrap().drain(..).map(move |x| (thread, x))
+            })
+            .collect();
+        hosts.sort_by_key(|(_, x)| Reverse(x.cost_ns));
+
+        // each thread's share of the load of the hosts on its node
+        let mut target_loads = vec![0u64; self.num_threads];
+        for (thread, target_load) in target_loads.iter_mut().enumerate() {
+            let node = self.numa_nodes[thread];
+            let node_load: u64 = hosts
+                .iter()
+                .filter(|(prev_thread, _)| self.numa_nodes[*prev_thread] == node)
+                .map(|(_, x)| x.cost_ns)
+                .sum();
+            let node_threads = self.numa_nodes.iter().filter(|x| **x == node).count();
+            let node_threads = u64::try_from(node_threads).unwrap();
+            *target_load = (node_load + node_threads - 1) / node_threads;
+        }
+
+        let mut loads = vec![0u64; self.num_threads];
+
+        for (prev_thread, host) in hosts {
+            let thread = if loads[prev_thread] + host.cost_ns <= target_loads[prev_thread] {
+                prev_thread
+            } else {
+                // the least loaded thread on the same node
+                let node = self.numa_nodes[prev_thread];
+                (0..loads.len())
+                    .filter(|x| self.numa_nodes[*x] == node)
+                    .min_by_key(|x| loads[*x])
+                    .unwrap()
+            };
+
+            loads[thread] += host.cost_ns;
+            // hosts are added in decreasing order of cost
+            self.thread_hosts[thread].get_mut().unwrap().push_back(host);
+        }
+
+        log::debug!(
+            "Rebalanced hosts between threads; estimated loads are now {:?} ns",
+            loads
+        );
+    }
+
+    /// See [`crate::core::scheduler::Scheduler::join`].
+    pub fn join(self) {
+        self.pool.join();
+    }
+}
+
+/// A wrapper around the work pool's scoped runner.
+pub struct SchedulerScope<'sched, 'pool, 'scope, HostType: Host>
+where
+    'sched: 'scope,
+{
+    thread_hosts: &'sched Vec<Mutex<VecDeque<CostedHost<HostType>>>>,
+    thread_hosts_processed: &'sched Vec<Mutex<Vec<CostedHost<HostType>>>>,
+    thread_queue_order: &'sched Vec<Vec<usize>>,
+    hosts_need_swap: &'sched mut bool,
+    runner: TaskRunner<'pool, 'scope>,
+}
+
+impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope, HostType> {
+    /// See [`crate::core::scheduler::SchedulerScope::run`].
+    pub fn run(self, f: impl Fn(usize) + Sync + Send + 'scope) {
+        self.runner.run(f);
+    }
+
+    /// See [`crate::core::scheduler::SchedulerScope::run_with_hosts`].
+    pub fn run_with_hosts(
+        self,
+        f: impl Fn(usize, &mut HostIter<'_, HostType>) + Send + Sync + 'scope,
+    ) {
+        self.runner.run(move |i| {
+            let mut host_iter = HostIter {
+                thread_hosts_from: self.thread_hosts,
+                thread_hosts_to: &self.thread_hosts_processed[i],
+                queue_order: &self.thread_queue_order[i],
+            };
+
+            f(i, &mut host_iter);
+        });
+
+        *self.hosts_need_swap = true;
+    }
+
+    /// See [`crate::core::scheduler::SchedulerScope::run_with_data`].
+    pub fn run_with_data<T>(
+        self,
+        data: &'scope [T],
+        f: impl Fn(usize, &mut HostIter<'_, HostType>, &T) + Send + Sync + 'scope,
+    ) where
+        T: Sync,
+    {
+        self.runner.run(move |i| {
+            let this_elem = &data[i];
+
+            let mut host_iter = HostIter {
+                thread_hosts_from: self.thread_hosts,
+                thread_hosts_to: &self.thread_hosts_processed[i],
+                queue_order: &self.thread_queue_order[i],
+            };
+
+            f(i, &mut host_iter, this_elem);
+        });
+
+        *self.hosts_need_swap = true;
+    }
+}
+
+/// Supports iterating over all hosts assigned to this thread. The iterator will steal hosts from
+/// other threads once it has run all of its own hosts.
+pub struct HostIter<'a, HostType: Host> {
+    /// Queues to take hosts from.
+    thread_hosts_from: &'a [Mutex<VecDeque<CostedHost<HostType>>>],
+    /// Where to add hosts to when done with them.
+    thread_hosts_to: &'a Mutex<Vec<CostedHost<HostType>>>,
+    /// The indexes of the queues of `thread_hosts_from` to take hosts from, in order. The first is
+    /// this thread's own queue.
+    queue_order: &'a [usize],
+}
+
+impl<'a, HostType: Host> HostIter<'a, HostType> {
+    /// See [`crate::core::scheduler::HostIter::for_each`].
+    pub fn for_each<F>(&mut self, mut f: F)
+    where
+        F: FnMut(HostType) -> HostType,
+    {
+        // reuse the allocation from previous rounds
+        let mut processed = std::mem::take(&mut *self.thread_hosts_to.lock().unwrap());
+
+        let (own_index, other_indexes) = self.queue_order.split_first().unwrap();
+
+        // run our own hosts, most costly first
+        let own_queue = &self.thread_hosts_from[*own_index];
+        loop {
+            // don't hold the lock while running the host
+            let Some(host) = own_queue.lock().unwrap().pop_front() else {
+                break;
+            };
+            processed.push(host.run(&mut f));
+        }
+
+        // then steal the least costly hosts from the other threads
+        for from_index in other_indexes {
+            let from_queue = &self.thread_hosts_from[*from_index];
+            let mut num_stolen = 0;
+            loop {
+                let Some(host) = from_queue.lock().unwrap().pop_back() else {
+                    break;
+                };
+                processed.push(host.run(&mut f));
+                num_stolen += 1;
+            }
+            timeline::record_steal(*from_index, num_stolen);
+        }
+
+        self.thread_hosts_to.lock().unwrap().append(&mut processed);
+    }
+}
+
+#[cfg(any(test, doctest))]
+mod tests {
+    use std::sync::atomic::{AtomicU32, Ordering};
+
+    use super::*;
+
+    #[derive(Debug)]
+    struct TestHost {
+        id: u32,
+    }
+
+    /// Replace the hosts that each thread processed this round with hosts of the given ids and
+    /// costs.
+    fn set_processed(sched: &mut ThreadPerCoreLptSched<TestHost>, hosts: &[&[(u32, u64)]]) {
+        for (thread, hosts) in hosts.iter().enumerate() {
+            let processed = sched.thread_hosts_processed[thread].get_mut().unwrap();
+            processed.clear();
+            processed.extend(hosts.iter().map(|(id, cost_ns)| CostedHost {
+                host: TestHost { id: *id },
+                cost_ns: *cost_ns,
+            }));
+        }
+    }
+
+    /// The ids of the hosts in each thread's queue, in order.
+    fn queued_ids(sched: &mut ThreadPerCoreLptSched<TestHost>) -> Vec<Vec<u32>> {
+        sched
+            .thread_hosts
+            .iter_mut()
+            .map(|queue| queue.get_mut().unwrap().iter().map(|x| x.host.id).collect())
+            .collect()
+    }
+
+    #[test]
+    fn test_parallelism() {
+        let hosts = [0, 1, 2, 3, 4].map(|id| TestHost { id });
+        let sched = ThreadPerCoreLptSched::new(&[None, None], hosts);
+
+        assert_eq!(sched.parallelism(), 2);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_run_with_hosts() {
+        let hosts = [0, 1, 2, 3, 4].map(|id| TestHost { id });
+        let mut sched = ThreadPerCoreLptSched::new(&[None, None], hosts);
+
+        let counter = AtomicU32::new(0);
+
+        for _ in 0..3 {
+            sched.scope(|s| {
+                s.run_with_hosts(|_, hosts| {
+                    hosts.for_each(|host| {
+                        counter.fetch_add(1, Ordering::SeqCst);
+                        host
+                    });
+                });
+            });
+        }
+
+        assert_eq!(counter.load(Ordering::SeqCst), 5 * 3);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_run_with_data() {
+        let hosts = [0, 1, 2, 3, 4].map(|id| TestHost { id });
+        let mut sched = ThreadPerCoreLptSched::new(&[None, None], hosts);
+
+        let data = vec![0u32; sched.parallelism()];
+        let data: Vec<_> = data.into_iter().map(|x| std::sync::Mutex::new(x)).collect();
+
+        for _ in 0..3 {
+            sched.scope(|s| {
+                s.run_with_data(&data, |_, hosts, elem| {
+                    let mut elem = elem.lock().unwrap();
+                    hosts.for_each(|host| {
+                        *elem += 1;
+                        host
+                    });
+                });
+            });
+        }
+
+        let sum: u32 = data.into_iter().map(|x| x.into_inner().unwrap()).sum();
+        assert_eq!(sum, 5 * 3);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_rebalance() {
+        let mut sched = ThreadPerCoreLptSched::new(&[None, None], Vec::new());
+
+        // two expensive hosts that ran on the same thread, and some cheap hosts
+        set_processed(
+            &mut sched,
+            &[
+                &[(0, 100), (1, 10), (2, 100), (3, 10), (4, 10)],
+                &[(5, 10), (6, 10), (7, 10)],
+            ],
+        );
+        sched.rebalance();
+
+        // the target load is 130 per thread, so the second expensive host moves to the other
+        // thread, and the cheap hosts stay where they were
+        assert_eq!(queued_ids(&mut sched), [vec![0, 1, 3, 4], vec![2, 5, 6, 7]]);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_rebalance_within_numa_node() {
+        let nodes = [Some(0), Some(0), Some(1), Some(1)];
+        let mut sched = ThreadPerCoreLptSched::new_with_numa_nodes(&[None; 4], &nodes, Vec::new());
+
+        // node 0 is much busier than node 1, but hosts shouldn't leave their node
+        set_processed(
+            &mut sched,
+            &[&[(0, 100), (1, 100), (2, 100)], &[], &[(3, 10)], &[]],
+        );
+        sched.rebalance();
+
+        assert_eq!(
+            queued_ids(&mut sched),
+            [vec![0, 2], vec![1], vec![3], vec![]]
+        );
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_no_rebalance_when_balanced() {
+        let mut sched = ThreadPerCoreLptSched::new(&[None, None], Vec::new());
+
+        set_processed(&mut sched, &[&[(0, 10), (1, 100)], &[(2, 100), (3, 10)]]);
+        sched.rounds_since_rebalance = MIN_ROUNDS_BETWEEN_REBALANCES;
+        sched.prepare_next_round();
+
+        // hosts stay on their threads, most costly first
+        assert_eq!(queued_ids(&mut sched), [vec![1, 0], vec![2, 3]]);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_rebalance_when_imbalanced() {
+        let mut sched = ThreadPerCoreLptSched::new(&[None, None], Vec::new());
+
+        // not until enough rounds have passed since the last rebalance
+        set_processed(&mut sched, &[&[(0, 100), (1, 100)], &[]]);
+        sched.rounds_since_rebalance = MIN_ROUNDS_BETWEEN_REBALANCES - 2;
+        sched.prepare_next_round();
+        assert_eq!(queued_ids(&mut sched), [vec![0, 1], vec![]]);
+
+        for queue in &mut sched.thread_hosts {
+            queue.get_mut().unwrap().clear();
+        }
+        set_processed(&mut sched, &[&[(0, 100), (1, 100)], &[]]);
+        sched.prepare_next_round();
+        assert_eq!(queued_ids(&mut sched), [vec![0], vec![1]]);
+        assert_eq!(sched.rounds_since_rebalance, 0);
+
+        sched.join();
+    }
+}
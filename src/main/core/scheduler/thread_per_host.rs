@@ -1,24 +1,32 @@
-use std::cell::RefCell;
 use std::sync::Mutex;
 
-use crate::core::scheduler::pools::bounded::{ParallelismBoundedThreadPool, TaskRunner};
+use crate::core::scheduler::logical_processor::LogicalProcessors;
+use crate::core::scheduler::pools::unbounded::{TaskRunner, UnboundedThreadPool};
 use crate::host::host::Host;
 
 use super::CORE_AFFINITY;
 
-std::thread_local! {
-    /// The host that belongs to this thread.
-    static THREAD_HOST: RefCell<Option<Box<Host>>> = RefCell::new(None);
-}
-
 /// A host scheduler.
+///
+/// Rather than giving each host its own OS thread (which doesn't scale to many thousands of
+/// hosts), hosts are multiplexed over a single worker thread per logical processor. A host runs to
+/// completion each time it's executed, so it doesn't need a stack of its own between rounds. Each
+/// logical processor runs the hosts that last ran on it, and then steals hosts from other logical
+/// processors. Each worker thread has its own thread-local
+/// [`Worker`](crate::core::worker::Worker), which is shared by the hosts that run on it.
 pub struct ThreadPerHostSched {
-    pool: ParallelismBoundedThreadPool,
+    pool: UnboundedThreadPool,
+    /// The host contexts. A context is only accessed by the worker thread that took its index from
+    /// `logical_processors`, so the locks are never contended.
+    hosts: Vec<Mutex<Option<Box<Host>>>>,
+    /// The host context indexes to run on each logical processor.
+    logical_processors: LogicalProcessors,
+    logical_processors_need_reset: bool,
 }
 
 impl ThreadPerHostSched {
     /// A new host scheduler with logical processors that are pinned to the provided OS processors.
-    /// Each logical processor is assigned many threads, and each thread is given a single host.
+    /// Each logical processor has a single worker thread, and is assigned many hosts.
     pub fn new<T>(cpu_ids: &[Option<u32>], hosts: T) -> Self
     where
         T: IntoIterator<Item = Box<Host>>,
@@ -26,141 +34,159 @@ impl ThreadPerHostSched {
     {
         let hosts = hosts.into_iter();
 
-        let mut pool = ParallelismBoundedThreadPool::new(cpu_ids, hosts.len(), "shadow-worker");
+        // we don't need more logical processors than hosts
+        let cpu_ids = &cpu_ids[..std::cmp::min(cpu_ids.len(), std::cmp::max(hosts.len(), 1))];
 
-        // for determinism, threads will take hosts from a vec rather than a queue
-        let hosts: Vec<Mutex<Option<Box<Host>>>> = hosts.map(|x| Mutex::new(Some(x))).collect();
+        let mut pool = UnboundedThreadPool::new(cpu_ids.len(), "shadow-worker");
 
-        // have each thread take a host and store it as a thread-local
+        // set the affinity of each thread; threads never move between logical processors
         pool.scope(|s| {
-            s.run(|t| {
-                THREAD_HOST.with(|x| {
-                    let host = hosts[t.thread_idx].lock().unwrap().take().unwrap();
-                    *x.borrow_mut() = Some(host);
-                });
+            s.run(|i| {
+                if let Some(cpu_id) = cpu_ids[i] {
+                    let mut cpus = nix::sched::CpuSet::new();
+                    cpus.set(cpu_id as usize).unwrap();
+                    nix::sched::sched_setaffinity(nix::unistd::Pid::from_raw(0), &cpus).unwrap();
+
+                    // update the thread-local core affinity
+                    CORE_AFFINITY.with(|x| *x.borrow_mut() = Some(cpu_id));
+                }
             });
         });
 
-        Self { pool }
+        // for determinism, processors will take hosts from a vec rather than a queue
+        let hosts: Vec<Mutex<Option<Box<Host>>>> = hosts.map(|x| Mutex::new(Some(x))).collect();
+
+        // assign hosts to logical processors in a round-robin manner
+        let logical_processors = LogicalProcessors::new(cpu_ids, std::cmp::max(hosts.len(), 1));
+        for (processor_idx, host_idx) in logical_processors.iter().cycle().zip(0..hosts.len()) {
+            logical_processors.add_worker(processor_idx, host_idx);
+        }
+
+        Self {
+            pool,
+            hosts,
+            logical_processors,
+            logical_processors_need_reset: false,
+        }
     }
 
     /// See [`crate::core::scheduler::Scheduler::parallelism`].
     pub fn parallelism(&self) -> usize {
-        self.pool.num_processors()
+        self.logical_processors.iter().len()
     }
 
     /// See [`crate::core::scheduler::Scheduler::scope`].
     pub fn scope<'scope>(
         &'scope mut self,
-        f: impl for<'a> FnOnce(SchedulerScope<'a, 'scope>) + 'scope,
+        f: impl for<'a, 'b> FnOnce(SchedulerScope<'a, 'b, 'scope>) + 'scope,
     ) {
+        // we can't reset after the below `pool.scope()` due to lifetime restrictions, so we need to
+        // do it before instead
+        if self.logical_processors_need_reset {
+            self.logical_processors.reset();
+            self.logical_processors_need_reset = false;
+        }
+
+        // data/references that we'll pass to the scope
+        let hosts = &self.hosts;
+        let logical_processors = &self.logical_processors;
+        let logical_processors_need_reset = &mut self.logical_processors_need_reset;
+
+        // we cannot access `self` after calling `pool.scope()` since `SchedulerScope` has a
+        // lifetime of `'scope` (which at minimum spans the entire current function)
+
         self.pool.scope(move |s| {
-            let sched_scope = SchedulerScope { runner: s };
+            let sched_scope = SchedulerScope {
+                hosts,
+                logical_processors,
+                logical_processors_need_reset,
+                runner: s,
+            };
 
             (f)(sched_scope);
         });
     }
 
     /// See [`crate::core::scheduler::Scheduler::join`].
-    pub fn join(mut self) {
-        let hosts: Vec<Mutex<Option<Box<Host>>>> = (0..self.pool.num_threads())
-            .map(|_| Mutex::new(None))
-            .collect();
-
-        // collect all of the hosts from the threads
-        self.pool.scope(|s| {
-            s.run(|t| {
-                THREAD_HOST.with(|x| {
-                    let host = x.borrow_mut().take().unwrap();
-                    *hosts[t.thread_idx].lock().unwrap() = Some(host);
-                });
-            });
-        });
-
+    pub fn join(self) {
         self.pool.join();
     }
 }
 
 /// A wrapper around the work pool's scoped runner.
-pub struct SchedulerScope<'pool, 'scope> {
+pub struct SchedulerScope<'sched, 'pool, 'scope>
+where
+    'sched: 'scope,
+{
+    hosts: &'sched [Mutex<Option<Box<Host>>>],
+    logical_processors: &'sched LogicalProcessors,
+    logical_processors_need_reset: &'sched mut bool,
     runner: TaskRunner<'pool, 'scope>,
 }
 
-impl<'pool, 'scope> SchedulerScope<'pool, 'scope> {
+impl<'sched, 'pool, 'scope> SchedulerScope<'sched, 'pool, 'scope> {
     /// See [`crate::core::scheduler::SchedulerScope::run`].
     pub fn run(self, f: impl Fn(usize) + Sync + Send + 'scope) {
-        self.runner.run(move |task_context| {
-            // update the thread-local core affinity
-            if let Some(cpu_id) = task_context.cpu_id {
-                CORE_AFFINITY.with(|x| *x.borrow_mut() = Some(cpu_id));
-            }
-
-            (f)(task_context.thread_idx)
-        });
+        self.runner.run(f);
     }
 
     /// See [`crate::core::scheduler::SchedulerScope::run_with_hosts`].
-    pub fn run_with_hosts(self, f: impl Fn(usize, &mut HostIter) + Send + Sync + 'scope) {
-        self.runner.run(move |task_context| {
-            // update the thread-local core affinity
-            if let Some(cpu_id) = task_context.cpu_id {
-                CORE_AFFINITY.with(|x| *x.borrow_mut() = Some(cpu_id));
-            }
-
-            THREAD_HOST.with(|host| {
-                let mut host = host.borrow_mut();
-
-                let mut host_iter = HostIter { host: host.take() };
-
-                f(task_context.thread_idx, &mut host_iter);
-
-                host.replace(host_iter.host.take().unwrap());
-            });
+    pub fn run_with_hosts(self, f: impl Fn(usize, &mut HostIter<'_>) + Send + Sync + 'scope) {
+        self.runner.run(move |i| {
+            let mut host_iter = HostIter {
+                hosts: self.hosts,
+                logical_processors: self.logical_processors,
+                processor_idx: i,
+            };
+
+            f(i, &mut host_iter);
         });
+
+        *self.logical_processors_need_reset = true;
     }
 
     /// See [`crate::core::scheduler::SchedulerScope::run_with_data`].
     pub fn run_with_data<T>(
         self,
         data: &'scope [T],
-        f: impl Fn(usize, &mut HostIter, &T) + Send + Sync + 'scope,
+        f: impl Fn(usize, &mut HostIter<'_>, &T) + Send + Sync + 'scope,
     ) where
         T: Sync,
     {
-        self.runner.run(move |task_context| {
-            // update the thread-local core affinity
-            if let Some(cpu_id) = task_context.cpu_id {
-                CORE_AFFINITY.with(|x| *x.borrow_mut() = Some(cpu_id));
-            }
-
-            let this_elem = &data[task_context.processor_idx];
-
-            THREAD_HOST.with(|host| {
-                let mut host = host.borrow_mut();
+        self.runner.run(move |i| {
+            let this_elem = &data[i];
 
-                let mut host_iter = HostIter { host: host.take() };
+            let mut host_iter = HostIter {
+                hosts: self.hosts,
+                logical_processors: self.logical_processors,
+                processor_idx: i,
+            };
 
-                f(task_context.thread_idx, &mut host_iter, this_elem);
-
-                host.replace(host_iter.host.unwrap());
-            });
+            f(i, &mut host_iter, this_elem);
         });
+
+        *self.logical_processors_need_reset = true;
     }
 }
 
-/// Supports iterating over all hosts assigned to this thread. For this thread-per-host scheduler,
-/// there will only ever be one host per thread.
-pub struct HostIter {
-    host: Option<Box<Host>>,
+/// Supports iterating over all hosts run by this thread's logical processor, including hosts
+/// stolen from other logical processors.
+pub struct HostIter<'a> {
+    hosts: &'a [Mutex<Option<Box<Host>>>],
+    logical_processors: &'a LogicalProcessors,
+    processor_idx: usize,
 }
 
-impl HostIter {
+impl<'a> HostIter<'a> {
     /// See [`crate::core::scheduler::HostIter::for_each`].
     pub fn for_each<F>(&mut self, mut f: F)
     where
         F: FnMut(Box<Host>) -> Box<Host>,
     {
-        let host = self.host.take().unwrap();
-        self.host.replace(f(host));
+        while let Some((host_idx, _)) = self.logical_processors.next_worker(self.processor_idx) {
+            let mut host = self.hosts[host_idx].lock().unwrap();
+            let h = host.take().unwrap();
+            host.replace(f(h));
+        }
     }
 }
@@ -2,21 +2,23 @@ use std::collections::{HashMap, HashSet};
 use std::ffi::{OsStr, OsString};
 use std::hash::{Hash, Hasher};
 use std::os::unix::fs::MetadataExt;
-use std::path::PathBuf;
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
 use std::time::Duration;
 
 use anyhow::Context;
-use log::warn;
+use log::{info, warn};
 use rand::{Rng, SeedableRng};
 use rand_xoshiro::Xoshiro256PlusPlus;
 
 use crate::core::support::configuration::Flatten;
 use crate::core::support::configuration::{
-    parse_string_as_args, ConfigOptions, HostOptions, LogInfoFlag, LogLevel, ProcessArgs,
-    ProcessOptions, QDiscMode,
+    parse_string_as_args, ConfigOptions, HeartbeatFormat, HostOptions, LogInfoFlag, LogLevel,
+    ProcessArgs, ProcessOptions, QDiscMode,
 };
 use crate::core::support::units::{self, Unit};
-use crate::network::graph::{load_network_graph, IpAssignment, NetworkGraph, RoutingInfo};
+use crate::network::graph::{load_network_graph, routing, IpAssignment, NetworkGraph, RoutingInfo};
+use crate::network::pcap_filter::PcapFilter;
 use crate::utility::tilde_expansion;
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
@@ -50,6 +52,7 @@ impl SimConfig {
 
         // build the host list
         let mut hosts = vec![];
+        let mut interner = ProcessInterner::default();
         for (name, host_options) in &config.hosts {
             let mut new_hosts = build_host(
                 config,
@@ -57,6 +60,7 @@ impl SimConfig {
                 name,
                 randomness_for_seed_calc,
                 hosts_to_debug,
+                &mut interner,
             )
             .with_context(|| format!("Failed to configure host '{name}'"))?;
             hosts.append(&mut new_hosts);
@@ -68,10 +72,10 @@ impl SimConfig {
         }
 
         // load and parse the network graph
-        let graph: String = load_network_graph(config.network.graph.as_ref().unwrap())
+        let graph = load_network_graph(config.network.graph.as_ref().unwrap())
             .map_err(|e| anyhow::anyhow!(e))
             .context("Failed to load the network graph")?;
-        let graph = NetworkGraph::parse(&graph)
+        let graph = NetworkGraph::from_reader(graph)
             .map_err(|e| anyhow::anyhow!(e))
             .context("Failed to parse the network graph")?;
 
@@ -133,6 +137,11 @@ impl SimConfig {
             &graph,
             &ip_assignment.get_nodes(),
             config.network.use_shortest_path.unwrap(),
+            config
+                .experimental
+                .routing_cache_directory
+                .flatten_ref()
+                .map(|x| tilde_expansion(x)),
         )?;
 
         // get all host bandwidths
@@ -162,7 +171,8 @@ impl SimConfig {
 #[derive(Clone)]
 pub struct HostInfo {
     pub name: String,
-    pub processes: Vec<ProcessInfo>,
+    /// Shared by all hosts that were created from the same host options.
+    pub processes: Arc<[ProcessInfo]>,
     pub seed: u64,
     pub network_node_id: u32,
     pub pause_for_debugging: bool,
@@ -174,9 +184,13 @@ pub struct HostInfo {
     pub log_level: Option<LogLevel>,
     pub pcap_dir: Option<PathBuf>,
     pub pcap_capture_size: u64,
+    pub pcap_filter: Option<Arc<PcapFilter>>,
+    pub pcap_flow_packet_limit: Option<u32>,
+    pub pcap_sample_probability: f64,
     pub heartbeat_log_level: Option<LogLevel>,
     pub heartbeat_log_info: HashSet<LogInfoFlag>,
     pub heartbeat_interval: Option<SimulationTime>,
+    pub heartbeat_format: HeartbeatFormat,
     pub send_buf_size: u64,
     pub recv_buf_size: u64,
     pub autotune_send_buf: bool,
@@ -186,11 +200,56 @@ pub struct HostInfo {
 
 #[derive(Clone)]
 pub struct ProcessInfo {
-    pub plugin: PathBuf,
+    pub plugin: Arc<Path>,
     pub start_time: SimulationTime,
     pub stop_time: Option<SimulationTime>,
-    pub args: Vec<OsString>,
-    pub env: String,
+    pub args: Arc<[OsString]>,
+    pub env: Arc<str>,
+}
+
+/// Deduplicates process data between hosts, so that hosts running the same processes share a
+/// single copy of each plugin path, argument list, and environment, and each plugin path is only
+/// resolved once.
+#[derive(Default)]
+struct ProcessInterner {
+    /// Resolved plugin paths, keyed by the path given in the configuration.
+    plugins: HashMap<PathBuf, Arc<Path>>,
+    args: HashSet<Arc<[OsString]>>,
+    envs: HashSet<Arc<str>>,
+}
+
+impl ProcessInterner {
+    fn plugin(
+        &mut self,
+        path: &Path,
+        resolve: impl FnOnce() -> anyhow::Result<PathBuf>,
+    ) -> anyhow::Result<Arc<Path>> {
+        if let Some(x) = self.plugins.get(path) {
+            return Ok(Arc::clone(x));
+        }
+        let resolved: Arc<Path> = resolve()?.into();
+        self.plugins
+            .insert(path.to_path_buf(), Arc::clone(&resolved));
+        Ok(resolved)
+    }
+
+    fn args(&mut self, args: Vec<OsString>) -> Arc<[OsString]> {
+        if let Some(x) = self.args.get(args.as_slice()) {
+            return Arc::clone(x);
+        }
+        let args: Arc<[OsString]> = args.into();
+        self.args.insert(Arc::clone(&args));
+        args
+    }
+
+    fn env(&mut self, env: &str) -> Arc<str> {
+        if let Some(x) = self.envs.get(env) {
+            return Arc::clone(x);
+        }
+        let env: Arc<str> = env.into();
+        self.envs.insert(Arc::clone(&env));
+        env
+    }
 }
 
 #[derive(Debug, Clone)]
@@ -206,6 +265,7 @@ fn build_host(
     hostname: &str,
     randomness_for_seed_calc: u64,
     hosts_to_debug: &HashSet<String>,
+    interner: &mut ProcessInterner,
 ) -> anyhow::Result<Vec<HostInfo>> {
     let quantity = *host.quantity;
 
@@ -217,6 +277,32 @@ fn build_host(
         ));
     }
 
+    // all hosts created from these host options run the same processes
+    let mut processes = vec![];
+    for proc in &host.processes {
+        let mut new_processes = build_process(proc, interner)
+            .with_context(|| format!("Failed to configure process '{}'", proc.path.display()))?;
+        processes.append(&mut new_processes);
+    }
+    let processes: Arc<[ProcessInfo]> = processes.into();
+
+    // all hosts created from these host options share the same capture filter
+    let pcap_filter = host
+        .options
+        .pcap_filter
+        .flatten_ref()
+        .map(|x| x.parse::<PcapFilter>().map_err(|e| anyhow::anyhow!(e)))
+        .transpose()
+        .context("Failed to parse the pcap filter")?
+        .map(Arc::new);
+
+    let pcap_sample_probability = host.options.pcap_sample_probability.unwrap();
+    if !(0.0..=1.0).contains(&pcap_sample_probability) {
+        return Err(anyhow::anyhow!(
+            "The pcap sample probability {pcap_sample_probability} is not between 0 and 1",
+        ));
+    }
+
     let mut hosts = Vec::with_capacity(quantity.try_into().unwrap());
 
     for host_index in 0..quantity {
@@ -235,17 +321,9 @@ fn build_host(
 
         let pause_for_debugging = hosts_to_debug.contains(&hostname);
 
-        let mut processes = vec![];
-        for proc in &host.processes {
-            let mut new_processes = build_process(proc).with_context(|| {
-                format!("Failed to configure process '{}'", proc.path.display())
-            })?;
-            processes.append(&mut new_processes);
-        }
-
         hosts.push(HostInfo {
             name: hostname,
-            processes,
+            processes: Arc::clone(&processes),
 
             seed: randomness_for_seed_calc ^ hostname_hash,
             network_node_id: host.network_node_id,
@@ -275,6 +353,9 @@ fn build_host(
                 .convert(units::SiPrefixUpper::Base)
                 .unwrap()
                 .value(),
+            pcap_filter: pcap_filter.clone(),
+            pcap_flow_packet_limit: host.options.pcap_flow_packet_limit.flatten(),
+            pcap_sample_probability,
 
             // some options come from the config options and not the host options
             heartbeat_log_level: config.experimental.host_heartbeat_log_level,
@@ -288,6 +369,7 @@ fn build_host(
                 .host_heartbeat_interval
                 .flatten()
                 .map(|x| Duration::from(x).try_into().unwrap()),
+            heartbeat_format: config.experimental.host_heartbeat_format.unwrap(),
             send_buf_size: config
                 .experimental
                 .socket_send_buffer
@@ -312,7 +394,10 @@ fn build_host(
 }
 
 /// For a process entry in the configuration options, build a list of `ProcessInfo` objects.
-fn build_process(proc: &ProcessOptions) -> anyhow::Result<Vec<ProcessInfo>> {
+fn build_process(
+    proc: &ProcessOptions,
+    interner: &mut ProcessInterner,
+) -> anyhow::Result<Vec<ProcessInfo>> {
     let start_time = Duration::from(proc.start_time).try_into().unwrap();
     let stop_time = proc
         .stop_time
@@ -337,6 +422,27 @@ fn build_process(proc: &ProcessOptions) -> anyhow::Result<Vec<ProcessInfo>> {
 
     let expanded_path = tilde_expansion(proc.path.to_str().unwrap());
 
+    let canonical_path = interner.plugin(&proc.path, || {
+        resolve_plugin_path(&proc.path, &expanded_path)
+    })?;
+
+    // set argv[0] as the user-provided expanded string, not the canonicalized version
+    args.insert(0, expanded_path.into());
+
+    Ok(vec![
+        ProcessInfo {
+            plugin: canonical_path,
+            start_time,
+            stop_time,
+            args: interner.args(args),
+            env: interner.env(&proc.environment),
+        };
+        (*proc.quantity).try_into().unwrap()
+    ])
+}
+
+/// Find the binary that the plugin path given in the configuration refers to.
+fn resolve_plugin_path(path: &Path, expanded_path: &Path) -> anyhow::Result<PathBuf> {
     // We currently use `which::which`, which searches the `PATH` similarly to a
     // shell.
     let new_canonical_path: Result<PathBuf, anyhow::Error> = which::which(&expanded_path)
@@ -363,7 +469,7 @@ fn build_process(proc: &ProcessOptions) -> anyhow::Result<Vec<ProcessInfo>> {
     } else if let Ok(p) = new_canonical_path.as_ref() {
         p
     } else if let Ok(p) = legacy_canonical_path.as_ref() {
-        warn!("Expanded path {:?} only via legacy fallback search, which implicitly searched current working dir. Consider prefixing with './'", proc.path.to_str().unwrap());
+        warn!("Expanded path {:?} only via legacy fallback search, which implicitly searched current working dir. Consider prefixing with './'", path.to_str().unwrap());
         p
     } else {
         return Err(new_canonical_path
@@ -373,25 +479,9 @@ fn build_process(proc: &ProcessOptions) -> anyhow::Result<Vec<ProcessInfo>> {
 
     verify_plugin_path(&canonical_path)
         .with_context(|| format!("Failed to verify plugin path '{:?}'", canonical_path))?;
-    log::info!(
-        "Resolved binary path {:?} to {:?}",
-        proc.path,
-        canonical_path
-    );
+    log::info!("Resolved binary path {:?} to {:?}", path, canonical_path);
 
-    // set argv[0] as the user-provided expanded string, not the canonicalized version
-    args.insert(0, expanded_path.into());
-
-    Ok(vec![
-        ProcessInfo {
-            plugin: canonical_path.clone(),
-            start_time,
-            stop_time,
-            args: args,
-            env: proc.environment.clone(),
-        };
-        (*proc.quantity).try_into().unwrap()
-    ])
+    Ok(canonical_path.clone())
 }
 
 /// Generate an IP assignment map using hosts' configured IP addresses and graph node IDs. For hosts
@@ -420,43 +510,63 @@ fn assign_ips(hosts: &mut Vec<HostInfo>) -> anyhow::Result<IpAssignment<u32>> {
 }
 
 /// Generate a map containing routing information (latency, packet loss, etc) for each pair of
-/// nodes.
+/// nodes. If `cache_dir` is set, previously generated routing information for the same graph and
+/// nodes is loaded from the directory, and new routing information is written to it.
 fn generate_routing_info(
     graph: &NetworkGraph,
     nodes: &std::collections::HashSet<u32>,
     use_shortest_paths: bool,
+    cache_dir: Option<PathBuf>,
 ) -> anyhow::Result<RoutingInfo<u32>> {
+    // sort the nodes so that the cache key doesn't depend on the hash set's order
+    let mut node_ids: Vec<u32> = nodes.iter().copied().collect();
+    node_ids.sort_unstable();
+
+    let cache = cache_dir.map(|dir| {
+        let key = routing::CacheKey::new(graph, &node_ids, use_shortest_paths);
+        let path = dir.join(format!("routing-{:016x}.bin", key.hash()));
+        (path, key)
+    });
+
+    if let Some((cache_path, key)) = &cache {
+        match routing::read_cache(cache_path, key, &node_ids) {
+            Ok(paths) => {
+                info!("Loaded routing information from {cache_path:?}");
+                return Ok(RoutingInfo::new(paths));
+            }
+            Err(e) if e.kind() == std::io::ErrorKind::NotFound => {}
+            Err(e) => warn!("Ignoring the routing cache file {cache_path:?}: {e}"),
+        }
+    }
+
     // convert gml node IDs to petgraph indexes
-    let nodes: Vec<_> = nodes
+    let nodes: Vec<_> = node_ids
         .iter()
         .map(|x| *graph.node_id_to_index(*x).unwrap())
         .collect();
 
-    // helper to convert petgraph indexes back to gml node IDs
-    let to_ids = |((src, dst), path)| {
-        let src = graph.node_index_to_id(src).unwrap();
-        let dst = graph.node_index_to_id(dst).unwrap();
-        ((src, dst), path)
-    };
-
     let paths = if use_shortest_paths {
         graph
             .compute_shortest_paths(&nodes[..])
             .map_err(|e| anyhow::anyhow!(e))
             .context("Failed to compute shortest paths between graph nodes")?
-            .into_iter()
-            .map(to_ids)
-            .collect()
     } else {
         graph
             .get_direct_paths(&nodes[..])
             .map_err(|e| anyhow::anyhow!(e))
             .context("Failed to get the direct paths between graph nodes")?
-            .into_iter()
-            .map(to_ids)
-            .collect()
     };
 
+    // convert petgraph indexes back to gml node IDs
+    let paths = paths.map_nodes(|x| graph.node_index_to_id(x).unwrap());
+
+    if let Some((cache_path, key)) = &cache {
+        match routing::write_cache(cache_path, key, &paths) {
+            Ok(()) => info!("Saved routing information to {cache_path:?}"),
+            Err(e) => warn!("Failed to write the routing cache file {cache_path:?}: {e}"),
+        }
+    }
+
     Ok(RoutingInfo::new(paths))
 }
 
@@ -1,43 +1,421 @@
 use std::cell::RefCell;
+use std::collections::BTreeMap;
+use std::ffi::CStr;
+use std::sync::atomic::{AtomicPtr, Ordering};
 use std::sync::Mutex;
 
-use crate::utility::counter::Counter;
+use crate::utility::counter::{Counter, IndexedCounter};
 
 use anyhow::Context;
 use serde::Serialize;
+use shadow_tsc::Tsc;
+
+/// The types of objects whose allocations and deallocations are counted.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+#[repr(C)]
+pub enum ObjectType {
+    Epoll,
+    Event,
+    Futex,
+    FutexTable,
+    LegacyDescriptor,
+    ManagedThread,
+    NetworkInterface,
+    Packet,
+    Payload,
+    Process,
+    RegularFile,
+    Router,
+    StatusListener,
+    SysCallCondition,
+    SysCallHandler,
+    TaskRef,
+    Tcp,
+    Timer,
+    TimerFd,
+    Udp,
+}
+
+impl ObjectType {
+    /// All object types, in the order of their discriminants.
+    const ALL: [Self; 20] = [
+        Self::Epoll,
+        Self::Event,
+        Self::Futex,
+        Self::FutexTable,
+        Self::LegacyDescriptor,
+        Self::ManagedThread,
+        Self::NetworkInterface,
+        Self::Packet,
+        Self::Payload,
+        Self::Process,
+        Self::RegularFile,
+        Self::Router,
+        Self::StatusListener,
+        Self::SysCallCondition,
+        Self::SysCallHandler,
+        Self::TaskRef,
+        Self::Tcp,
+        Self::Timer,
+        Self::TimerFd,
+        Self::Udp,
+    ];
+
+    pub const COUNT: usize = Self::ALL.len();
+
+    /// The name used when the object counts are output.
+    pub fn name(&self) -> &'static str {
+        match self {
+            Self::Epoll => "Epoll",
+            Self::Event => "Event",
+            Self::Futex => "Futex",
+            Self::FutexTable => "FutexTable",
+            Self::LegacyDescriptor => "LegacyDescriptor",
+            Self::ManagedThread => "ManagedThread",
+            Self::NetworkInterface => "NetworkInterface",
+            Self::Packet => "Packet",
+            Self::Payload => "Payload",
+            Self::Process => "Process",
+            Self::RegularFile => "RegularFile",
+            Self::Router => "Router",
+            Self::StatusListener => "StatusListener",
+            Self::SysCallCondition => "SysCallCondition",
+            Self::SysCallHandler => "SysCallHandler",
+            Self::TaskRef => "TaskRef",
+            Self::Tcp => "TCP",
+            Self::Timer => "Timer",
+            Self::TimerFd => "TimerFd",
+            Self::Udp => "UDP",
+        }
+    }
+}
+
+/// Counts of objects, indexed by [`ObjectType`].
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct ObjectCounts(IndexedCounter<{ ObjectType::COUNT }>);
+
+impl ObjectCounts {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn add_one(&mut self, object_type: ObjectType) {
+        self.0.add_one(object_type as usize);
+    }
+
+    pub fn add_counter(&mut self, other: &Self) {
+        self.0.add_counter(&other.0);
+    }
+
+    pub fn to_counter(&self) -> Counter {
+        self.0.to_counter(|x| ObjectType::ALL[x].name().to_string())
+    }
+}
+
+impl std::fmt::Display for ObjectCounts {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        self.to_counter().fmt(f)
+    }
+}
+
+/// Syscall numbers less than this can be counted. Shadow's own syscalls start at 1000.
+const MAX_COUNTED_SYSCALL: usize = 1024;
+
+/// The names of counted syscalls, indexed by syscall number. Each name is registered the first
+/// time that a [`SyscallCounter`] counts the syscall, and is only looked up when the counts are
+/// output.
+static SYSCALL_NAMES: [AtomicPtr<libc::c_char>; MAX_COUNTED_SYSCALL] = {
+    #[allow(clippy::declare_interior_mutable_const)]
+    const NULL: AtomicPtr<libc::c_char> = AtomicPtr::new(std::ptr::null_mut());
+    [NULL; MAX_COUNTED_SYSCALL]
+};
+
+fn register_syscall_name(num: usize, name: &'static CStr) {
+    SYSCALL_NAMES[num].store(name.as_ptr().cast_mut(), Ordering::Relaxed);
+}
+
+fn syscall_name(num: usize) -> String {
+    let name = SYSCALL_NAMES[num].load(Ordering::Relaxed);
+    if name.is_null() {
+        return format!("syscall_{num}");
+    }
+    unsafe { CStr::from_ptr(name) }
+        .to_string_lossy()
+        .into_owned()
+}
+
+/// Counts of syscalls, indexed by syscall number.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct SyscallCounter(IndexedCounter<MAX_COUNTED_SYSCALL>);
+
+impl SyscallCounter {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Count the syscall `num`, which has the name `name`.
+    pub fn add_one(&mut self, num: usize, name: &'static CStr) {
+        if num >= MAX_COUNTED_SYSCALL {
+            debug_panic!("Syscall number {num} is too large to count");
+        } else if self.0.add_one(num) == 1 {
+            // the name only needs to be registered once, but it's cheap to store again
+            register_syscall_name(num, name);
+        }
+    }
+
+    pub fn add_counter(&mut self, other: &Self) {
+        self.0.add_counter(&other.0);
+    }
+
+    pub fn to_counter(&self) -> Counter {
+        self.0.to_counter(syscall_name)
+    }
+}
+
+impl std::fmt::Display for SyscallCounter {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        self.to_counter().fmt(f)
+    }
+}
+
+fn cycles_to_nanos(cycles: u64, cycles_per_second: u64) -> u64 {
+    (u128::from(cycles) * 1_000_000_000 / u128::from(cycles_per_second.max(1)))
+        .try_into()
+        .unwrap_or(u64::MAX)
+}
+
+/// The number of buckets in a [`LatencyHistogram`]. The last bucket also counts all longer
+/// durations.
+const LATENCY_BUCKETS: usize = 40;
+
+/// A histogram of wall-clock durations, measured in native TSC cycles. Bucket `i` counts durations
+/// in `[2^i, 2^(i+1))` cycles, and bucket 0 also counts durations of 0 cycles.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct LatencyHistogram {
+    count: u64,
+    total_cycles: u64,
+    buckets: [u64; LATENCY_BUCKETS],
+}
+
+impl LatencyHistogram {
+    pub fn new() -> Self {
+        Self {
+            count: 0,
+            total_cycles: 0,
+            buckets: [0; LATENCY_BUCKETS],
+        }
+    }
+
+    pub fn record(&mut self, cycles: u64) {
+        let bucket = (u64::BITS - 1 - (cycles | 1).leading_zeros()) as usize;
+        self.buckets[std::cmp::min(bucket, LATENCY_BUCKETS - 1)] += 1;
+        self.count += 1;
+        self.total_cycles = self.total_cycles.saturating_add(cycles);
+    }
+
+    pub fn add(&mut self, other: &Self) {
+        for (x, y) in self.buckets.iter_mut().zip(other.buckets.iter()) {
+            *x += y;
+        }
+        self.count += other.count;
+        self.total_cycles = self.total_cycles.saturating_add(other.total_cycles);
+    }
+
+    fn to_output(&self, cycles_per_second: u64) -> LatencyHistogramForOutput {
+        let to_nanos = |cycles| cycles_to_nanos(cycles, cycles_per_second);
+
+        let mut buckets = BTreeMap::new();
+        for (i, count) in self.buckets.iter().enumerate() {
+            if *count != 0 {
+                let min_cycles = if i == 0 { 0 } else { 1 << i };
+                *buckets.entry(to_nanos(min_cycles)).or_insert(0) += count;
+            }
+        }
+
+        LatencyHistogramForOutput {
+            count: self.count,
+            total_nanos: to_nanos(self.total_cycles),
+            buckets,
+        }
+    }
+}
+
+impl Default for LatencyHistogram {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Wall-clock latencies of a host's syscalls (the time Shadow spent handling them) and of its IPC
+/// round trips with managed threads.
+#[derive(Debug, Clone, Default)]
+pub struct SyscallLatencies {
+    /// Indexed by syscall number. The index of the syscall's histogram in `syscalls` plus one, or
+    /// 0 if the syscall has no histogram.
+    index: Vec<u16>,
+    syscalls: Vec<(usize, LatencyHistogram)>,
+    ipc: LatencyHistogram,
+}
+
+impl SyscallLatencies {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    fn syscall_histogram(&mut self, num: usize) -> &mut LatencyHistogram {
+        if self.index.len() <= num {
+            self.index.resize(num + 1, 0);
+        }
+
+        if self.index[num] == 0 {
+            self.syscalls.push((num, LatencyHistogram::new()));
+            self.index[num] = self.syscalls.len().try_into().unwrap();
+        }
+
+        &mut self.syscalls[usize::from(self.index[num]) - 1].1
+    }
+
+    /// Record that Shadow spent `cycles` handling the syscall `num`, which has the name `name`.
+    pub fn record_syscall(&mut self, num: usize, name: &'static CStr, cycles: u64) {
+        if num >= MAX_COUNTED_SYSCALL {
+            debug_panic!("Syscall number {num} is too large to record");
+        } else {
+            if self.index.get(num).copied().unwrap_or(0) == 0 {
+                register_syscall_name(num, name);
+            }
+            self.syscall_histogram(num).record(cycles);
+        }
+    }
+
+    /// Record an IPC round trip with a managed thread that took `cycles`.
+    pub fn record_ipc(&mut self, cycles: u64) {
+        self.ipc.record(cycles);
+    }
+
+    fn syscall_cycles(&self) -> u64 {
+        self.syscalls.iter().map(|(_, x)| x.total_cycles).sum()
+    }
+
+    /// The syscall that Shadow spent the most time handling.
+    fn top_syscall(&self) -> Option<usize> {
+        self.syscalls
+            .iter()
+            .max_by_key(|(_, x)| x.total_cycles)
+            .map(|(num, _)| *num)
+    }
+
+    pub fn add(&mut self, other: &Self) {
+        for (num, histogram) in &other.syscalls {
+            self.syscall_histogram(*num).add(histogram);
+        }
+        self.ipc.add(&other.ipc);
+    }
+
+    fn to_output(&self, cycles_per_second: u64) -> SyscallLatenciesForOutput {
+        SyscallLatenciesForOutput {
+            syscalls: self
+                .syscalls
+                .iter()
+                .map(|(num, x)| (syscall_name(*num), x.to_output(cycles_per_second)))
+                .collect(),
+            ipc_round_trip: self.ipc.to_output(cycles_per_second),
+        }
+    }
+}
+
+/// Syscall latencies for each host and for the whole simulation.
+#[derive(Debug, Default)]
+pub struct SyscallLatencyStats {
+    global: SyscallLatencies,
+    hosts: BTreeMap<String, SyscallLatencies>,
+}
+
+impl SyscallLatencyStats {
+    pub fn add_host(&mut self, name: &str, latencies: SyscallLatencies) {
+        self.global.add(&latencies);
+        self.hosts
+            .entry(name.to_string())
+            .or_default()
+            .add(&latencies);
+    }
+}
+
+/// Wall-clock and CPU time used by a host, collected when the host shuts down.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct HostProfile {
+    /// Native TSC cycles spent executing the host's events, including the time spent waiting for
+    /// its managed threads.
+    pub execution_cycles: u64,
+    /// CPU time used by the host's plugin processes while they had control. Only measured with
+    /// `experimental.use_plugin_cpu_time`.
+    pub plugin_cpu_nanos: u64,
+}
+
+/// The number of hosts to show in the table logged by [`write_stats_to_file`].
+const HOST_PROFILE_TABLE_LEN: usize = 10;
 
 /// Simulation statistics to be accessed by a single thread.
 #[derive(Debug)]
 pub struct LocalSimStats {
-    pub alloc_counts: RefCell<Counter>,
-    pub dealloc_counts: RefCell<Counter>,
-    pub syscall_counts: RefCell<Counter>,
+    pub alloc_counts: RefCell<ObjectCounts>,
+    pub dealloc_counts: RefCell<ObjectCounts>,
+    pub syscall_counts: RefCell<SyscallCounter>,
 }
 
 impl LocalSimStats {
     pub fn new() -> Self {
         Self {
-            alloc_counts: RefCell::new(Counter::new()),
-            dealloc_counts: RefCell::new(Counter::new()),
-            syscall_counts: RefCell::new(Counter::new()),
+            alloc_counts: RefCell::new(ObjectCounts::new()),
+            dealloc_counts: RefCell::new(ObjectCounts::new()),
+            syscall_counts: RefCell::new(SyscallCounter::new()),
         }
     }
 }
 
+/// Wall-clock time spent in each phase of the simulation startup.
+#[derive(Serialize, Clone, Debug, Default)]
+pub struct StartupStats {
+    /// When Shadow started running.
+    #[serde(skip)]
+    pub shadow_start: Option<std::time::Instant>,
+    /// Shadow's resident memory when it started running.
+    #[serde(skip)]
+    pub shadow_start_rss_bytes: Option<u64>,
+    /// Loading the network graph and computing the routing information.
+    pub sim_config_secs: f64,
+    /// Growth in resident memory from when Shadow started until the simulation config was built,
+    /// which includes parsing the configuration file.
+    pub config_rss_bytes: u64,
+    /// Building the hosts and adding their processes.
+    pub host_build_secs: f64,
+    /// Growth in resident memory while building the hosts.
+    pub host_build_rss_bytes: u64,
+    /// Booting the hosts.
+    pub host_boot_secs: f64,
+    /// From when Shadow started until the first scheduling round.
+    pub total_secs: f64,
+}
+
 /// Simulation statistics to be accessed by multiple threads.
 #[derive(Debug)]
 pub struct SharedSimStats {
-    pub alloc_counts: Mutex<Counter>,
-    pub dealloc_counts: Mutex<Counter>,
-    pub syscall_counts: Mutex<Counter>,
+    pub alloc_counts: Mutex<ObjectCounts>,
+    pub dealloc_counts: Mutex<ObjectCounts>,
+    pub syscall_counts: Mutex<SyscallCounter>,
+    pub syscall_latencies: Mutex<SyscallLatencyStats>,
+    pub host_profiles: Mutex<BTreeMap<String, HostProfile>>,
+    pub startup: Mutex<StartupStats>,
 }
 
 impl SharedSimStats {
     pub fn new() -> Self {
         Self {
-            alloc_counts: Mutex::new(Counter::new()),
-            dealloc_counts: Mutex::new(Counter::new()),
-            syscall_counts: Mutex::new(Counter::new()),
+            alloc_counts: Mutex::new(ObjectCounts::new()),
+            dealloc_counts: Mutex::new(ObjectCounts::new()),
+            syscall_counts: Mutex::new(SyscallCounter::new()),
+            syscall_latencies: Mutex::new(SyscallLatencyStats::default()),
+            host_profiles: Mutex::new(BTreeMap::new()),
+            startup: Mutex::new(StartupStats::default()),
         }
     }
 
@@ -55,9 +433,9 @@ impl SharedSimStats {
         shared_dealloc_counts.add_counter(&local_dealloc_counts);
         shared_syscall_counts.add_counter(&local_syscall_counts);
 
-        *local_alloc_counts = Counter::new();
-        *local_dealloc_counts = Counter::new();
-        *local_syscall_counts = Counter::new();
+        *local_alloc_counts = ObjectCounts::new();
+        *local_dealloc_counts = ObjectCounts::new();
+        *local_syscall_counts = SyscallCounter::new();
     }
 }
 
@@ -66,6 +444,10 @@ impl SharedSimStats {
 struct SimStatsForOutput {
     pub objects: ObjectStatsForOutput,
     pub syscalls: Counter,
+    pub syscall_latency: SyscallLatencyStatsForOutput,
+    /// Hosts ordered from the most to the least execution time.
+    pub host_profile: Vec<HostProfileForOutput>,
+    pub startup: StartupStats,
 }
 
 #[derive(Serialize, Clone, Debug)]
@@ -74,22 +456,135 @@ struct ObjectStatsForOutput {
     pub dealloc_counts: Counter,
 }
 
+#[derive(Serialize, Clone, Debug)]
+struct SyscallLatencyStatsForOutput {
+    /// The measured native TSC rate, used to convert cycles to nanoseconds.
+    pub tsc_cycles_per_second: u64,
+    pub global: SyscallLatenciesForOutput,
+    pub hosts: BTreeMap<String, SyscallLatenciesForOutput>,
+}
+
+#[derive(Serialize, Clone, Debug)]
+struct SyscallLatenciesForOutput {
+    pub syscalls: BTreeMap<String, LatencyHistogramForOutput>,
+    pub ipc_round_trip: LatencyHistogramForOutput,
+}
+
+#[derive(Serialize, Clone, Debug)]
+struct LatencyHistogramForOutput {
+    pub count: u64,
+    pub total_nanos: u64,
+    /// The number of durations in each non-empty bucket, keyed by the bucket's lower bound in
+    /// nanoseconds.
+    pub buckets: BTreeMap<u64, u64>,
+}
+
+#[derive(Serialize, Clone, Debug)]
+struct HostProfileForOutput {
+    pub hostname: String,
+    /// Wall-clock time spent executing the host's events.
+    pub execution_nanos: u64,
+    /// Execution time not spent waiting for the host's managed threads.
+    pub shadow_nanos: u64,
+    /// Wall-clock time spent handling the host's syscalls. Part of `shadow_nanos`.
+    pub syscall_nanos: u64,
+    /// Wall-clock time spent waiting for the host's managed threads.
+    pub ipc_wait_nanos: u64,
+    /// CPU time used by the host's plugin processes while they had control, not including time
+    /// spent spinning while waiting for Shadow. Zero unless `experimental.use_plugin_cpu_time` is
+    /// enabled.
+    pub plugin_cpu_nanos: u64,
+    /// The syscall that Shadow spent the most time handling.
+    pub top_syscall: Option<String>,
+}
+
+impl HostProfileForOutput {
+    fn new(
+        hostname: &str,
+        profile: &HostProfile,
+        latencies: Option<&SyscallLatencies>,
+        cycles_per_second: u64,
+    ) -> Self {
+        let to_nanos = |cycles| cycles_to_nanos(cycles, cycles_per_second);
+        let syscall_cycles = latencies.map(|x| x.syscall_cycles()).unwrap_or(0);
+        let ipc_cycles = latencies.map(|x| x.ipc.total_cycles).unwrap_or(0);
+
+        Self {
+            hostname: hostname.to_string(),
+            execution_nanos: to_nanos(profile.execution_cycles),
+            shadow_nanos: to_nanos(profile.execution_cycles.saturating_sub(ipc_cycles)),
+            syscall_nanos: to_nanos(syscall_cycles),
+            ipc_wait_nanos: to_nanos(ipc_cycles),
+            plugin_cpu_nanos: profile.plugin_cpu_nanos,
+            top_syscall: latencies.and_then(|x| x.top_syscall()).map(syscall_name),
+        }
+    }
+
+    fn table(profiles: &[Self]) -> String {
+        let ms = |nanos: u64| nanos as f64 / 1_000_000.0;
+
+        let mut table = format!(
+            "{:>4}  {:<24} {:>12} {:>12} {:>12} {:>12} {:>12}  top syscall\n",
+            "rank", "host", "exec (ms)", "shadow (ms)", "syscall (ms)", "ipc (ms)", "plugin (ms)",
+        );
+        for (i, x) in profiles.iter().enumerate() {
+            table.push_str(&format!(
+                "{:>4}  {:<24} {:>12.1} {:>12.1} {:>12.1} {:>12.1} {:>12.1}  {}\n",
+                i + 1,
+                x.hostname,
+                ms(x.execution_nanos),
+                ms(x.shadow_nanos),
+                ms(x.syscall_nanos),
+                ms(x.ipc_wait_nanos),
+                ms(x.plugin_cpu_nanos),
+                x.top_syscall.as_deref().unwrap_or("-"),
+            ));
+        }
+        table
+    }
+}
+
+impl SyscallLatencyStatsForOutput {
+    fn new(stats: &SyscallLatencyStats, cycles_per_second: u64) -> Self {
+        Self {
+            tsc_cycles_per_second: cycles_per_second,
+            global: stats.global.to_output(cycles_per_second),
+            hosts: stats
+                .hosts
+                .iter()
+                .map(|(name, x)| (name.clone(), x.to_output(cycles_per_second)))
+                .collect(),
+        }
+    }
+}
+
 impl SimStatsForOutput {
     /// Takes data from `stats` and puts it into a structure designed for output. May reset fields
     /// of `stats`.
     pub fn new(stats: &SharedSimStats) -> Self {
+        let cycles_per_second =
+            Tsc::measure_native_cycles_per_second(std::time::Duration::from_millis(10));
+        let latencies = std::mem::take(&mut *stats.syscall_latencies.lock().unwrap());
+
+        let mut host_profile: Vec<_> = std::mem::take(&mut *stats.host_profiles.lock().unwrap())
+            .iter()
+            .map(|(name, x)| {
+                HostProfileForOutput::new(name, x, latencies.hosts.get(name), cycles_per_second)
+            })
+            .collect();
+        // a stable sort, so hosts with equal times stay ordered by name
+        host_profile.sort_by(|a, b| b.execution_nanos.cmp(&a.execution_nanos));
+
         Self {
             objects: ObjectStatsForOutput {
-                alloc_counts: std::mem::replace(
-                    &mut stats.alloc_counts.lock().unwrap(),
-                    Counter::new(),
-                ),
-                dealloc_counts: std::mem::replace(
-                    &mut stats.dealloc_counts.lock().unwrap(),
-                    Counter::new(),
-                ),
+                alloc_counts: std::mem::take(&mut *stats.alloc_counts.lock().unwrap()).to_counter(),
+                dealloc_counts: std::mem::take(&mut *stats.dealloc_counts.lock().unwrap())
+                    .to_counter(),
             },
-            syscalls: std::mem::replace(&mut stats.syscall_counts.lock().unwrap(), Counter::new()),
+            syscalls: std::mem::take(&mut *stats.syscall_counts.lock().unwrap()).to_counter(),
+            syscall_latency: SyscallLatencyStatsForOutput::new(&latencies, cycles_per_second),
+            host_profile,
+            startup: std::mem::take(&mut stats.startup.lock().unwrap()),
         }
     }
 }
@@ -101,6 +596,14 @@ pub fn write_stats_to_file(
 ) -> anyhow::Result<()> {
     let stats = SimStatsForOutput::new(stats);
 
+    if !stats.host_profile.is_empty() {
+        let len = std::cmp::min(stats.host_profile.len(), HOST_PROFILE_TABLE_LEN);
+        log::info!(
+            "Top {len} hosts by execution time:\n{}",
+            HostProfileForOutput::table(&stats.host_profile[..len])
+        );
+    }
+
     let file = std::fs::File::create(&filename)
         .with_context(|| format!("Failed to create file '{}'", filename.display()))?;
 
@@ -113,3 +616,187 @@ pub fn write_stats_to_file(
 
     Ok(())
 }
+
+mod export {
+    use super::*;
+    use std::ffi::CString;
+
+    #[no_mangle]
+    pub extern "C" fn syscallcounter_new() -> *mut SyscallCounter {
+        Box::into_raw(Box::new(SyscallCounter::new()))
+    }
+
+    #[no_mangle]
+    pub extern "C" fn syscallcounter_free(counter: *mut SyscallCounter) {
+        if counter.is_null() {
+            return;
+        }
+        drop(unsafe { Box::from_raw(counter) });
+    }
+
+    /// Count the syscall `num`. The syscall's `name` must be a string that's valid for the
+    /// lifetime of the program, such as a string literal.
+    #[no_mangle]
+    pub extern "C" fn syscallcounter_addOne(
+        counter: *mut SyscallCounter,
+        num: libc::c_long,
+        name: *const libc::c_char,
+    ) {
+        assert!(!name.is_null());
+        let counter = unsafe { counter.as_mut() }.unwrap();
+        let name = unsafe { CStr::from_ptr(name) };
+
+        counter.add_one(num.try_into().unwrap(), name);
+    }
+
+    /// Creates a new string representation of the counter, e.g., for logging.
+    /// The returned string must be free'd by passing it to syscallcounter_freeString.
+    #[no_mangle]
+    pub extern "C" fn syscallcounter_allocString(
+        counter: *const SyscallCounter,
+    ) -> *mut libc::c_char {
+        let counter = unsafe { counter.as_ref() }.unwrap();
+        CString::new(counter.to_string()).unwrap().into_raw()
+    }
+
+    /// Frees a string previously returned from syscallcounter_allocString.
+    #[no_mangle]
+    pub extern "C" fn syscallcounter_freeString(ptr: *mut libc::c_char) {
+        assert!(!ptr.is_null());
+        drop(unsafe { CString::from_raw(ptr) });
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_object_type_order() {
+        for (i, x) in ObjectType::ALL.iter().enumerate() {
+            assert_eq!(*x as usize, i);
+        }
+    }
+
+    #[test]
+    fn test_object_counts() {
+        let mut counts = ObjectCounts::new();
+        counts.add_one(ObjectType::Tcp);
+        counts.add_one(ObjectType::Tcp);
+        counts.add_one(ObjectType::Packet);
+        assert_eq!(counts.to_string(), "{TCP:2, Packet:1}");
+    }
+
+    #[test]
+    fn test_syscall_counter() {
+        let mut counter = SyscallCounter::new();
+        counter.add_one(
+            libc::SYS_read as usize,
+            CStr::from_bytes_with_nul(b"read\0").unwrap(),
+        );
+        counter.add_one(
+            libc::SYS_read as usize,
+            CStr::from_bytes_with_nul(b"read\0").unwrap(),
+        );
+        counter.add_one(1005, CStr::from_bytes_with_nul(b"shadow_yield\0").unwrap());
+
+        let mut total = SyscallCounter::new();
+        total.add_counter(&counter);
+        total.add_counter(&counter);
+        assert_eq!(total.to_string(), "{read:4, shadow_yield:2}");
+    }
+
+    #[test]
+    fn test_latency_histogram() {
+        let mut histogram = LatencyHistogram::new();
+        for cycles in [0, 1, 2, 3, 4, 1000, u64::MAX] {
+            histogram.record(cycles);
+        }
+        assert_eq!(histogram.count, 7);
+        assert_eq!(&histogram.buckets[..4], &[2, 2, 1, 0]);
+        // 1000 is in [512, 1024)
+        assert_eq!(histogram.buckets[9], 1);
+        assert_eq!(histogram.buckets[LATENCY_BUCKETS - 1], 1);
+
+        // at 1 GHz, cycles are nanoseconds
+        let output = histogram.to_output(1_000_000_000);
+        assert_eq!(output.total_nanos, u64::MAX);
+        assert_eq!(
+            output.buckets.into_iter().collect::<Vec<_>>(),
+            [
+                (0, 2),
+                (2, 2),
+                (4, 1),
+                (512, 1),
+                (1 << (LATENCY_BUCKETS - 1), 1)
+            ]
+        );
+    }
+
+    #[test]
+    fn test_host_profile() {
+        let read = CStr::from_bytes_with_nul(b"read\0").unwrap();
+        let write = CStr::from_bytes_with_nul(b"write\0").unwrap();
+
+        let mut latencies = SyscallLatencies::new();
+        latencies.record_syscall(libc::SYS_read as usize, read, 10);
+        latencies.record_syscall(libc::SYS_write as usize, write, 50);
+        latencies.record_syscall(libc::SYS_read as usize, read, 30);
+        latencies.record_ipc(200);
+
+        let profile = HostProfile {
+            execution_cycles: 500,
+            plugin_cpu_nanos: 150,
+        };
+
+        // at 1 GHz, cycles are nanoseconds
+        let output = HostProfileForOutput::new("a", &profile, Some(&latencies), 1_000_000_000);
+        assert_eq!(output.execution_nanos, 500);
+        assert_eq!(output.shadow_nanos, 300);
+        assert_eq!(output.syscall_nanos, 90);
+        assert_eq!(output.ipc_wait_nanos, 200);
+        assert_eq!(output.plugin_cpu_nanos, 150);
+        assert_eq!(output.top_syscall.as_deref(), Some("write"));
+
+        let output = HostProfileForOutput::new("b", &profile, None, 1_000_000_000);
+        assert_eq!(output.shadow_nanos, 500);
+        assert_eq!(output.top_syscall, None);
+
+        let table = HostProfileForOutput::table(&[output]);
+        assert_eq!(table.lines().count(), 2);
+        assert!(table
+            .lines()
+            .nth(1)
+            .unwrap()
+            .trim_start()
+            .starts_with("1  b"));
+    }
+
+    #[test]
+    fn test_syscall_latencies() {
+        let read = CStr::from_bytes_with_nul(b"read\0").unwrap();
+        let write = CStr::from_bytes_with_nul(b"write\0").unwrap();
+
+        let mut host_a = SyscallLatencies::new();
+        host_a.record_syscall(libc::SYS_write as usize, write, 100);
+        host_a.record_syscall(libc::SYS_read as usize, read, 10);
+        host_a.record_ipc(1000);
+
+        let mut host_b = SyscallLatencies::new();
+        host_b.record_syscall(libc::SYS_read as usize, read, 20);
+
+        let mut stats = SyscallLatencyStats::default();
+        stats.add_host("a", host_a);
+        stats.add_host("b", host_b);
+
+        let output = stats.global.to_output(1_000_000_000);
+        assert_eq!(output.syscalls["read"].count, 2);
+        assert_eq!(output.syscalls["read"].total_nanos, 30);
+        assert_eq!(output.syscalls["write"].count, 1);
+        assert_eq!(output.ipc_round_trip.count, 1);
+
+        let output = stats.hosts["b"].to_output(1_000_000_000);
+        assert_eq!(output.syscalls.keys().collect::<Vec<_>>(), ["read"]);
+        assert_eq!(output.ipc_round_trip.count, 0);
+    }
+}
@@ -308,6 +308,13 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_object_counters").unwrap().as_str())]
     pub use_object_counters: Option<bool>,
 
+    /// Write log messages from hosts to per-thread binary files in "shadow-log" in the data
+    /// directory instead of to stdout
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_binary_log").unwrap().as_str())]
+    pub use_binary_log: Option<bool>,
+
     /// Preload our libc library for all managed processes for fast syscall interposition when possible.
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
@@ -347,12 +354,47 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_shim_syscall_handler").unwrap().as_str())]
     pub use_shim_syscall_handler: Option<bool>,
 
+    /// Have the shim stage large write, send, and recv buffers in a per-thread shared memory scratch
+    /// area, which Shadow can access in place instead of copying across processes
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_shmem_scratch").unwrap().as_str())]
+    pub use_shmem_scratch: Option<bool>,
+
+    /// Start processes by forking a pre-loaded "zygote" process for each distinct binary, argument
+    /// list, and environment, instead of starting each process with a new exec
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_zygote_launcher").unwrap().as_str())]
+    pub use_zygote_launcher: Option<bool>,
+
     /// Pin each thread and any processes it executes to the same logical CPU Core to improve cache affinity
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
     #[clap(help = EXP_HELP.get("use_cpu_pinning").unwrap().as_str())]
     pub use_cpu_pinning: Option<bool>,
 
+    /// When pinning to CPUs, keep each thread's hosts, shared memory, and processes on the thread's
+    /// NUMA node
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_numa_placement").unwrap().as_str())]
+    pub use_numa_placement: Option<bool>,
+
+    /// Measure the CPU time used by each host's plugin processes, and report it in the host
+    /// profiles in the sim stats
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_plugin_cpu_time").unwrap().as_str())]
+    pub use_plugin_cpu_time: Option<bool>,
+
+    /// Record a timeline of each worker thread's scheduling rounds and write it to
+    /// "scheduler-trace.json" in the Chrome trace event format
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_scheduler_trace").unwrap().as_str())]
+    pub use_scheduler_trace: Option<bool>,
+
     /// If set, overrides the automatically calculated minimum time workers may run ahead when sending events between nodes
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "seconds")]
@@ -420,6 +462,27 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("host_heartbeat_interval").unwrap().as_str())]
     pub host_heartbeat_interval: Option<NullableOption<units::Time<units::TimePrefixUpper>>>,
 
+    /// Write host heartbeats as log messages ("log"), or as rows in CSV files in the data
+    /// directory ("csv")
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "format")]
+    #[clap(help = EXP_HELP.get("host_heartbeat_format").unwrap().as_str())]
+    pub host_heartbeat_format: Option<HeartbeatFormat>,
+
+    /// Write log messages from hosts to separate files for each Shadow thread or for each host,
+    /// rather than to stdout
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "mode")]
+    #[clap(help = EXP_HELP.get("log_sharding").unwrap().as_str())]
+    pub log_sharding: Option<LogSharding>,
+
+    /// Save captured packets to a pcap file for each interface ("pcap"), or to a single pcapng
+    /// file with an interface description block for each interface ("pcapng")
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "format")]
+    #[clap(help = EXP_HELP.get("pcap_format").unwrap().as_str())]
+    pub pcap_format: Option<PcapFormat>,
+
     /// Log the syscalls for each process to individual "strace" files
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "mode")]
@@ -465,6 +528,13 @@ pub struct ExperimentalOptions {
     #[clap(long, value_name = "name")]
     #[clap(help = EXP_HELP.get("scheduler").unwrap().as_str())]
     pub scheduler: Option<Scheduler>,
+
+    /// Directory in which to cache the routing information computed from the network graph, so
+    /// that later simulations with the same graph and host placement can skip computing it
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "path")]
+    #[clap(help = EXP_HELP.get("routing_cache_directory").unwrap().as_str())]
+    pub routing_cache_directory: Option<NullableOption<String>>,
 }
 
 impl ExperimentalOptions {
@@ -482,6 +552,7 @@ impl Default for ExperimentalOptions {
             use_explicit_block_message: Some(false),
             use_syscall_counters: Some(true),
             use_object_counters: Some(true),
+            use_binary_log: Some(false),
             use_preload_libc: Some(true),
             use_preload_openssl_rng: Some(true),
             use_preload_openssl_crypto: Some(false),
@@ -496,7 +567,12 @@ impl Default for ExperimentalOptions {
             unblocked_vdso_latency: Some(units::Time::new(10, units::TimePrefix::Nano)),
             use_memory_manager: Some(true),
             use_shim_syscall_handler: Some(true),
+            use_shmem_scratch: Some(false),
+            use_zygote_launcher: Some(false),
             use_cpu_pinning: Some(true),
+            use_numa_placement: Some(false),
+            use_plugin_cpu_time: Some(false),
+            use_scheduler_trace: Some(false),
             runahead: Some(NullableOption::Value(units::Time::new(
                 1,
                 units::TimePrefix::Milli,
@@ -514,9 +590,13 @@ impl Default for ExperimentalOptions {
                 1,
                 units::TimePrefixUpper::Sec,
             ))),
+            host_heartbeat_format: Some(HeartbeatFormat::Log),
+            log_sharding: Some(LogSharding::Off),
+            pcap_format: Some(PcapFormat::Pcap),
             strace_logging_mode: Some(StraceLoggingMode::Off),
             use_extended_yaml: Some(false),
             scheduler: Some(Scheduler::ThreadPerCore),
+            routing_cache_directory: Some(NullableOption::Null),
         }
     }
 }
@@ -546,6 +626,22 @@ pub struct HostDefaultOptions {
     #[clap(long, value_name = "bytes")]
     #[clap(help = HOST_HELP.get("pcap_capture_size").unwrap().as_str())]
     pub pcap_capture_size: Option<units::Bytes<units::SiPrefixUpper>>,
+
+    /// Only capture packets that match this filter expression if pcap logging is enabled (ex:
+    /// `tcp and port 80`)
+    #[clap(long, value_name = "filter")]
+    #[clap(help = HOST_HELP.get("pcap_filter").unwrap().as_str())]
+    pub pcap_filter: Option<NullableOption<String>>,
+
+    /// Only capture the first N packets of each flow if pcap logging is enabled
+    #[clap(long, value_name = "N")]
+    #[clap(help = HOST_HELP.get("pcap_flow_packet_limit").unwrap().as_str())]
+    pub pcap_flow_packet_limit: Option<NullableOption<u32>>,
+
+    /// The probability of capturing each packet if pcap logging is enabled
+    #[clap(long, value_name = "probability")]
+    #[clap(help = HOST_HELP.get("pcap_sample_probability").unwrap().as_str())]
+    pub pcap_sample_probability: Option<f64>,
 }
 
 impl HostDefaultOptions {
@@ -554,6 +650,9 @@ impl HostDefaultOptions {
             log_level: None,
             pcap_directory: None,
             pcap_capture_size: None,
+            pcap_filter: None,
+            pcap_flow_packet_limit: None,
+            pcap_sample_probability: None,
         }
     }
 
@@ -573,6 +672,9 @@ impl Default for HostDefaultOptions {
             // capture all the data available from the packet". The maximum length of an IP packet
             // (including the header) is 65535 bytes.
             pcap_capture_size: Some(units::Bytes::new(65535, units::SiPrefixUpper::Base)),
+            pcap_filter: None,
+            pcap_flow_packet_limit: None,
+            pcap_sample_probability: Some(1.0),
         }
     }
 }
@@ -632,7 +734,7 @@ pub struct HostOptions {
     pub options: HostDefaultOptions,
 }
 
-#[derive(Debug, Copy, Clone, Serialize, Deserialize, JsonSchema)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash, Serialize, Deserialize, JsonSchema)]
 #[serde(rename_all = "lowercase")]
 pub enum LogLevel {
     Error,
@@ -679,6 +781,7 @@ impl From<LogLevel> for log::Level {
 pub enum Scheduler {
     ThreadPerHost,
     ThreadPerCore,
+    ThreadPerCoreLpt,
 }
 
 impl FromStr for Scheduler {
@@ -857,6 +960,7 @@ pub enum StraceLoggingMode {
     Off,
     Standard,
     Deterministic,
+    Deferred,
 }
 
 impl FromStr for StraceLoggingMode {
@@ -867,6 +971,52 @@ impl FromStr for StraceLoggingMode {
     }
 }
 
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "snake_case")]
+pub enum LogSharding {
+    Off,
+    Thread,
+    Host,
+}
+
+impl FromStr for LogSharding {
+    type Err = serde_yaml::Error;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        serde_yaml::from_str(s)
+    }
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "snake_case")]
+pub enum HeartbeatFormat {
+    Log,
+    Csv,
+}
+
+impl FromStr for HeartbeatFormat {
+    type Err = serde_yaml::Error;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        serde_yaml::from_str(s)
+    }
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "snake_case")]
+pub enum PcapFormat {
+    Pcap,
+    Pcapng,
+}
+
+impl FromStr for PcapFormat {
+    type Err = serde_yaml::Error;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        serde_yaml::from_str(s)
+    }
+}
+
 /// This wrapper type allows cli options to specify "null" to overwrite a config file option with
 /// `None`, and is intended to be used for options where "null" is a valid option value.
 ///
@@ -1399,6 +1549,35 @@ mod export {
         config.experimental.use_shim_syscall_handler.unwrap()
     }
 
+    #[no_mangle]
+    pub extern "C" fn config_getUseShmemScratch(config: *const ConfigOptions) -> bool {
+        assert!(!config.is_null());
+        let config = unsafe { &*config };
+        config.experimental.use_shmem_scratch.unwrap()
+    }
+
+    #[no_mangle]
+    pub extern "C" fn config_getUseZygoteLauncher(config: *const ConfigOptions) -> bool {
+        assert!(!config.is_null());
+        let config = unsafe { &*config };
+        config.experimental.use_zygote_launcher.unwrap()
+    }
+
+    #[no_mangle]
+    pub extern "C" fn config_getUseNumaPlacement(config: *const ConfigOptions) -> bool {
+        assert!(!config.is_null());
+        let config = unsafe { &*config };
+        config.experimental.use_cpu_pinning.unwrap()
+            && config.experimental.use_numa_placement.unwrap()
+    }
+
+    #[no_mangle]
+    pub extern "C" fn config_getUsePluginCpuTime(config: *const ConfigOptions) -> bool {
+        assert!(!config.is_null());
+        let config = unsafe { &*config };
+        config.experimental.use_plugin_cpu_time.unwrap()
+    }
+
     #[no_mangle]
     pub extern "C" fn config_getPreloadSpinMax(config: *const ConfigOptions) -> i32 {
         assert!(!config.is_null());
@@ -1483,6 +1662,7 @@ mod export {
         match config.experimental.strace_logging_mode.as_ref().unwrap() {
             StraceLoggingMode::Standard => StraceFmtMode::Standard,
             StraceLoggingMode::Deterministic => StraceFmtMode::Deterministic,
+            StraceLoggingMode::Deferred => StraceFmtMode::Deferred,
             StraceLoggingMode::Off => StraceFmtMode::Off,
         }
     }
@@ -0,0 +1,429 @@
+//! An opt-in timeline of what the worker threads do in each scheduling round, which can be written
+//! as a Chrome trace (JSON) and viewed in Perfetto or `chrome://tracing` to see why rounds are slow.
+//!
+//! Each thread records small fixed-size [`Record`]s into its own ring buffer, so recording doesn't
+//! take any locks. Once a thread's buffer is full its oldest records are overwritten. The buffers
+//! are collected with [`flush_thread`] at the end of the simulation and written with
+//! [`write_to_file`].
+//!
+//! When the timeline isn't enabled, every recording function returns after a single relaxed atomic
+//! load.
+
+use std::cell::{Cell, RefCell};
+use std::io::Write;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Mutex;
+use std::time::Instant;
+
+use anyhow::Context;
+use once_cell::sync::OnceCell;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::HostId;
+
+/// The number of records kept for each thread. Each record is 32 bytes.
+const RING_CAPACITY: usize = 1 << 18;
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+
+/// The real time that all record times are relative to.
+static START: OnceCell<Instant> = OnceCell::new();
+
+/// The current round. Set by the manager before it runs each round.
+static CURRENT_ROUND: AtomicU64 = AtomicU64::new(0);
+
+/// The simulation window of each round, indexed by round.
+static WINDOWS: Mutex<Vec<(EmulatedTime, EmulatedTime)>> = Mutex::new(Vec::new());
+
+/// The records of threads that have been flushed.
+static FLUSHED: Mutex<Vec<ThreadRecords>> = Mutex::new(Vec::new());
+
+std::thread_local! {
+    static RING: RefCell<Ring> = RefCell::new(Ring::new());
+    /// The number of packets sent to other hosts by this thread during the current round.
+    static PACKETS_SENT: Cell<u64> = Cell::new(0);
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+enum Kind {
+    /// A worker thread's part of a round. `arg` is the round.
+    Round,
+    /// The manager's view of a round, from starting the round until all threads have finished.
+    /// `arg` is the round.
+    Barrier,
+    /// A host executing its events. `arg` is the host ID.
+    Execute,
+    /// Hosts stolen from another thread's queue. `arg` is the other thread, `count` the number of
+    /// hosts.
+    Steal,
+    /// Packets sent to other hosts during a round. `arg` is the round, `count` the number of
+    /// packets.
+    PacketsSent,
+}
+
+#[derive(Debug, Copy, Clone)]
+struct Record {
+    kind: Kind,
+    /// Nanoseconds since [`START`].
+    start_ns: u64,
+    /// Zero for instant events.
+    dur_ns: u64,
+    arg: u64,
+    count: u32,
+}
+
+/// A fixed-capacity buffer that overwrites its oldest records once full.
+#[derive(Debug)]
+struct Ring {
+    records: Vec<Record>,
+    /// The index to write the next record to once the buffer is full.
+    next: usize,
+}
+
+impl Ring {
+    const fn new() -> Self {
+        Self {
+            records: Vec::new(),
+            next: 0,
+        }
+    }
+
+    fn push(&mut self, record: Record) {
+        if self.records.len() < RING_CAPACITY {
+            self.records.push(record);
+        } else {
+            self.records[self.next] = record;
+            self.next = (self.next + 1) % RING_CAPACITY;
+        }
+    }
+
+    /// Take the records, oldest first.
+    fn take(&mut self) -> Vec<Record> {
+        let mut records = std::mem::take(&mut self.records);
+        records.rotate_left(self.next);
+        self.next = 0;
+        records
+    }
+}
+
+#[derive(Debug)]
+struct ThreadRecords {
+    name: String,
+    tid: u32,
+    records: Vec<Record>,
+}
+
+/// Start recording. Should be called before the simulation starts.
+pub fn enable() {
+    START.get_or_init(Instant::now);
+    ENABLED.store(true, Ordering::Relaxed);
+}
+
+#[inline]
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// The current time if recording is enabled, to pass to the `record_*` functions later.
+#[inline]
+pub fn now() -> Option<Instant> {
+    is_enabled().then(Instant::now)
+}
+
+fn push(kind: Kind, start: Instant, end: Instant, arg: u64, count: u32) {
+    let origin = *START.get().unwrap();
+    let start_ns = u64::try_from(start.saturating_duration_since(origin).as_nanos()).unwrap();
+    let dur_ns = u64::try_from(end.saturating_duration_since(start).as_nanos()).unwrap();
+
+    RING.with(|ring| {
+        ring.borrow_mut().push(Record {
+            kind,
+            start_ns,
+            dur_ns,
+            arg,
+            count,
+        })
+    });
+}
+
+/// Called by the manager before running a round for the window `[start, end)`. Returns the time to
+/// pass to [`end_round`].
+pub fn start_round(window_start: EmulatedTime, window_end: EmulatedTime) -> Option<Instant> {
+    let now = now()?;
+    let mut windows = WINDOWS.lock().unwrap();
+    CURRENT_ROUND.store(windows.len() as u64, Ordering::Relaxed);
+    windows.push((window_start, window_end));
+    Some(now)
+}
+
+/// Called by the manager once all threads have finished the round.
+pub fn end_round(start: Option<Instant>) {
+    if let Some(start) = start {
+        let round = CURRENT_ROUND.load(Ordering::Relaxed);
+        push(Kind::Barrier, start, Instant::now(), round, 0);
+    }
+}
+
+/// Called by a worker thread when it has finished its part of the current round, which it started
+/// at `start`.
+pub fn record_round(start: Option<Instant>) {
+    if let Some(start) = start {
+        let now = Instant::now();
+        let round = CURRENT_ROUND.load(Ordering::Relaxed);
+        push(Kind::Round, start, now, round, 0);
+
+        let packets = PACKETS_SENT.with(|x| x.replace(0));
+        if packets > 0 {
+            push(
+                Kind::PacketsSent,
+                now,
+                now,
+                round,
+                u32::try_from(packets).unwrap_or(u32::MAX),
+            );
+        }
+    }
+}
+
+/// Record that `host` executed its events, starting at `start`.
+pub fn record_execute(host: HostId, start: Option<Instant>) {
+    if let Some(start) = start {
+        push(
+            Kind::Execute,
+            start,
+            Instant::now(),
+            u32::from(host).into(),
+            0,
+        );
+    }
+}
+
+/// Record that this thread stole `num_hosts` hosts from thread `from_thread`.
+#[inline]
+pub fn record_steal(from_thread: usize, num_hosts: usize) {
+    if is_enabled() && num_hosts > 0 {
+        let now = Instant::now();
+        push(
+            Kind::Steal,
+            now,
+            now,
+            from_thread as u64,
+            u32::try_from(num_hosts).unwrap_or(u32::MAX),
+        );
+    }
+}
+
+/// Record that this thread sent a packet to another host.
+#[inline]
+pub fn count_packet_sent() {
+    if is_enabled() {
+        PACKETS_SENT.with(|x| x.set(x.get() + 1));
+    }
+}
+
+/// Hand this thread's records over to be written by [`write_to_file`]. `tid` identifies the thread
+/// in the trace, and must be unique.
+pub fn flush_thread(name: impl Into<String>, tid: u32) {
+    if !is_enabled() {
+        return;
+    }
+
+    let records = RING.with(|ring| ring.borrow_mut().take());
+    FLUSHED.lock().unwrap().push(ThreadRecords {
+        name: name.into(),
+        tid,
+        records,
+    });
+}
+
+/// Write all flushed records to `filename` in the Chrome trace event format.
+pub fn write_to_file(filename: &std::path::Path) -> anyhow::Result<()> {
+    let file = std::fs::File::create(filename)
+        .with_context(|| format!("Failed to create file '{}'", filename.display()))?;
+    let mut writer = std::io::BufWriter::new(file);
+
+    let threads = std::mem::take(&mut *FLUSHED.lock().unwrap());
+    let windows = std::mem::take(&mut *WINDOWS.lock().unwrap());
+
+    write_trace(&mut writer, &threads, &windows)
+        .and_then(|_| Ok(writer.flush()?))
+        .with_context(|| format!("Failed to write trace to file '{}'", filename.display()))
+}
+
+fn write_trace(
+    writer: &mut impl Write,
+    threads: &[ThreadRecords],
+    windows: &[(EmulatedTime, EmulatedTime)],
+) -> anyhow::Result<()> {
+    // the end time of each round's barrier, used to find how long each worker waited for the others
+    let mut barrier_ends_ns = vec![None; windows.len()];
+    for record in threads.iter().flat_map(|x| &x.records) {
+        if record.kind == Kind::Barrier {
+            if let Some(end) = barrier_ends_ns.get_mut(record.arg as usize) {
+                *end = Some(record.start_ns + record.dur_ns);
+            }
+        }
+    }
+
+    let window_args = |round: u64| {
+        let (start, end) = windows[round as usize];
+        serde_json::json!({
+            "round": round,
+            "window_start_ns": (start - EmulatedTime::SIMULATION_START).as_nanos(),
+            "window_end_ns": (end - EmulatedTime::SIMULATION_START).as_nanos(),
+        })
+    };
+
+    // trace times are in microseconds
+    let us = |ns: u64| ns as f64 / 1000.0;
+
+    let mut first = true;
+    let mut write_event =
+        |writer: &mut dyn Write, event: serde_json::Value| -> anyhow::Result<()> {
+            if !std::mem::take(&mut first) {
+                writer.write_all(b",\n")?;
+            }
+            serde_json::to_writer(writer, &event)?;
+            Ok(())
+        };
+
+    writer.write_all(b"{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n")?;
+
+    for thread in threads {
+        let tid = thread.tid;
+        write_event(
+            writer,
+            serde_json::json!({
+                "ph": "M", "pid": 0, "tid": tid, "name": "thread_name",
+                "args": {"name": thread.name},
+            }),
+        )?;
+
+        for record in &thread.records {
+            let ts = us(record.start_ns);
+            let dur = us(record.dur_ns);
+            let event = match record.kind {
+                Kind::Round | Kind::Barrier => {
+                    let name = if record.kind == Kind::Round {
+                        "round"
+                    } else {
+                        "barrier"
+                    };
+                    serde_json::json!({
+                        "ph": "X", "pid": 0, "tid": tid, "name": name, "ts": ts, "dur": dur,
+                        "args": window_args(record.arg),
+                    })
+                }
+                Kind::Execute => serde_json::json!({
+                    "ph": "X", "pid": 0, "tid": tid, "name": "execute", "ts": ts, "dur": dur,
+                    "args": {"host": record.arg},
+                }),
+                Kind::Steal => serde_json::json!({
+                    "ph": "i", "s": "t", "pid": 0, "tid": tid, "name": "steal", "ts": ts,
+                    "args": {"from_thread": record.arg, "hosts": record.count},
+                }),
+                Kind::PacketsSent => serde_json::json!({
+                    "ph": "C", "pid": 0, "tid": tid, "name": "packets_sent", "ts": ts,
+                    "args": {"packets": record.count},
+                }),
+            };
+            write_event(writer, event)?;
+
+            // the time between a worker finishing its part of a round and the last worker
+            // finishing
+            if record.kind == Kind::Round {
+                let end_ns = record.start_ns + record.dur_ns;
+                let barrier_end_ns = barrier_ends_ns.get(record.arg as usize).copied().flatten();
+                if let Some(barrier_end_ns) = barrier_end_ns.filter(|x| *x > end_ns) {
+                    write_event(
+                        writer,
+                        serde_json::json!({
+                            "ph": "X", "pid": 0, "tid": tid, "name": "idle", "ts": us(end_ns),
+                            "dur": us(barrier_end_ns - end_ns), "args": {"round": record.arg},
+                        }),
+                    )?;
+                }
+            }
+        }
+    }
+
+    writer.write_all(b"\n]}\n")?;
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+    use super::*;
+
+    fn record(start_ns: u64) -> Record {
+        Record {
+            kind: Kind::Execute,
+            start_ns,
+            dur_ns: 0,
+            arg: 0,
+            count: 0,
+        }
+    }
+
+    #[test]
+    fn test_ring_overwrites_oldest() {
+        let mut ring = Ring::new();
+        for i in 0..(RING_CAPACITY + 3) {
+            ring.push(record(i as u64));
+        }
+
+        let records = ring.take();
+        assert_eq!(records.len(), RING_CAPACITY);
+        assert_eq!(records.first().unwrap().start_ns, 3);
+        assert_eq!(records.last().unwrap().start_ns, (RING_CAPACITY + 2) as u64);
+        assert!(ring.take().is_empty());
+    }
+
+    #[test]
+    fn test_write_trace() {
+        let windows = [(
+            EmulatedTime::SIMULATION_START,
+            EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(10),
+        )];
+        let threads = [
+            ThreadRecords {
+                name: "manager".into(),
+                tid: 0,
+                records: vec![Record {
+                    kind: Kind::Barrier,
+                    start_ns: 0,
+                    dur_ns: 5000,
+                    arg: 0,
+                    count: 0,
+                }],
+            },
+            ThreadRecords {
+                name: "worker-0".into(),
+                tid: 1,
+                records: vec![Record {
+                    kind: Kind::Round,
+                    start_ns: 1000,
+                    dur_ns: 2000,
+                    arg: 0,
+                    count: 0,
+                }],
+            },
+        ];
+
+        let mut out = Vec::new();
+        write_trace(&mut out, &threads, &windows).unwrap();
+        let trace: serde_json::Value = serde_json::from_slice(&out).unwrap();
+        let events = trace["traceEvents"].as_array().unwrap();
+
+        // two thread names, the barrier, the round, and the worker's idle time
+        assert_eq!(events.len(), 5);
+        let idle = events.iter().find(|x| x["name"] == "idle").unwrap();
+        assert_eq!(idle["tid"], 1);
+        assert_eq!(idle["ts"], 3.0);
+        assert_eq!(idle["dur"], 2.0);
+        let round = events.iter().find(|x| x["name"] == "round").unwrap();
+        assert_eq!(round["args"]["window_end_ns"], 10);
+    }
+}
@@ -1,3 +1,4 @@
+use crate::core::sim_stats::ObjectType;
 use crate::host::host::Host;
 use crate::utility::{Magic, ObjectCounter};
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
@@ -25,7 +26,7 @@ impl Event {
             src_host_id: src_host.id(),
             dst_host_id,
             src_host_event_id: src_host.get_new_event_id(),
-            _counter: ObjectCounter::new("Event"),
+            _counter: ObjectCounter::new(ObjectType::Event),
         }
     }
 
@@ -1,6 +1,7 @@
 use std::cmp::Reverse;
 use std::collections::binary_heap::BinaryHeap;
-use std::sync::Mutex;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Mutex, MutexGuard};
 
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
 
@@ -93,9 +94,80 @@ impl<T: PartialOrd + Eq> std::ops::DerefMut for PanickingOrd<T> {
     }
 }
 
-/// A wrapper for [`EventQueue`] that uses interior mutability to make the ffi simpler.
+/// A wrapper for [`EventQueue`] that uses interior mutability so that it can be shared between
+/// threads. The time of the queue's next event can be read without taking the lock, so that hosts
+/// without any events to run can be skipped cheaply.
 #[derive(Debug)]
-pub struct ThreadSafeEventQueue(pub Mutex<EventQueue>);
+pub struct ThreadSafeEventQueue {
+    queue: Mutex<EventQueue>,
+    /// The time of the queue's next event as a `CEmulatedTime`, or `EMUTIME_INVALID` if the queue
+    /// is empty. Only written while `queue` is locked.
+    next_event_time: AtomicU64,
+}
+
+impl ThreadSafeEventQueue {
+    pub fn new() -> Self {
+        Self {
+            queue: Mutex::new(EventQueue::new()),
+            next_event_time: AtomicU64::new(EmulatedTime::to_c_emutime(None)),
+        }
+    }
+
+    /// Lock the queue. The queue's next event time is updated when the guard is dropped.
+    pub fn lock(&self) -> ThreadSafeEventQueueGuard {
+        ThreadSafeEventQueueGuard {
+            queue: self.queue.lock().unwrap(),
+            next_event_time: &self.next_event_time,
+        }
+    }
+
+    /// Push a new [`Event`] on to the queue.
+    pub fn push(&self, event: Event) {
+        self.lock().push(event);
+    }
+
+    /// The time of the next [`Event`]. This doesn't take the lock, so another thread that's
+    /// currently pushing to or popping from the queue may change it.
+    pub fn next_event_time(&self) -> Option<EmulatedTime> {
+        EmulatedTime::from_c_emutime(self.next_event_time.load(Ordering::Acquire))
+    }
+}
+
+impl Default for ThreadSafeEventQueue {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// A locked [`ThreadSafeEventQueue`].
+pub struct ThreadSafeEventQueueGuard<'a> {
+    queue: MutexGuard<'a, EventQueue>,
+    next_event_time: &'a AtomicU64,
+}
+
+impl std::ops::Deref for ThreadSafeEventQueueGuard<'_> {
+    type Target = EventQueue;
+
+    fn deref(&self) -> &Self::Target {
+        &self.queue
+    }
+}
+
+impl std::ops::DerefMut for ThreadSafeEventQueueGuard<'_> {
+    fn deref_mut(&mut self) -> &mut Self::Target {
+        &mut self.queue
+    }
+}
+
+impl Drop for ThreadSafeEventQueueGuard<'_> {
+    fn drop(&mut self) {
+        // still holding the lock, so no other thread is writing this
+        self.next_event_time.store(
+            EmulatedTime::to_c_emutime(self.queue.next_event_time()),
+            Ordering::Release,
+        );
+    }
+}
 
 mod export {
     use super::*;
@@ -105,9 +177,7 @@ mod export {
 
     #[no_mangle]
     pub unsafe extern "C" fn eventqueue_new() -> *const ThreadSafeEventQueue {
-        Arc::into_raw(Arc::new(ThreadSafeEventQueue(
-            Mutex::new(EventQueue::new()),
-        )))
+        Arc::into_raw(Arc::new(ThreadSafeEventQueue::new()))
     }
 
     #[no_mangle]
@@ -138,16 +208,14 @@ mod export {
         assert!(!event.is_null());
         let queue = unsafe { queue.as_ref() }.unwrap();
         let event = unsafe { Box::from_raw(event) };
-        queue.0.lock().unwrap().push(*event);
+        queue.push(*event);
     }
 
     #[no_mangle]
     pub unsafe extern "C" fn eventqueue_pop(queue: *const ThreadSafeEventQueue) -> *mut Event {
         let queue = unsafe { queue.as_ref() }.unwrap();
         queue
-            .0
             .lock()
-            .unwrap()
             .pop()
             .map(Box::new)
             .map(Box::into_raw)
@@ -159,6 +227,6 @@ mod export {
         queue: *const ThreadSafeEventQueue,
     ) -> CEmulatedTime {
         let queue = unsafe { queue.as_ref() }.unwrap();
-        EmulatedTime::to_c_emutime(queue.0.lock().unwrap().next_event_time())
+        EmulatedTime::to_c_emutime(queue.next_event_time())
     }
 }
@@ -1,6 +1,7 @@
 use std::sync::Arc;
 
 use crate::{
+    core::sim_stats::ObjectType,
     host::host::Host,
     utility::{IsSend, IsSync, Magic, ObjectCounter},
 };
@@ -20,7 +21,7 @@ impl TaskRef {
         Self {
             inner: Arc::new(f),
             magic: Magic::new(),
-            _counter: ObjectCounter::new("TaskRef"),
+            _counter: ObjectCounter::new(ObjectType::TaskRef),
         }
     }
 
@@ -9,14 +9,16 @@
 
 #include "main/bindings/c/bindings.h"
 
-// Increment a counter for the allocation of the object with the given name.
+// Increment a counter for the allocation of an object of the given type, where
+// the type is an `ObjectType` without the `OBJECT_TYPE_` prefix (ex: `TCP`).
 // This should be paired with an increment of the dealloc counter with the
-// same name, otherwise we print a warning that a memory leak was detected.
-#define worker_count_allocation(type) worker_increment_object_alloc_counter(#type)
+// same type, otherwise we print a warning that a memory leak was detected.
+#define worker_count_allocation(type) worker_increment_object_alloc_counter(OBJECT_TYPE_##type)
 
-// Increment a counter for the deallocation of the object with the given name.
+// Increment a counter for the deallocation of an object of the given type, where
+// the type is an `ObjectType` without the `OBJECT_TYPE_` prefix (ex: `TCP`).
 // This should be paired with an increment of the alloc counter with the
-// same name, otherwise we print a warning that a memory leak was detected.
-#define worker_count_deallocation(type) worker_increment_object_dealloc_counter(#type)
+// same type, otherwise we print a warning that a memory leak was detected.
+#define worker_count_deallocation(type) worker_increment_object_dealloc_counter(OBJECT_TYPE_##type)
 
 #endif /* SHD_WORKER_H_ */
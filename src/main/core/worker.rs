@@ -5,19 +5,21 @@ use once_cell::sync::Lazy;
 use rand::Rng;
 
 use crate::core::controller::ShadowStatusBarState;
+use crate::core::logger::shadow_logger;
 use crate::core::scheduler::runahead::Runahead;
 use crate::core::sim_config::Bandwidth;
-use crate::core::sim_stats::{LocalSimStats, SharedSimStats};
+use crate::core::sim_stats::{LocalSimStats, ObjectType, SharedSimStats, SyscallCounter};
+use crate::core::timeline;
 use crate::core::work::event::Event;
 use crate::core::work::task::TaskRef;
 use crate::cshadow;
 use crate::host::host::Host;
+use crate::host::memory_manager::ShmemScratch;
 use crate::host::process::{Process, ProcessId};
 use crate::host::thread::{ThreadId, ThreadRef};
 use crate::network::graph::{IpAssignment, RoutingInfo};
 use crate::network::packet::Packet;
 use crate::utility::childpid_watcher::ChildPidWatcher;
-use crate::utility::counter::Counter;
 use crate::utility::notnull::*;
 use crate::utility::status_bar;
 use crate::utility::SyncSendPointer;
@@ -28,9 +30,9 @@ use shadow_shim_helper_rs::HostId;
 use std::cell::{Cell, RefCell};
 use std::collections::HashMap;
 use std::sync::atomic::{AtomicBool, AtomicU32};
-use std::sync::{Arc, Mutex};
+use std::sync::Arc;
 
-use super::work::event_queue::EventQueue;
+use super::work::event_queue::ThreadSafeEventQueue;
 
 static USE_OBJECT_COUNTERS: AtomicBool = AtomicBool::new(false);
 
@@ -62,6 +64,7 @@ struct ThreadInfo {
     #[allow(dead_code)]
     id: ThreadId,
     native_tid: Pid,
+    shmem_scratch: Option<ShmemScratch>,
 }
 
 struct Clock {
@@ -146,15 +149,18 @@ impl Worker {
 
     /// Set the currently-active Host.
     pub fn set_active_host(host: Box<Host>) {
+        shadow_logger::set_host_log_level(host.info().log_level);
         let old = Worker::with(|w| w.active_host.borrow_mut().replace(host)).unwrap();
         debug_assert!(old.is_none());
     }
 
     /// Clear the currently-active Host.
     pub fn take_active_host() -> Box<Host> {
-        Worker::with(|w| w.active_host.borrow_mut().take())
-            .unwrap()
+        let host = Worker::with(|w| w.active_host.borrow_mut().take())
             .unwrap()
+            .unwrap();
+        shadow_logger::set_host_log_level(None);
+        host
     }
 
     /// Set the currently-active Process.
@@ -187,6 +193,7 @@ impl Worker {
         let info = ThreadInfo {
             id: thread.id(),
             native_tid: thread.system_tid(),
+            shmem_scratch: ShmemScratch::for_thread(thread),
         };
         let old = Worker::with(|w| w.active_thread_info.borrow_mut().replace(info)).unwrap();
         debug_assert!(old.is_none());
@@ -226,6 +233,17 @@ impl Worker {
         Worker::with(|w| w.active_thread_info.borrow().as_ref().map(|t| t.native_tid)).flatten()
     }
 
+    /// The active thread's syscall-argument scratch area, if it has one.
+    pub fn active_thread_shmem_scratch() -> Option<ShmemScratch> {
+        Worker::with(|w| {
+            w.active_thread_info
+                .borrow()
+                .as_ref()
+                .and_then(|t| t.shmem_scratch)
+        })
+        .flatten()
+    }
+
     pub fn set_round_end_time(t: EmulatedTime) {
         Worker::with(|w| w.clock.borrow_mut().barrier.replace(t)).unwrap();
     }
@@ -376,6 +394,7 @@ impl Worker {
         Worker::update_next_event_time(packet_event.time());
 
         debug_assert!(packet_event.time() >= round_end_time);
+        timeline::count_packet_sent();
         Worker::with(|w| w.shared.push_to_host(dst_host_id, packet_event)).unwrap();
     }
 
@@ -392,35 +411,39 @@ impl Worker {
             .flatten()
     }
 
-    pub fn increment_object_alloc_counter(s: &str) {
+    pub fn increment_object_alloc_counter(object_type: ObjectType) {
         if !USE_OBJECT_COUNTERS.load(std::sync::atomic::Ordering::Relaxed) {
             return;
         }
 
         Worker::with(|w| {
-            w.sim_stats.alloc_counts.borrow_mut().add_one(s);
+            w.sim_stats.alloc_counts.borrow_mut().add_one(object_type);
         })
         .unwrap_or_else(|| {
             // no live worker; fall back to the shared counter
-            SIM_STATS.alloc_counts.lock().unwrap().add_one(s);
+            SIM_STATS.alloc_counts.lock().unwrap().add_one(object_type);
         });
     }
 
-    pub fn increment_object_dealloc_counter(s: &str) {
+    pub fn increment_object_dealloc_counter(object_type: ObjectType) {
         if !USE_OBJECT_COUNTERS.load(std::sync::atomic::Ordering::Relaxed) {
             return;
         }
 
         Worker::with(|w| {
-            w.sim_stats.dealloc_counts.borrow_mut().add_one(s);
+            w.sim_stats.dealloc_counts.borrow_mut().add_one(object_type);
         })
         .unwrap_or_else(|| {
             // no live worker; fall back to the shared counter
-            SIM_STATS.dealloc_counts.lock().unwrap().add_one(s);
+            SIM_STATS
+                .dealloc_counts
+                .lock()
+                .unwrap()
+                .add_one(object_type);
         });
     }
 
-    pub fn add_syscall_counts(syscall_counts: &Counter) {
+    pub fn add_syscall_counts(syscall_counts: &SyscallCounter) {
         Worker::with(|w| {
             w.sim_stats
                 .syscall_counts
@@ -459,7 +482,7 @@ pub struct WorkerShared {
     // calculates the runahead for the next simulation round
     pub runahead: Runahead,
     pub child_pid_watcher: ChildPidWatcher,
-    pub event_queues: HashMap<HostId, Arc<Mutex<EventQueue>>>,
+    pub event_queues: HashMap<HostId, Arc<ThreadSafeEventQueue>>,
     pub bootstrap_end_time: EmulatedTime,
     pub sim_end_time: EmulatedTime,
 }
@@ -567,7 +590,7 @@ impl WorkerShared {
 
     pub fn push_to_host(&self, host: HostId, event: Event) {
         let event_queue = self.event_queues.get(&host).unwrap();
-        event_queue.lock().unwrap().push(event);
+        event_queue.push(event);
     }
 }
 
@@ -662,28 +685,20 @@ mod export {
     /// Implementation for counting allocated objects. Do not use this function directly.
     /// Use worker_count_allocation instead from the call site.
     #[no_mangle]
-    pub extern "C" fn worker_increment_object_alloc_counter(object_name: *const libc::c_char) {
-        assert!(!object_name.is_null());
-
-        let s = unsafe { std::ffi::CStr::from_ptr(object_name) };
-        let s = s.to_str().unwrap();
-        Worker::increment_object_alloc_counter(s);
+    pub extern "C" fn worker_increment_object_alloc_counter(object_type: ObjectType) {
+        Worker::increment_object_alloc_counter(object_type);
     }
 
     /// Implementation for counting deallocated objects. Do not use this function directly.
     /// Use worker_count_deallocation instead from the call site.
     #[no_mangle]
-    pub extern "C" fn worker_increment_object_dealloc_counter(object_name: *const libc::c_char) {
-        assert!(!object_name.is_null());
-
-        let s = unsafe { std::ffi::CStr::from_ptr(object_name) };
-        let s = s.to_str().unwrap();
-        Worker::increment_object_dealloc_counter(s);
+    pub extern "C" fn worker_increment_object_dealloc_counter(object_type: ObjectType) {
+        Worker::increment_object_dealloc_counter(object_type);
     }
 
     /// Aggregate the given syscall counts in a worker syscall counter.
     #[no_mangle]
-    pub extern "C" fn worker_add_syscall_counts(syscall_counts: *const Counter) {
+    pub extern "C" fn worker_add_syscall_counts(syscall_counts: *const SyscallCounter) {
         assert!(!syscall_counts.is_null());
         let syscall_counts = unsafe { syscall_counts.as_ref() }.unwrap();
 
@@ -422,14 +422,32 @@ int affinity_initPlatformInfo() {
     return 0;
 }
 
-int affinity_setProcessAffinity(pid_t pid, int new_cpu_num, int old_cpu_num) {
-    assert(pid >= 0);
+static const CPUInfo* _affinity_findCPU(int cpu_num) {
+    for (size_t idx = 0; idx < _global_platform_info.n_cpus; ++idx) {
+        if (_global_platform_info.p_cpus[idx].logical_cpu_num == cpu_num) {
+            return &_global_platform_info.p_cpus[idx];
+        }
+    }
+    return NULL;
+}
 
-    // We can short-circuit if there's no work to do.
-    if (!_affinity_enabled || new_cpu_num == AFFINITY_UNINIT || new_cpu_num == old_cpu_num) {
-        return old_cpu_num;
+int affinity_getCPUNode(int cpu_num) {
+    if (!_affinity_enabled || cpu_num == AFFINITY_UNINIT) {
+        return AFFINITY_UNINIT;
     }
 
+    const CPUInfo* p_cpu_info = _affinity_findCPU(cpu_num);
+    return p_cpu_info ? p_cpu_info->node : AFFINITY_UNINIT;
+}
+
+/*
+ * Set the affinity of pid to new_cpu_num, or if whole_node is set, to all of
+ * the eligible CPUs on new_cpu_num's node.
+ */
+static int _affinity_setProcessAffinity(pid_t pid, int new_cpu_num, int old_cpu_num,
+                                        bool whole_node) {
+    assert(pid >= 0);
+
     cpu_set_t* cpu_set = NULL;
     bool set_affinity_suceeded = false;
     int retval = new_cpu_num;
@@ -445,14 +463,25 @@ int affinity_setProcessAffinity(pid_t pid, int new_cpu_num, int old_cpu_num) {
         // And then add the new_cpu_num as the only element of the set
         CPU_SET_S(new_cpu_num, cpu_set_size, cpu_set);
 
+        if (whole_node) {
+            // ...along with the rest of its node
+            int node = affinity_getCPUNode(new_cpu_num);
+            for (size_t idx = 0; idx < _global_platform_info.n_cpus; ++idx) {
+                const CPUInfo* p_info = &_global_platform_info.p_cpus[idx];
+                if (p_info->node == node && _cpuIdxIsEligible(idx)) {
+                    CPU_SET_S(p_info->logical_cpu_num, cpu_set_size, cpu_set);
+                }
+            }
+        }
+
         int rc = sched_setaffinity(pid, cpu_set_size, cpu_set);
 
         set_affinity_suceeded = (rc == 0);
     }
 
     if (!set_affinity_suceeded) {
-        error("cpu-pin was set, but the CPU affinity for PID %d could not be set to %d", (int)pid,
-              new_cpu_num);
+        error("cpu-pin was set, but the CPU affinity for PID %d could not be set to %s%d",
+              (int)pid, whole_node ? "the node of CPU " : "", new_cpu_num);
         retval = old_cpu_num;
     }
 
@@ -462,3 +491,31 @@ int affinity_setProcessAffinity(pid_t pid, int new_cpu_num, int old_cpu_num) {
 
     return retval;
 }
+
+int affinity_setProcessAffinity(pid_t pid, int new_cpu_num, int old_cpu_num) {
+    assert(pid >= 0);
+
+    // We can short-circuit if there's no work to do.
+    if (!_affinity_enabled || new_cpu_num == AFFINITY_UNINIT || new_cpu_num == old_cpu_num) {
+        return old_cpu_num;
+    }
+
+    return _affinity_setProcessAffinity(pid, new_cpu_num, old_cpu_num, false);
+}
+
+int affinity_setProcessNodeAffinity(pid_t pid, int new_cpu_num, int old_cpu_num) {
+    assert(pid >= 0);
+
+    // We can short-circuit if there's no work to do.
+    if (!_affinity_enabled || new_cpu_num == AFFINITY_UNINIT || new_cpu_num == old_cpu_num) {
+        return old_cpu_num;
+    }
+
+    // The process can already run anywhere on the node.
+    if (old_cpu_num != AFFINITY_UNINIT &&
+        affinity_getCPUNode(new_cpu_num) == affinity_getCPUNode(old_cpu_num)) {
+        return old_cpu_num;
+    }
+
+    return _affinity_setProcessAffinity(pid, new_cpu_num, old_cpu_num, true);
+}
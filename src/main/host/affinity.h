@@ -50,6 +50,23 @@ int affinity_initPlatformInfo();
  */
 int affinity_setProcessAffinity(pid_t pid, int new_cpu_num, int old_cpu_num);
 
+/*
+ * Same as affinity_setProcessAffinity, but allows the process to run on any of
+ * the CPUs on new_cpu_num's NUMA node, rather than only on new_cpu_num. Doesn't
+ * change the affinity if old_cpu_num is on the same node.
+ *
+ * THREAD SAFETY: thread-safe.
+ */
+int affinity_setProcessNodeAffinity(pid_t pid, int new_cpu_num, int old_cpu_num);
+
+/*
+ * Returns the NUMA node of the CPU with number cpu_num, or AFFINITY_UNINIT if
+ * it isn't known (for example if CPU pinning isn't enabled).
+ *
+ * THREAD SAFETY: thread-safe.
+ */
+int affinity_getCPUNode(int cpu_num);
+
 /*
  * Helper function. Same semantics as affinity_setProcessAffinity but sets the
  * affinity of the calling thread/process.
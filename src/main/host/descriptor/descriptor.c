@@ -32,7 +32,7 @@ void legacyfile_init(LegacyFile* descriptor, LegacyFileType type,
 
     trace("Descriptor %p has been initialized now", descriptor);
 
-    worker_count_allocation(LegacyDescriptor);
+    worker_count_allocation(LEGACY_DESCRIPTOR);
 }
 
 void legacyfile_clear(LegacyFile* descriptor) {
@@ -60,7 +60,7 @@ static void _legacyfile_free(LegacyFile* descriptor) {
     trace("Descriptor %p calling vtable free now", descriptor);
     descriptor->funcTable->free(descriptor);
 
-    worker_count_deallocation(LegacyDescriptor);
+    worker_count_deallocation(LEGACY_DESCRIPTOR);
 }
 
 void legacyfile_ref(gpointer data) {
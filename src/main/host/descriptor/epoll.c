@@ -261,7 +261,7 @@ static void _epoll_free(LegacyFile* descriptor) {
     MAGIC_CLEAR(epoll);
     g_free(epoll);
 
-    worker_count_deallocation(Epoll);
+    worker_count_deallocation(EPOLL);
 }
 
 void epoll_clearWatchListeners(Epoll* epoll) {
@@ -332,7 +332,7 @@ Epoll* epoll_new() {
     /* the epoll descriptor itself is always able to be epolled */
     legacyfile_adjustStatus(&(epoll->super), STATUS_FILE_ACTIVE, TRUE);
 
-    worker_count_allocation(Epoll);
+    worker_count_allocation(EPOLL);
 
     return epoll;
 }
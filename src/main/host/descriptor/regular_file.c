@@ -127,7 +127,7 @@ static void _regularfile_free(LegacyFile* desc) {
     MAGIC_CLEAR(file);
     free(file);
 
-    worker_count_deallocation(RegularFile);
+    worker_count_deallocation(REGULAR_FILE);
 }
 
 static LegacyFileFunctionTable _fileFunctions = (LegacyFileFunctionTable){
@@ -145,7 +145,7 @@ RegularFile* regularfile_new() {
     MAGIC_INIT(file);
     file->osfile.fd = OSFILE_INVALID; // negative means uninitialized (0 is a valid fd)
 
-    worker_count_allocation(RegularFile);
+    worker_count_allocation(REGULAR_FILE);
     return file;
 }
 
@@ -49,7 +49,7 @@ static void _timerfd_free(LegacyFile* descriptor) {
     }
     MAGIC_CLEAR(timerfd);
     g_free(timerfd);
-    worker_count_deallocation(TimerFd);
+    worker_count_deallocation(TIMER_FD);
 }
 
 static void _timerfd_cleanup(LegacyFile* descriptor) {
@@ -82,7 +82,7 @@ TimerFd* timerfd_new(HostId hostId) {
     timerfd->timer = timer_new(task);
     taskref_drop(task);
 
-    worker_count_allocation(TimerFd);
+    worker_count_allocation(TIMER_FD);
 
     return timerfd;
 }
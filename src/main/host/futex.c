@@ -35,7 +35,7 @@ Futex* futex_new(PluginPhysicalPtr word) {
                      .referenceCount = 1,
                      MAGIC_INITIALIZER};
 
-    worker_count_allocation(Futex);
+    worker_count_allocation(FUTEX);
 
     return futex;
 }
@@ -47,7 +47,7 @@ static void _futex_free(Futex* futex) {
 
     MAGIC_CLEAR(futex);
     free(futex);
-    worker_count_deallocation(Futex);
+    worker_count_deallocation(FUTEX);
 }
 
 void futex_ref(Futex* futex) {
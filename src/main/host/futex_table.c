@@ -30,7 +30,7 @@ FutexTable* futextable_new() {
 
     *table = (FutexTable){.referenceCount = 1, MAGIC_INITIALIZER};
 
-    worker_count_allocation(FutexTable);
+    worker_count_allocation(FUTEX_TABLE);
     return table;
 }
 
@@ -43,7 +43,7 @@ static void _futextable_free(FutexTable* table) {
 
     MAGIC_CLEAR(table);
     free(table);
-    worker_count_deallocation(FutexTable);
+    worker_count_deallocation(FUTEX_TABLE);
 }
 
 void futextable_ref(FutexTable* table) {
@@ -1,11 +1,14 @@
-use crate::core::support::configuration::QDiscMode;
+use crate::core::sim_stats::{HostProfile, SyscallLatencies};
+use crate::core::support::configuration::{HeartbeatFormat, QDiscMode};
 use crate::core::work::event::Event;
-use crate::core::work::event_queue::EventQueue;
+use crate::core::work::event_queue::ThreadSafeEventQueue;
 use crate::core::work::task::TaskRef;
-use crate::core::worker::Worker;
+use crate::core::worker::{self, Worker};
 use crate::cshadow;
 use crate::host::descriptor::socket::abstract_unix_ns::AbstractUnixNamespace;
 use crate::host::network_interface::NetworkInterface;
+use crate::network::pcap_capture::PcapOptions;
+use crate::network::pcap_filter::PcapFilter;
 use crate::network::router::Router;
 use crate::utility::{self, HostTreePointer, SyncSendPointer};
 use atomic_refcell::AtomicRefCell;
@@ -29,7 +32,7 @@ use std::net::{Ipv4Addr, SocketAddrV4};
 use std::ops::{Deref, DerefMut};
 use std::os::unix::prelude::OsStringExt;
 use std::path::{Path, PathBuf};
-use std::sync::{Arc, Mutex};
+use std::sync::Arc;
 
 #[cfg(feature = "perf_timers")]
 use crate::utility::perf_timer::PerfTimer;
@@ -55,10 +58,14 @@ pub struct HostParameters {
     pub heartbeat_interval: Option<SimulationTime>,
     pub heartbeat_log_level: LogLevel,
     pub heartbeat_log_info: cshadow::LogInfoFlags,
+    pub heartbeat_format: HeartbeatFormat,
     pub log_level: LogLevel,
     // TODO: change to PathBuf when we don't need C compatibility
     pub pcap_dir: Option<CString>,
     pub pcap_capture_size: u32,
+    pub pcap_filter: Option<Arc<PcapFilter>>,
+    pub pcap_flow_packet_limit: Option<u32>,
+    pub pcap_sample_probability: f64,
     pub qdisc: QDiscMode,
     pub init_sock_recv_buf_size: u64,
     pub autotune_recv_buf: bool,
@@ -102,7 +109,7 @@ pub struct Host {
     #[allow(unused)]
     root: Root,
 
-    event_queue: Arc<Mutex<EventQueue>>,
+    event_queue: Arc<ThreadSafeEventQueue>,
 
     random: RefCell<Xoshiro256PlusPlus>,
 
@@ -155,6 +162,16 @@ pub struct Host {
     // Owned pointers to processes.
     processes: RefCell<BTreeMap<ProcessId, HostTreePointer<cshadow::Process>>>,
 
+    // Wall-clock time spent handling this host's syscalls, merged into the
+    // global sim stats at shutdown.
+    syscall_latencies: RefCell<SyscallLatencies>,
+
+    // Wall-clock and CPU time used by this host, merged into the global sim
+    // stats at shutdown. The native TSC value when the host's execution timer
+    // was last continued, or `None` if it's stopped.
+    profile: Cell<HostProfile>,
+    execution_start_cycles: Cell<Option<u64>>,
+
     tsc: Tsc,
     // Cached lock for shim_shmem. `[Host::shmem_lock]` uses unsafe code to give it
     // a 'static lifetime.
@@ -228,7 +245,7 @@ impl Host {
             default_address,
             info: OnceCell::new(),
             root,
-            event_queue: Arc::new(Mutex::new(EventQueue::new())),
+            event_queue: Arc::new(ThreadSafeEventQueue::new()),
             params,
             router: RefCell::new(Router::new()),
             tracker: RefCell::new(None),
@@ -248,6 +265,9 @@ impl Host {
             determinism_sequence_counter,
             tsc,
             processes: RefCell::new(BTreeMap::new()),
+            syscall_latencies: RefCell::new(SyscallLatencies::new()),
+            profile: Cell::new(HostProfile::default()),
+            execution_start_cycles: Cell::new(None),
             #[cfg(feature = "perf_timers")]
             execution_timer,
         };
@@ -303,12 +323,12 @@ impl Host {
         *self.default_address.borrow_mut() = unsafe { SyncSendPointer::new(inet_addr) };
 
         // Virtual addresses and interfaces for managing network I/O
+        let pcap_options = self.pcap_options(host_root_path);
         let localhost = unsafe {
             NetworkInterface::new(
                 self.id(),
                 local_addr,
-                self.pcap_dir_path(host_root_path),
-                self.params.pcap_capture_size,
+                pcap_options.as_ref(),
                 self.params.qdisc,
                 false,
             )
@@ -319,8 +339,7 @@ impl Host {
             NetworkInterface::new(
                 self.id(),
                 inet_addr,
-                self.pcap_dir_path(host_root_path),
-                self.params.pcap_capture_size,
+                pcap_options.as_ref(),
                 self.params.qdisc,
                 true,
             )
@@ -377,29 +396,41 @@ impl Host {
         path.canonicalize().ok()
     }
 
+    fn pcap_options(&self, host_root_path: &Path) -> Option<PcapOptions> {
+        Some(PcapOptions {
+            dir: self.pcap_dir_path(host_root_path)?,
+            capture_len: self.params.pcap_capture_size,
+            filter: self.params.pcap_filter.clone(),
+            flow_packet_limit: self.params.pcap_flow_packet_limit,
+            sample_probability: self.params.pcap_sample_probability,
+            seed: self.params.node_seed,
+        })
+    }
+
     pub fn add_application(
         &self,
         start_time: SimulationTime,
         stop_time: Option<SimulationTime>,
         plugin_name: &CStr,
         plugin_path: &CStr,
-        mut envv: Vec<CString>,
+        envv: &[CString],
         argv: &[CString],
         pause_for_debugging: bool,
     ) {
-        {
+        let host_shmem_envvar = {
             // SAFETY: We're not touching the data inside the block, only
             // using its metadata to create a serialized pointer to it.
             let block = unsafe { &*self.shim_shmem.get() };
             let mut envvar = String::from("SHADOW_SHM_HOST_BLK=");
             envvar.push_str(&block.serialize().to_string());
-            envv.push(CString::new(envvar).unwrap());
-        }
+            CString::new(envvar).unwrap()
+        };
 
         let process_id = self.get_new_process_id();
 
         let envv_ptrs: Vec<*const i8> = envv
             .iter()
+            .chain(std::iter::once(&host_shmem_envvar))
             .map(|x| x.as_ptr())
             // the last element of envv must be NULL
             .chain(std::iter::once(std::ptr::null()))
@@ -584,11 +615,17 @@ impl Host {
     pub fn continue_execution_timer(&self) {
         #[cfg(feature = "perf_timers")]
         self.execution_timer.borrow_mut().start();
+        self.execution_start_cycles.set(Some(Tsc::native_rdtsc()));
     }
 
     pub fn stop_execution_timer(&self) {
         #[cfg(feature = "perf_timers")]
         self.execution_timer.borrow_mut().stop();
+        if let Some(start) = self.execution_start_cycles.take() {
+            let mut profile = self.profile.get();
+            profile.execution_cycles += Tsc::native_rdtsc().saturating_sub(start);
+            self.profile.set(profile);
+        }
     }
 
     pub fn schedule_task_at_emulated_time(&self, task: TaskRef, t: EmulatedTime) -> bool {
@@ -600,7 +637,7 @@ impl Host {
         self.schedule_task_at_emulated_time(task, Worker::current_time().unwrap() + t)
     }
 
-    pub fn event_queue(&self) -> &Arc<Mutex<EventQueue>> {
+    pub fn event_queue(&self) -> &Arc<ThreadSafeEventQueue> {
         &self.event_queue
     }
 
@@ -608,7 +645,7 @@ impl Host {
         if event.time() >= self.params.sim_end_time {
             return false;
         }
-        self.event_queue.lock().unwrap().push(event);
+        self.event_queue.push(event);
         true
     }
 
@@ -636,6 +673,7 @@ impl Host {
                     heartbeat_interval,
                     self.params.heartbeat_log_level,
                     self.params.heartbeat_log_info,
+                    self.params.heartbeat_format == HeartbeatFormat::Csv,
                 )
             };
             // SAFETY: we synchronize access to the Host's tracker using a RefCell.
@@ -667,7 +705,22 @@ impl Host {
             cshadow::dns_deregister(dns.cast_mut(), self.default_address.borrow().ptr())
         });
 
+        worker::with_global_sim_stats(|stats| {
+            stats
+                .syscall_latencies
+                .lock()
+                .unwrap()
+                .add_host(self.name(), self.syscall_latencies.take())
+        });
+
         self.stop_execution_timer();
+        worker::with_global_sim_stats(|stats| {
+            stats
+                .host_profiles
+                .lock()
+                .unwrap()
+                .insert(self.name().to_string(), self.profile.get())
+        });
         #[cfg(feature = "perf_timers")]
         info!(
             "host '{}' has been shut down, total execution time was {:?}",
@@ -689,7 +742,7 @@ impl Host {
     pub fn execute(&self, until: EmulatedTime) {
         loop {
             let mut event = {
-                let mut event_queue = self.event_queue.lock().unwrap();
+                let mut event_queue = self.event_queue.lock();
                 match event_queue.next_event_time() {
                     Some(t) if t < until => {}
                     _ => break,
@@ -735,8 +788,10 @@ impl Host {
         }
     }
 
+    /// The time of the host's next event. Doesn't lock the host's event queue, so is cheap enough
+    /// to check for every host in every round.
     pub fn next_event_time(&self) -> Option<EmulatedTime> {
-        self.event_queue.lock().unwrap().next_event_time()
+        self.event_queue.next_event_time()
     }
 
     pub fn packets_are_available_to_receive(&self) {
@@ -966,6 +1021,41 @@ mod export {
         hostrc.tsc()
     }
 
+    /// Record that Shadow spent `cycles` native TSC cycles handling the syscall
+    /// `number`. `name` must be a static string.
+    #[no_mangle]
+    pub unsafe extern "C" fn host_recordSyscallLatency(
+        host: *const Host,
+        number: libc::c_long,
+        name: *const c_char,
+        cycles: u64,
+    ) {
+        let host = unsafe { host.as_ref().unwrap() };
+        let name = unsafe { CStr::from_ptr(name) };
+        host.syscall_latencies.borrow_mut().record_syscall(
+            number.try_into().unwrap(),
+            name,
+            cycles,
+        );
+    }
+
+    /// Record an IPC round trip with a managed thread that took `cycles` native
+    /// TSC cycles.
+    #[no_mangle]
+    pub unsafe extern "C" fn host_recordIpcLatency(host: *const Host, cycles: u64) {
+        let host = unsafe { host.as_ref().unwrap() };
+        host.syscall_latencies.borrow_mut().record_ipc(cycles);
+    }
+
+    /// Record that the host's plugin processes used `nanos` of CPU time.
+    #[no_mangle]
+    pub unsafe extern "C" fn host_recordPluginCpuTime(host: *const Host, nanos: u64) {
+        let host = unsafe { host.as_ref().unwrap() };
+        let mut profile = host.profile.get();
+        profile.plugin_cpu_nanos += nanos;
+        host.profile.set(profile);
+    }
+
     #[no_mangle]
     pub unsafe extern "C" fn host_getName(hostrc: *const Host) -> *const c_char {
         let hostrc = unsafe { hostrc.as_ref().unwrap() };
@@ -5,8 +5,10 @@
 #include <glib.h>
 #include <inttypes.h>
 #include <sched.h>
+#include <stdbool.h>
 #include <search.h>
 #include <string.h>
+#include <time.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
@@ -17,10 +19,22 @@
 #include "lib/shadow-shim-helper-rs/ipc.h"
 #include "lib/shadow-shim-helper-rs/shim_event.h"
 #include "lib/shmem/shmem_allocator.h"
+#include "lib/tsc/tsc.h"
+#include "main/core/support/config_handlers.h"
 #include "main/core/worker.h"
 #include "main/host/affinity.h"
 #include "main/host/shimipc.h"
 #include "main/host/syscall_condition.h"
+#include "main/host/zygote.h"
+
+static bool _useZygoteLauncher = false;
+ADD_CONFIG_HANDLER(config_getUseZygoteLauncher, _useZygoteLauncher)
+
+static bool _useNumaPlacement = false;
+ADD_CONFIG_HANDLER(config_getUseNumaPlacement, _useNumaPlacement)
+
+static bool _usePluginCpuTime = false;
+ADD_CONFIG_HANDLER(config_getUsePluginCpuTime, _usePluginCpuTime)
 
 struct _ManagedThread {
     Thread* base;
@@ -41,10 +55,22 @@ struct _ManagedThread {
     pid_t nativePid;
     pid_t nativeTid;
 
+    // The native TSC value when we last sent an event to the plugin. Used to
+    // measure the round trip until the plugin's next event.
+    uint64_t continueCycles;
+
+    // The CPU-time clock of the native process, if we were able to get it.
+    clockid_t cpuClock;
+    bool haveCpuClock;
+    // The process's CPU time when we last sent an event to the plugin, or -1
+    // if we didn't read it.
+    int64_t continueCpuNanos;
+
     // Value storing the current CPU affinity of the thread (more preceisely,
     // of the native thread backing this thread object). This value will be set
     // to AFFINITY_UNINIT if CPU pinning is not enabled or if the thread has
-    // not yet been pinned to a CPU.
+    // not yet been pinned to a CPU. With NUMA placement, the thread may run on
+    // any CPU on this CPU's node.
     int affinity;
 };
 
@@ -55,15 +81,31 @@ typedef struct _ShMemWriteBlock {
 } ShMemWriteBlock;
 
 /*
- * Helper function. Sets the thread's CPU affinity to the worker's affinity.
+ * Helper function. Sets the thread's CPU affinity to the worker's affinity, or
+ * to the worker's NUMA node if NUMA placement is enabled.
  */
 static void _managedthread_syncAffinityWithWorker(ManagedThread* mthread) {
     int current_affinity = scheduler_getAffinity();
     if (current_affinity < 0) {
         current_affinity = AFFINITY_UNINIT;
     }
-    mthread->affinity =
-        affinity_setProcessAffinity(mthread->nativeTid, current_affinity, mthread->affinity);
+    if (_useNumaPlacement) {
+        mthread->affinity = affinity_setProcessNodeAffinity(
+            mthread->nativeTid, current_affinity, mthread->affinity);
+    } else {
+        mthread->affinity =
+            affinity_setProcessAffinity(mthread->nativeTid, current_affinity, mthread->affinity);
+    }
+}
+
+/* Returns the CPU time used by all threads of the native process so far, or -1
+ * if it can't be read (e.g. because the process has exited). */
+static int64_t _managedthread_getProcessCpuNanos(ManagedThread* mthread) {
+    struct timespec ts;
+    if (!mthread->haveCpuClock || clock_gettime(mthread->cpuClock, &ts) != 0) {
+        return -1;
+    }
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 static void _managedthread_continuePlugin(ManagedThread* thread, const ShimEvent* event) {
@@ -77,6 +119,8 @@ static void _managedthread_continuePlugin(ManagedThread* thread, const ShimEvent
     // Reacquired in _managedthread_waitForNextEvent.
     host_unlockShimShmemLock(host);
 
+    thread->continueCycles = Tsc_nativeRdtsc();
+    thread->continueCpuNanos = _usePluginCpuTime ? _managedthread_getProcessCpuNanos(thread) : -1;
     shimevent_sendEventToPlugin(thread->ipc_data, event);
 }
 
@@ -97,7 +141,7 @@ void managedthread_free(ManagedThread* mthread) {
         // shmemallocator_globalFree(&thread->ipc_blk);
     }
 
-    worker_count_deallocation(ManagedThread);
+    worker_count_deallocation(MANAGED_THREAD);
 }
 
 static gchar** _add_u64_to_env(gchar** envp, const char* var, uint64_t x) {
@@ -122,41 +166,50 @@ static pid_t _managedthread_fork_exec(ManagedThread* thread, const char* file, c
         utility_panic("pipe2: %s", g_strerror(errno));
     }
 
-    // vfork has superior performance to fork with large workloads.
-    pid_t pid = vfork();
+    pid_t pid = -1;
+    if (_useZygoteLauncher) {
+        // Falls back to starting the process directly below if the zygote
+        // can't be used.
+        pid = zygote_spawn(file, argv, envp, workingDir, pipefd[1]);
+    }
 
-    // Beware! Unless you really know what you're doing, don't add any code
-    // between here and the execvpe below. The forked child process is sharing
-    // memory and control structures with the parent at this point. See
-    // `man 2 vfork`.
+    if (pid < 0) {
+        // vfork has superior performance to fork with large workloads.
+        pid = vfork();
 
-    switch (pid) {
-        case -1:
-            utility_panic("fork failed");
-            return -1;
-            break;
-        case 0: {
-            // child
+        // Beware! Unless you really know what you're doing, don't add any code
+        // between here and the execvpe below. The forked child process is sharing
+        // memory and control structures with the parent at this point. See
+        // `man 2 vfork`.
 
-            // *Don't* close the write end of the pipe on exec.
-            if (fcntl(pipefd[1], F_SETFD, 0)) {
-                die_after_vfork();
-            }
+        switch (pid) {
+            case -1:
+                utility_panic("fork failed");
+                return -1;
+                break;
+            case 0: {
+                // child
 
-            // Set the working directory
-            if (chdir(workingDir) < 0) {
-                die_after_vfork();
-            }
+                // *Don't* close the write end of the pipe on exec.
+                if (fcntl(pipefd[1], F_SETFD, 0)) {
+                    die_after_vfork();
+                }
+
+                // Set the working directory
+                if (chdir(workingDir) < 0) {
+                    die_after_vfork();
+                }
 
-            int rc = execvpe(file, argv, envp);
-            if (rc == -1) {
+                int rc = execvpe(file, argv, envp);
+                if (rc == -1) {
+                    die_after_vfork();
+                }
+                // Unreachable
                 die_after_vfork();
             }
-            // Unreachable
-            die_after_vfork();
+            default: // parent
+                break;
         }
-        default: // parent
-            break;
     }
 
     // *Must* close the write-end of the pipe, so that the child's copy is the
@@ -219,6 +272,7 @@ void managedthread_run(ManagedThread* mthread, char* pluginPath, char** argv, ch
     mthread->nativePid = _managedthread_fork_exec(mthread, pluginPath, argv, myenvv, workingDir);
     // In Linux, the PID is equal to the TID of its first thread.
     mthread->nativeTid = mthread->nativePid;
+    mthread->haveCpuClock = clock_getcpuclockid(mthread->nativePid, &mthread->cpuClock) == 0;
     childpidwatcher_watch(
         worker_getChildPidWatcher(), mthread->nativePid, _markPluginExited, mthread->ipc_data);
 
@@ -237,6 +291,20 @@ void managedthread_run(ManagedThread* mthread, char* pluginPath, char** argv, ch
 static inline void _managedthread_waitForNextEvent(ManagedThread* mthread, ShimEvent* e) {
     utility_debugAssert(mthread->ipc_data);
     shimevent_recvEventFromPlugin(mthread->ipc_data, e);
+    // This includes any time the plugin spent running natively.
+    host_recordIpcLatency(
+        thread_getHost(mthread->base), Tsc_nativeRdtsc() - mthread->continueCycles);
+    if (mthread->continueCpuNanos >= 0) {
+        // The process's other threads are normally blocked while this one
+        // runs, so the increase in the process's CPU time is attributed to
+        // this thread. Sampling only while the plugin has control leaves out
+        // the time it spends spinning while we handle its syscalls.
+        int64_t cpuNanos = _managedthread_getProcessCpuNanos(mthread);
+        if (cpuNanos >= mthread->continueCpuNanos) {
+            host_recordPluginCpuTime(
+                thread_getHost(mthread->base), cpuNanos - mthread->continueCpuNanos);
+        }
+    }
     // The managed mthread has yielded control back to us. Reacquire the shared
     // memory lock, which we released in `_managedthread_continuePlugin`.
     host_lockShimShmemLock(thread_getHost(mthread->base));
@@ -313,6 +381,12 @@ SysCallCondition* managedthread_resume(ManagedThread* mthread) {
                 // Flush any writes the syscallhandler made.
                 process_flushPtrs(thread_getProcess(mthread->base));
 
+                // Now that there are no outstanding references to plugin memory, move any
+                // regions that we've been frequently accessing the slow way into the memory
+                // manager's shared memory file.
+                memorymanager_remapHotRegions(
+                    process_getMemoryManager(thread_getProcess(mthread->base)), mthread->base);
+
                 if (result.state == SYSCALL_BLOCK) {
                     if (shimipc_sendExplicitBlockMessageEnabled()) {
                         trace("Sending block message to plugin");
@@ -412,6 +486,8 @@ pid_t managedthread_clone(ManagedThread* child, ManagedThread* parent, unsigned
     }
     trace("native clone created tid %d", childNativeTid);
     child->nativePid = parent->nativePid;
+    child->cpuClock = parent->cpuClock;
+    child->haveCpuClock = parent->haveCpuClock;
     child->nativeTid = childNativeTid;
 
     // Child is now ready to start.
@@ -463,7 +539,7 @@ ManagedThread* managedthread_new(Thread* thread) {
     // of the sim. but the process may not launch/start until later. any
     // resources for launch/start should be allocated in the respective funcs.
 
-    worker_count_allocation(ManagedThread);
+    worker_count_allocation(MANAGED_THREAD);
     return mthread;
 }
 
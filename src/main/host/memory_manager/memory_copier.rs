@@ -7,6 +7,10 @@ use log::*;
 use nix::{errno::Errno, unistd::Pid};
 use std::fmt::Debug;
 
+/// Maximum number of iovecs that a single `process_vm_readv` or `process_vm_writev` call
+/// accepts (`UIO_MAXIOV` in Linux).
+pub(super) const IOV_MAX: usize = 1024;
+
 /// A utility for copying data to and from a process's memory.
 #[derive(Debug, Clone)]
 pub struct MemoryCopier {
@@ -18,6 +22,26 @@ impl MemoryCopier {
         Self { pid }
     }
 
+    // The thread to pass to `process_vm_readv` and `process_vm_writev`. While
+    // their documentation says to use the pid, in practice it needs to be the
+    // tid of a still-running thread. i.e. using the pid after the thread group
+    // leader has exited will fail. Panics if the MemoryCopier's process isn't
+    // currently active.
+    fn active_tid(&self) -> Pid {
+        // Unit tests copy to and from their own process, without a worker.
+        if cfg!(test) && !Worker::is_alive() {
+            return self.pid;
+        }
+
+        let active_tid = Worker::active_thread_native_tid().unwrap();
+        let active_pid = Worker::active_process_native_pid().unwrap();
+
+        // Don't access another process's memory.
+        assert_eq!(active_pid, self.pid);
+
+        active_tid
+    }
+
     /// Copy the region.
     /// SAFETY: A mutable reference to the process memory must not exist.
     pub unsafe fn clone_mem<T: Pod + Debug>(
@@ -121,6 +145,38 @@ impl MemoryCopier {
         Ok(())
     }
 
+    // Copy each of `srcs` into the corresponding buffer in `dsts`, using as few
+    // `process_vm_readv` calls as the iovec limit allows.
+    /// SAFETY: A mutable reference to the process memory must not exist.
+    pub unsafe fn copy_from_ptrs<T: Pod + Debug>(
+        &self,
+        dsts: &mut [&mut [T]],
+        srcs: &[TypedPluginPtr<T>],
+    ) -> Result<(), Errno> {
+        assert_eq!(dsts.len(), srcs.len());
+        let mut bufs: Vec<&mut [u8]> = Vec::with_capacity(dsts.len());
+        for (dst, src) in dsts.iter_mut().zip(srcs) {
+            assert_eq!(dst.len(), src.len());
+            // SAFETY: We do not write uninitialized data into `buf`.
+            let buf = unsafe { pod::to_u8_slice_mut(&mut **dst) };
+            // SAFETY: this buffer is write-only. See `copy_from_ptr`.
+            bufs.push(unsafe {
+                std::slice::from_raw_parts_mut(buf.as_mut_ptr() as *mut u8, buf.len())
+            });
+        }
+        let ptrs: Vec<TypedPluginPtr<u8>> = srcs.iter().map(|src| src.cast_u8()).collect();
+
+        for (bufs, ptrs) in bufs.chunks_mut(IOV_MAX).zip(ptrs.chunks(IOV_MAX)) {
+            let toread: usize = ptrs.iter().map(|p| p.len()).sum();
+            let bytes_read = unsafe { self.readv_ptrs(bufs, ptrs)? };
+            if bytes_read != toread {
+                warn!("Tried to read {} bytes but only got {}", toread, bytes_read);
+                return Err(Errno::EFAULT);
+            }
+        }
+        Ok(())
+    }
+
     // Low level helper for reading directly from `srcs` to `dsts`.
     // Returns the number of bytes read. Panics if the
     // MemoryManager's process isn't currently active.
@@ -163,16 +219,7 @@ impl MemoryCopier {
             dsts.iter().map(|d| d.len()).sum::<usize>()
         );
 
-        // While the documentation for process_vm_readv says to use the pid, in
-        // practice it needs to be the tid of a still-running thread. i.e. using the
-        // pid after the thread group leader has exited will fail.
-        let active_tid = Worker::active_thread_native_tid().unwrap();
-        let active_pid = Worker::active_process_native_pid().unwrap();
-
-        // Don't access another process's memory.
-        assert_eq!(active_pid, self.pid);
-
-        let nread = nix::sys::uio::process_vm_readv(active_tid, dsts, srcs)?;
+        let nread = nix::sys::uio::process_vm_readv(self.active_tid(), dsts, srcs)?;
 
         Ok(nread)
     }
@@ -205,18 +252,159 @@ impl MemoryCopier {
             len: towrite,
         }];
 
-        // While the documentation for process_vm_writev says to use the pid, in
-        // practice it needs to be the tid of a still-running thread. i.e. using the
-        // pid after the thread group leader has exited will fail.
-        let active_tid = Worker::active_thread_native_tid().unwrap();
-        let active_pid = Worker::active_process_native_pid().unwrap();
-
-        // Don't access another process's memory.
-        assert_eq!(active_pid, self.pid);
-
-        let nwritten = nix::sys::uio::process_vm_writev(active_tid, &local, &remote)?;
+        let nwritten = nix::sys::uio::process_vm_writev(self.active_tid(), &local, &remote)?;
         // There shouldn't be any partial writes with a single remote iovec.
         assert_eq!(nwritten, towrite);
         Ok(())
     }
+
+    // Copy each of `srcs` into the corresponding range of process memory in
+    // `dsts`, using as few `process_vm_writev` calls as the iovec limit allows.
+    // Panics if the MemoryManager's process isn't currently active.
+    /// SAFETY: A reference to the process memory must not exist.
+    pub unsafe fn copy_to_ptrs<T: Pod + Debug>(
+        &self,
+        dsts: &[TypedPluginPtr<T>],
+        srcs: &[&[T]],
+    ) -> Result<(), Errno> {
+        assert_eq!(dsts.len(), srcs.len());
+        let mut local = Vec::with_capacity(srcs.len());
+        let mut remote = Vec::with_capacity(dsts.len());
+        for (dst, src) in dsts.iter().zip(srcs) {
+            assert_eq!(dst.len(), src.len());
+            let src: &[std::mem::MaybeUninit<u8>] = pod::to_u8_slice(src);
+            // SAFETY: See `copy_to_ptr`.
+            let src: &[u8] =
+                unsafe { std::slice::from_raw_parts(src.as_ptr() as *const u8, src.len()) };
+            local.push(std::io::IoSlice::new(src));
+            remote.push(nix::sys::uio::RemoteIoVec {
+                base: usize::from(dst.ptr()),
+                len: src.len(),
+            });
+        }
+
+        let active_tid = self.active_tid();
+
+        for (local, remote) in local.chunks(IOV_MAX).zip(remote.chunks(IOV_MAX)) {
+            let towrite: usize = remote.iter().map(|r| r.len).sum();
+            trace!(
+                "write_ptrs writing {} bytes to {} ptrs",
+                towrite,
+                remote.len()
+            );
+            let nwritten = nix::sys::uio::process_vm_writev(active_tid, local, remote)?;
+            // Unlike with a single remote iovec, we can get a partial write if
+            // one of the later ranges isn't accessible.
+            if nwritten != towrite {
+                warn!(
+                    "Tried to write {} bytes but only wrote {}",
+                    towrite, nwritten
+                );
+                return Err(Errno::EFAULT);
+            }
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::host::syscall_types::PluginPtr;
+
+    const RW: i32 = libc::PROT_READ | libc::PROT_WRITE;
+
+    /// Map zeroed anonymous pages in this process with the given protections, which the tests
+    /// access through their addresses as if they were in a plugin.
+    fn mmap_pages(prots: &[i32]) -> usize {
+        let base = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                prots.len() * page_size(),
+                RW,
+                libc::MAP_PRIVATE | libc::MAP_ANONYMOUS,
+                -1,
+                0,
+            )
+        };
+        assert_ne!(base, libc::MAP_FAILED);
+        for (i, prot) in prots.iter().enumerate() {
+            let page = unsafe { base.add(i * page_size()) };
+            assert_eq!(unsafe { libc::mprotect(page, page_size(), *prot) }, 0);
+        }
+        base as usize
+    }
+
+    fn munmap_pages(base: usize, num_pages: usize) {
+        let rv = unsafe { libc::munmap(base as *mut libc::c_void, num_pages * page_size()) };
+        assert_eq!(rv, 0);
+    }
+
+    fn ptr(addr: usize, len: usize) -> TypedPluginPtr<u8> {
+        TypedPluginPtr::new::<u8>(PluginPtr::from(addr), len)
+    }
+
+    fn bytes(addr: usize, len: usize) -> Vec<u8> {
+        unsafe { std::slice::from_raw_parts(addr as *const u8, len) }.to_vec()
+    }
+
+    #[test]
+    fn test_copy_ptrs_more_than_iov_max() {
+        let copier = MemoryCopier::new(Pid::this());
+
+        // enough separate 3-byte ranges for three batches
+        let num_ranges = 2 * IOV_MAX + 1;
+        let num_pages = (num_ranges * 4 + page_size() - 1) / page_size();
+        let base = mmap_pages(&vec![RW; num_pages]);
+        let ranges: Vec<_> = (0..num_ranges).map(|i| ptr(base + 4 * i, 3)).collect();
+
+        let srcs: Vec<Vec<u8>> = (0..num_ranges)
+            .map(|i| vec![i as u8, (i >> 8) as u8, 0xff])
+            .collect();
+        let src_slices: Vec<&[u8]> = srcs.iter().map(|x| &x[..]).collect();
+        unsafe { copier.copy_to_ptrs(&ranges, &src_slices) }.unwrap();
+
+        // each range was written, and the gaps between them weren't
+        for (i, src) in srcs.iter().enumerate() {
+            assert_eq!(bytes(base + 4 * i, 4), [&src[..], &[0]].concat());
+        }
+
+        let mut dsts = vec![vec![0u8; 3]; num_ranges];
+        let mut dst_slices: Vec<&mut [u8]> = dsts.iter_mut().map(|x| &mut x[..]).collect();
+        unsafe { copier.copy_from_ptrs(&mut dst_slices, &ranges) }.unwrap();
+        assert_eq!(dsts, srcs);
+
+        munmap_pages(base, num_pages);
+    }
+
+    #[test]
+    fn test_copy_ptrs_bad_range() {
+        let copier = MemoryCopier::new(Pid::this());
+        let base = mmap_pages(&[RW, libc::PROT_NONE]);
+        let num_ranges = IOV_MAX + 10;
+
+        // a bad range at the start, partway through the first batch, and partway through the
+        // second batch, after the first batch has been copied
+        for bad_index in [0, 5, IOV_MAX + 5] {
+            let mut ranges: Vec<_> = (0..num_ranges).map(|i| ptr(base + i, 1)).collect();
+            ranges[bad_index] = ptr(base + page_size(), 1);
+
+            let mut dsts = vec![[0u8; 1]; num_ranges];
+            let mut dst_slices: Vec<&mut [u8]> = dsts.iter_mut().map(|x| &mut x[..]).collect();
+            assert_eq!(
+                unsafe { copier.copy_from_ptrs(&mut dst_slices, &ranges) },
+                Err(Errno::EFAULT)
+            );
+
+            let srcs = vec![[1u8]; num_ranges];
+            let src_slices: Vec<&[u8]> = srcs.iter().map(|x| &x[..]).collect();
+            assert_eq!(
+                unsafe { copier.copy_to_ptrs(&ranges, &src_slices) },
+                Err(Errno::EFAULT)
+            );
+        }
+
+        munmap_pages(base, 2);
+    }
 }
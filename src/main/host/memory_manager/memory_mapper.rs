@@ -1,3 +1,4 @@
+use crate::host::memory_manager::memory_copier::MemoryCopier;
 use crate::host::memory_manager::{page_size, MemoryManager};
 use crate::host::syscall_types::{PluginPtr, SyscallResult, TypedPluginPtr};
 use crate::host::thread::ThreadRef;
@@ -22,6 +23,14 @@ use std::process;
 const HEAP_PROT: i32 = libc::PROT_READ | libc::PROT_WRITE;
 const STACK_PROT: i32 = libc::PROT_READ | libc::PROT_WRITE;
 
+/// Number of accesses that have to fall back to the (slow) `MemoryCopier` before we try to
+/// migrate the containing region into the shared memory file.
+const HOT_REGION_MISS_THRESHOLD: u32 = 64;
+
+/// Regions larger than this aren't migrated, since doing so requires copying the whole region,
+/// faulting in any pages that the plugin hasn't touched yet.
+const HOT_REGION_MAX_LEN: usize = 64 * (1 << 20); // 64 MB.
+
 // Represents a region of plugin memory.
 #[derive(Clone, Debug)]
 struct Region {
@@ -33,6 +42,39 @@ struct Region {
     original_path: Option<proc_maps::MappingPath>,
 }
 
+/// Counts misses in regions that aren't mapped into Shadow, keyed by the start of the region, to
+/// find the regions that should be migrated into the shared memory file.
+#[derive(Debug, Default)]
+struct HotRegions {
+    misses: HashMap<usize, u32>,
+    /// Start addresses of regions that have reached `HOT_REGION_MISS_THRESHOLD`.
+    hot: Vec<usize>,
+}
+
+impl HotRegions {
+    fn inc_misses(&mut self, start: usize) {
+        let counter = self.misses.entry(start).or_insert(0);
+        *counter += 1;
+        if *counter == HOT_REGION_MISS_THRESHOLD {
+            self.hot.push(start);
+        }
+    }
+
+    /// Forget the misses in the region starting at `start`, e.g. because it was unmapped.
+    fn forget(&mut self, start: usize) {
+        self.misses.remove(&start);
+    }
+
+    /// Take the regions that have reached the threshold, and reset their miss counts.
+    fn take_hot(&mut self) -> Vec<usize> {
+        let hot = std::mem::take(&mut self.hot);
+        for start in &hot {
+            self.misses.remove(start);
+        }
+        hot
+    }
+}
+
 #[allow(dead_code)]
 fn log_regions<It: Iterator<Item = (Interval, Region)>>(level: log::Level, regions: It) {
     if log::log_enabled!(level) {
@@ -69,6 +111,9 @@ pub struct MemoryMapper {
 
     misses_by_path: RefCell<HashMap<String, u32>>,
 
+    /// Misses in regions that aren't mapped into Shadow. See `remap_hot_regions`.
+    hot_regions: RefCell<HotRegions>,
+
     /// The bounds of the heap. Note that before the plugin's first `brk` syscall this will be a
     /// zero-sized interval (though in the case of thread-preload that'll have already happened
     /// before we get control).
@@ -129,13 +174,13 @@ impl ShmFile {
     /// the part of the stack that's already allocated and initialized.
     fn copy_into_file(
         &self,
-        memory_manager: &MemoryManager,
+        memory_copier: &MemoryCopier,
         region_interval: &Interval,
         region: &Region,
         interval: &Interval,
-    ) {
+    ) -> Result<(), nix::errno::Errno> {
         if interval.is_empty() {
-            return;
+            return Ok(());
         }
         assert!(!region.shadow_base.is_null());
         assert!(region_interval.contains(&interval.start));
@@ -148,12 +193,38 @@ impl ShmFile {
             )
         };
 
-        memory_manager
-            .copy_from_ptr(
+        // SAFETY: We're in the middle of (re)mapping the region; no references to it exist.
+        unsafe {
+            memory_copier.copy_from_ptr(
                 dst,
                 TypedPluginPtr::new::<u8>(PluginPtr::from(interval.start), interval.len()),
             )
-            .unwrap()
+        }
+    }
+
+    /// Allocate the region's interval in the file, map it into shadow's address space, and copy the
+    /// region's current contents into it. Returns where it was mapped. If the contents can't be
+    /// copied, the mapping and the space in the file are released again.
+    fn copy_region_into_shadow(
+        &mut self,
+        memory_copier: &MemoryCopier,
+        interval: &Interval,
+        region: &Region,
+    ) -> Result<*mut c_void, nix::errno::Errno> {
+        self.alloc(interval);
+        // Map as writable at first so that we can copy in the current contents.
+        let shadow_base = self.mmap_into_shadow(interval, libc::PROT_READ | libc::PROT_WRITE);
+        let region = Region {
+            shadow_base,
+            ..region.clone()
+        };
+        if let Err(e) = self.copy_into_file(memory_copier, interval, &region, interval) {
+            unsafe { sys::mman::munmap(shadow_base, interval.len()) }
+                .unwrap_or_else(|e| warn!("munmap: {}", e));
+            self.dealloc(interval);
+            return Err(e);
+        }
+        Ok(shadow_base)
     }
 
     /// Map the given range of the file into the plugin's address space.
@@ -172,9 +243,13 @@ impl ShmFile {
 }
 
 /// Get the current mapped regions of the process.
+///
+/// This is the only time we read the process's maps file; afterwards `regions`
+/// is kept up to date from the results of the mmap-family syscalls and `brk`
+/// that we observe (see `handle_mmap_result` et al).
 fn get_regions(pid: Pid) -> IntervalMap<Region> {
     let mut regions = IntervalMap::new();
-    for mapping in proc_maps::mappings_for_pid(pid.as_raw()).unwrap() {
+    proc_maps::for_each_mapping_for_pid(pid.as_raw(), |mapping| {
         let mut prot = 0;
         if mapping.read {
             prot |= libc::PROT_READ;
@@ -196,7 +271,8 @@ fn get_regions(pid: Pid) -> IntervalMap<Region> {
         );
         // Regions shouldn't overlap.
         assert_eq!(mutations.len(), 0);
-    }
+    })
+    .unwrap();
     regions
 }
 
@@ -232,7 +308,14 @@ fn get_heap(
     shm_file.alloc(&heap_interval);
     let mut heap_region = heap_region.clone();
     heap_region.shadow_base = shm_file.mmap_into_shadow(&heap_interval, HEAP_PROT);
-    shm_file.copy_into_file(memory_manager, &heap_interval, &heap_region, &heap_interval);
+    shm_file
+        .copy_into_file(
+            &memory_manager.memory_copier,
+            &heap_interval,
+            &heap_region,
+            &heap_interval,
+        )
+        .unwrap();
     shm_file.mmap_into_plugin(thread, &heap_interval, HEAP_PROT);
 
     {
@@ -282,12 +365,14 @@ fn map_stack(
 
     // Copy the current contents of the remapped part of the current stack, if any.
     if remapped_overlaps_current {
-        shm_file.copy_into_file(
-            memory_manager,
-            &remapped_stack_bounds,
-            &region,
-            &(current_stack_bounds.start..remapped_stack_bounds.end),
-        );
+        shm_file
+            .copy_into_file(
+                &memory_manager.memory_copier,
+                &remapped_stack_bounds,
+                &region,
+                &(current_stack_bounds.start..remapped_stack_bounds.end),
+            )
+            .unwrap();
     }
 
     shm_file.mmap_into_plugin(thread, &remapped_stack_bounds, STACK_PROT);
@@ -306,7 +391,7 @@ impl Drop for MemoryMapper {
         if misses.is_empty() {
             debug!("MemoryManager misses: None");
         } else {
-            debug!("MemoryManager misses: (consider extending MemoryManager to remap regions with a high miss count)");
+            debug!("MemoryManager misses:");
             for (path, count) in misses.iter() {
                 debug!("\t{} in {}", count, path);
             }
@@ -383,10 +468,38 @@ impl MemoryMapper {
             shm_file,
             regions,
             misses_by_path: RefCell::new(HashMap::new()),
+            hot_regions: RefCell::new(HotRegions::default()),
             heap,
         }
     }
 
+    /// A mapper for unit tests that access their own process's memory, in which only `interval`
+    /// is mapped into Shadow, at `shadow_base`. Takes ownership of the mapping at `shadow_base`.
+    #[cfg(test)]
+    pub fn new_for_test(interval: Interval, shadow_base: *mut c_void) -> MemoryMapper {
+        let mut regions = IntervalMap::new();
+        regions.insert(
+            interval,
+            Region {
+                shadow_base,
+                prot: libc::PROT_READ | libc::PROT_WRITE,
+                sharing: Sharing::Private,
+                original_path: None,
+            },
+        );
+        MemoryMapper {
+            shm_file: ShmFile {
+                shm_file: File::open("/dev/null").unwrap(),
+                shm_plugin_fd: -1,
+                len: 0,
+            },
+            regions,
+            misses_by_path: RefCell::new(HashMap::new()),
+            hot_regions: RefCell::new(HotRegions::default()),
+            heap: 0..0,
+        }
+    }
+
     /// Processes the mutations returned by an IntervalMap::insert or IntervalMap::clear operation.
     /// Each mutation describes a mapping that has been partly or completely overwritten (in the
     /// case of an insert) or cleared (in the case of clear).
@@ -534,6 +647,9 @@ impl MemoryMapper {
         let mutations = self.regions.clear(interval.clone());
         self.unmap_mutations(mutations);
 
+        // Don't attribute misses in whatever used to be mapped here to the new region.
+        self.hot_regions.get_mut().forget(interval.start);
+
         if is_anonymous && sharing == Sharing::Private {
             // Overwrite the freshly mapped region with a region from the shared mem file and map
             // it. In principle we might be able to avoid doing the first mmap above in this case,
@@ -1019,13 +1135,115 @@ impl MemoryMapper {
 
     /// Counts accesses where we had to fall back to the thread's (slow) apis.
     fn inc_misses<T: Debug + Pod>(&self, src: TypedPluginPtr<T>) {
-        let key = match self.regions.get(usize::from(src.ptr())) {
+        let interval_and_region = self.regions.get(usize::from(src.ptr()));
+        let key = match &interval_and_region {
             Some((_, original_path)) => format!("{:?}", original_path),
             None => "not found".to_string(),
         };
         let mut misses = self.misses_by_path.borrow_mut();
         let counter = misses.entry(key).or_insert(0);
         *counter += 1;
+
+        // Accesses that miss a region that *is* mapped into Shadow (e.g. because they're
+        // unaligned or straddle two regions) wouldn't be helped by remapping.
+        if let Some((interval, region)) = interval_and_region {
+            if region.shadow_base.is_null() {
+                self.hot_regions.borrow_mut().inc_misses(interval.start);
+            }
+        }
+    }
+
+    /// Whether we know how to migrate the given region into `shm_file`.
+    fn is_remappable(interval: &Interval, region: &Region) -> bool {
+        // Already mapped.
+        if !region.shadow_base.is_null() {
+            return false;
+        }
+        // Other processes (or the file) may observe writes to shared mappings, so they need to
+        // stay backed by what they were originally mapped from.
+        if region.sharing != Sharing::Private {
+            return false;
+        }
+        // We need to be able to read the region to copy it, and mapping executable pages from
+        // the shared memory file requires /dev/shm to be mounted with exec permissions.
+        if region.prot & libc::PROT_READ == 0 || region.prot & libc::PROT_EXEC != 0 {
+            return false;
+        }
+        if interval.len() > HOT_REGION_MAX_LEN {
+            return false;
+        }
+        match &region.original_path {
+            None | Some(MappingPath::Path(_)) => true,
+            // The heap and stack are already handled, and the other special regions are managed
+            // by the kernel.
+            Some(MappingPath::Heap)
+            | Some(MappingPath::InitialStack)
+            | Some(MappingPath::ThreadStack(_))
+            | Some(MappingPath::Vdso)
+            | Some(MappingPath::OtherSpecial(_)) => false,
+        }
+    }
+
+    /// Migrates regions that have had a high number of misses into the shared memory file, so
+    /// that subsequent accesses to them are direct. Like `get_heap`, this copies the current
+    /// contents of each region into the file and then maps the file over the original region
+    /// in the plugin.
+    ///
+    /// `thread` must be running and ready to make native syscalls, and no references to plugin
+    /// memory may be outstanding.
+    pub fn remap_hot_regions(&mut self, thread: &mut ThreadRef, memory_copier: &MemoryCopier) {
+        let hot_regions = self.hot_regions.get_mut().take_hot();
+
+        for start in hot_regions {
+            let (interval, mut region) = match self.regions.get(start) {
+                Some((interval, region))
+                    if interval.start == start && Self::is_remappable(&interval, region) =>
+                {
+                    (interval, region.clone())
+                }
+                _ => continue,
+            };
+
+            let copied = self
+                .shm_file
+                .copy_region_into_shadow(memory_copier, &interval, &region);
+            region.shadow_base = match copied {
+                Ok(x) => x,
+                Err(e) => {
+                    // e.g. a file mapping that extends beyond the end of the file. Leave the
+                    // original mapping in place.
+                    debug!(
+                        "Couldn't copy region {:x}-{:x} {:?}: {}",
+                        interval.start, interval.end, region, e
+                    );
+                    continue;
+                }
+            };
+            self.shm_file
+                .mmap_into_plugin(thread, &interval, region.prot);
+            if region.prot != libc::PROT_READ | libc::PROT_WRITE {
+                // Mirror the plugin's protections; see `handle_mprotect`.
+                unsafe {
+                    sys::mman::mprotect(
+                        region.shadow_base,
+                        interval.len(),
+                        sys::mman::ProtFlags::from_bits(region.prot).unwrap(),
+                    )
+                }
+                .unwrap_or_else(|e| warn!("mprotect: {}", e));
+            }
+
+            trace!(
+                "Remapped hot region {:x}-{:x} {:?}",
+                interval.start,
+                interval.end,
+                region
+            );
+
+            // Should have overwritten exactly the old region.
+            let mutations = self.regions.insert(interval, region);
+            debug_assert_eq!(mutations.len(), 1);
+        }
     }
 }
 
@@ -1037,3 +1255,196 @@ impl MemoryMapper {
 fn test_validate_void_size() {
     assert_eq!(std::mem::size_of::<c_void>(), 1);
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use std::sync::atomic::{AtomicU32, Ordering};
+
+    const RW: i32 = libc::PROT_READ | libc::PROT_WRITE;
+
+    fn region(prot: i32, sharing: Sharing, original_path: Option<MappingPath>) -> Region {
+        Region {
+            shadow_base: std::ptr::null_mut(),
+            prot,
+            sharing,
+            original_path,
+        }
+    }
+
+    /// An unlinked shared memory file, like the one that `MemoryMapper::new` creates.
+    fn shm_file() -> ShmFile {
+        static NEXT_ID: AtomicU32 = AtomicU32::new(0);
+        let path = format!(
+            "/dev/shm/shadow_memory_mapper_test_{}_{}",
+            process::id(),
+            NEXT_ID.fetch_add(1, Ordering::Relaxed)
+        );
+        let shm_file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create_new(true)
+            .open(&path)
+            .unwrap();
+        std::fs::remove_file(&path).unwrap();
+        ShmFile {
+            shm_file,
+            shm_plugin_fd: -1,
+            len: 0,
+        }
+    }
+
+    /// Map anonymous pages in this process with the given protections, filled with a pattern.
+    fn mmap_pages(prots: &[i32]) -> Interval {
+        let len = prots.len() * page_size();
+        let base = unsafe {
+            sys::mman::mmap(
+                std::ptr::null_mut(),
+                len,
+                sys::mman::ProtFlags::from_bits(RW).unwrap(),
+                sys::mman::MapFlags::MAP_PRIVATE | sys::mman::MapFlags::MAP_ANONYMOUS,
+                -1,
+                0,
+            )
+        }
+        .unwrap();
+
+        let bytes = unsafe { std::slice::from_raw_parts_mut(base as *mut u8, len) };
+        for (i, x) in bytes.iter_mut().enumerate() {
+            *x = (i % 251) as u8;
+        }
+
+        for (i, prot) in prots.iter().enumerate() {
+            unsafe {
+                sys::mman::mprotect(
+                    base.add(i * page_size()),
+                    page_size(),
+                    sys::mman::ProtFlags::from_bits(*prot).unwrap(),
+                )
+            }
+            .unwrap();
+        }
+
+        let start = base as usize;
+        start..(start + len)
+    }
+
+    fn munmap(base: *mut c_void, interval: &Interval) {
+        unsafe { sys::mman::munmap(base, interval.len()) }.unwrap();
+    }
+
+    #[test]
+    fn test_hot_regions() {
+        let mut hot_regions = HotRegions::default();
+
+        for _ in 0..(HOT_REGION_MISS_THRESHOLD - 1) {
+            hot_regions.inc_misses(0x1000);
+            hot_regions.inc_misses(0x2000);
+        }
+        assert_eq!(hot_regions.take_hot(), Vec::<usize>::new());
+
+        // reaching the threshold makes a region hot once, however many more misses it has
+        hot_regions.inc_misses(0x1000);
+        hot_regions.inc_misses(0x1000);
+
+        // forgetting a region resets its count
+        hot_regions.forget(0x2000);
+        hot_regions.inc_misses(0x2000);
+
+        assert_eq!(hot_regions.take_hot(), vec![0x1000]);
+
+        // as does taking it
+        hot_regions.inc_misses(0x1000);
+        assert_eq!(hot_regions.take_hot(), Vec::<usize>::new());
+    }
+
+    #[test]
+    fn test_is_remappable() {
+        let interval = 0x1000..0x3000;
+        let is_remappable = |x| MemoryMapper::is_remappable(&interval, &x);
+
+        assert!(is_remappable(region(RW, Sharing::Private, None)));
+        assert!(is_remappable(region(
+            libc::PROT_READ,
+            Sharing::Private,
+            Some(MappingPath::Path(PathBuf::from("/lib/libc.so.6")))
+        )));
+
+        assert!(!is_remappable(Region {
+            shadow_base: std::ptr::NonNull::dangling().as_ptr(),
+            ..region(RW, Sharing::Private, None)
+        }));
+        assert!(!is_remappable(region(RW, Sharing::Shared, None)));
+        assert!(!is_remappable(region(
+            libc::PROT_WRITE,
+            Sharing::Private,
+            None
+        )));
+        assert!(!is_remappable(region(
+            libc::PROT_READ | libc::PROT_EXEC,
+            Sharing::Private,
+            None
+        )));
+        for path in [
+            MappingPath::Heap,
+            MappingPath::InitialStack,
+            MappingPath::ThreadStack(1),
+            MappingPath::Vdso,
+            MappingPath::OtherSpecial("[vvar]".to_string()),
+        ] {
+            assert!(!is_remappable(region(RW, Sharing::Private, Some(path))));
+        }
+
+        let large = 0..(HOT_REGION_MAX_LEN + page_size());
+        assert!(!MemoryMapper::is_remappable(
+            &large,
+            &region(RW, Sharing::Private, None)
+        ));
+    }
+
+    #[test]
+    fn test_copy_region_into_shadow() {
+        let interval = mmap_pages(&[RW, libc::PROT_READ]);
+        let memory_copier = MemoryCopier::new(Pid::this());
+        let mut shm_file = shm_file();
+
+        let shadow_base = shm_file
+            .copy_region_into_shadow(
+                &memory_copier,
+                &interval,
+                &region(RW, Sharing::Private, None),
+            )
+            .unwrap();
+
+        let original =
+            unsafe { std::slice::from_raw_parts(interval.start as *const u8, interval.len()) };
+        let copied =
+            unsafe { std::slice::from_raw_parts(shadow_base as *const u8, interval.len()) };
+        assert_eq!(copied, original);
+
+        munmap(shadow_base, &interval);
+        munmap(interval.start as *mut c_void, &interval);
+    }
+
+    #[test]
+    fn test_copy_region_into_shadow_error() {
+        // only the first page can be read, so the copy fails after writing part of the file
+        let interval = mmap_pages(&[RW, libc::PROT_NONE]);
+        let memory_copier = MemoryCopier::new(Pid::this());
+        let mut shm_file = shm_file();
+
+        let rv = shm_file.copy_region_into_shadow(
+            &memory_copier,
+            &interval,
+            &region(RW, Sharing::Private, None),
+        );
+        assert_eq!(rv, Err(nix::errno::Errno::EFAULT));
+
+        // the part of the file that was written has been released
+        let stat = nix::sys::stat::fstat(shm_file.shm_file.as_raw_fd()).unwrap();
+        assert_eq!(stat.st_blocks, 0);
+
+        munmap(interval.start as *mut c_void, &interval);
+    }
+}
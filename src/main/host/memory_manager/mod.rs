@@ -15,6 +15,7 @@
 //! all access to process memory must go through it. This includes servicing syscalls that
 //! modify the process address space (such as `mmap`).
 
+use crate::core::worker::Worker;
 use crate::cshadow as c;
 use crate::host::syscall_types::{PluginPtr, SyscallError, SyscallResult, TypedPluginPtr};
 use crate::host::thread::ThreadRef;
@@ -287,6 +288,50 @@ fn page_size() -> usize {
         .unwrap()
 }
 
+/// The active thread's syscall-argument scratch area, if it has one. The shim
+/// stages large syscall buffers there, and since it's shared memory we can
+/// access it in place rather than going through the `MemoryCopier`.
+#[derive(Debug, Copy, Clone)]
+pub struct ShmemScratch {
+    plugin_base: usize,
+    shadow_base: *mut u8,
+    len: usize,
+}
+
+impl ShmemScratch {
+    /// Returns the scratch area registered for `thread`, if any.
+    pub fn for_thread(thread: &ThreadRef) -> Option<Self> {
+        let mut plugin_base = c::PluginPtr { val: 0 };
+        let mut len = 0;
+        let shadow_base =
+            unsafe { c::thread_getShmemScratch(thread.cthread(), &mut plugin_base, &mut len) };
+        if shadow_base.is_null() {
+            return None;
+        }
+        Some(Self {
+            plugin_base: usize::try_from(plugin_base.val).unwrap(),
+            shadow_base: shadow_base as *mut u8,
+            len: len.try_into().unwrap(),
+        })
+    }
+
+    /// Shadow's pointer to `ptr`, if it lies entirely within the scratch area
+    /// and is suitably aligned for `T`.
+    fn translate<T>(&self, ptr: TypedPluginPtr<T>) -> Option<*mut T> {
+        let start = usize::from(ptr.ptr());
+        let len = ptr.len().checked_mul(std::mem::size_of::<T>())?;
+        let offset = start.checked_sub(self.plugin_base)?;
+        if offset.checked_add(len)? > self.len {
+            return None;
+        }
+        let shadow_ptr = unsafe { self.shadow_base.add(offset) };
+        if shadow_ptr as usize % std::mem::align_of::<T>() != 0 {
+            return None;
+        }
+        Some(shadow_ptr as *mut T)
+    }
+}
+
 /// Provides accessors for reading and writing another process's memory.
 /// When in use, any operation that touches that process's memory must go
 /// through the MemoryManager to ensure soundness. See MemoryManager::new.
@@ -338,6 +383,11 @@ impl MemoryManager {
     // `memory_mapper`.  Calling methods should fall back to the `memory_copier`
     // on failure.
     fn mapped_ref<'a, T: Pod + Debug>(&'a self, ptr: TypedPluginPtr<T>) -> Option<&[T]> {
+        if let Some(p) = Worker::active_thread_shmem_scratch().and_then(|s| s.translate(ptr)) {
+            // SAFETY: The scratch area is only written by the managed thread,
+            // which is stopped while we're handling its syscall.
+            return Some(unsafe { std::slice::from_raw_parts(p, ptr.len()) });
+        }
         let mm = self.memory_mapper.as_ref()?;
         // SAFETY: No mutable refs to process memory exist by preconditions of
         // MemoryManager::new + we have a reference.
@@ -348,6 +398,10 @@ impl MemoryManager {
     // `memory_mapper`.  Calling methods should fall back to the `memory_copier`
     // on failure.
     fn mapped_mut<'a, T: Pod + Debug>(&'a mut self, ptr: TypedPluginPtr<T>) -> Option<&mut [T]> {
+        if let Some(p) = Worker::active_thread_shmem_scratch().and_then(|s| s.translate(ptr)) {
+            // SAFETY: As in `mapped_ref`, plus we have an exclusive reference.
+            return Some(unsafe { std::slice::from_raw_parts_mut(p, ptr.len()) });
+        }
         let mm = self.memory_mapper.as_ref()?;
         // SAFETY: No other refs to process memory exist by preconditions of
         // MemoryManager::new + we have an exclusive reference.
@@ -434,6 +488,35 @@ impl MemoryManager {
         unsafe { self.memory_copier.copy_from_ptr(dst, src) }
     }
 
+    /// Copies each of `srcs` into the corresponding buffer in `dsts`. Ranges
+    /// that are mapped into Shadow are copied directly, and the rest are
+    /// gathered into a single vectored `process_vm_readv` instead of one
+    /// syscall per range.
+    pub fn copy_from_ptrs<T: Debug + Pod>(
+        &self,
+        dsts: &mut [&mut [T]],
+        srcs: &[TypedPluginPtr<T>],
+    ) -> Result<(), Errno> {
+        assert_eq!(dsts.len(), srcs.len());
+        let mut unmapped_dsts = Vec::new();
+        let mut unmapped_srcs = Vec::new();
+        for (dst, src) in dsts.iter_mut().zip(srcs) {
+            if let Some(mapped) = self.mapped_ref(*src) {
+                dst.copy_from_slice(mapped);
+            } else {
+                unmapped_dsts.push(&mut **dst);
+                unmapped_srcs.push(*src);
+            }
+        }
+        if unmapped_srcs.is_empty() {
+            return Ok(());
+        }
+        unsafe {
+            self.memory_copier
+                .copy_from_ptrs(&mut unmapped_dsts, &unmapped_srcs)
+        }
+    }
+
     // Copies memory from the beginning of the given pointer to the last address
     // in the pointer that's accessible. Not exposed as a public interface
     // because this is generally only useful for strings, and
@@ -556,6 +639,36 @@ impl MemoryManager {
         unsafe { self.memory_copier.copy_to_ptr(dst, src) }
     }
 
+    /// Writes each of `srcs` into the corresponding range in `dsts`. Like
+    /// `copy_from_ptrs`, ranges that aren't mapped into Shadow are batched into
+    /// a single vectored `process_vm_writev`.
+    pub fn copy_to_ptrs<T: Pod + Debug>(
+        &mut self,
+        dsts: &[TypedPluginPtr<T>],
+        srcs: &[&[T]],
+    ) -> Result<(), Errno> {
+        assert_eq!(dsts.len(), srcs.len());
+        let mut unmapped_dsts = Vec::new();
+        let mut unmapped_srcs = Vec::new();
+        for (dst, src) in dsts.iter().zip(srcs) {
+            if let Some(mapped) = self.mapped_mut(*dst) {
+                mapped.copy_from_slice(src);
+            } else {
+                unmapped_dsts.push(*dst);
+                unmapped_srcs.push(*src);
+            }
+        }
+        if unmapped_srcs.is_empty() {
+            return Ok(());
+        }
+        // SAFETY: No other refs to process memory exist by preconditions of
+        // MemoryManager::new + we have an exclusive reference.
+        unsafe {
+            self.memory_copier
+                .copy_to_ptrs(&unmapped_dsts, &unmapped_srcs)
+        }
+    }
+
     /// Which process's address space this MemoryManager manages.
     pub fn pid(&self) -> Pid {
         self.pid
@@ -568,6 +681,15 @@ impl MemoryManager {
         self.memory_mapper = Some(MemoryMapper::new(self, thread));
     }
 
+    /// Migrate regions of plugin memory that are frequently accessed through the
+    /// (slow) `MemoryCopier` into the MemoryMapper's shared memory file. Needs a
+    /// running thread, and no outstanding references to process memory.
+    pub fn remap_hot_regions(&mut self, thread: &mut ThreadRef) {
+        if let Some(mm) = &mut self.memory_mapper {
+            mm.remap_hot_regions(thread, &self.memory_copier);
+        }
+    }
+
     /// Whether the internal MemoryMapper has been initialized.
     pub fn has_mapper(&self) -> bool {
         self.memory_mapper.is_some()
@@ -811,6 +933,21 @@ mod export {
         }
     }
 
+    /// Migrate frequently-missed regions into the MemoryMapper, if it's
+    /// initialized. `thread` must be running and ready to make native syscalls,
+    /// and all plugin pointers must have already been flushed.
+    #[no_mangle]
+    pub unsafe extern "C" fn memorymanager_remapHotRegions(
+        memory_manager: *mut MemoryManager,
+        thread: *mut c::Thread,
+    ) {
+        let memory_manager = unsafe { memory_manager.as_mut().unwrap() };
+        if memory_manager.has_mapper() {
+            let mut thread = unsafe { ThreadRef::new(notnull_mut_debug(thread)) };
+            memory_manager.remap_hot_regions(&mut thread)
+        }
+    }
+
     #[no_mangle]
     pub unsafe extern "C" fn memorymanager_freeRef<'a>(memory_ref: *mut ProcessMemoryRef<'a, u8>) {
         unsafe { Box::from_raw(notnull_mut_debug(memory_ref)) };
@@ -907,6 +1044,84 @@ mod export {
         }
     }
 
+    /// Copy data from `n` ranges of this reader's memory: `lens[i]` bytes from
+    /// `srcs[i]` into `dsts[i]`. Ranges that aren't mapped into Shadow are read
+    /// with a single syscall.
+    #[no_mangle]
+    pub unsafe extern "C" fn memorymanager_readPtrs(
+        memory_manager: *const MemoryManager,
+        dsts: *const *mut c_void,
+        srcs: *const c::PluginPtr,
+        lens: *const libc::size_t,
+        n: usize,
+    ) -> i32 {
+        if n == 0 {
+            return 0;
+        }
+        let memory_manager = unsafe { memory_manager.as_ref().unwrap() };
+        let dsts = unsafe { std::slice::from_raw_parts(notnull_debug(dsts), n) };
+        let srcs = unsafe { std::slice::from_raw_parts(notnull_debug(srcs), n) };
+        let lens = unsafe { std::slice::from_raw_parts(notnull_debug(lens), n) };
+        let mut dst_slices: Vec<&mut [u8]> = dsts
+            .iter()
+            .zip(lens)
+            .map(|(dst, len)| unsafe {
+                std::slice::from_raw_parts_mut(notnull_mut_debug(*dst) as *mut u8, *len)
+            })
+            .collect();
+        let src_ptrs: Vec<TypedPluginPtr<u8>> = srcs
+            .iter()
+            .zip(lens)
+            .map(|(src, len)| TypedPluginPtr::new::<u8>(PluginPtr::from(*src), *len))
+            .collect();
+        match memory_manager.copy_from_ptrs(&mut dst_slices, &src_ptrs) {
+            Ok(_) => 0,
+            Err(e) => {
+                trace!("Couldn't read {:?}: {:?}", src_ptrs, e);
+                -(e as i32)
+            }
+        }
+    }
+
+    /// Write data to `n` ranges of this writer's memory: `lens[i]` bytes from
+    /// `srcs[i]` into `dsts[i]`. Ranges that aren't mapped into Shadow are
+    /// written with a single syscall.
+    #[no_mangle]
+    pub unsafe extern "C" fn memorymanager_writePtrs(
+        memory_manager: *mut MemoryManager,
+        dsts: *const c::PluginPtr,
+        srcs: *const *const c_void,
+        lens: *const libc::size_t,
+        n: usize,
+    ) -> i32 {
+        if n == 0 {
+            return 0;
+        }
+        let memory_manager = unsafe { memory_manager.as_mut().unwrap() };
+        let dsts = unsafe { std::slice::from_raw_parts(notnull_debug(dsts), n) };
+        let srcs = unsafe { std::slice::from_raw_parts(notnull_debug(srcs), n) };
+        let lens = unsafe { std::slice::from_raw_parts(notnull_debug(lens), n) };
+        let dst_ptrs: Vec<TypedPluginPtr<u8>> = dsts
+            .iter()
+            .zip(lens)
+            .map(|(dst, len)| TypedPluginPtr::new::<u8>(PluginPtr::from(*dst), *len))
+            .collect();
+        let src_slices: Vec<&[u8]> = srcs
+            .iter()
+            .zip(lens)
+            .map(|(src, len)| unsafe {
+                std::slice::from_raw_parts(notnull_debug(*src) as *const u8, *len)
+            })
+            .collect();
+        match memory_manager.copy_to_ptrs(&dst_ptrs, &src_slices) {
+            Ok(_) => 0,
+            Err(e) => {
+                trace!("Couldn't write {:?}: {:?}", dst_ptrs, e);
+                -(e as i32)
+            }
+        }
+    }
+
     /// Write data to this writer's memory.
     #[no_mangle]
     pub unsafe extern "C" fn memorymanager_writePtr(
@@ -946,6 +1161,23 @@ mod export {
         }
     }
 
+    /// Get Shadow's pointer to the specified plugin memory if it's mapped into
+    /// Shadow's address space, or NULL if it isn't. Nothing is copied; reads
+    /// and writes through the pointer access the plugin's memory directly.
+    #[no_mangle]
+    pub unsafe extern "C" fn memorymanager_getMappedPtr(
+        memory_manager: *mut MemoryManager,
+        plugin_src: c::PluginPtr,
+        n: usize,
+    ) -> *mut c_void {
+        let memory_manager = unsafe { memory_manager.as_mut().unwrap() };
+        let plugin_src = TypedPluginPtr::new::<u8>(PluginPtr::from(plugin_src), n);
+        match memory_manager.mapped_mut(plugin_src) {
+            Some(mref) => mref.as_mut_ptr() as *mut c_void,
+            None => std::ptr::null_mut(),
+        }
+    }
+
     /// Get a readable and writable pointer to this writer's memory.
     #[no_mangle]
     pub unsafe extern "C" fn memorymanager_getMutablePtr<'a>(
@@ -1100,3 +1332,131 @@ mod export {
             .into()
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use memory_copier::IOV_MAX;
+
+    const RW: i32 = libc::PROT_READ | libc::PROT_WRITE;
+
+    /// Map zeroed anonymous pages in this process with the given protections, which the tests
+    /// access through their addresses as if they were in a plugin.
+    fn mmap_pages(prots: &[i32]) -> usize {
+        let base = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                prots.len() * page_size(),
+                RW,
+                libc::MAP_PRIVATE | libc::MAP_ANONYMOUS,
+                -1,
+                0,
+            )
+        };
+        assert_ne!(base, libc::MAP_FAILED);
+        for (i, prot) in prots.iter().enumerate() {
+            let page = unsafe { base.add(i * page_size()) };
+            assert_eq!(unsafe { libc::mprotect(page, page_size(), *prot) }, 0);
+        }
+        base as usize
+    }
+
+    fn munmap_pages(base: usize, num_pages: usize) {
+        let rv = unsafe { libc::munmap(base as *mut libc::c_void, num_pages * page_size()) };
+        assert_eq!(rv, 0);
+    }
+
+    fn ptr(addr: usize, len: usize) -> TypedPluginPtr<u8> {
+        TypedPluginPtr::new::<u8>(PluginPtr::from(addr), len)
+    }
+
+    fn bytes(addr: usize, len: usize) -> Vec<u8> {
+        unsafe { std::slice::from_raw_parts(addr as *const u8, len) }.to_vec()
+    }
+
+    /// A MemoryManager for this process, in which the page at `plugin_base` is mapped into Shadow
+    /// at the separate page at `shadow_base`, so that tests can tell which ranges were accessed
+    /// through the mapping. The rest of the address space is accessed through the copier.
+    fn memory_manager(plugin_base: usize, shadow_base: usize) -> MemoryManager {
+        let interval = plugin_base..(plugin_base + page_size());
+        MemoryManager {
+            memory_copier: MemoryCopier::new(Pid::this()),
+            memory_mapper: Some(MemoryMapper::new_for_test(
+                interval,
+                shadow_base as *mut c_void,
+            )),
+            pid: Pid::this(),
+        }
+    }
+
+    #[test]
+    fn test_copy_ptrs_mixed() {
+        // the first page is mapped into Shadow and the second isn't
+        let plugin_base = mmap_pages(&[RW, RW]);
+        let shadow_base = mmap_pages(&[RW]);
+        let mut mm = memory_manager(plugin_base, shadow_base);
+        let mapped = |offset, len| ptr(plugin_base + offset, len);
+        let unmapped = |offset, len| ptr(plugin_base + page_size() + offset, len);
+
+        let ranges = [mapped(0, 3), unmapped(0, 3), mapped(8, 2), unmapped(8, 2)];
+        let srcs: [&[u8]; 4] = [b"abc", b"def", b"gh", b"ij"];
+        mm.copy_to_ptrs(&ranges, &srcs).unwrap();
+
+        // the mapped ranges were written through Shadow's mapping
+        assert_eq!(bytes(shadow_base, 10), b"abc\0\0\0\0\0gh");
+        assert_eq!(bytes(plugin_base, 10), [0; 10]);
+        assert_eq!(bytes(plugin_base + page_size(), 10), b"def\0\0\0\0\0ij");
+
+        // and are read through it, while a range that straddles the mapped and unmapped pages is
+        // copied from the plugin's pages
+        let ranges = [
+            mapped(0, 3),
+            unmapped(0, 3),
+            mapped(page_size() - 2, 4),
+            mapped(8, 2),
+        ];
+        let mut dsts: Vec<Vec<u8>> = ranges.iter().map(|r| vec![0; r.len()]).collect();
+        let mut dst_slices: Vec<&mut [u8]> = dsts.iter_mut().map(|x| &mut x[..]).collect();
+        mm.copy_from_ptrs(&mut dst_slices, &ranges).unwrap();
+        assert_eq!(dsts, [&b"abc"[..], b"def", b"\0\0de", b"gh"]);
+
+        drop(mm);
+        munmap_pages(plugin_base, 2);
+    }
+
+    #[test]
+    fn test_copy_ptrs_more_than_iov_max() {
+        let plugin_base = mmap_pages(&[RW, RW, libc::PROT_NONE]);
+        let mut mm = memory_manager(plugin_base, mmap_pages(&[RW]));
+
+        // alternate between mapped and unmapped ranges, with enough unmapped ranges for two
+        // batches of the copier
+        let num_ranges = 2 * (IOV_MAX + 10);
+        let mut ranges: Vec<_> = (0..num_ranges)
+            .map(|i| ptr(plugin_base + (i % 2) * page_size() + i / 2, 1))
+            .collect();
+
+        let srcs: Vec<[u8; 1]> = (0..num_ranges).map(|i| [i as u8 | 1]).collect();
+        let src_slices: Vec<&[u8]> = srcs.iter().map(|x| &x[..]).collect();
+        mm.copy_to_ptrs(&ranges, &src_slices).unwrap();
+
+        let mut dsts = vec![[0u8; 1]; num_ranges];
+        let mut dst_slices: Vec<&mut [u8]> = dsts.iter_mut().map(|x| &mut x[..]).collect();
+        mm.copy_from_ptrs(&mut dst_slices, &ranges).unwrap();
+        assert_eq!(dsts, srcs);
+
+        // a bad unmapped range partway through the second batch fails the whole copy
+        ranges[2 * (IOV_MAX + 5) + 1] = ptr(plugin_base + 2 * page_size(), 1);
+
+        let mut dst_slices: Vec<&mut [u8]> = dsts.iter_mut().map(|x| &mut x[..]).collect();
+        assert_eq!(
+            mm.copy_from_ptrs(&mut dst_slices, &ranges),
+            Err(Errno::EFAULT)
+        );
+        assert_eq!(mm.copy_to_ptrs(&ranges, &src_slices), Err(Errno::EFAULT));
+
+        drop(mm);
+        munmap_pages(plugin_base, 3);
+    }
+}
@@ -10,3 +10,4 @@ pub mod syscall_condition;
 pub mod syscall_types;
 pub mod thread;
 pub mod timer;
+pub mod tracker_metrics;
@@ -58,7 +58,7 @@ struct _NetworkInterface {
     bool tb_receive_refill_pending;
 
     /* To support capturing incoming and outgoing packets */
-    PcapWriter_BufWriter_File* pcap;
+    PcapInterface* pcap;
 
     MAGIC_DECLARE;
 };
@@ -221,18 +221,8 @@ void networkinterface_disassociate(NetworkInterface* interface, const CompatSock
 static void _networkinterface_capturePacket(NetworkInterface* interface, Packet* packet) {
     utility_debugAssert(interface->pcap != NULL);
 
-    /* get the current time that the packet is being sent/received */
-    CSimulationTime now = worker_getCurrentSimulationTime();
-    guint32 ts_sec = now / SIMTIME_ONE_SECOND;
-    guint32 ts_usec = (now % SIMTIME_ONE_SECOND) / SIMTIME_ONE_MICROSECOND;
-
-    int error = pcapwriter_writePacket(interface->pcap, ts_sec, ts_usec, packet);
-    if (error) {
-        /* if there was a non-recoverable error */
-        warning("Fatal pcap logging error; stopping pcap logging for current interface");
-        pcapwriter_free(interface->pcap);
-        interface->pcap = NULL;
-    }
+    /* the packet is written asynchronously by the capture thread */
+    pcapcapture_capturePacket(interface->pcap, worker_getCurrentSimulationTime(), packet);
 }
 
 static CompatSocket _boundsockets_lookup(GHashTable* table, gchar* key) {
@@ -622,8 +612,8 @@ void networkinterface_wantsSend(NetworkInterface* interface, const Host* host,
     _networkinterface_sendPackets(interface, host);
 }
 
-NetworkInterface* networkinterface_new(Address* address, const gchar* pcapDir,
-                                       guint32 pcapCaptureSize, QDiscMode qdisc, bool uses_router) {
+NetworkInterface* networkinterface_new(Address* address, PcapInterface* pcap, QDiscMode qdisc,
+                                       bool uses_router) {
     NetworkInterface* interface = g_new0(NetworkInterface, 1);
     MAGIC_INIT(interface);
 
@@ -641,21 +631,8 @@ NetworkInterface* networkinterface_new(Address* address, const gchar* pcapDir,
     /* parse queuing discipline */
     interface->qdisc = qdisc;
 
-    if (pcapDir != NULL) {
-        GString* filename = g_string_new(NULL);
-        g_string_append(filename, pcapDir);
-
-        /* Append trailing slash if not present */
-        if (!g_str_has_suffix(filename->str, "/")) {
-            g_string_append(filename, "/");
-        }
-
-        g_string_append_printf(filename, "%s-%s.pcap", address_toHostName(interface->address),
-                               address_toHostIPString(interface->address));
-
-        interface->pcap = pcapwriter_new(filename->str, pcapCaptureSize);
-        g_string_free(filename, TRUE);
-    }
+    /* we take ownership of the pcap interface, if any */
+    interface->pcap = pcap;
 
     interface->uses_router = uses_router;
 
@@ -663,7 +640,7 @@ NetworkInterface* networkinterface_new(Address* address, const gchar* pcapDir,
           address_toHostName(interface->address), address_toHostIPString(interface->address),
           interface->qdisc == Q_DISC_MODE_ROUND_ROBIN ? "rr" : "fifo");
 
-    worker_count_allocation(NetworkInterface);
+    worker_count_allocation(NETWORK_INTERFACE);
     return interface;
 }
 
@@ -679,12 +656,12 @@ void networkinterface_free(NetworkInterface* interface) {
     address_unref(interface->address);
 
     if(interface->pcap) {
-        pcapwriter_free(interface->pcap);
+        pcapcapture_freeInterface(interface->pcap);
     }
 
     MAGIC_CLEAR(interface);
     g_free(interface);
 
-    worker_count_deallocation(NetworkInterface);
+    worker_count_deallocation(NETWORK_INTERFACE);
 }
 
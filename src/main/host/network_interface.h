@@ -12,14 +12,15 @@
 
 typedef struct _NetworkInterface NetworkInterface;
 
+#include "main/bindings/c/bindings-opaque.h"
 #include "main/core/support/definitions.h"
 #include "main/host/descriptor/compat_socket.h"
 #include "main/host/descriptor/socket.h"
 #include "main/host/protocol.h"
 #include "main/routing/address.h"
 
-NetworkInterface* networkinterface_new(Address* address, const gchar* pcapDir,
-                                       guint32 pcapCaptureSize, QDiscMode qdisc, bool uses_router);
+NetworkInterface* networkinterface_new(Address* address, PcapInterface* pcap, QDiscMode qdisc,
+                                       bool uses_router);
 void networkinterface_free(NetworkInterface* interface);
 
 /* The address and ports must be in network byte order. */
@@ -1,11 +1,12 @@
-use std::path::PathBuf;
+use std::ffi::CStr;
 
 use libc::{in_addr_t, in_port_t};
 
 use crate::core::support::configuration::QDiscMode;
 use crate::cshadow as c;
 use crate::host::host::Host;
-use crate::utility::{self, HostTreePointer};
+use crate::network::pcap_capture::{PcapInterface, PcapOptions};
+use crate::utility::HostTreePointer;
 use shadow_shim_helper_rs::HostId;
 
 /// Represents a network device that can send and receive packets. All accesses
@@ -24,19 +25,19 @@ impl NetworkInterface {
     pub unsafe fn new(
         host_id: HostId,
         addr: *mut c::Address,
-        maybe_pcap_dir: Option<PathBuf>,
-        pcap_capture_size: u32,
+        maybe_pcap_options: Option<&PcapOptions>,
         qdisc: QDiscMode,
         uses_router: bool,
     ) -> NetworkInterface {
-        let maybe_pcap_dir = maybe_pcap_dir.map(|p| utility::pathbuf_to_nul_term_cstring(p));
-        let pcap_dir_cptr = maybe_pcap_dir
-            .as_ref()
-            .map_or(std::ptr::null(), |p| p.as_ptr());
+        let pcap = maybe_pcap_options.map_or(std::ptr::null_mut(), |options| {
+            let hostname = unsafe { CStr::from_ptr(c::address_toHostName(addr)) };
+            let ip = unsafe { CStr::from_ptr(c::address_toHostIPString(addr)) };
+            let name = format!("{}-{}", hostname.to_str().unwrap(), ip.to_str().unwrap());
+            Box::into_raw(Box::new(PcapInterface::new(&name, options)))
+        });
 
-        let c_ptr = unsafe {
-            c::networkinterface_new(addr, pcap_dir_cptr, pcap_capture_size, qdisc, uses_router)
-        };
+        // the C interface takes ownership of the pcap interface
+        let c_ptr = unsafe { c::networkinterface_new(addr, pcap, qdisc, uses_router) };
 
         NetworkInterface {
             c_ptr: HostTreePointer::new_for_host(host_id, c_ptr),
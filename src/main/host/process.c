@@ -561,6 +561,10 @@ static void _process_start(Process* proc) {
         proc->straceFd = open(straceFileName, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC,
                               S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
         g_free(straceFileName);
+
+        if (proc->straceFd >= 0 && proc->straceLoggingMode == STRACE_FMT_MODE_DEFERRED) {
+            stracewriter_register(proc->straceFd);
+        }
     }
 
     // tid of first thread of a process is equal to the pid.
@@ -913,7 +917,7 @@ Process* process_new(const Host* host, guint processID, CSimulationTime startTim
     // timer_new clones the task; we don't need our own reference anymore.
     taskref_drop(task);
 
-    worker_count_allocation(Process);
+    worker_count_allocation(PROCESS);
 
     return proc;
 }
@@ -964,6 +968,10 @@ static void _process_free(Process* proc) {
         legacyfile_unref((LegacyFile*)proc->stdoutFile);
     }
     if (proc->straceFd >= 0) {
+        // the writer thread must stop using this fd before it can be reused
+        if (proc->straceLoggingMode == STRACE_FMT_MODE_DEFERRED) {
+            stracewriter_deregister(proc->straceFd);
+        }
         close(proc->straceFd);
     }
 
@@ -979,7 +987,7 @@ static void _process_free(Process* proc) {
 
     shmemallocator_globalFree(&proc->shimSharedMemBlock);
 
-    worker_count_deallocation(Process);
+    worker_count_deallocation(PROCESS);
 
     MAGIC_CLEAR(proc);
     g_free(proc);
@@ -1060,6 +1068,16 @@ int process_readPtr(Process* proc, void* dst, PluginVirtualPtr src, size_t n) {
     return memorymanager_readPtr(proc->memoryManager, dst, src, n);
 }
 
+int process_readPtrs(Process* proc, void* const* dsts, const PluginPtr* srcs, const size_t* lens,
+                     size_t n) {
+    MAGIC_ASSERT(proc);
+
+    // Disallow additional references while there's a mutable reference.
+    utility_debugAssert(!proc->memoryMutRef);
+
+    return memorymanager_readPtrs(proc->memoryManager, dsts, srcs, lens, n);
+}
+
 int process_writePtr(Process* proc, PluginVirtualPtr dst, const void* src, size_t n) {
     MAGIC_ASSERT(proc);
 
@@ -1070,6 +1088,17 @@ int process_writePtr(Process* proc, PluginVirtualPtr dst, const void* src, size_
     return memorymanager_writePtr(proc->memoryManager, dst, src, n);
 }
 
+int process_writePtrs(Process* proc, const PluginPtr* dsts, const void* const* srcs,
+                      const size_t* lens, size_t n) {
+    MAGIC_ASSERT(proc);
+
+    // Disallow additional references when trying to get a mutable reference.
+    utility_debugAssert(!proc->memoryMutRef);
+    utility_debugAssert(proc->memoryRefs->len == 0);
+
+    return memorymanager_writePtrs(proc->memoryManager, dsts, srcs, lens, n);
+}
+
 const void* process_getReadablePtr(Process* proc, PluginPtr plugin_src, size_t n) {
     MAGIC_ASSERT(proc);
 
@@ -1147,6 +1176,15 @@ void* process_getWriteablePtr(Process* proc, PluginPtr plugin_src, size_t n) {
     return memorymanagermut_ptr(ref);
 }
 
+void* process_getMappedPtr(Process* proc, PluginPtr plugin_src, size_t n) {
+    MAGIC_ASSERT(proc);
+
+    // Disallow access while there's a mutable reference that may be flushed over it.
+    utility_debugAssert(!proc->memoryMutRef);
+
+    return memorymanager_getMappedPtr(proc->memoryManager, plugin_src, n);
+}
+
 // Returns a writeable pointer corresponding to the specified src. Use when
 // the data at the given address needs to be both read and written.
 //
@@ -109,6 +109,13 @@ PluginPhysicalPtr process_getPhysicalAddress(Process* proc, PluginVirtualPtr vPt
 // the specified range couldn't be accessed. Always succeeds with n==0.
 int process_readPtr(Process* proc, void* dst, PluginVirtualPtr src, size_t n);
 
+// Copy `n` ranges of plugin memory: `lens[i]` bytes from `srcs[i]` to `dsts[i]`.
+// Ranges that aren't mapped into shadow's address space are gathered into a
+// single vectored read, so prefer this over repeated calls to process_readPtr.
+// Returns 0 on success or -EFAULT if any of the ranges couldn't be accessed.
+int process_readPtrs(Process* proc, void* const* dsts, const PluginPtr* srcs, const size_t* lens,
+                     size_t n);
+
 // Make the data starting at plugin_src, and extending until the first NULL
 // byte, up at most `n` bytes, available in shadow's address space.
 //
@@ -135,6 +142,13 @@ ssize_t process_readString(Process* proc, char* str, PluginVirtualPtr src, size_
 // the specified range couldn't be accessed. The write is flushed immediately.
 int process_writePtr(Process* proc, PluginVirtualPtr dst, const void* src, size_t n);
 
+// Copy `n` ranges into plugin memory: `lens[i]` bytes from `srcs[i]` to
+// `dsts[i]`. Like process_readPtrs, unmapped ranges are batched into a single
+// vectored write. Returns 0 on success or -EFAULT if any of the ranges couldn't
+// be accessed. The writes are flushed immediately.
+int process_writePtrs(Process* proc, const PluginPtr* dsts, const void* const* srcs,
+                      const size_t* lens, size_t n);
+
 // Make the data at plugin_src available in shadow's address space.
 //
 // The returned pointer is read-only, and is automatically invalidated when the
@@ -157,6 +171,13 @@ void* process_getWriteablePtr(Process* proc, PluginPtr plugin_src, size_t n);
 // The returned pointer is automatically invalidated when the plugin runs again.
 void* process_getMutablePtr(Process* proc, PluginPtr plugin_src, size_t n);
 
+// Returns shadow's pointer to the `n` bytes at `plugin_src` if they're mapped
+// into shadow's address space, or NULL if they aren't. Unlike
+// process_getWriteablePtr, nothing is copied and there's nothing to flush:
+// reads and writes through the pointer access the plugin's memory directly.
+// The pointer is invalidated when the plugin runs again.
+void* process_getMappedPtr(Process* proc, PluginPtr plugin_src, size_t n);
+
 // Flushes and invalidates all previously returned readable/writable plugin
 // pointers, as if returning control to the plugin. This can be useful in
 // conjunction with `thread_nativeSyscall` operations that touch memory.
@@ -1,3 +1,4 @@
+use std::fmt::Display;
 use std::num::TryFromIntError;
 use std::os::unix::io::{FromRawFd, IntoRawFd};
 
@@ -5,11 +6,14 @@ use nix::unistd::Pid;
 
 use crate::cshadow;
 use crate::host::descriptor::{CompatFile, Descriptor};
-use crate::host::syscall::format::{FmtOptions, StraceFmtMode};
+use crate::host::syscall::format::{write_syscall, FmtOptions, StraceFmtMode};
+use crate::host::syscall::strace_writer;
+use crate::host::thread::ThreadId;
 
 use super::memory_manager::MemoryManager;
 use super::timer::Timer;
 
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
 use shadow_shim_helper_rs::HostId;
 
 /// Virtual pid of a shadow process
@@ -137,6 +141,33 @@ impl Process {
         Some(rv)
     }
 
+    /// Write a syscall to the strace file. In the "deferred" strace logging mode the line is
+    /// written by a background thread, otherwise it's formatted directly into the file before
+    /// returning. If strace logging is disabled, this function will do nothing.
+    pub fn write_strace(
+        &self,
+        time: &EmulatedTime,
+        tid: ThreadId,
+        name: &str,
+        args: impl Display + Into<String>,
+        rv: impl Display,
+    ) -> std::io::Result<()> {
+        let mode = unsafe { cshadow::process_straceLoggingMode(self.cprocess) };
+        let mode = StraceFmtMode::try_from(mode).unwrap();
+
+        if matches!(mode, StraceFmtMode::Deferred) {
+            // the writer thread needs its own copies
+            let fd = unsafe { cshadow::process_getStraceFd(self.cprocess) };
+            if fd >= 0 {
+                strace_writer::write(fd, *time, tid, name.into(), args.into(), rv.to_string());
+            }
+            return Ok(());
+        }
+
+        self.with_strace_file(|file| write_syscall(file, time, tid, name, args, rv))
+            .unwrap_or(Ok(()))
+    }
+
     /// Get a reference to the descriptor with the given fd handle.
     pub fn get_descriptor(&self, fd: u32) -> Option<&Descriptor> {
         let desc_table =
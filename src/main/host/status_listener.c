@@ -66,7 +66,7 @@ StatusListener* statuslistener_new(StatusCallbackFunc notifyFunc, void* callback
 
     MAGIC_INIT(listener);
 
-    worker_count_allocation(StatusListener);
+    worker_count_allocation(STATUS_LISTENER);
     return listener;
 }
 
@@ -83,7 +83,7 @@ static void _statuslistener_free(StatusListener* listener) {
 
     MAGIC_CLEAR(listener);
     free(listener);
-    worker_count_deallocation(StatusListener);
+    worker_count_deallocation(STATUS_LISTENER);
 }
 
 void statuslistener_ref(StatusListener* listener) {
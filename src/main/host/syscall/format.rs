@@ -24,6 +24,8 @@ pub enum StraceFmtMode {
     Off,
     Standard,
     Deterministic,
+    /// Same format as `Standard`, but written to the file by a background thread.
+    Deferred,
 }
 
 impl From<StraceFmtMode> for Option<FmtOptions> {
@@ -32,6 +34,7 @@ impl From<StraceFmtMode> for Option<FmtOptions> {
             StraceFmtMode::Off => None,
             StraceFmtMode::Standard => Some(FmtOptions::Standard),
             StraceFmtMode::Deterministic => Some(FmtOptions::Deterministic),
+            StraceFmtMode::Deferred => Some(FmtOptions::Standard),
         }
     }
 }
@@ -614,20 +617,18 @@ mod export {
         let rv = SyscallResultFmt::<libc::c_long>::new(&result, logging_mode, proc.memory());
 
         if let Some(ref rv) = rv {
-            proc.with_strace_file(|file| {
-                let time = Worker::current_time();
-
-                if let (Some(time), Ok(tid)) = (time, tid.try_into()) {
-                    write_syscall(file, &time, tid, name, args, rv).unwrap();
-                } else {
-                    log::warn!(
-                        "Could not log syscall {} with time {:?} and tid {:?}",
-                        name,
-                        time,
-                        tid
-                    );
-                }
-            });
+            let time = Worker::current_time();
+
+            if let (Some(time), Ok(tid)) = (time, tid.try_into()) {
+                proc.write_strace(&time, tid, name, args, rv).unwrap();
+            } else {
+                log::warn!(
+                    "Could not log syscall {} with time {:?} and tid {:?}",
+                    name,
+                    time,
+                    tid
+                );
+            }
         }
 
         // need to return the result, otherwise the drop impl will free the condition pointer
@@ -14,6 +14,7 @@ use crate::host::syscall_condition::SysCallCondition;
 use crate::host::syscall_types::{Blocked, PluginPtr, SysCallArgs, TypedPluginPtr};
 use crate::host::syscall_types::{SyscallError, SyscallResult};
 use crate::utility::callback_queue::CallbackQueue;
+use crate::utility::pod;
 use crate::utility::sockaddr::SockaddrStorage;
 
 use log::*;
@@ -915,30 +916,30 @@ fn write_sockaddr(
     let from_addr_slice = addr.as_slice();
     let from_len: u32 = from_addr_slice.len().try_into().unwrap();
 
-    // get the provided address buffer length, and overwrite it with the real address length
-    let plugin_addr_len = {
-        let mut plugin_addr_len = mem.memory_ref_mut(plugin_addr_len)?;
-        let plugin_addr_len_value = plugin_addr_len.get_mut(0).unwrap();
+    // get the provided address buffer length
+    let [plugin_addr_len_value] = mem.read_vals::<_, 1>(plugin_addr_len)?;
 
-        // keep a copy before we change it
-        let plugin_addr_len_copy = *plugin_addr_len_value;
-
-        *plugin_addr_len_value = from_len;
-
-        plugin_addr_len.flush()?;
-        plugin_addr_len_copy
-    };
-
-    // return early if the address length is 0
-    if plugin_addr_len == 0 {
+    // return early if the address length is 0, but still write back the real address length
+    if plugin_addr_len_value == 0 {
+        mem.copy_to_ptr(plugin_addr_len, &[from_len])?;
         return Ok(());
     }
 
     // the minimum of the given address buffer length and the real address length
-    let len_to_copy = std::cmp::min(from_len, plugin_addr_len).try_into().unwrap();
+    let len_to_copy = std::cmp::min(from_len, plugin_addr_len_value)
+        .try_into()
+        .unwrap();
 
+    // write the real address length and the (possibly truncated) address in a single batch
+    let plugin_addr_len = plugin_addr_len.cast::<MaybeUninit<u8>>().unwrap();
     let plugin_addr = TypedPluginPtr::new::<MaybeUninit<u8>>(plugin_addr, len_to_copy);
-    mem.copy_to_ptr(plugin_addr, &from_addr_slice[..len_to_copy])?;
+    mem.copy_to_ptrs(
+        &[plugin_addr_len, plugin_addr],
+        &[
+            pod::to_u8_slice(&[from_len]),
+            &from_addr_slice[..len_to_copy],
+        ],
+    )?;
 
     Ok(())
 }
@@ -3,6 +3,7 @@ use crate::host::descriptor::{File, FileState};
 
 pub mod format;
 pub mod handler;
+pub mod strace_writer;
 
 // The helpers defined here are syscall-related but not handler-specific.
 
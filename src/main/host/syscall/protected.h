@@ -14,6 +14,7 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "lib/shadow-shim-helper-rs/shim_helper.h"
 #include "main/host/descriptor/epoll.h"
@@ -62,10 +63,15 @@ struct _SysCallHandler {
     /* The total time elapsed while handling all syscalls. */
     gdouble perfSecondsTotal;
     //#endif
+    /* The native TSC value when we started handling the current syscall. */
+    uint64_t syscallStartCycles;
+    /* The cumulative native TSC cycles spent handling the current syscall,
+     * including previous calls that ended up blocking. */
+    uint64_t syscallCycles;
     /* The total number of syscalls that we have handled. */
     long numSyscalls;
     // A counter for individual syscalls
-    Counter* syscall_counter;
+    SyscallCounter* syscall_counter;
 
     // In some cases the syscallhandler comples, but we block the caller anyway
     // to move time forward. This stores the result of the completed syscall, to
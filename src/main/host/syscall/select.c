@@ -33,16 +33,27 @@ static SysCallReturn _syscallhandler_select_helper(SysCallHandler* sys, int nfds
     FD_ZERO(&writefds);
     FD_ZERO(&exceptfds);
 
-    // Get the fd_set syscall args in our memory.
-    if (readfds_ptr.val && process_readPtr(sys->process, &readfds, readfds_ptr, sizeof(readfds))) {
-        return syscallreturn_makeDoneErrno(EFAULT);
-    }
-    if (writefds_ptr.val &&
-        process_readPtr(sys->process, &writefds, writefds_ptr, sizeof(writefds))) {
-        return syscallreturn_makeDoneErrno(EFAULT);
+    // Collect the non-NULL fd_set syscall args, so that we can read and write
+    // them back with a single batched access to plugin memory.
+    const PluginVirtualPtr fdset_ptrs[] = {readfds_ptr, writefds_ptr, exceptfds_ptr};
+    fd_set* fdsets[] = {&readfds, &writefds, &exceptfds};
+    PluginPtr plugin_ptrs[3];
+    void* local_ptrs[3];
+    const void* local_const_ptrs[3];
+    size_t lens[3];
+    size_t num_fdsets = 0;
+    for (int i = 0; i < 3; i++) {
+        if (fdset_ptrs[i].val) {
+            plugin_ptrs[num_fdsets] = fdset_ptrs[i];
+            local_ptrs[num_fdsets] = fdsets[i];
+            local_const_ptrs[num_fdsets] = fdsets[i];
+            lens[num_fdsets] = sizeof(fd_set);
+            num_fdsets++;
+        }
     }
-    if (exceptfds_ptr.val &&
-        process_readPtr(sys->process, &exceptfds, exceptfds_ptr, sizeof(exceptfds))) {
+
+    // Get the fd_set syscall args in our memory.
+    if (process_readPtrs(sys->process, local_ptrs, plugin_ptrs, lens, num_fdsets)) {
         return syscallreturn_makeDoneErrno(EFAULT);
     }
 
@@ -128,17 +139,7 @@ static SysCallReturn _syscallhandler_select_helper(SysCallHandler* sys, int nfds
 
     // OK now we know we have success; write back the result fd sets.
     scr = syscallreturn_makeDoneI64(num_set_bits);
-    if (readfds_ptr.val && process_writePtr(sys->process, readfds_ptr, &readfds, sizeof(readfds))) {
-        scr = syscallreturn_makeDoneErrno(EFAULT);
-        goto done;
-    }
-    if (writefds_ptr.val &&
-        process_writePtr(sys->process, writefds_ptr, &writefds, sizeof(writefds))) {
-        scr = syscallreturn_makeDoneErrno(EFAULT);
-        goto done;
-    }
-    if (exceptfds_ptr.val &&
-        process_writePtr(sys->process, exceptfds_ptr, &exceptfds, sizeof(exceptfds))) {
+    if (process_writePtrs(sys->process, plugin_ptrs, local_const_ptrs, lens, num_fdsets)) {
         scr = syscallreturn_makeDoneErrno(EFAULT);
         goto done;
     }
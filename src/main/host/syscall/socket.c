@@ -133,20 +133,17 @@ static int _syscallhandler_getnameHelper(SysCallHandler* sys, struct sockaddr* s
     /* The result is truncated if they didn't give us enough space. */
     size_t retSize = MIN(addrlen, slen);
 
+    /* Return the results, writing both the length and the address in one batch. */
     addrlen = slen;
-    if (process_writePtr(sys->process, addrlenPtr, &addrlen, sizeof(addrlen)) != 0) {
-        debug("Couldn't write addrlenPtr %p", (void*)addrlenPtr.val);
+    const PluginPtr dsts[] = {addrlenPtr, addrPtr};
+    const void* srcs[] = {&addrlen, saddr};
+    const size_t lens[] = {sizeof(addrlen), retSize};
+    if (process_writePtrs(sys->process, dsts, srcs, lens, retSize > 0 ? 2 : 1) != 0) {
+        debug("Couldn't write addrlenPtr %p or addrPtr %p", (void*)addrlenPtr.val,
+              (void*)addrPtr.val);
         return -EFAULT;
     }
 
-    if (retSize > 0) {
-        /* Return the results */
-        if (process_writePtr(sys->process, addrPtr, saddr, retSize) != 0) {
-            debug("Couldn't write addrPtr %p", (void*)addrPtr.val);
-            return -EFAULT;
-        }
-    }
-
     return 0;
 }
 
@@ -0,0 +1,144 @@
+//! Writes strace files on a background thread for the "deferred" strace logging mode.
+//!
+//! In the deferred mode, a syscall handler only captures what must be read while the syscall is
+//! being handled: the formatted arguments and result, which may include the contents of plugin
+//! memory. The rest of the work (formatting the timestamp, assembling the line, and writing it to
+//! the process's strace file) happens on a single writer thread, which buffers its writes. The
+//! output is identical to the "standard" mode.
+//!
+//! A process's strace file must be registered with [`register`] before syscalls are written to it,
+//! and deregistered with [`deregister`] before its file descriptor is closed. The writer thread
+//! uses its own duplicate of the file descriptor, and files are identified by the process's
+//! descriptor number. Since the messages for a file descriptor are sent in the same order that the
+//! descriptor is opened and closed, a reused descriptor number never refers to the wrong file.
+
+use std::collections::HashMap;
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::os::unix::io::{FromRawFd, RawFd};
+
+use once_cell::sync::OnceCell;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+
+use crate::host::syscall::format::write_syscall;
+use crate::host::thread::ThreadId;
+use crate::utility::background_writer::{BackgroundWriter, Messages};
+
+/// The most messages that can be waiting for the writer thread. If the writer falls behind, worker
+/// threads block instead of queueing an unbounded number of syscall lines in memory.
+const MAX_PENDING_MESSAGES: usize = 1 << 16;
+
+static WRITER: OnceCell<BackgroundWriter<Message>> = OnceCell::new();
+
+enum Message {
+    Register(RawFd, File),
+    Deregister(RawFd),
+    Syscall(RawFd, SyscallRecord),
+}
+
+struct SyscallRecord {
+    time: EmulatedTime,
+    tid: ThreadId,
+    name: String,
+    args: String,
+    rv: String,
+}
+
+fn writer() -> &'static BackgroundWriter<Message> {
+    WRITER.get_or_init(|| {
+        BackgroundWriter::bounded("shadow-strace", MAX_PENDING_MESSAGES, writer_thread_fn)
+    })
+}
+
+/// Start writing deferred syscalls for the strace file `fd`.
+pub fn register(fd: RawFd) {
+    let dup_fd = match nix::unistd::dup(fd) {
+        Ok(x) => x,
+        Err(e) => {
+            log::warn!("Could not duplicate strace file descriptor {fd}: {e}");
+            return;
+        }
+    };
+    let file = unsafe { File::from_raw_fd(dup_fd) };
+    writer().send(Message::Register(fd, file));
+}
+
+/// Stop writing to the strace file `fd`. Must be called before `fd` is closed.
+pub fn deregister(fd: RawFd) {
+    writer().send(Message::Deregister(fd));
+}
+
+/// Write a syscall to the strace file `fd` in the background.
+pub fn write(fd: RawFd, time: EmulatedTime, tid: ThreadId, name: String, args: String, rv: String) {
+    let record = SyscallRecord {
+        time,
+        tid,
+        name,
+        args,
+        rv,
+    };
+    writer().send(Message::Syscall(fd, record));
+}
+
+/// Write all remaining syscalls, and wait for the writer thread to exit.
+pub fn finish() {
+    if let Some(writer) = WRITER.get() {
+        writer.finish();
+    }
+}
+
+fn writer_thread_fn(messages: Messages<Message>) {
+    let mut files: HashMap<RawFd, BufWriter<File>> = HashMap::new();
+
+    let flush = |fd: RawFd, mut file: BufWriter<File>| {
+        if let Err(e) = file.flush() {
+            log::warn!("Could not write to strace file {fd}: {e}");
+        }
+    };
+
+    for message in messages {
+        match message {
+            Message::Register(fd, file) => {
+                if let Some(old) = files.insert(fd, BufWriter::new(file)) {
+                    // shouldn't happen, but don't lose its syscalls if it does
+                    flush(fd, old);
+                }
+            }
+            Message::Deregister(fd) => {
+                if let Some(file) = files.remove(&fd) {
+                    flush(fd, file);
+                }
+            }
+            Message::Syscall(fd, x) => {
+                let Some(file) = files.get_mut(&fd) else {
+                    log::warn!("Syscall {} for unregistered strace file {fd}", x.name);
+                    continue;
+                };
+                if let Err(e) = write_syscall(file, &x.time, x.tid, &x.name, &x.args, &x.rv) {
+                    log::warn!("Could not write to strace file {fd}: {e}");
+                    files.remove(&fd);
+                }
+            }
+        }
+    }
+
+    for (fd, file) in files.drain() {
+        flush(fd, file);
+    }
+}
+
+mod export {
+    use super::*;
+
+    /// Start writing deferred syscalls for the strace file `fd`.
+    #[no_mangle]
+    pub extern "C" fn stracewriter_register(fd: libc::c_int) {
+        register(fd);
+    }
+
+    /// Stop writing to the strace file `fd`. Must be called before `fd` is closed.
+    #[no_mangle]
+    pub extern "C" fn stracewriter_deregister(fd: libc::c_int) {
+        deregister(fd);
+    }
+}
@@ -77,6 +77,171 @@ static int _syscallhandler_validateVecParams(SysCallHandler* sys, int fd, Plugin
     return 0;
 }
 
+/* The state of a vectored read or write on a regular file. Regular files don't
+ * need the per-buffer socket semantics, so we read or write ranges that are
+ * mapped into shadow's address space in place, and collect consecutive ranges
+ * that aren't into a single bounce buffer that's filled or drained with one
+ * batched memory access. Each file operation transfers at most
+ * SYSCALL_IO_BUFSIZE bytes, and we keep going until the whole vector is
+ * transferred, the file returns less than we asked for, or there's an error. */
+typedef struct _FileVecTransfer {
+    SysCallHandler* sys;
+    RegularFile* file;
+    bool doWrite;
+    bool positional;
+    off_t offset;
+    /* The pending ranges that aren't mapped into shadow's address space. */
+    PluginPtr* unmappedPtrs;
+    size_t* unmappedLens;
+    size_t numUnmapped;
+    size_t unmappedSize;
+    /* The number of bytes transferred so far. */
+    size_t transferred;
+    /* The error from the last file operation, if it failed. */
+    ssize_t error;
+    bool done;
+} FileVecTransfer;
+
+static ssize_t _syscallhandler_transferFile(FileVecTransfer* xfer, void* buf, size_t size) {
+    off_t offset = xfer->offset + (off_t)xfer->transferred;
+    if (xfer->doWrite) {
+        if (!xfer->positional) {
+            utility_debugAssert(xfer->offset == 0);
+            return regularfile_write(xfer->file, buf, size);
+        }
+        return regularfile_pwrite(xfer->file, buf, size, offset);
+    } else {
+        const Host* host = _syscallhandler_getHost(xfer->sys);
+        if (!xfer->positional) {
+            utility_debugAssert(xfer->offset == 0);
+            return regularfile_read(xfer->file, host, buf, size);
+        }
+        return regularfile_pread(xfer->file, host, buf, size, offset);
+    }
+}
+
+static void _syscallhandler_recordFileTransfer(FileVecTransfer* xfer, ssize_t result,
+                                               size_t requested) {
+    if (result < 0) {
+        xfer->error = result;
+        xfer->done = true;
+        return;
+    }
+    xfer->transferred += (size_t)result;
+    if ((size_t)result < requested) {
+        xfer->done = true;
+    }
+}
+
+/* Transfer the pending unmapped ranges through a bounce buffer. */
+static void _syscallhandler_flushUnmappedRanges(FileVecTransfer* xfer) {
+    if (xfer->numUnmapped == 0) {
+        return;
+    }
+
+    size_t size = xfer->unmappedSize;
+    char* buf = malloc(size);
+    void** dsts = malloc(xfer->numUnmapped * sizeof(*dsts));
+    size_t pos = 0;
+    for (size_t i = 0; i < xfer->numUnmapped; i++) {
+        dsts[i] = buf + pos;
+        pos += xfer->unmappedLens[i];
+    }
+
+    ssize_t result = 0;
+    if (xfer->doWrite) {
+        if (process_readPtrs(xfer->sys->process, dsts, xfer->unmappedPtrs, xfer->unmappedLens,
+                             xfer->numUnmapped) != 0) {
+            result = -EFAULT;
+        } else {
+            result = _syscallhandler_transferFile(xfer, buf, size);
+        }
+    } else {
+        result = _syscallhandler_transferFile(xfer, buf, size);
+        if (result > 0) {
+            /* Scatter what we read into the plugin's buffers. */
+            size_t n = 0;
+            size_t copied = 0;
+            while (n < xfer->numUnmapped && copied < (size_t)result) {
+                xfer->unmappedLens[n] = MIN(xfer->unmappedLens[n], (size_t)result - copied);
+                copied += xfer->unmappedLens[n];
+                n++;
+            }
+            if (process_writePtrs(xfer->sys->process, xfer->unmappedPtrs,
+                                  (const void* const*)dsts, xfer->unmappedLens, n) != 0) {
+                result = -EFAULT;
+            }
+        }
+    }
+
+    free(dsts);
+    free(buf);
+    xfer->numUnmapped = 0;
+    xfer->unmappedSize = 0;
+    _syscallhandler_recordFileTransfer(xfer, result, size);
+}
+
+/* Returns the number of bytes transferred or a negative errno. */
+static ssize_t _syscallhandler_transferVecFile(SysCallHandler* sys, RegularFile* file,
+                                               const struct iovec* iov, unsigned long iovlen,
+                                               off_t offset, bool positional, bool doWrite) {
+    int errorCode = _syscallhandler_validateLegacyFile((LegacyFile*)file, DT_NONE);
+    if (errorCode != 0) {
+        return errorCode;
+    }
+
+    /* Each iovec adds at most one range to each batch of unmapped ranges. */
+    FileVecTransfer xfer = {
+        .sys = sys,
+        .file = file,
+        .doWrite = doWrite,
+        .positional = positional,
+        .offset = offset,
+        .unmappedPtrs = malloc(iovlen * sizeof(PluginPtr)),
+        .unmappedLens = malloc(iovlen * sizeof(size_t)),
+    };
+
+    for (unsigned long i = 0; i < iovlen && !xfer.done; i++) {
+        size_t pos = 0;
+        while (pos < iov[i].iov_len && !xfer.done) {
+            PluginPtr ptr = (PluginPtr){.val = (uint64_t)iov[i].iov_base + pos};
+            size_t len = MIN(iov[i].iov_len - pos, SYSCALL_IO_BUFSIZE);
+
+            void* mapped = process_getMappedPtr(sys->process, ptr, len);
+            if (mapped != NULL) {
+                /* Keep the file operations in the order of the vector. */
+                _syscallhandler_flushUnmappedRanges(&xfer);
+                if (!xfer.done) {
+                    ssize_t result = _syscallhandler_transferFile(&xfer, mapped, len);
+                    _syscallhandler_recordFileTransfer(&xfer, result, len);
+                }
+            } else {
+                len = MIN(len, SYSCALL_IO_BUFSIZE - xfer.unmappedSize);
+                xfer.unmappedPtrs[xfer.numUnmapped] = ptr;
+                xfer.unmappedLens[xfer.numUnmapped] = len;
+                xfer.numUnmapped++;
+                xfer.unmappedSize += len;
+                if (xfer.unmappedSize == SYSCALL_IO_BUFSIZE) {
+                    _syscallhandler_flushUnmappedRanges(&xfer);
+                }
+            }
+            pos += len;
+        }
+    }
+    if (!xfer.done) {
+        _syscallhandler_flushUnmappedRanges(&xfer);
+    }
+
+    free(xfer.unmappedPtrs);
+    free(xfer.unmappedLens);
+
+    /* Like linux, report a partial transfer rather than a later error. */
+    if (xfer.transferred > 0 || xfer.error == 0) {
+        return (ssize_t)xfer.transferred;
+    }
+    return xfer.error;
+}
+
 static SysCallReturn
 _syscallhandler_readvHelper(SysCallHandler* sys, int fd, PluginPtr iovPtr,
                             unsigned long iovlen, unsigned long pos_l,
@@ -112,6 +277,12 @@ _syscallhandler_readvHelper(SysCallHandler* sys, int fd, PluginPtr iovPtr,
      * unnecessary data transfer between the plugin and Shadow. */
     size_t totalBytesWritten = 0;
 
+    if (dType == DT_FILE) {
+        result = _syscallhandler_transferVecFile(
+            sys, (RegularFile*)desc, iov, iovlen, offset, doPreadv, false);
+        goto done;
+    }
+
     for (unsigned long i = 0; i < iovlen; i++) {
         PluginPtr bufPtr = (PluginPtr){.val = (uint64_t)iov[i].iov_base};
         size_t bufSize = iov[i].iov_len;
@@ -122,7 +293,6 @@ _syscallhandler_readvHelper(SysCallHandler* sys, int fd, PluginPtr iovPtr,
         }
 
         switch (dType) {
-            case DT_FILE:
             case DT_TCPSOCKET:
             case DT_UDPSOCKET: {
                 off_t thisOffset = offset;
@@ -176,6 +346,7 @@ _syscallhandler_readvHelper(SysCallHandler* sys, int fd, PluginPtr iovPtr,
         result = totalBytesWritten;
     }
 
+done:
     free(iov);
 
     if (result == -EWOULDBLOCK && !(legacyfile_getFlags(desc) & O_NONBLOCK)) {
@@ -233,6 +404,12 @@ _syscallhandler_writevHelper(SysCallHandler* sys, int fd, PluginPtr iovPtr,
      * unnecessary data transfer between the plugin and Shadow. */
     size_t totalBytesWritten = 0;
 
+    if (dType == DT_FILE) {
+        result = _syscallhandler_transferVecFile(
+            sys, (RegularFile*)desc, iov, iovlen, offset, doPwritev, true);
+        goto done;
+    }
+
     for (unsigned long i = 0; i < iovlen; i++) {
         PluginPtr bufPtr = (PluginPtr){.val = (uint64_t)iov[i].iov_base};
         size_t bufSize = iov[i].iov_len;
@@ -243,7 +420,6 @@ _syscallhandler_writevHelper(SysCallHandler* sys, int fd, PluginPtr iovPtr,
         }
 
         switch (dType) {
-            case DT_FILE:
             case DT_TCPSOCKET:
             case DT_UDPSOCKET: {
                 off_t thisOffset = offset;
@@ -297,6 +473,7 @@ _syscallhandler_writevHelper(SysCallHandler* sys, int fd, PluginPtr iovPtr,
         result = totalBytesWritten;
     }
 
+done:
     free(iov);
 
     if (result == -EWOULDBLOCK && !(legacyfile_getFlags(desc) & O_NONBLOCK)) {
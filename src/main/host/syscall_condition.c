@@ -54,7 +54,7 @@ SysCallCondition* syscallcondition_new(Trigger trigger) {
                                .referenceCount = 1,
                                MAGIC_INITIALIZER};
 
-    worker_count_allocation(SysCallCondition);
+    worker_count_allocation(SYS_CALL_CONDITION);
 
     if (cond->trigger.object.as_pointer) {
         switch (cond->trigger.type) {
@@ -200,7 +200,7 @@ static void _syscallcondition_free(SysCallCondition* cond) {
 
     MAGIC_CLEAR(cond);
     free(cond);
-    worker_count_deallocation(SysCallCondition);
+    worker_count_deallocation(SYS_CALL_CONDITION);
 }
 
 void syscallcondition_ref(SysCallCondition* cond) {
@@ -16,6 +16,7 @@
 
 #include "lib/logger/logger.h"
 #include "lib/shadow-shim-helper-rs/shim_event.h"
+#include "lib/tsc/tsc.h"
 #include "main/bindings/c/bindings.h"
 #include "main/core/support/config_handlers.h"
 #include "main/core/worker.h"
@@ -85,7 +86,7 @@ SysCallHandler* syscallhandler_new(const Host* host, Process* process, Thread* t
     };
 
     if (_countSyscalls) {
-        sys->syscall_counter = counter_new();
+        sys->syscall_counter = syscallcounter_new();
     }
 
     MAGIC_INIT(sys);
@@ -93,7 +94,7 @@ SysCallHandler* syscallhandler_new(const Host* host, Process* process, Thread* t
     process_ref(process);
     thread_ref(thread);
 
-    worker_count_allocation(SysCallHandler);
+    worker_count_allocation(SYS_CALL_HANDLER);
     return sys;
 }
 
@@ -108,16 +109,16 @@ static void _syscallhandler_free(SysCallHandler* sys) {
 
     if (_countSyscalls && sys->syscall_counter) {
         // Log the plugin thread specific counts
-        char* str = counter_alloc_string(sys->syscall_counter);
+        char* str = syscallcounter_allocString(sys->syscall_counter);
         info("Thread %d (%s) syscall counts: %s", thread_getID(sys->thread),
              process_getPluginName(sys->process), str);
-        counter_free_string(sys->syscall_counter, str);
+        syscallcounter_freeString(str);
 
         // Add up the counts at the worker level
         worker_add_syscall_counts(sys->syscall_counter);
 
         // Cleanup
-        counter_free(sys->syscall_counter);
+        syscallcounter_free(sys->syscall_counter);
     }
 
     if (sys->process) {
@@ -141,7 +142,7 @@ static void _syscallhandler_free(SysCallHandler* sys) {
 
     MAGIC_CLEAR(sys);
     free(sys);
-    worker_count_deallocation(SysCallHandler);
+    worker_count_deallocation(SYS_CALL_HANDLER);
 }
 
 void syscallhandler_ref(SysCallHandler* sys) {
@@ -169,22 +170,25 @@ static void _syscallhandler_pre_syscall(SysCallHandler* sys, long number,
     // This avoids double counting in the case where the initial call blocked at first,
     // but then later became unblocked and is now being handled again here.
     if (sys->syscall_counter && !_syscallhandler_wasBlocked(sys)) {
-        counter_add_value(sys->syscall_counter, name, 1);
+        syscallcounter_addOne(sys->syscall_counter, number, name);
     }
 
 #ifdef USE_PERF_TIMERS
     /* Track elapsed time during this syscall by marking the start time. */
     g_timer_start(sys->perfTimer);
 #endif
+    sys->syscallStartCycles = Tsc_nativeRdtsc();
 }
 
 static void _syscallhandler_post_syscall(SysCallHandler* sys, long number,
                                          const char* name, SysCallReturn* scr) {
+    sys->syscallCycles += Tsc_nativeRdtsc() - sys->syscallStartCycles;
 #ifdef USE_PERF_TIMERS
     /* Add the cumulative elapsed seconds and num syscalls. */
     sys->perfSecondsCurrent += g_timer_elapsed(sys->perfTimer, NULL);
 #endif
-    if (logger_isEnabled(logger_getDefault(), LOGLEVEL_TRACE)) {
+    if (logger_maybeEnabled(LOGLEVEL_TRACE) &&
+        logger_isEnabled(logger_getDefault(), LOGLEVEL_TRACE)) {
         const char* errstr = "n/a";
         char errstrbuf[100];
 
@@ -212,6 +216,8 @@ static void _syscallhandler_post_syscall(SysCallHandler* sys, long number,
     if (scr->state != SYSCALL_BLOCK) {
         /* The syscall completed, count it and the cumulative time to complete it. */
         sys->numSyscalls++;
+        host_recordSyscallLatency(_syscallhandler_getHost(sys), number, name, sys->syscallCycles);
+        sys->syscallCycles = 0;
 #ifdef USE_PERF_TIMERS
         sys->perfSecondsTotal += sys->perfSecondsCurrent;
         sys->perfSecondsCurrent = 0;
@@ -16,6 +16,7 @@
 
 #include "lib/logger/logger.h"
 #include "lib/shadow-shim-helper-rs/shim_event.h"
+#include "main/core/support/config_handlers.h"
 #include "main/core/worker.h"
 #include "main/host/managed_thread.h"
 #include "main/host/syscall/kernel_types.h"
@@ -23,6 +24,14 @@
 #include "main/host/syscall_handler.h"
 #include "main/utility/syscall.h"
 
+// Size of the scratch area appended to each thread's shared memory block, in
+// which the shim stages large syscall buffers so that we can access them in
+// place instead of copying them across processes.
+#define THREAD_SHMEM_SCRATCH_NBYTES ((size_t)256 * 1024)
+
+static bool _use_shmem_scratch = false;
+ADD_CONFIG_HANDLER(config_getUseShmemScratch, _use_shmem_scratch)
+
 struct _Thread {
     // For safe down-casting. Set and checked by child class.
     int type_id;
@@ -55,14 +64,16 @@ Thread* thread_new(const Host* host, Process* process, int threadID) {
                        .hostId = host_getID(host),
                        .process = process,
                        .tid = threadID,
-                       .shimSharedMemBlock = shmemallocator_globalAlloc(shimshmemthread_size()),
                        MAGIC_INITIALIZER};
     process_ref(process);
 
+    size_t scratchLen = _use_shmem_scratch ? THREAD_SHMEM_SCRATCH_NBYTES : 0;
+    thread->shimSharedMemBlock = shmemallocator_globalAlloc(shimshmemthread_size() + scratchLen);
+
     thread->sys = syscallhandler_new(host, process, thread);
     thread->mthread = managedthread_new(thread);
 
-    shimshmemthread_init(thread_sharedMem(thread), host_getShimShmemLock(host));
+    shimshmemthread_init(thread_sharedMem(thread), host_getShimShmemLock(host), scratchLen);
 
     return thread;
 }
@@ -175,6 +186,21 @@ ShimShmemThread* thread_sharedMem(Thread* thread) {
     return thread->shimSharedMemBlock.p;
 }
 
+void* thread_getShmemScratch(Thread* thread, PluginPtr* pluginScratch, size_t* len) {
+    MAGIC_ASSERT(thread);
+    ShimShmemThread* shmem = thread_sharedMem(thread);
+
+    size_t scratchLen = shimshmem_getThreadScratchLen(shmem);
+    uint64_t pluginScratchVal = shimshmem_getThreadPluginScratch(shmem);
+    if (scratchLen == 0 || pluginScratchVal == 0) {
+        return NULL;
+    }
+
+    *pluginScratch = (PluginPtr){.val = pluginScratchVal};
+    *len = scratchLen;
+    return (char*)thread->shimSharedMemBlock.p + shimshmemthread_size();
+}
+
 SysCallHandler* thread_getSysCallHandler(Thread* thread) {
     return thread->sys;
 }
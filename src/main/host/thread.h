@@ -79,6 +79,11 @@ ShMemBlock* thread_getShMBlock(Thread* thread);
 // the block returned by thread_getShMBlock).
 ShimShmemThread* thread_sharedMem(Thread* thread);
 
+// If the shim has registered a syscall-argument scratch area for this thread,
+// returns Shadow's pointer to it and sets `pluginScratch` and `len` to its
+// location in the managed thread's address space. Returns NULL otherwise.
+void* thread_getShmemScratch(Thread* thread, PluginPtr* pluginScratch, size_t* len);
+
 Process* thread_getProcess(Thread* thread);
 const Host* thread_getHost(Thread* thread);
 // Get the syscallhandler for this thread.
@@ -3,6 +3,7 @@ use std::sync::{Arc, Weak};
 use atomic_refcell::AtomicRefCell;
 use log::trace;
 
+use crate::core::sim_stats::ObjectType;
 use crate::core::work::task::TaskRef;
 use crate::core::worker::Worker;
 use crate::utility::{Magic, ObjectCounter};
@@ -48,7 +49,7 @@ impl Timer {
     pub fn new<F: 'static + Fn(&Host) + Send + Sync>(on_expire: F) -> Self {
         Self {
             magic: Magic::new(),
-            _counter: ObjectCounter::new("Timer"),
+            _counter: ObjectCounter::new(ObjectType::Timer),
             internal: Arc::new(AtomicRefCell::new(TimerInternal {
                 next_expire_time: None,
                 expire_interval: SimulationTime::ZERO,
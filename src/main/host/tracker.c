@@ -12,6 +12,7 @@
 
 #include "lib/logger/log_level.h"
 #include "lib/logger/logger.h"
+#include "main/bindings/c/bindings.h"
 #include "main/core/support/definitions.h"
 #include "main/core/worker.h"
 #include "main/host/protocol.h"
@@ -51,6 +52,8 @@ struct _Tracker {
     CSimulationTime interval;
     LogLevel loglevel;
     LogInfoFlags loginfo;
+    /* write the heartbeat stats as CSV rows instead of log messages */
+    bool writeCsv;
 
     gboolean didLogNodeHeader;
     gboolean didLogRAMHeader;
@@ -74,6 +77,8 @@ struct _Tracker {
     guint numFailedFrees;
 
     GHashTable* socketStats;
+    /* the id to give the next socket, which is stable across runs unlike its pointer */
+    uint64_t nextSocketId;
 
     CEmulatedTime lastHeartbeat;
 
@@ -84,6 +89,8 @@ typedef struct _SocketStats SocketStats;
 struct _SocketStats {
     /* use the socket's pointer as a unique id/handle */
     guintptr socket;
+    /* the socket's number within its host, in the order that the sockets were added */
+    uint64_t id;
     ProtocolType type;
 
     in_addr_t peerIP;
@@ -103,11 +110,12 @@ struct _SocketStats {
     MAGIC_DECLARE;
 };
 
-static SocketStats* _socketstats_new(guintptr socket, ProtocolType type, gsize inputBufferSize,
-                                     gsize outputBufferSize) {
+static SocketStats* _socketstats_new(guintptr socket, uint64_t id, ProtocolType type,
+                                     gsize inputBufferSize, gsize outputBufferSize) {
     SocketStats* ss = g_new0(SocketStats, 1);
 
     ss->socket = socket;
+    ss->id = id;
     ss->type = type;
     ss->inputBufferSize = inputBufferSize;
     ss->outputBufferSize = outputBufferSize;
@@ -128,13 +136,14 @@ static void _socketstats_free(SocketStats* ss) {
 static guintptr _tracker_socketHandle(LegacySocket* sock) { return (guintptr)sock; }
 
 Tracker* tracker_new(const Host* host, CSimulationTime interval, LogLevel loglevel,
-                     LogInfoFlags loginfo) {
+                     LogInfoFlags loginfo, bool writeCsv) {
     Tracker* tracker = g_new0(Tracker, 1);
     MAGIC_INIT(tracker);
 
     tracker->interval = interval;
     tracker->loglevel = loglevel;
     tracker->loginfo = loginfo;
+    tracker->writeCsv = writeCsv;
 
     tracker->allocatedLocations = g_hash_table_new(g_direct_hash, g_direct_equal);
     tracker->socketStats = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, (GDestroyNotify)_socketstats_free);
@@ -315,7 +324,8 @@ void tracker_addSocket(Tracker* tracker, LegacySocket* socket, ProtocolType type
     guintptr handle = _tracker_socketHandle(socket);
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = _socketstats_new(handle, type, inputBufferSize, outputBufferSize);
+        SocketStats* ss = _socketstats_new(
+            handle, tracker->nextSocketId++, type, inputBufferSize, outputBufferSize);
         g_hash_table_insert(tracker->socketStats, &(ss->socket), ss);
     }
 }
@@ -496,9 +506,6 @@ static void _tracker_logSocket(Tracker* tracker, LogLevel level, CSimulationTime
     GHashTableIter socketIterator;
     g_hash_table_iter_init(&socketIterator, tracker->socketStats);
 
-    /* as we iterate, keep track of sockets that we should remove. we cant remove them
-     * during the iteration because it will invalidate the iterator */
-    GQueue* socketsToRemove = g_queue_new();
     gint socketLogCount = 0;
 
     while(g_hash_table_iter_next(&socketIterator, NULL, (gpointer*)&ss)) {
@@ -540,27 +547,28 @@ static void _tracker_logSocket(Tracker* tracker, LogLevel level, CSimulationTime
         g_free(outLocal);
         g_free(inRemote);
         g_free(outRemote);
-
-        /* check if we should remove the socket after iterating */
-        if(ss->removeAfterNextLog) {
-            g_queue_push_tail(socketsToRemove, GINT_TO_POINTER(ss->socket));
-        }
     }
 
     if(socketLogCount > 0) {
         logger_log(logger_getDefault(), level, __FILE__, __FUNCTION__, __LINE__, "%s", msg->str);
     }
 
-    /* free all the tracker instances of the sockets that were closed, now that we logged the info */
-    while (!g_queue_is_empty(socketsToRemove)) {
-        guintptr socket = (guintptr)g_queue_pop_head(socketsToRemove);
-        g_hash_table_remove(tracker->socketStats, &socket);
-    }
-    g_queue_free(socketsToRemove);
-
     g_string_free(msg, TRUE);
 }
 
+/* free all the tracker instances of the sockets that were closed, now that we logged the info */
+static void _tracker_removeClosedSockets(Tracker* tracker) {
+    SocketStats* ss = NULL;
+    GHashTableIter socketIterator;
+    g_hash_table_iter_init(&socketIterator, tracker->socketStats);
+
+    while (g_hash_table_iter_next(&socketIterator, NULL, (gpointer*)&ss)) {
+        if (ss && ss->removeAfterNextLog) {
+            g_hash_table_iter_remove(&socketIterator);
+        }
+    }
+}
+
 static void _tracker_logRAM(Tracker* tracker, LogLevel level, CSimulationTime interval) {
     guint seconds = (guint) (interval / SIMTIME_ONE_SECOND);
     guint numptrs = g_hash_table_size(tracker->allocatedLocations);
@@ -577,22 +585,111 @@ static void _tracker_logRAM(Tracker* tracker, LogLevel level, CSimulationTime in
         tracker->allocatedBytesTotal, numptrs, tracker->numFailedFrees);
 }
 
+static TrackerCounters _tracker_toRecordCounters(const Counters* c) {
+    return (TrackerCounters){
+        .packets_control = c->packets.control,
+        .packets_control_retrans = c->packets.controlRetransmit,
+        .packets_data = c->packets.data,
+        .packets_data_retrans = c->packets.dataRetransmit,
+        .bytes_control_header = c->bytes.controlHeader,
+        .bytes_control_header_retrans = c->bytes.controlHeaderRetransmit,
+        .bytes_data_header = c->bytes.dataHeader,
+        .bytes_data_header_retrans = c->bytes.dataHeaderRetransmit,
+        .bytes_data_payload = c->bytes.dataPayload,
+        .bytes_data_payload_retrans = c->bytes.dataPayloadRetransmit,
+    };
+}
+
+static TrackerInterfaceCounters _tracker_toRecordInterfaceCounters(const IFaceCounters* local,
+                                                                   const IFaceCounters* remote) {
+    return (TrackerInterfaceCounters){
+        .in_local = _tracker_toRecordCounters(&local->inCounters),
+        .out_local = _tracker_toRecordCounters(&local->outCounters),
+        .in_remote = _tracker_toRecordCounters(&remote->inCounters),
+        .out_remote = _tracker_toRecordCounters(&remote->outCounters),
+    };
+}
+
+static void _tracker_writeNode(Tracker* tracker, const Host* host, CSimulationTime interval) {
+    TrackerNodeRecord record = {
+        .interval_nanos = interval / SIMTIME_ONE_NANOSECOND,
+        .processing_nanos = tracker->processingTimeLastIntervalNanos,
+        .delayed_count = tracker->numDelayedLastInterval,
+        .delay_nanos = tracker->delayTimeLastInterval / SIMTIME_ONE_NANOSECOND,
+        .counters = _tracker_toRecordInterfaceCounters(&tracker->local, &tracker->remote),
+    };
+    trackermetrics_writeNode(host, &record);
+}
+
+static void _tracker_writeSocket(Tracker* tracker, const Host* host) {
+    SocketStats* ss = NULL;
+    GHashTableIter socketIterator;
+    g_hash_table_iter_init(&socketIterator, tracker->socketStats);
+
+    while (g_hash_table_iter_next(&socketIterator, NULL, (gpointer*)&ss)) {
+        /* don't write tcp sockets that don't have peer IP/port set */
+        if (!ss || (ss->type == PTCP && !ss->peerIP)) {
+            continue;
+        }
+
+        TrackerSocketRecord record = {
+            .socket = ss->id,
+            .peer_port = ss->peerPort,
+            .input_buffer_length = ss->inputBufferLength,
+            .input_buffer_size = ss->inputBufferSize,
+            .output_buffer_length = ss->outputBufferLength,
+            .output_buffer_size = ss->outputBufferSize,
+            .counters = _tracker_toRecordInterfaceCounters(&ss->local, &ss->remote),
+        };
+        const char* protocol = ss->type == PTCP     ? "TCP"
+                               : ss->type == PUDP   ? "UDP"
+                               : ss->type == PLOCAL ? "LOCAL"
+                                                    : "UNKNOWN";
+        trackermetrics_writeSocket(host, &record, protocol, ss->peerHostname);
+    }
+}
+
+static void _tracker_writeRAM(Tracker* tracker, const Host* host, CSimulationTime interval) {
+    TrackerRamRecord record = {
+        .interval_nanos = interval / SIMTIME_ONE_NANOSECOND,
+        .alloc_bytes = tracker->allocatedBytesLastInterval,
+        .dealloc_bytes = tracker->deallocatedBytesLastInterval,
+        .total_bytes = tracker->allocatedBytesTotal,
+        .pointers_count = g_hash_table_size(tracker->allocatedLocations),
+        .failed_free_count = tracker->numFailedFrees,
+    };
+    trackermetrics_writeRam(host, &record);
+}
+
 void tracker_heartbeat(Tracker* tracker, const Host* host) {
     MAGIC_ASSERT(tracker);
 
     /* check to see if node info is being logged */
     if(tracker->loginfo & LOG_INFO_FLAGS_NODE) {
-        _tracker_logNode(tracker, tracker->loglevel, tracker->interval);
+        if (tracker->writeCsv) {
+            _tracker_writeNode(tracker, host, tracker->interval);
+        } else {
+            _tracker_logNode(tracker, tracker->loglevel, tracker->interval);
+        }
     }
 
     /* check to see if socket buffer info is being logged */
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        _tracker_logSocket(tracker, tracker->loglevel, tracker->interval);
+        if (tracker->writeCsv) {
+            _tracker_writeSocket(tracker, host);
+        } else {
+            _tracker_logSocket(tracker, tracker->loglevel, tracker->interval);
+        }
+        _tracker_removeClosedSockets(tracker);
     }
 
     /* check to see if ram info is being logged */
     if(tracker->loginfo & LOG_INFO_FLAGS_RAM) {
-        _tracker_logRAM(tracker, tracker->loglevel, tracker->interval);
+        if (tracker->writeCsv) {
+            _tracker_writeRAM(tracker, host, tracker->interval);
+        } else {
+            _tracker_logRAM(tracker, tracker->loglevel, tracker->interval);
+        }
     }
 
     /* clear interval stats */
@@ -8,6 +8,7 @@
 #define SHD_TRACKER_H_
 
 #include <glib.h>
+#include <stdbool.h>
 #include <netinet/in.h>
 
 #include "lib/logger/log_level.h"
@@ -17,7 +18,7 @@
 #include "main/routing/packet.minimal.h"
 
 Tracker* tracker_new(const Host* host, CSimulationTime interval, LogLevel loglevel,
-                     LogInfoFlags loginfo);
+                     LogInfoFlags loginfo, bool writeCsv);
 void tracker_free(Tracker* tracker);
 
 void tracker_addProcessingTimeNanos(Tracker* tracker, CSimulationTime processingTime);
@@ -0,0 +1,593 @@
+//! Heartbeat metrics from host trackers, written as CSV files.
+//!
+//! When a host's heartbeat format is "csv", its tracker hands the raw counters for each interval
+//! to this module instead of formatting log messages. The records are sent to a single writer
+//! thread, which formats them and appends them to "heartbeat-node.csv", "heartbeat-socket.csv",
+//! and "heartbeat-ram.csv" in the data directory, with one row per host (or per socket) per
+//! interval. Each file is created when its first record is written.
+//!
+//! The writer thread buffers the records it receives during a scheduling round, and at the end of
+//! each round (see [`end_round`]) sorts them by time and hostname before writing them, so that the
+//! order of the rows doesn't depend on which threads the hosts ran on.
+
+use std::fmt::Write as _;
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::path::{Path, PathBuf};
+
+use once_cell::sync::OnceCell;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+
+use crate::utility::background_writer::{BackgroundWriter, Messages};
+
+/// The most records that can be queued for the writer thread. There's a record per host (or per
+/// socket) per heartbeat, each at most a few hundred bytes, so this caps the queue at some tens of
+/// MiB. Hosts wait for the writer when it's full.
+const MAX_QUEUED_RECORDS: usize = 1 << 16;
+
+static DATA_PATH: OnceCell<PathBuf> = OnceCell::new();
+static WRITER: OnceCell<BackgroundWriter<Message>> = OnceCell::new();
+
+enum Message {
+    Record(Record),
+    EndRound,
+}
+
+/// Packet and byte counters for one direction of an interface.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+#[repr(C)]
+pub struct TrackerCounters {
+    pub packets_control: u64,
+    pub packets_control_retrans: u64,
+    pub packets_data: u64,
+    pub packets_data_retrans: u64,
+    pub bytes_control_header: u64,
+    pub bytes_control_header_retrans: u64,
+    pub bytes_data_header: u64,
+    pub bytes_data_header_retrans: u64,
+    pub bytes_data_payload: u64,
+    pub bytes_data_payload_retrans: u64,
+}
+
+impl TrackerCounters {
+    const HEADER: &'static [&'static str] = &[
+        "packets-total",
+        "bytes-total",
+        "packets-control",
+        "bytes-control-header",
+        "packets-control-retrans",
+        "bytes-control-header-retrans",
+        "packets-data",
+        "bytes-data-header",
+        "bytes-data-payload",
+        "packets-data-retrans",
+        "bytes-data-header-retrans",
+        "bytes-data-payload-retrans",
+    ];
+
+    fn total_packets(&self) -> u64 {
+        self.packets_control
+            + self.packets_control_retrans
+            + self.packets_data
+            + self.packets_data_retrans
+    }
+
+    fn total_bytes(&self) -> u64 {
+        self.bytes_control_header
+            + self.bytes_control_header_retrans
+            + self.bytes_data_header
+            + self.bytes_data_header_retrans
+            + self.bytes_data_payload
+            + self.bytes_data_payload_retrans
+    }
+
+    fn write_fields(&self, row: &mut String) {
+        let fields = [
+            self.total_packets(),
+            self.total_bytes(),
+            self.packets_control,
+            self.bytes_control_header,
+            self.packets_control_retrans,
+            self.bytes_control_header_retrans,
+            self.packets_data,
+            self.bytes_data_header,
+            self.bytes_data_payload,
+            self.packets_data_retrans,
+            self.bytes_data_header_retrans,
+            self.bytes_data_payload_retrans,
+        ];
+        for x in fields {
+            write!(row, ",{x}").unwrap();
+        }
+    }
+}
+
+/// Counters for the inbound and outbound directions of the localhost and remote interfaces.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+#[repr(C)]
+pub struct TrackerInterfaceCounters {
+    pub in_local: TrackerCounters,
+    pub out_local: TrackerCounters,
+    pub in_remote: TrackerCounters,
+    pub out_remote: TrackerCounters,
+}
+
+impl TrackerInterfaceCounters {
+    const PREFIXES: [&'static str; 4] = ["in-local-", "out-local-", "in-remote-", "out-remote-"];
+
+    fn write_header(row: &mut String) {
+        for prefix in Self::PREFIXES {
+            for name in TrackerCounters::HEADER {
+                write!(row, ",{prefix}{name}").unwrap();
+            }
+        }
+    }
+
+    fn write_fields(&self, row: &mut String) {
+        for x in [
+            &self.in_local,
+            &self.out_local,
+            &self.in_remote,
+            &self.out_remote,
+        ] {
+            x.write_fields(row);
+        }
+    }
+}
+
+/// A host's node statistics for one heartbeat interval.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+#[repr(C)]
+pub struct TrackerNodeRecord {
+    pub interval_nanos: u64,
+    pub processing_nanos: u64,
+    pub delayed_count: u64,
+    pub delay_nanos: u64,
+    pub counters: TrackerInterfaceCounters,
+}
+
+/// A socket's statistics for one heartbeat interval.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+#[repr(C)]
+pub struct TrackerSocketRecord {
+    /// A number that identifies the socket within its host. Sockets are numbered in the order that
+    /// the host created them, so the numbers are the same in every run.
+    pub socket: u64,
+    pub peer_port: u16,
+    pub input_buffer_length: u64,
+    pub input_buffer_size: u64,
+    pub output_buffer_length: u64,
+    pub output_buffer_size: u64,
+    pub counters: TrackerInterfaceCounters,
+}
+
+/// A host's memory allocation statistics for one heartbeat interval.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+#[repr(C)]
+pub struct TrackerRamRecord {
+    pub interval_nanos: u64,
+    pub alloc_bytes: u64,
+    pub dealloc_bytes: u64,
+    pub total_bytes: u64,
+    pub pointers_count: u64,
+    pub failed_free_count: u64,
+}
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+enum RecordKind {
+    Node(TrackerNodeRecord),
+    Socket {
+        record: TrackerSocketRecord,
+        protocol: &'static str,
+        peer_hostname: String,
+    },
+    Ram(TrackerRamRecord),
+}
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+struct Record {
+    /// Nanoseconds since the start of the simulation.
+    time: u64,
+    hostname: String,
+    kind: RecordKind,
+}
+
+impl Record {
+    /// Rows are written in this order within a round.
+    fn sort_key(&self) -> (u64, &str, u64) {
+        let socket = match &self.kind {
+            RecordKind::Socket { record, .. } => record.socket,
+            _ => 0,
+        };
+        (self.time, &self.hostname, socket)
+    }
+
+    fn file_index(&self) -> usize {
+        match self.kind {
+            RecordKind::Node(_) => 0,
+            RecordKind::Socket { .. } => 1,
+            RecordKind::Ram(_) => 2,
+        }
+    }
+
+    fn write_header(&self, row: &mut String) {
+        row.push_str("time-nanos,hostname");
+        match self.kind {
+            RecordKind::Node(_) => {
+                row.push_str(
+                    ",interval-nanos,recv-bytes,send-bytes,processing-nanos,delayed-count,\
+                     delay-nanos",
+                );
+                TrackerInterfaceCounters::write_header(row);
+            }
+            RecordKind::Socket { .. } => {
+                row.push_str(
+                    ",socket,protocol,peer-hostname,peer-port,inbuflen-bytes,inbufsize-bytes,\
+                     outbuflen-bytes,outbufsize-bytes,recv-bytes,send-bytes",
+                );
+                TrackerInterfaceCounters::write_header(row);
+            }
+            RecordKind::Ram(_) => {
+                row.push_str(
+                    ",interval-nanos,alloc-bytes,dealloc-bytes,total-bytes,pointers-count,\
+                     failfree-count",
+                );
+            }
+        }
+        row.push('\n');
+    }
+
+    fn write_row(&self, row: &mut String) {
+        write!(row, "{},{}", self.time, self.hostname).unwrap();
+        match &self.kind {
+            RecordKind::Node(x) => {
+                write!(
+                    row,
+                    ",{},{},{},{},{},{}",
+                    x.interval_nanos,
+                    x.counters.in_remote.total_bytes(),
+                    x.counters.out_remote.total_bytes(),
+                    x.processing_nanos,
+                    x.delayed_count,
+                    x.delay_nanos,
+                )
+                .unwrap();
+                x.counters.write_fields(row);
+            }
+            RecordKind::Socket {
+                record: x,
+                protocol,
+                peer_hostname,
+            } => {
+                let recv = x.counters.in_local.total_bytes() + x.counters.in_remote.total_bytes();
+                let send = x.counters.out_local.total_bytes() + x.counters.out_remote.total_bytes();
+                write!(
+                    row,
+                    ",{},{protocol},{peer_hostname},{},{},{},{},{},{recv},{send}",
+                    x.socket,
+                    x.peer_port,
+                    x.input_buffer_length,
+                    x.input_buffer_size,
+                    x.output_buffer_length,
+                    x.output_buffer_size,
+                )
+                .unwrap();
+                x.counters.write_fields(row);
+            }
+            RecordKind::Ram(x) => {
+                write!(
+                    row,
+                    ",{},{},{},{},{},{}",
+                    x.interval_nanos,
+                    x.alloc_bytes,
+                    x.dealloc_bytes,
+                    x.total_bytes,
+                    x.pointers_count,
+                    x.failed_free_count,
+                )
+                .unwrap();
+            }
+        }
+        row.push('\n');
+    }
+}
+
+/// Set the directory that the metrics files are written to. Must be called before any records are
+/// written.
+pub fn init(data_path: &Path) {
+    DATA_PATH
+        .set(data_path.to_path_buf())
+        .ok()
+        .expect("Tracker metrics were already initialized");
+}
+
+fn writer() -> &'static BackgroundWriter<Message> {
+    WRITER.get_or_init(|| {
+        let data_path = DATA_PATH.get().cloned().unwrap_or_default();
+        BackgroundWriter::bounded("shadow-metrics", MAX_QUEUED_RECORDS, move |messages| {
+            writer_thread_fn(messages, &data_path)
+        })
+    })
+}
+
+fn send_record(hostname: &str, kind: RecordKind) {
+    let now = crate::core::worker::Worker::current_time().unwrap();
+    let record = Record {
+        time: (now - EmulatedTime::SIMULATION_START)
+            .as_nanos()
+            .try_into()
+            .unwrap(),
+        hostname: hostname.to_string(),
+        kind,
+    };
+    writer().send(Message::Record(record));
+}
+
+/// Notify the writer thread that all hosts have finished the round, so that it can write the
+/// round's records.
+pub fn end_round() {
+    if let Some(writer) = WRITER.get() {
+        writer.send(Message::EndRound);
+    }
+}
+
+/// Write all remaining records, and wait for the writer thread to exit.
+pub fn finish() {
+    if let Some(writer) = WRITER.get() {
+        writer.finish();
+    }
+}
+
+const FILE_NAMES: [&str; 3] = [
+    "heartbeat-node.csv",
+    "heartbeat-socket.csv",
+    "heartbeat-ram.csv",
+];
+
+/// A metrics file, or `None` if it hasn't been created yet. Once writing to a file has failed, it
+/// stays `Some(None)` and isn't written to again.
+type MetricsFile = Option<Option<BufWriter<File>>>;
+
+fn writer_thread_fn(messages: Messages<Message>, data_path: &Path) {
+    let mut files: [MetricsFile; 3] = Default::default();
+    // the records received during the current round
+    let mut records = Vec::new();
+
+    for message in messages {
+        match message {
+            Message::Record(record) => records.push(record),
+            Message::EndRound => write_round(&mut records, &mut files, data_path),
+        }
+    }
+
+    write_round(&mut records, &mut files, data_path);
+
+    for file in files.iter_mut().flatten().flatten() {
+        if let Err(e) = file.flush() {
+            log::warn!("Could not flush a heartbeat metrics file: {e}");
+        }
+    }
+}
+
+fn write_round(records: &mut Vec<Record>, files: &mut [MetricsFile; 3], data_path: &Path) {
+    // a stable sort keeps the order of each host's records within the round
+    records.sort_by(|a, b| a.sort_key().cmp(&b.sort_key()));
+
+    let mut row = String::new();
+    for record in records.drain(..) {
+        let idx = record.file_index();
+
+        let file = files[idx].get_or_insert_with(|| {
+            let path = data_path.join(FILE_NAMES[idx]);
+            let mut header = String::new();
+            record.write_header(&mut header);
+
+            let mut file = match File::create(&path) {
+                Ok(f) => BufWriter::new(f),
+                Err(e) => {
+                    log::warn!("Could not create '{}': {e}", path.display());
+                    return None;
+                }
+            };
+            if let Err(e) = file.write_all(header.as_bytes()) {
+                log::warn!("Could not write to '{}': {e}", path.display());
+                return None;
+            }
+            Some(file)
+        });
+
+        let Some(writer) = file else {
+            continue;
+        };
+
+        row.clear();
+        record.write_row(&mut row);
+        if let Err(e) = writer.write_all(row.as_bytes()) {
+            log::warn!("Could not write to '{}': {e}", FILE_NAMES[idx]);
+            *file = None;
+        }
+    }
+}
+
+mod export {
+    use std::ffi::CStr;
+    use std::os::raw::c_char;
+
+    use super::*;
+    use crate::host::host::Host;
+
+    /// Record a host's node statistics for the current heartbeat interval.
+    #[no_mangle]
+    pub unsafe extern "C" fn trackermetrics_writeNode(
+        host: *const Host,
+        record: *const TrackerNodeRecord,
+    ) {
+        let host = unsafe { host.as_ref().unwrap() };
+        let record = unsafe { record.as_ref().unwrap() };
+        send_record(host.name(), RecordKind::Node(*record));
+    }
+
+    /// Record a socket's statistics for the current heartbeat interval. `protocol` must be a
+    /// static string.
+    #[no_mangle]
+    pub unsafe extern "C" fn trackermetrics_writeSocket(
+        host: *const Host,
+        record: *const TrackerSocketRecord,
+        protocol: *const c_char,
+        peer_hostname: *const c_char,
+    ) {
+        let host = unsafe { host.as_ref().unwrap() };
+        let record = unsafe { record.as_ref().unwrap() };
+        let protocol: &'static CStr = unsafe { CStr::from_ptr(protocol) };
+        let peer_hostname = unsafe { CStr::from_ptr(peer_hostname) };
+        send_record(
+            host.name(),
+            RecordKind::Socket {
+                record: *record,
+                protocol: protocol.to_str().unwrap(),
+                peer_hostname: peer_hostname.to_string_lossy().into_owned(),
+            },
+        );
+    }
+
+    /// Record a host's memory allocation statistics for the current heartbeat interval.
+    #[no_mangle]
+    pub unsafe extern "C" fn trackermetrics_writeRam(
+        host: *const Host,
+        record: *const TrackerRamRecord,
+    ) {
+        let host = unsafe { host.as_ref().unwrap() };
+        let record = unsafe { record.as_ref().unwrap() };
+        send_record(host.name(), RecordKind::Ram(*record));
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn node_record(time: u64, hostname: &str, processing_nanos: u64) -> Record {
+        Record {
+            time,
+            hostname: hostname.to_string(),
+            kind: RecordKind::Node(TrackerNodeRecord {
+                interval_nanos: 1_000_000_000,
+                processing_nanos,
+                ..Default::default()
+            }),
+        }
+    }
+
+    #[test]
+    fn test_header_matches_row() {
+        let records = [
+            node_record(0, "a", 0),
+            Record {
+                time: 0,
+                hostname: "a".to_string(),
+                kind: RecordKind::Socket {
+                    record: TrackerSocketRecord::default(),
+                    protocol: "TCP",
+                    peer_hostname: "b".to_string(),
+                },
+            },
+            Record {
+                time: 0,
+                hostname: "a".to_string(),
+                kind: RecordKind::Ram(TrackerRamRecord::default()),
+            },
+        ];
+
+        for record in records {
+            let mut header = String::new();
+            record.write_header(&mut header);
+            let mut row = String::new();
+            record.write_row(&mut row);
+            assert_eq!(header.split(',').count(), row.split(',').count());
+        }
+    }
+
+    #[test]
+    fn test_write_round() {
+        let dir =
+            std::env::temp_dir().join(format!("shadow-tracker-metrics-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+
+        let mut counters = TrackerInterfaceCounters::default();
+        counters.in_remote.packets_data = 2;
+        counters.in_remote.bytes_data_header = 100;
+        counters.in_remote.bytes_data_payload = 1000;
+        let mut records = vec![
+            node_record(2, "a", 5),
+            node_record(1, "b", 4),
+            Record {
+                time: 1,
+                hostname: "a".to_string(),
+                kind: RecordKind::Node(TrackerNodeRecord {
+                    interval_nanos: 1,
+                    counters,
+                    ..Default::default()
+                }),
+            },
+        ];
+
+        let mut files: [MetricsFile; 3] = Default::default();
+        write_round(&mut records, &mut files, &dir);
+        assert!(records.is_empty());
+        for file in files.iter_mut().flatten().flatten() {
+            file.flush().unwrap();
+        }
+        assert!(files[1].is_none());
+
+        let contents = std::fs::read_to_string(dir.join(FILE_NAMES[0])).unwrap();
+        let rows: Vec<Vec<&str>> = contents
+            .lines()
+            .map(|line| line.split(',').take(5).collect())
+            .collect();
+        assert_eq!(
+            rows,
+            [
+                vec![
+                    "time-nanos",
+                    "hostname",
+                    "interval-nanos",
+                    "recv-bytes",
+                    "send-bytes"
+                ],
+                vec!["1", "a", "1", "1100", "0"],
+                vec!["1", "b", "1000000000", "0", "0"],
+                vec!["2", "a", "1000000000", "0", "0"],
+            ]
+        );
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn test_sockets_sorted_by_number() {
+        let socket_record = |socket| Record {
+            time: 1,
+            hostname: "a".to_string(),
+            kind: RecordKind::Socket {
+                record: TrackerSocketRecord {
+                    socket,
+                    ..Default::default()
+                },
+                protocol: "UDP",
+                peer_hostname: "b".to_string(),
+            },
+        };
+
+        let mut records = vec![socket_record(2), node_record(1, "a", 0), socket_record(0)];
+        records.sort_by(|a, b| a.sort_key().cmp(&b.sort_key()));
+
+        let sockets: Vec<u64> = records
+            .iter()
+            .filter_map(|x| match &x.kind {
+                RecordKind::Socket { record, .. } => Some(record.socket),
+                _ => None,
+            })
+            .collect();
+        assert_eq!(sockets, [0, 2]);
+    }
+}
@@ -0,0 +1,291 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#include "main/host/zygote.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "lib/logger/logger.h"
+#include "main/utility/utility.h"
+
+typedef struct _Zygote {
+    // Serializes spawn requests, and starting the zygote.
+    GMutex lock;
+    // 0 until the zygote has been started.
+    pid_t pid;
+    // Shadow's end of the socket, or -1 if the zygote isn't usable.
+    int sock;
+    // Set once the zygote failed to start or stopped responding, after which
+    // we don't try to use it again.
+    bool broken;
+} Zygote;
+
+// Zygotes, keyed by the file, argv, and environment they were started with.
+static GMutex _zygotesLock;
+static GHashTable* _zygotes = NULL;
+
+// Environment variables that differ between processes that can otherwise share
+// a zygote. These aren't read by the shim until after the zygote has forked,
+// so aren't part of the zygote's key or environment.
+static const char* _perProcessVars[] = {
+    "SHADOW_IPC_BLK",        "SHADOW_SHM_HOST_BLK", "SHADOW_SHM_PROCESS_BLK",
+    "SHADOW_SHM_THREAD_BLK", "SHADOW_LOG_FILE",     "SHADOW_TSC_HZ",
+};
+
+static bool _zygote_isPerProcessVar(const char* entry) {
+    for (size_t i = 0; i < G_N_ELEMENTS(_perProcessVars); i++) {
+        size_t len = strlen(_perProcessVars[i]);
+        if (strncmp(entry, _perProcessVars[i], len) == 0 && entry[len] == '=') {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void _zygote_appendStr(GByteArray* bytes, const char* str) {
+    g_byte_array_append(bytes, (const guint8*)str, strlen(str) + 1);
+}
+
+static GBytes* _zygote_key(const char* file, char* const argv[], char* const envp[]) {
+    GByteArray* bytes = g_byte_array_new();
+
+    _zygote_appendStr(bytes, file);
+    for (char* const* arg = argv; *arg != NULL; arg++) {
+        _zygote_appendStr(bytes, *arg);
+    }
+    // separates the arguments from the environment
+    g_byte_array_append(bytes, (const guint8*)"", 1);
+    for (char* const* entry = envp; *entry != NULL; entry++) {
+        if (!_zygote_isPerProcessVar(*entry)) {
+            _zygote_appendStr(bytes, *entry);
+        }
+    }
+
+    return g_byte_array_free_to_bytes(bytes);
+}
+
+static void _zygote_free(Zygote* zygote) {
+    if (zygote->sock >= 0) {
+        close(zygote->sock);
+    }
+    g_mutex_clear(&zygote->lock);
+    g_free(zygote);
+}
+
+static void _zygote_markBroken(Zygote* zygote) {
+    if (zygote->sock >= 0) {
+        close(zygote->sock);
+        zygote->sock = -1;
+    }
+    zygote->broken = true;
+}
+
+static void _zygote_start(Zygote* zygote, const char* file, char* const argv[], char* const envp[],
+                          const char* workingDir) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds)) {
+        warning("socketpair: %s", g_strerror(errno));
+        _zygote_markBroken(zygote);
+        return;
+    }
+
+    // Everything the child needs must be allocated before the vfork.
+    GPtrArray* zygoteEnv = g_ptr_array_new_with_free_func(g_free);
+    for (char* const* entry = envp; *entry != NULL; entry++) {
+        if (!_zygote_isPerProcessVar(*entry)) {
+            g_ptr_array_add(zygoteEnv, g_strdup(*entry));
+        }
+    }
+    g_ptr_array_add(zygoteEnv, g_strdup_printf("%s=%d", ZYGOTE_FD_ENV_VAR, fds[1]));
+    g_ptr_array_add(zygoteEnv, NULL);
+    char** zygoteEnvv = (char**)zygoteEnv->pdata;
+
+    pid_t pid = vfork();
+
+    // As in _managedthread_fork_exec, don't add any code between here and the
+    // execvpe below. See `man 2 vfork`.
+
+    switch (pid) {
+        case -1:
+            utility_panic("fork failed");
+            break;
+        case 0: {
+            // child
+
+            // *Don't* close the zygote's end of the socket on exec.
+            if (fcntl(fds[1], F_SETFD, 0)) {
+                die_after_vfork();
+            }
+
+            if (chdir(workingDir) < 0) {
+                die_after_vfork();
+            }
+
+            execvpe(file, argv, zygoteEnvv);
+            die_after_vfork();
+        }
+        default: // parent
+            break;
+    }
+
+    g_ptr_array_unref(zygoteEnv);
+
+    if (close(fds[1])) {
+        utility_panic("close: %s", g_strerror(errno));
+    }
+
+    zygote->pid = pid;
+    zygote->sock = fds[0];
+
+    debug("started zygote for %s with PID %d", file, pid);
+}
+
+// Ask the zygote to fork a new process, returning its pid, or -1 on failure.
+static pid_t _zygote_request(Zygote* zygote, char* const envp[], const char* workingDir,
+                             int watchFd) {
+    GByteArray* msg = g_byte_array_new();
+    _zygote_appendStr(msg, workingDir);
+    for (char* const* entry = envp; *entry != NULL; entry++) {
+        _zygote_appendStr(msg, *entry);
+    }
+
+    if (msg->len > ZYGOTE_MAX_REQUEST_LEN) {
+        debug("zygote request of %u bytes is too large", msg->len);
+        g_byte_array_unref(msg);
+        return -1;
+    }
+
+    struct iovec iov = {.iov_base = msg->data, .iov_len = msg->len};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control = {0};
+    struct msghdr header = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    // pass the childpidwatcher pipe, which the new process will inherit
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &watchFd, sizeof(int));
+
+    ssize_t rv = sendmsg(zygote->sock, &header, MSG_NOSIGNAL);
+    g_byte_array_unref(msg);
+    if (rv < 0) {
+        warning("Could not send request to zygote %d: %s", zygote->pid, g_strerror(errno));
+        _zygote_markBroken(zygote);
+        return -1;
+    }
+
+    int32_t response = 0;
+    do {
+        rv = recv(zygote->sock, &response, sizeof(response), 0);
+    } while (rv < 0 && errno == EINTR);
+
+    if (rv != sizeof(response)) {
+        warning("Zygote %d stopped responding; starting processes directly instead", zygote->pid);
+        _zygote_markBroken(zygote);
+        return -1;
+    }
+
+    if (response < 0) {
+        warning("Zygote %d could not fork: %s", zygote->pid, g_strerror(-response));
+        return -1;
+    }
+
+    return response;
+}
+
+pid_t zygote_spawn(const char* file, char* const argv[], char* const envp[],
+                   const char* workingDir, int watchFd) {
+    utility_debugAssert(file != NULL);
+
+    GBytes* key = _zygote_key(file, argv, envp);
+
+    g_mutex_lock(&_zygotesLock);
+    if (_zygotes == NULL) {
+        _zygotes = g_hash_table_new_full(
+            g_bytes_hash, g_bytes_equal, (GDestroyNotify)g_bytes_unref, (GDestroyNotify)_zygote_free);
+    }
+    Zygote* zygote = g_hash_table_lookup(_zygotes, key);
+    if (zygote == NULL) {
+        zygote = g_new0(Zygote, 1);
+        g_mutex_init(&zygote->lock);
+        zygote->sock = -1;
+        g_hash_table_insert(_zygotes, key, zygote);
+    } else {
+        g_bytes_unref(key);
+    }
+    g_mutex_unlock(&_zygotesLock);
+
+    // Only hold the zygote's own lock while starting it, so that zygotes for
+    // different binaries can start in parallel.
+    g_mutex_lock(&zygote->lock);
+
+    if (zygote->pid == 0 && !zygote->broken) {
+        _zygote_start(zygote, file, argv, envp, workingDir);
+    }
+
+    pid_t pid = -1;
+    if (!zygote->broken) {
+        pid = _zygote_request(zygote, envp, workingDir, watchFd);
+    }
+
+    g_mutex_unlock(&zygote->lock);
+
+    if (pid > 0) {
+        debug("started process %s with PID %d from zygote %d", file, pid, zygote->pid);
+    }
+    return pid;
+}
+
+void zygote_shutdownAll() {
+    g_mutex_lock(&_zygotesLock);
+
+    if (_zygotes != NULL) {
+        GHashTableIter iter;
+        gpointer value;
+        g_hash_table_iter_init(&iter, _zygotes);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            Zygote* zygote = value;
+
+            // the zygote exits once its socket is closed
+            _zygote_markBroken(zygote);
+
+            if (zygote->pid > 0) {
+                int status = 0;
+                if (waitpid(zygote->pid, &status, 0) < 0) {
+                    warning("waitpid on zygote %d: %s", zygote->pid, g_strerror(errno));
+                } else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL) {
+                    // its parent-death signal, if the thread that started it
+                    // has already exited
+                    debug("Zygote %d was killed during shutdown", zygote->pid);
+                } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                    warning("Zygote %d exited abnormally with status %d", zygote->pid, status);
+                }
+            }
+        }
+
+        g_hash_table_destroy(_zygotes);
+        _zygotes = NULL;
+    }
+
+    g_mutex_unlock(&_zygotesLock);
+}
@@ -0,0 +1,52 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#ifndef SRC_MAIN_HOST_ZYGOTE_H_
+#define SRC_MAIN_HOST_ZYGOTE_H_
+
+#include <sys/types.h>
+
+/*
+ * A zygote is a plugin process that has been started and loaded (including
+ * dynamic linking and relocation), but that stops in the shim's constructor,
+ * before it's initialized as a managed process. Each later launch of the same
+ * binary with the same arguments and environment is then a fork of the zygote
+ * rather than a new execve, which skips the loader's work.
+ *
+ * The zygote's children are created with CLONE_PARENT so that they're direct
+ * children of Shadow, exactly as if they had been started with vfork+execvpe.
+ */
+
+// Environment variable holding the zygote's end of its socket with Shadow. The
+// shim becomes a zygote if this is set.
+#define ZYGOTE_FD_ENV_VAR "SHADOW_ZYGOTE_FD"
+
+// Maximum size of a spawn request: the working directory followed by the
+// "KEY=VALUE" environment entries, each nul-terminated.
+#define ZYGOTE_MAX_REQUEST_LEN (64 * 1024)
+
+/*
+ * Start a process running `file` with `argv` and `envp` in `workingDir` by
+ * forking a zygote, starting the zygote first if there isn't one yet for this
+ * file, argv, and environment. `watchFd` is inherited by the new process, as
+ * the write end of the childpidwatcher pipe.
+ *
+ * Returns the native pid of the new process, or -1 if the process couldn't be
+ * started through a zygote, in which case the caller should start it directly.
+ *
+ * THREAD SAFETY: Thread-safe.
+ */
+pid_t zygote_spawn(const char* file, char* const argv[], char* const envp[],
+                   const char* workingDir, int watchFd);
+
+/*
+ * Tell all zygotes to exit, and wait for them to do so. Must only be called
+ * once no more processes will be spawned, and before the threads that called
+ * `zygote_spawn` exit, since each zygote is killed when the thread that started
+ * it exits.
+ */
+void zygote_shutdownAll();
+
+#endif // SRC_MAIN_HOST_ZYGOTE_H_
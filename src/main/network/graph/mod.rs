@@ -1,21 +1,26 @@
 mod petgraph_wrapper;
+pub mod routing;
 
 use std::collections::hash_map::Entry;
 use std::collections::HashMap;
 use std::error::Error;
 use std::hash::Hash;
+use std::io::{BufRead, Write};
 
 use crate::core::support::configuration::{
     self, Compression, FileSource, GraphOptions, GraphSource,
 };
 use crate::core::support::{units, units::Unit};
 use crate::network::graph::petgraph_wrapper::GraphWrapper;
+use crate::network::graph::routing::{DijkstraScratch, PathMatrix, TargetSet};
 use crate::utility::tilde_expansion;
 
 use anyhow::Context;
+use gml_parser::gml;
 use log::*;
 use petgraph::graph::NodeIndex;
-use rayon::iter::{IntoParallelIterator, ParallelIterator};
+use rayon::iter::{IndexedParallelIterator, IntoParallelRefIterator, ParallelIterator};
+use rayon::slice::ParallelSliceMut;
 
 type NetGraphError = Box<dyn Error + Send + Sync + 'static>;
 
@@ -134,38 +139,48 @@ impl NetworkGraph {
     }
 
     pub fn parse(graph_text: &str) -> Result<Self, NetGraphError> {
-        let gml_graph = gml_parser::parse(graph_text)?;
-
-        let mut g = match gml_graph.directed {
-            true => GraphWrapper::Directed(
-                petgraph::graph::Graph::<_, _, petgraph::Directed, _>::with_capacity(
-                    gml_graph.nodes.len(),
-                    gml_graph.edges.len(),
-                ),
-            ),
-            false => {
-                GraphWrapper::Undirected(
-                    petgraph::graph::Graph::<_, _, petgraph::Undirected, _>::with_capacity(
-                        gml_graph.nodes.len(),
-                        gml_graph.edges.len(),
-                    ),
-                )
-            }
-        };
+        Self::from_reader(graph_text.as_bytes())
+    }
+
+    /// Parse a graph incrementally from a reader. Nodes and edges are added to the graph as they
+    /// are read, so the graph text and parsed GML are never held in memory all at once.
+    pub fn from_reader(reader: impl BufRead) -> Result<Self, NetGraphError> {
+        // the graph is built as directed and converted at the end, since the 'directed' key may
+        // appear anywhere in the graph
+        let mut g = petgraph::graph::Graph::<_, _, petgraph::Directed, u32>::default();
+        let mut directed = false;
 
         // map from GML id to petgraph id
         let mut id_map = HashMap::new();
 
-        for x in gml_graph.nodes.into_iter() {
-            let x: ShadowNode = x.try_into()?;
-            let gml_id = x.id;
-            let petgraph_id = g.add_node(x);
-            id_map.insert(gml_id, petgraph_id);
+        // edges that were read before one of their nodes
+        let mut pending_edges = Vec::new();
+
+        for item in gml_parser::GmlReader::new(reader) {
+            match item? {
+                gml::GmlItem::Node(x) => {
+                    let x: ShadowNode = x.try_into()?;
+                    let gml_id = x.id;
+                    let petgraph_id = g.add_node(x);
+                    if id_map.insert(gml_id, petgraph_id).is_some() {
+                        return Err(format!("Node id {} was used more than once", gml_id).into());
+                    }
+                }
+                gml::GmlItem::Edge(x) => {
+                    let x: ShadowEdge = x.try_into()?;
+                    match (id_map.get(&x.source), id_map.get(&x.target)) {
+                        (Some(source), Some(target)) => {
+                            g.add_edge(*source, *target, x);
+                        }
+                        _ => pending_edges.push(x),
+                    }
+                }
+                gml::GmlItem::Directed(x) => directed = x,
+                gml::GmlItem::KeyValue(_) => {}
+            }
         }
 
-        for x in gml_graph.edges.into_iter() {
-            let x: ShadowEdge = x.try_into()?;
-
+        for x in pending_edges.into_iter() {
             let source = *id_map
                 .get(&x.source)
                 .ok_or(format!("Edge source {} doesn't exist", x.source))?;
@@ -176,81 +191,81 @@ impl NetworkGraph {
             g.add_edge(source, target, x);
         }
 
+        g.shrink_to_fit();
+
+        let g = match directed {
+            true => GraphWrapper::Directed(g),
+            false => GraphWrapper::Undirected(g.into_edge_type()),
+        };
+
         Ok(Self {
             graph: g,
             node_id_to_index_map: id_map,
         })
     }
 
+    /// Compute the shortest paths between every pair of `nodes`. The path from a node to itself
+    /// is its self-loop rather than an empty path.
     pub fn compute_shortest_paths(
         &self,
         nodes: &[NodeIndex],
-    ) -> Result<HashMap<(NodeIndex, NodeIndex), PathProperties>, NetGraphError> {
+    ) -> Result<PathMatrix<NodeIndex>, NetGraphError> {
         let start = std::time::Instant::now();
 
-        // calculate shortest paths
-        let mut paths: HashMap<(_, _), PathProperties> = nodes
-            .into_par_iter()
-            .flat_map(|src| {
-                match &self.graph {
-                    GraphWrapper::Directed(graph) => {
-                        petgraph::algo::dijkstra(&graph, *src, None, |e| e.weight().into())
-                    }
-                    GraphWrapper::Undirected(graph) => {
-                        petgraph::algo::dijkstra(&graph, *src, None, |e| e.weight().into())
-                    }
-                }
-                .into_iter()
-                // ignore nodes that aren't in use
-                .filter(|(dst, _)| nodes.contains(dst))
-                // include the src node
-                .map(|(dst, path)| ((*src, dst), path))
-                .collect::<HashMap<(_, _), _>>()
-            })
-            .collect();
+        let graph_node_count = self.graph.node_count();
+        let targets = TargetSet::new(graph_node_count, nodes);
+
+        // each row is computed independently and written in-place
+        let mut paths = vec![PathProperties::default(); nodes.len().pow(2)];
+        paths
+            .par_chunks_mut(std::cmp::max(nodes.len(), 1))
+            .zip(nodes.par_iter())
+            .try_for_each_init(
+                || DijkstraScratch::new(graph_node_count),
+                |scratch, (row, src)| {
+                    routing::shortest_paths_from_wrapper(&self.graph, *src, &targets, row, scratch)
+                },
+            )?;
 
         // use the self-loop for paths from a node to itself
-        for node in nodes {
-            // the dijkstra shortest path from node -> node will always be 0
-            assert_eq!(paths[&(*node, *node)], PathProperties::default());
+        for (i, node) in nodes.iter().enumerate() {
+            // the shortest path from node -> node will always be 0
+            let path = &mut paths[i * nodes.len() + i];
+            assert_eq!(*path, PathProperties::default());
 
             // there must be a single self-loop for each node
-            paths.insert((*node, *node), self.get_edge_weight(node, node)?.into());
+            *path = self.get_edge_weight(node, node)?.into();
         }
 
-        assert_eq!(paths.len(), nodes.len().pow(2));
-
         debug!(
             "Finished computing shortest paths: {} seconds, {} entries",
             (std::time::Instant::now() - start).as_secs(),
             paths.len()
         );
 
-        Ok(paths)
+        Ok(PathMatrix::new(nodes.to_vec(), paths))
     }
 
     pub fn get_direct_paths(
         &self,
         nodes: &[NodeIndex],
-    ) -> Result<HashMap<(NodeIndex, NodeIndex), PathProperties>, NetGraphError> {
+    ) -> Result<PathMatrix<NodeIndex>, NetGraphError> {
         let start = std::time::Instant::now();
 
-        let paths: HashMap<_, _> = nodes
-            .iter()
-            .flat_map(|src| nodes.iter().map(move |dst| (*src, *dst)))
+        let paths: Vec<PathProperties> = nodes
+            .par_iter()
+            .flat_map_iter(|src| nodes.iter().map(move |dst| (*src, *dst)))
             // we require the graph to be connected with exactly one edge between any two nodes
-            .map(|(src, dst)| Ok(((src, dst), self.get_edge_weight(&src, &dst)?.into())))
+            .map(|(src, dst)| Ok(self.get_edge_weight(&src, &dst)?.into()))
             .collect::<Result<_, NetGraphError>>()?;
 
-        assert_eq!(paths.len(), nodes.len().pow(2));
-
         debug!(
             "Finished computing direct paths: {} seconds, {} entries",
             (std::time::Instant::now() - start).as_secs(),
             paths.len()
         );
 
-        Ok(paths)
+        Ok(PathMatrix::new(nodes.to_vec(), paths))
     }
 
     /// Get the weight for the edge between two nodes. Returns an error if there
@@ -424,12 +439,12 @@ impl<T: Copy + Eq + Hash + std::fmt::Display> IpAssignment<T> {
 /// Routing information for paths between nodes.
 #[derive(Debug)]
 pub struct RoutingInfo<T: Eq + Hash + std::fmt::Display + Clone + Copy> {
-    paths: HashMap<(T, T), PathProperties>,
+    paths: PathMatrix<T>,
     packet_counters: std::sync::RwLock<HashMap<(T, T), u64>>,
 }
 
 impl<T: Eq + Hash + std::fmt::Display + Clone + Copy> RoutingInfo<T> {
-    pub fn new(paths: HashMap<(T, T), PathProperties>) -> Self {
+    pub fn new(paths: PathMatrix<T>) -> Self {
         Self {
             paths,
             packet_counters: std::sync::RwLock::new(HashMap::new()),
@@ -438,7 +453,7 @@ impl<T: Eq + Hash + std::fmt::Display + Clone + Copy> RoutingInfo<T> {
 
     /// Get properties for the path from one node to another.
     pub fn path(&self, start: T, end: T) -> Option<PathProperties> {
-        self.paths.get(&(start, end)).copied()
+        self.paths.get(start, end)
     }
 
     /// Increment the number of packets sent from one node to another.
@@ -455,7 +470,7 @@ impl<T: Eq + Hash + std::fmt::Display + Clone + Copy> RoutingInfo<T> {
     pub fn log_packet_counts(&self) {
         // only logs paths that have transmitted at least one packet
         for ((start, end), count) in self.packet_counters.read().unwrap().iter() {
-            let path = self.paths.get(&(*start, *end)).unwrap();
+            let path = self.paths.get(*start, *end).unwrap();
             log::debug!(
                 "Found path {}->{}: latency={}ns, packet_loss={}, packet_count={}",
                 start,
@@ -468,39 +483,141 @@ impl<T: Eq + Hash + std::fmt::Display + Clone + Copy> RoutingInfo<T> {
     }
 
     pub fn get_smallest_latency_ns(&self) -> Option<u64> {
-        self.paths.values().map(|x| x.latency_ns).min()
+        self.paths.paths().iter().map(|x| x.latency_ns).min()
+    }
+}
+
+/// The number of decompressed bytes passed at a time from the decompression thread to the
+/// reader.
+const XZ_CHUNK_NBYTES: usize = 1 << 20;
+
+/// The maximum number of decompressed chunks that can be waiting to be read.
+const XZ_MAX_PENDING_CHUNKS: usize = 4;
+
+/// A reader that decompresses an xz file on a background thread. Only a few chunks of the
+/// decompressed file are held in memory at a time.
+struct XzReader {
+    receiver: std::sync::mpsc::Receiver<std::io::Result<Vec<u8>>>,
+    chunk: Vec<u8>,
+    pos: usize,
+}
+
+impl XzReader {
+    fn new(mut file: impl BufRead + Send + 'static) -> Self {
+        let (sender, receiver) = std::sync::mpsc::sync_channel(XZ_MAX_PENDING_CHUNKS);
+
+        std::thread::Builder::new()
+            .name("graph-xz".into())
+            .spawn(move || {
+                let mut writer = ChunkWriter {
+                    sender: sender.clone(),
+                    chunk: Vec::with_capacity(XZ_CHUNK_NBYTES),
+                };
+                let rv = lzma_rs::xz_decompress(&mut file, &mut writer)
+                    .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e.to_string()))
+                    .and_then(|_| writer.flush());
+                if let Err(e) = rv {
+                    // if the reader has gone away, there's nobody left to tell
+                    let _ = sender.send(Err(e));
+                }
+            })
+            .unwrap();
+
+        Self {
+            receiver,
+            chunk: Vec::new(),
+            pos: 0,
+        }
     }
 }
 
-/// Read and decompress a file.
-fn read_xz<P: AsRef<std::path::Path>>(path: P) -> Result<String, NetGraphError> {
+impl std::io::Read for XzReader {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        let available = self.fill_buf()?;
+        let len = std::cmp::min(available.len(), buf.len());
+        buf[..len].copy_from_slice(&available[..len]);
+        self.consume(len);
+        Ok(len)
+    }
+}
+
+impl BufRead for XzReader {
+    fn fill_buf(&mut self) -> std::io::Result<&[u8]> {
+        while self.pos == self.chunk.len() {
+            match self.receiver.recv() {
+                Ok(chunk) => {
+                    self.chunk = chunk?;
+                    self.pos = 0;
+                }
+                // the decompression thread has finished
+                Err(_) => break,
+            }
+        }
+        Ok(&self.chunk[self.pos..])
+    }
+
+    fn consume(&mut self, amt: usize) {
+        self.pos = std::cmp::min(self.pos + amt, self.chunk.len());
+    }
+}
+
+/// Passes written bytes to an [`XzReader`] in chunks.
+struct ChunkWriter {
+    sender: std::sync::mpsc::SyncSender<std::io::Result<Vec<u8>>>,
+    chunk: Vec<u8>,
+}
+
+impl std::io::Write for ChunkWriter {
+    fn write(&mut self, buf: &[u8]) -> std::io::Result<usize> {
+        let len = std::cmp::min(buf.len(), XZ_CHUNK_NBYTES - self.chunk.len());
+        self.chunk.extend_from_slice(&buf[..len]);
+        if self.chunk.len() == XZ_CHUNK_NBYTES {
+            self.flush()?;
+        }
+        Ok(len)
+    }
+
+    fn flush(&mut self) -> std::io::Result<()> {
+        if self.chunk.is_empty() {
+            return Ok(());
+        }
+        let chunk = std::mem::replace(&mut self.chunk, Vec::with_capacity(XZ_CHUNK_NBYTES));
+        // fails if the reader was dropped, which stops the decompression
+        self.sender
+            .send(Ok(chunk))
+            .map_err(|_| std::io::Error::from(std::io::ErrorKind::BrokenPipe))
+    }
+}
+
+/// Open and decompress a file.
+fn read_xz<P: AsRef<std::path::Path>>(path: P) -> Result<XzReader, NetGraphError> {
     let path = path.as_ref();
 
-    let mut f = std::io::BufReader::new(
+    let f = std::io::BufReader::new(
         std::fs::File::open(path).with_context(|| format!("Failed to open file: {path:?}"))?,
     );
 
-    let mut decomp: Vec<u8> = Vec::new();
-    lzma_rs::xz_decompress(&mut f, &mut decomp).context("Failed to decompress file")?;
-    decomp.shrink_to_fit();
-
-    Ok(String::from_utf8(decomp)?)
+    Ok(XzReader::new(f))
 }
 
-/// Get the network graph as a string.
-pub fn load_network_graph(graph_options: &GraphOptions) -> Result<String, NetGraphError> {
+/// Get a reader for the network graph. Compressed graphs are decompressed as they are read.
+pub fn load_network_graph(
+    graph_options: &GraphOptions,
+) -> Result<Box<dyn BufRead + '_>, NetGraphError> {
     Ok(match graph_options {
         GraphOptions::Gml(GraphSource::File(FileSource {
             compression: None,
             path: f,
-        })) => std::fs::read_to_string(tilde_expansion(f))
-            .with_context(|| format!("Failed to read file: {f}"))?,
+        })) => Box::new(std::io::BufReader::new(
+            std::fs::File::open(tilde_expansion(f))
+                .with_context(|| format!("Failed to read file: {f}"))?,
+        )),
         GraphOptions::Gml(GraphSource::File(FileSource {
             compression: Some(Compression::Xz),
             path: f,
-        })) => read_xz(tilde_expansion(f))?,
-        GraphOptions::Gml(GraphSource::Inline(s)) => s.clone(),
-        GraphOptions::OneGbitSwitch => configuration::ONE_GBIT_SWITCH_GRAPH.to_string(),
+        })) => Box::new(read_xz(tilde_expansion(f))?),
+        GraphOptions::Gml(GraphSource::Inline(s)) => Box::new(s.as_bytes()),
+        GraphOptions::OneGbitSwitch => Box::new(configuration::ONE_GBIT_SWITCH_GRAPH.as_bytes()),
     })
 }
 
@@ -552,6 +669,99 @@ mod tests {
         }
     }
 
+    #[test]
+    fn test_edge_before_node() {
+        let graph = r#"graph [
+              edge [
+                source 1
+                target 2
+                latency "1 ns"
+              ]
+              node [
+                id 1
+              ]
+              node [
+                id 2
+              ]
+              directed 1
+            ]"#;
+
+        let graph = NetworkGraph::parse(graph).unwrap();
+        let source = *graph.node_id_to_index(1).unwrap();
+        let target = *graph.node_id_to_index(2).unwrap();
+        assert!(matches!(graph.graph(), GraphWrapper::Directed(_)));
+        assert!(graph.graph().find_edge(source, target).is_some());
+        assert!(graph.graph().find_edge(target, source).is_none());
+    }
+
+    #[test]
+    fn test_duplicate_id() {
+        let graph = r#"graph [
+              node [
+                id 1
+              ]
+              node [
+                id 1
+              ]
+            ]"#;
+
+        NetworkGraph::parse(graph).unwrap_err();
+    }
+
+    // disabled under miri since it spawns a thread and is slow
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn test_xz_reader() {
+        let text = configuration::ONE_GBIT_SWITCH_GRAPH.repeat(10_000);
+
+        let mut compressed = Vec::new();
+        lzma_rs::xz_compress(&mut text.as_bytes(), &mut compressed).unwrap();
+
+        let mut decompressed = String::new();
+        let mut reader = XzReader::new(std::io::Cursor::new(compressed));
+        std::io::Read::read_to_string(&mut reader, &mut decompressed).unwrap();
+        assert_eq!(decompressed, text);
+
+        // a truncated file must return an error rather than a short read
+        let mut compressed = Vec::new();
+        lzma_rs::xz_compress(&mut text.as_bytes(), &mut compressed).unwrap();
+        compressed.truncate(compressed.len() / 2);
+
+        let mut reader = XzReader::new(std::io::Cursor::new(compressed));
+        std::io::Read::read_to_end(&mut reader, &mut Vec::new()).unwrap_err();
+    }
+
+    // disabled under miri due to https://github.com/rayon-rs/rayon/issues/952
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn test_unreachable_node() {
+        let graph = r#"graph [
+              node [
+                id 0
+              ]
+              node [
+                id 1
+              ]
+              edge [
+                source 0
+                target 0
+                latency "1 ns"
+              ]
+              edge [
+                source 1
+                target 1
+                latency "1 ns"
+              ]
+            ]"#;
+
+        let graph = NetworkGraph::parse(graph).unwrap();
+        let node_0 = *graph.node_id_to_index(0).unwrap();
+        let node_1 = *graph.node_id_to_index(1).unwrap();
+
+        graph.compute_shortest_paths(&[node_0]).unwrap();
+        graph.compute_shortest_paths(&[node_0, node_1]).unwrap_err();
+    }
+
     // disabled under miri due to https://github.com/rayon-rs/rayon/issues/952
     #[test]
     #[cfg_attr(miri, ignore)]
@@ -616,7 +826,7 @@ mod tests {
                 .compute_shortest_paths(&[node_0, node_1, node_2])
                 .unwrap();
 
-            let lookup_latency = |a, b| shortest_paths.get(&(a, b)).unwrap().latency_ns;
+            let lookup_latency = |a, b| shortest_paths.get(a, b).unwrap().latency_ns;
 
             if *directed {
                 assert_eq!(lookup_latency(node_0, node_0), 3333);
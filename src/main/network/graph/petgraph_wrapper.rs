@@ -26,4 +26,7 @@ impl<N, E, Ix: IndexType> GraphWrapper<N, E, Ix> {
     enum_passthrough!(self, (a, b), Directed, Undirected;
         pub fn find_edge(&self, a: NodeIndex<Ix>, b: NodeIndex<Ix>) -> Option<EdgeIndex<Ix>>
     );
+    enum_passthrough!(self, (), Directed, Undirected;
+        pub fn node_count(&self) -> usize
+    );
 }
@@ -0,0 +1,472 @@
+//! Precomputation of the routing paths between the graph nodes that are in use.
+
+use std::cmp::Ordering;
+use std::collections::{BinaryHeap, HashMap};
+use std::hash::Hash;
+use std::io::{Read, Write};
+use std::path::Path;
+
+use petgraph::graph::{Graph, NodeIndex};
+use petgraph::visit::EdgeRef;
+use petgraph::EdgeType;
+
+use super::{NetGraphError, NetworkGraph, PathProperties, ShadowEdge, ShadowNode};
+use crate::network::graph::petgraph_wrapper::GraphWrapper;
+use crate::utility::stable_hash::StableHasher;
+
+/// A dense matrix of path properties between every pair of a set of nodes.
+#[derive(Debug)]
+pub struct PathMatrix<T: Copy + Eq + Hash> {
+    nodes: Vec<T>,
+    node_map: HashMap<T, usize>,
+    /// Row-major, indexed by `src * nodes.len() + dst`.
+    paths: Vec<PathProperties>,
+}
+
+impl<T: Copy + Eq + Hash> PathMatrix<T> {
+    pub fn new(nodes: Vec<T>, paths: Vec<PathProperties>) -> Self {
+        assert_eq!(paths.len(), nodes.len().pow(2));
+        let node_map: HashMap<_, _> = nodes.iter().enumerate().map(|(i, x)| (*x, i)).collect();
+        assert_eq!(
+            node_map.len(),
+            nodes.len(),
+            "Duplicate nodes in path matrix"
+        );
+
+        Self {
+            nodes,
+            node_map,
+            paths,
+        }
+    }
+
+    /// Get properties for the path from one node to another.
+    pub fn get(&self, src: T, dst: T) -> Option<PathProperties> {
+        let src = self.node_map.get(&src)?;
+        let dst = self.node_map.get(&dst)?;
+        Some(self.paths[src * self.nodes.len() + dst])
+    }
+
+    pub fn nodes(&self) -> &[T] {
+        &self.nodes
+    }
+
+    pub fn paths(&self) -> &[PathProperties] {
+        &self.paths
+    }
+
+    /// Convert the node type, for example from petgraph indexes to gml node IDs.
+    pub fn map_nodes<U: Copy + Eq + Hash>(self, f: impl Fn(T) -> U) -> PathMatrix<U> {
+        PathMatrix::new(self.nodes.into_iter().map(f).collect(), self.paths)
+    }
+}
+
+/// Marks a graph node that isn't a destination in [`TargetSet`].
+const NOT_A_TARGET: u32 = u32::MAX;
+
+/// Maps each graph node to its column in the path matrix, if it's one of the nodes in use.
+pub struct TargetSet {
+    columns: Vec<u32>,
+    len: usize,
+}
+
+impl TargetSet {
+    pub fn new(graph_node_count: usize, nodes: &[NodeIndex]) -> Self {
+        let mut columns = vec![NOT_A_TARGET; graph_node_count];
+        for (i, node) in nodes.iter().enumerate() {
+            columns[node.index()] = i.try_into().unwrap();
+        }
+
+        Self {
+            columns,
+            len: nodes.len(),
+        }
+    }
+
+    fn column(&self, node: NodeIndex) -> Option<usize> {
+        match self.columns[node.index()] {
+            NOT_A_TARGET => None,
+            x => Some(x as usize),
+        }
+    }
+}
+
+/// An entry in the dijkstra priority queue, ordered so that the lowest cost is the greatest.
+struct HeapEntry {
+    cost: PathProperties,
+    node: NodeIndex,
+}
+
+impl Ord for HeapEntry {
+    fn cmp(&self, other: &Self) -> Ordering {
+        // order by lowest latency first, then by lowest packet loss
+        other
+            .cost
+            .latency_ns
+            .cmp(&self.cost.latency_ns)
+            .then(other.cost.packet_loss.total_cmp(&self.cost.packet_loss))
+    }
+}
+
+impl PartialOrd for HeapEntry {
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl PartialEq for HeapEntry {
+    fn eq(&self, other: &Self) -> bool {
+        self.cmp(other) == Ordering::Equal
+    }
+}
+
+impl Eq for HeapEntry {}
+
+/// Per-thread state for [`shortest_paths_from`], reused between source nodes.
+pub struct DijkstraScratch {
+    costs: Vec<Option<PathProperties>>,
+    settled: Vec<bool>,
+    heap: BinaryHeap<HeapEntry>,
+}
+
+impl DijkstraScratch {
+    pub fn new(graph_node_count: usize) -> Self {
+        Self {
+            costs: vec![None; graph_node_count],
+            settled: vec![false; graph_node_count],
+            heap: BinaryHeap::new(),
+        }
+    }
+}
+
+/// Compute the shortest paths from `src` to every node in `targets`, writing the paths to `row`
+/// (indexed by the target's column). Stops as soon as all targets have been reached, rather than
+/// exploring the whole graph.
+fn shortest_paths_from<Ty: EdgeType>(
+    graph: &Graph<ShadowNode, ShadowEdge, Ty, u32>,
+    src: NodeIndex,
+    targets: &TargetSet,
+    row: &mut [PathProperties],
+    scratch: &mut DijkstraScratch,
+) -> Result<(), NetGraphError> {
+    scratch.costs.fill(None);
+    scratch.settled.fill(false);
+    scratch.heap.clear();
+
+    let mut remaining = targets.len;
+
+    scratch.costs[src.index()] = Some(PathProperties::default());
+    scratch.heap.push(HeapEntry {
+        cost: PathProperties::default(),
+        node: src,
+    });
+
+    while let Some(HeapEntry { cost, node }) = scratch.heap.pop() {
+        if std::mem::replace(&mut scratch.settled[node.index()], true) {
+            // already reached through a shorter path
+            continue;
+        }
+
+        if let Some(column) = targets.column(node) {
+            row[column] = cost;
+            remaining -= 1;
+            if remaining == 0 {
+                break;
+            }
+        }
+
+        for edge in graph.edges(node) {
+            let next = edge.target();
+            if scratch.settled[next.index()] {
+                continue;
+            }
+
+            let next_cost = cost + edge.weight().into();
+            let next_best = &mut scratch.costs[next.index()];
+            if next_best.map_or(true, |x| next_cost < x) {
+                *next_best = Some(next_cost);
+                scratch.heap.push(HeapEntry {
+                    cost: next_cost,
+                    node: next,
+                });
+            }
+        }
+    }
+
+    if remaining != 0 {
+        return Err(format!(
+            "Not all nodes in use are reachable from node {}",
+            graph.node_weight(src).unwrap().id
+        )
+        .into());
+    }
+
+    Ok(())
+}
+
+/// Compute the shortest paths from `src` to every node in `targets`. See [`shortest_paths_from`].
+pub fn shortest_paths_from_wrapper(
+    graph: &GraphWrapper<ShadowNode, ShadowEdge, u32>,
+    src: NodeIndex,
+    targets: &TargetSet,
+    row: &mut [PathProperties],
+    scratch: &mut DijkstraScratch,
+) -> Result<(), NetGraphError> {
+    match graph {
+        GraphWrapper::Directed(graph) => shortest_paths_from(graph, src, targets, row, scratch),
+        GraphWrapper::Undirected(graph) => shortest_paths_from(graph, src, targets, row, scratch),
+    }
+}
+
+const CACHE_MAGIC: &[u8; 8] = b"SHDROUT2";
+
+/// A canonical serialization of everything that affects the routing between a set of nodes: the
+/// graph's nodes and edges, the nodes in use, and whether shortest paths are used. It's stored in
+/// the routing cache file and compared when the file is read, and its hash names the file.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct CacheKey(Vec<u8>);
+
+impl CacheKey {
+    /// `nodes` must be sorted.
+    pub fn new(graph: &NetworkGraph, nodes: &[u32], use_shortest_paths: bool) -> Self {
+        fn push_graph<Ty: EdgeType>(
+            graph: &Graph<ShadowNode, ShadowEdge, Ty, u32>,
+            buf: &mut Vec<u8>,
+        ) {
+            // the graph's nodes and edges are sorted so that the key doesn't depend on the order
+            // they're listed in the graph file
+            let mut node_ids: Vec<u32> = graph.node_indices().map(|x| graph[x].id).collect();
+            node_ids.sort_unstable();
+
+            let mut edges: Vec<(u32, u32, u64, u32)> = graph
+                .edge_references()
+                .map(|edge| {
+                    let mut source = graph[edge.source()].id;
+                    let mut target = graph[edge.target()].id;
+                    if !Ty::is_directed() && source > target {
+                        std::mem::swap(&mut source, &mut target);
+                    }
+                    let path = PathProperties::from(edge.weight());
+                    (source, target, path.latency_ns, path.packet_loss.to_bits())
+                })
+                .collect();
+            edges.sort_unstable();
+
+            buf.push(Ty::is_directed().into());
+            push_u32(buf, node_ids.len());
+            for id in node_ids {
+                buf.extend_from_slice(&id.to_le_bytes());
+            }
+            push_u32(buf, edges.len());
+            for (source, target, latency_ns, packet_loss) in edges {
+                buf.extend_from_slice(&source.to_le_bytes());
+                buf.extend_from_slice(&target.to_le_bytes());
+                buf.extend_from_slice(&latency_ns.to_le_bytes());
+                buf.extend_from_slice(&packet_loss.to_le_bytes());
+            }
+        }
+
+        fn push_u32(buf: &mut Vec<u8>, x: usize) {
+            buf.extend_from_slice(&u32::try_from(x).unwrap().to_le_bytes());
+        }
+
+        debug_assert!(nodes.windows(2).all(|x| x[0] < x[1]));
+
+        let mut buf = Vec::new();
+        match graph.graph() {
+            GraphWrapper::Directed(graph) => push_graph(graph, &mut buf),
+            GraphWrapper::Undirected(graph) => push_graph(graph, &mut buf),
+        }
+        push_u32(&mut buf, nodes.len());
+        for id in nodes {
+            buf.extend_from_slice(&id.to_le_bytes());
+        }
+        buf.push(use_shortest_paths.into());
+
+        Self(buf)
+    }
+
+    /// A hash of the key that's the same in every run, for naming the cache file.
+    pub fn hash(&self) -> u64 {
+        let mut hasher = StableHasher::new();
+        hasher.write(CACHE_MAGIC);
+        hasher.write(&self.0);
+        hasher.finish()
+    }
+}
+
+/// Read a path matrix previously written with [`write_cache`]. Returns an error if the file
+/// doesn't exist or wasn't written with the same `key` and `nodes`.
+pub fn read_cache(path: &Path, key: &CacheKey, nodes: &[u32]) -> std::io::Result<PathMatrix<u32>> {
+    let invalid = |msg| std::io::Error::new(std::io::ErrorKind::InvalidData, msg);
+
+    let mut file = std::io::BufReader::new(std::fs::File::open(path)?);
+
+    let mut magic = [0u8; 8];
+    file.read_exact(&mut magic)?;
+    if &magic != CACHE_MAGIC {
+        return Err(invalid("Unrecognized file format"));
+    }
+
+    let read_u32 = |file: &mut std::io::BufReader<std::fs::File>| -> std::io::Result<u32> {
+        let mut buf = [0u8; 4];
+        file.read_exact(&mut buf)?;
+        Ok(u32::from_le_bytes(buf))
+    };
+
+    // a different graph could have the same file name if the key hashes collide
+    let key_len = read_u32(&mut file)? as usize;
+    if key_len != key.0.len() {
+        return Err(invalid("The network graph does not match"));
+    }
+    let mut file_key = vec![0u8; key_len];
+    file.read_exact(&mut file_key)?;
+    if file_key != key.0 {
+        return Err(invalid("The network graph does not match"));
+    }
+
+    let len = read_u32(&mut file)? as usize;
+    if len != nodes.len() {
+        return Err(invalid("The set of nodes does not match"));
+    }
+    for node in nodes {
+        if read_u32(&mut file)? != *node {
+            return Err(invalid("The set of nodes does not match"));
+        }
+    }
+
+    let mut paths = Vec::with_capacity(len * len);
+    for _ in 0..(len * len) {
+        let mut latency_ns = [0u8; 8];
+        file.read_exact(&mut latency_ns)?;
+        let packet_loss = f32::from_bits(read_u32(&mut file)?);
+        paths.push(PathProperties {
+            latency_ns: u64::from_le_bytes(latency_ns),
+            packet_loss,
+        });
+    }
+
+    if file.read(&mut [0u8])? != 0 {
+        return Err(invalid("Unexpected trailing data"));
+    }
+
+    Ok(PathMatrix::new(nodes.to_vec(), paths))
+}
+
+/// Write a path matrix so that it can be reused by later simulations. The file is written
+/// atomically so that concurrent simulations never see a partial file.
+pub fn write_cache(path: &Path, key: &CacheKey, matrix: &PathMatrix<u32>) -> std::io::Result<()> {
+    let tmp_path = path.with_extension(format!("tmp.{}", std::process::id()));
+
+    let rv = (|| {
+        let mut file = std::io::BufWriter::new(std::fs::File::create(&tmp_path)?);
+        file.write_all(CACHE_MAGIC)?;
+        file.write_all(&u32::try_from(key.0.len()).unwrap().to_le_bytes())?;
+        file.write_all(&key.0)?;
+        file.write_all(&u32::try_from(matrix.nodes().len()).unwrap().to_le_bytes())?;
+        for node in matrix.nodes() {
+            file.write_all(&node.to_le_bytes())?;
+        }
+        for path in matrix.paths() {
+            file.write_all(&path.latency_ns.to_le_bytes())?;
+            file.write_all(&path.packet_loss.to_bits().to_le_bytes())?;
+        }
+        file.into_inner()?.sync_all()?;
+        std::fs::rename(&tmp_path, path)
+    })();
+
+    if rv.is_err() {
+        let _ = std::fs::remove_file(&tmp_path);
+    }
+
+    rv
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn graph(edges: &[(u32, u32, &str)]) -> NetworkGraph {
+        let mut graph = String::from("graph [\n");
+        for id in [3, 5, 6] {
+            graph.push_str(&format!("  node [\n    id {id}\n  ]\n"));
+        }
+        for (source, target, latency) in edges {
+            graph.push_str(&format!(
+                "  edge [\n    source {source}\n    target {target}\n    latency \"{latency}\"\n  ]\n"
+            ));
+        }
+        graph.push_str("]");
+        NetworkGraph::parse(&graph).unwrap()
+    }
+
+    #[test]
+    fn test_cache_key() {
+        let edges = [(3, 3, "1 ms"), (3, 5, "2 ms"), (5, 6, "3 ms")];
+        let key = CacheKey::new(&graph(&edges), &[3, 5], true);
+
+        // the order of the edges in the graph file doesn't matter, nor does the order of the
+        // endpoints of an undirected edge
+        let reordered = [(6, 5, "3 ms"), (3, 3, "1 ms"), (3, 5, "2 ms")];
+        assert_eq!(CacheKey::new(&graph(&reordered), &[3, 5], true), key);
+        assert_eq!(
+            CacheKey::new(&graph(&reordered), &[3, 5], true).hash(),
+            key.hash()
+        );
+
+        // but the edges, their weights, the nodes in use, and the routing mode do
+        for other in [
+            CacheKey::new(&graph(&[(3, 3, "1 ms"), (3, 5, "2 ms")]), &[3, 5], true),
+            CacheKey::new(
+                &graph(&[(3, 3, "1 ms"), (3, 5, "2 ms"), (5, 6, "4 ms")]),
+                &[3, 5],
+                true,
+            ),
+            CacheKey::new(&graph(&edges), &[3, 6], true),
+            CacheKey::new(&graph(&edges), &[3, 5], false),
+        ] {
+            assert_ne!(other, key);
+            assert_ne!(other.hash(), key.hash());
+        }
+    }
+
+    #[test]
+    fn test_cache_roundtrip() {
+        let dir = std::env::temp_dir().join(format!("shadow-routing-test-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("routing.bin");
+
+        let nodes = vec![3, 5];
+        let paths: Vec<_> = (0..4)
+            .map(|x| PathProperties {
+                latency_ns: 1000 + x,
+                packet_loss: x as f32 / 10.0,
+            })
+            .collect();
+        let matrix = PathMatrix::new(nodes.clone(), paths);
+
+        let edges = [(3, 3, "1 ms"), (3, 5, "2 ms"), (5, 6, "3 ms")];
+        let key = CacheKey::new(&graph(&edges), &nodes, true);
+
+        write_cache(&path, &key, &matrix).unwrap();
+
+        let read = read_cache(&path, &key, &nodes).unwrap();
+        assert_eq!(read.nodes(), matrix.nodes());
+        for (a, b) in read.paths().iter().zip(matrix.paths()) {
+            assert_eq!(a.latency_ns, b.latency_ns);
+            assert_eq!(a.packet_loss, b.packet_loss);
+        }
+        assert_eq!(read.get(5, 3).unwrap().latency_ns, 1002);
+
+        // a different set of nodes must not use the cached paths
+        read_cache(&path, &key, &[3, 6]).unwrap_err();
+        read_cache(&path, &key, &[3]).unwrap_err();
+
+        // nor must a graph with different edges, even if the file has its name
+        let other = CacheKey::new(&graph(&edges[..2]), &nodes, true);
+        let err = read_cache(&path, &other, &nodes).unwrap_err();
+        assert_eq!(err.kind(), std::io::ErrorKind::InvalidData);
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -1,5 +1,7 @@
 pub mod graph;
 pub mod packet;
+pub mod pcap_capture;
+pub mod pcap_filter;
 mod relay;
 pub mod router;
 
@@ -0,0 +1,694 @@
+//! Packet capture for network interfaces.
+//!
+//! Worker threads don't write captured packets to files themselves. Each thread serializes the
+//! packets that it captures into a thread-local buffer, which is handed to a single writer thread
+//! when it grows large and at the end of each scheduling round (see [`flush_thread`] and
+//! [`end_round`]). At the end of each round, the writer thread orders the round's packets by their
+//! capture time (and by interface name for packets captured at the same time) so that the output
+//! doesn't depend on which threads the hosts ran on, and writes them to either a pcap file for
+//! each interface or a single pcapng file.
+//!
+//! Each interface can also be given a capture filter and sampling options (see [`PcapOptions`]),
+//! which are checked before a packet is serialized so that packets that aren't captured are cheap.
+
+use std::cell::RefCell;
+use std::collections::HashMap;
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::net::Ipv4Addr;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::Arc;
+
+use once_cell::sync::OnceCell;
+use rand::{Rng, SeedableRng};
+use rand_xoshiro::Xoshiro256PlusPlus;
+use shadow_shim_helper_rs::simulation_time::CSimulationTime;
+
+use crate::core::support::configuration::PcapFormat;
+use crate::cshadow as c;
+use crate::network::pcap_filter::{PacketFields, PcapFilter, Protocol};
+use crate::utility::background_writer::{BackgroundWriter, Messages};
+use crate::utility::give::Give;
+use crate::utility::pcap_writer::{PacketDisplay, PcapNgWriter, PcapWriter, TimestampPrecision};
+use crate::utility::stable_hash::StableHasher;
+
+/// Send a thread's buffer to the writer thread when it's at least this large.
+const MAX_THREAD_BUFFER_LEN: usize = 1 << 20;
+
+/// How many messages may be queued for the writer thread before capturing threads block. Packet
+/// messages are about `MAX_THREAD_BUFFER_LEN` bytes each, so this keeps at most about 256 MiB of
+/// packets waiting to be written.
+const MAX_QUEUED_MESSAGES: usize = 256;
+
+/// The most pcap files that the writer thread keeps open at once.
+const MAX_OPEN_PCAP_FILES: usize = 256;
+
+static CONFIG: OnceCell<Config> = OnceCell::new();
+static WRITER: OnceCell<BackgroundWriter<Message>> = OnceCell::new();
+static NEXT_INTERFACE_ID: AtomicU32 = AtomicU32::new(0);
+
+thread_local!(static BUFFER: RefCell<Vec<u8>> = RefCell::new(Vec::new()));
+
+struct Config {
+    format: PcapFormat,
+    data_path: PathBuf,
+}
+
+enum Message {
+    NewInterface(InterfaceInfo),
+    /// Serialized packets from a worker thread's buffer.
+    Packets(Vec<u8>),
+    EndRound,
+}
+
+struct InterfaceInfo {
+    id: u32,
+    name: String,
+    /// The pcap file, when using the pcap format.
+    path: PathBuf,
+    capture_len: u32,
+}
+
+/// Set the capture file format. Must be called before any interfaces are created.
+pub fn init(format: PcapFormat, data_path: &Path) {
+    CONFIG
+        .set(Config {
+            format,
+            data_path: data_path.to_path_buf(),
+        })
+        .ok()
+        .expect("Packet capture was already initialized");
+}
+
+fn writer() -> &'static BackgroundWriter<Message> {
+    WRITER.get_or_init(|| {
+        let (format, data_path) = match CONFIG.get() {
+            Some(config) => (config.format, config.data_path.clone()),
+            None => (PcapFormat::Pcap, PathBuf::new()),
+        };
+
+        BackgroundWriter::bounded("shadow-pcap", MAX_QUEUED_MESSAGES, move |messages| {
+            writer_thread_fn(messages, format, &data_path)
+        })
+    })
+}
+
+/// Options for capturing packets on an interface.
+#[derive(Debug, Clone)]
+pub struct PcapOptions {
+    /// When using the pcap format, packets are written to this directory.
+    pub dir: PathBuf,
+    /// Each packet (header and payload) captured will be truncated to this length.
+    pub capture_len: u32,
+    /// Only capture packets that match this filter.
+    pub filter: Option<Arc<PcapFilter>>,
+    /// Only capture this many packets of each flow.
+    pub flow_packet_limit: Option<u32>,
+    /// Capture each packet with this probability.
+    pub sample_probability: f64,
+    /// Seed for the sampling RNG, which is separate from the host's RNG so that capturing doesn't
+    /// change the simulation.
+    pub seed: u64,
+}
+
+/// A flow, independent of the direction of its packets.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+struct FlowKey {
+    protocol: Protocol,
+    a: (Ipv4Addr, u16),
+    b: (Ipv4Addr, u16),
+}
+
+impl FlowKey {
+    fn new(fields: &PacketFields) -> Self {
+        let src = (fields.src_ip, fields.src_port);
+        let dst = (fields.dst_ip, fields.dst_port);
+        Self {
+            protocol: fields.protocol,
+            a: std::cmp::min(src, dst),
+            b: std::cmp::max(src, dst),
+        }
+    }
+}
+
+/// Decides which of an interface's packets are captured, using the filter and sampling options.
+struct PacketSelector {
+    filter: Option<Arc<PcapFilter>>,
+    flow_packet_limit: Option<u32>,
+    sample_probability: f64,
+    random: Xoshiro256PlusPlus,
+    /// The number of packets captured for each flow, if there is a flow packet limit.
+    flow_packet_counts: HashMap<FlowKey, u32>,
+}
+
+impl PacketSelector {
+    fn new(name: &str, options: &PcapOptions) -> Self {
+        // each of a host's interfaces gets a different sampling RNG, and the same one in every run
+        let mut hasher = StableHasher::new();
+        hasher.write_u64(options.seed);
+        hasher.write_delimited(name.as_bytes());
+
+        Self {
+            filter: options.filter.clone(),
+            flow_packet_limit: options.flow_packet_limit,
+            sample_probability: options.sample_probability,
+            random: Xoshiro256PlusPlus::seed_from_u64(hasher.finish()),
+            flow_packet_counts: HashMap::new(),
+        }
+    }
+
+    fn should_capture(&mut self, fields: impl FnOnce() -> Option<PacketFields>) -> bool {
+        if self.filter.is_none()
+            && self.flow_packet_limit.is_none()
+            && self.sample_probability >= 1.0
+        {
+            return true;
+        }
+
+        let fields = fields();
+
+        if let Some(filter) = &self.filter {
+            // packets that a filter can't be applied to aren't captured
+            if !fields.map_or(false, |x| filter.matches(&x)) {
+                return false;
+            }
+        }
+
+        if self.sample_probability < 1.0 && !self.random.gen_bool(self.sample_probability) {
+            return false;
+        }
+
+        if let (Some(limit), Some(fields)) = (self.flow_packet_limit, fields) {
+            let count = self
+                .flow_packet_counts
+                .entry(FlowKey::new(&fields))
+                .or_insert(0);
+            if *count >= limit {
+                return false;
+            }
+            *count += 1;
+        }
+
+        true
+    }
+}
+
+/// A network interface that packets are captured on.
+pub struct PcapInterface {
+    id: u32,
+    capture_len: u32,
+    selector: RefCell<PacketSelector>,
+}
+
+impl PcapInterface {
+    /// Start capturing packets for the interface `name`. When using the pcap format, packets are
+    /// written to `<options.dir>/<name>.pcap`.
+    pub fn new(name: &str, options: &PcapOptions) -> Self {
+        let id = NEXT_INTERFACE_ID.fetch_add(1, Ordering::Relaxed);
+
+        let info = InterfaceInfo {
+            id,
+            name: name.to_string(),
+            path: options.dir.join(format!("{name}.pcap")),
+            capture_len: options.capture_len,
+        };
+
+        // the interface is registered before any of its packets can be sent to the writer thread
+        writer().send(Message::NewInterface(info));
+
+        Self {
+            id,
+            capture_len: options.capture_len,
+            selector: RefCell::new(PacketSelector::new(name, options)),
+        }
+    }
+
+    /// Whether the packet should be captured, given a function that returns the packet's fields
+    /// (or `None` if it isn't a TCP or UDP packet). This should be checked before calling
+    /// [`capture`](Self::capture).
+    pub fn should_capture(&self, fields: impl FnOnce() -> Option<PacketFields>) -> bool {
+        self.selector.borrow_mut().should_capture(fields)
+    }
+
+    /// Capture a packet at `time` nanoseconds after the start of the simulation.
+    pub fn capture(&self, time: u64, packet: &impl PacketDisplay, packet_len: u32) {
+        BUFFER.with(|buf| {
+            let mut buf = buf.borrow_mut();
+            let start = buf.len();
+
+            // the captured length is filled in once the packet data has been written
+            buf.extend_from_slice(&self.id.to_ne_bytes());
+            buf.extend_from_slice(&time.to_ne_bytes());
+            buf.extend_from_slice(&packet_len.to_ne_bytes());
+            buf.extend_from_slice(&0u32.to_ne_bytes());
+            let data_start = buf.len();
+
+            match packet.display_bytes(Give::new(&mut *buf, self.capture_len.into())) {
+                Ok(()) => {}
+                // the entire packet couldn't be written, which is fine since we'll use a smaller
+                // captured packet length value
+                Err(e) if e.kind() == std::io::ErrorKind::WriteZero => {}
+                Err(e) => {
+                    log::warn!("Unable to capture packet: {e}");
+                    buf.truncate(start);
+                    return;
+                }
+            }
+
+            let captured_len = u32::try_from(buf.len() - data_start).unwrap();
+            buf[(data_start - 4)..data_start].copy_from_slice(&captured_len.to_ne_bytes());
+
+            if buf.len() >= MAX_THREAD_BUFFER_LEN {
+                send_buffer(&mut buf);
+            }
+        });
+    }
+}
+
+fn send_buffer(buf: &mut Vec<u8>) {
+    writer().send(Message::Packets(std::mem::take(buf)));
+}
+
+/// Send this thread's captured packets to the writer thread. Each worker thread must call this
+/// before the end of each round.
+pub fn flush_thread() {
+    BUFFER
+        .try_with(|buf| {
+            let mut buf = buf.borrow_mut();
+            if !buf.is_empty() {
+                send_buffer(&mut buf);
+            }
+        })
+        .ok();
+}
+
+/// Notify the writer thread that all worker threads have flushed their packets for the round.
+pub fn end_round() {
+    if let Some(writer) = WRITER.get() {
+        writer.send(Message::EndRound);
+    }
+}
+
+/// Write all remaining packets, and wait for the writer thread to exit.
+pub fn finish() {
+    if let Some(writer) = WRITER.get() {
+        writer.finish();
+    }
+}
+
+/// A packet parsed from a thread's buffer.
+struct CapturedPacket<'a> {
+    interface_id: u32,
+    time: u64,
+    packet_len: u32,
+    data: &'a [u8],
+}
+
+fn parse_packets<'a>(mut buf: &'a [u8], packets: &mut Vec<CapturedPacket<'a>>) {
+    fn take<const N: usize>(buf: &mut &[u8]) -> [u8; N] {
+        let (x, rest) = buf.split_at(N);
+        *buf = rest;
+        x.try_into().unwrap()
+    }
+
+    while !buf.is_empty() {
+        let interface_id = u32::from_ne_bytes(take(&mut buf));
+        let time = u64::from_ne_bytes(take(&mut buf));
+        let packet_len = u32::from_ne_bytes(take(&mut buf));
+        let captured_len = u32::from_ne_bytes(take(&mut buf));
+        let (data, rest) = buf.split_at(captured_len.try_into().unwrap());
+        buf = rest;
+
+        packets.push(CapturedPacket {
+            interface_id,
+            time,
+            packet_len,
+            data,
+        });
+    }
+}
+
+fn writer_thread_fn(messages: Messages<Message>, format: PcapFormat, data_path: &Path) {
+    let mut output = match format {
+        PcapFormat::Pcap => Output::Pcap(PcapFiles::default()),
+        PcapFormat::Pcapng => Output::Pcapng(PcapNgFile::new(data_path.join("capture.pcapng"))),
+    };
+
+    // interface info indexed by interface id
+    let mut interfaces: Vec<Option<Interface>> = Vec::new();
+    // the buffers received during the current round
+    let mut buffers: Vec<Vec<u8>> = Vec::new();
+
+    for message in messages {
+        match message {
+            Message::NewInterface(info) => {
+                let idx = usize::try_from(info.id).unwrap();
+                if interfaces.len() <= idx {
+                    interfaces.resize_with(idx + 1, || None);
+                }
+                interfaces[idx] = Some(Interface {
+                    info,
+                    created: false,
+                    pcapng_id: None,
+                    failed: false,
+                });
+            }
+            Message::Packets(buf) => buffers.push(buf),
+            Message::EndRound => {
+                write_round(&buffers, &mut interfaces, &mut output);
+                buffers.clear();
+            }
+        }
+    }
+
+    write_round(&buffers, &mut interfaces, &mut output);
+    output.flush();
+}
+
+fn write_round(buffers: &[Vec<u8>], interfaces: &mut [Option<Interface>], output: &mut Output) {
+    let mut packets = Vec::new();
+    for buf in buffers {
+        parse_packets(buf, &mut packets);
+    }
+
+    // a stable sort, so that each interface's packets stay in the order they were captured
+    packets.sort_by(|a, b| {
+        a.time.cmp(&b.time).then_with(|| {
+            let name = |x: &CapturedPacket| {
+                &interfaces[x.interface_id as usize]
+                    .as_ref()
+                    .unwrap()
+                    .info
+                    .name
+            };
+            name(a).cmp(name(b))
+        })
+    });
+
+    for packet in &packets {
+        let interface = interfaces[packet.interface_id as usize].as_mut().unwrap();
+        if interface.failed {
+            continue;
+        }
+
+        if let Err(e) = output.write(interface, packet) {
+            log::warn!(
+                "Fatal pcap logging error; stopping pcap logging for interface '{}': {e}",
+                interface.info.name,
+            );
+            interface.failed = true;
+        }
+    }
+}
+
+struct Interface {
+    info: InterfaceInfo,
+    /// Whether the interface's pcap file has been created.
+    created: bool,
+    /// The interface's id in the pcapng file, if it has been added.
+    pcapng_id: Option<u32>,
+    failed: bool,
+}
+
+enum Output {
+    Pcap(PcapFiles),
+    Pcapng(PcapNgFile),
+}
+
+impl Output {
+    fn write(&mut self, interface: &mut Interface, packet: &CapturedPacket) -> std::io::Result<()> {
+        match self {
+            Self::Pcap(x) => x.write(interface, packet),
+            Self::Pcapng(x) => x.write(interface, packet),
+        }
+    }
+
+    fn flush(&mut self) {
+        let rv = match self {
+            Self::Pcap(x) => x.flush(),
+            Self::Pcapng(x) => x.flush(),
+        };
+        if let Err(e) = rv {
+            log::warn!("Unable to flush pcap output: {e}");
+        }
+    }
+}
+
+/// A pcap file for each interface. To avoid running out of file descriptors in large simulations,
+/// only some of the files are kept open at a time.
+#[derive(Default)]
+struct PcapFiles {
+    files: HashMap<u32, PcapWriter<BufWriter<File>>>,
+}
+
+impl PcapFiles {
+    fn write(&mut self, interface: &mut Interface, packet: &CapturedPacket) -> std::io::Result<()> {
+        let id = interface.info.id;
+
+        if !self.files.contains_key(&id) && self.files.len() >= MAX_OPEN_PCAP_FILES {
+            self.flush()?;
+            self.files.clear();
+        }
+
+        let writer = match self.files.entry(id) {
+            std::collections::hash_map::Entry::Occupied(x) => x.into_mut(),
+            std::collections::hash_map::Entry::Vacant(x) => {
+                let info = &interface.info;
+                let writer = if interface.created {
+                    let file = std::fs::OpenOptions::new().append(true).open(&info.path)?;
+                    PcapWriter::resume(
+                        BufWriter::new(file),
+                        info.capture_len,
+                        TimestampPrecision::Micros,
+                    )
+                } else {
+                    let file = File::create(&info.path)?;
+                    interface.created = true;
+                    PcapWriter::new_with_precision(
+                        BufWriter::new(file),
+                        info.capture_len,
+                        TimestampPrecision::Micros,
+                    )?
+                };
+                x.insert(writer)
+            }
+        };
+
+        // pcap files use microsecond timestamps, which all tools support
+        const NANOS_PER_SEC: u64 = 1_000_000_000;
+        const NANOS_PER_MICRO: u64 = 1_000;
+        writer.write_captured_packet(
+            u32::try_from(packet.time / NANOS_PER_SEC).unwrap(),
+            u32::try_from(packet.time % NANOS_PER_SEC / NANOS_PER_MICRO).unwrap(),
+            packet.packet_len,
+            packet.data,
+        )
+    }
+
+    fn flush(&mut self) -> std::io::Result<()> {
+        for writer in self.files.values_mut() {
+            writer.get_mut().flush()?;
+        }
+        Ok(())
+    }
+}
+
+/// A single pcapng file for all interfaces.
+struct PcapNgFile {
+    path: PathBuf,
+    /// Created when the first packet is written.
+    writer: Option<PcapNgWriter<BufWriter<File>>>,
+}
+
+impl PcapNgFile {
+    fn new(path: PathBuf) -> Self {
+        Self { path, writer: None }
+    }
+
+    fn write(&mut self, interface: &mut Interface, packet: &CapturedPacket) -> std::io::Result<()> {
+        let writer = match &mut self.writer {
+            Some(x) => x,
+            None => {
+                let file = BufWriter::new(File::create(&self.path)?);
+                self.writer.insert(PcapNgWriter::new(file)?)
+            }
+        };
+
+        // interfaces are added in the order of their first packet, which is deterministic
+        let id = match interface.pcapng_id {
+            Some(x) => x,
+            None => {
+                let id = writer.add_interface(&interface.info.name, interface.info.capture_len)?;
+                *interface.pcapng_id.insert(id)
+            }
+        };
+
+        writer.write_packet(id, packet.time, packet.packet_len, packet.data)
+    }
+
+    fn flush(&mut self) -> std::io::Result<()> {
+        if let Some(writer) = &mut self.writer {
+            writer.get_mut().flush()?;
+        }
+        Ok(())
+    }
+}
+
+mod export {
+    use super::*;
+
+    #[no_mangle]
+    pub extern "C" fn pcapcapture_freeInterface(interface: *mut PcapInterface) {
+        if interface.is_null() {
+            return;
+        }
+        drop(unsafe { Box::from_raw(interface) });
+    }
+
+    /// Capture a packet that was sent or received at time `now`.
+    #[no_mangle]
+    pub extern "C" fn pcapcapture_capturePacket(
+        interface: *const PcapInterface,
+        now: CSimulationTime,
+        packet: *const c::Packet,
+    ) {
+        assert!(!packet.is_null());
+        let interface = unsafe { interface.as_ref() }.unwrap();
+
+        let fields = || {
+            let protocol = match unsafe { c::packet_getProtocol(packet) } {
+                c::_ProtocolType_PTCP => Protocol::Tcp,
+                c::_ProtocolType_PUDP => Protocol::Udp,
+                _ => return None,
+            };
+            // addresses and ports are stored in network byte order
+            Some(PacketFields {
+                protocol,
+                src_ip: u32::from_be(unsafe { c::packet_getSourceIP(packet) }).into(),
+                src_port: u16::from_be(unsafe { c::packet_getSourcePort(packet) }),
+                dst_ip: u32::from_be(unsafe { c::packet_getDestinationIP(packet) }).into(),
+                dst_port: u16::from_be(unsafe { c::packet_getDestinationPort(packet) }),
+            })
+        };
+
+        if !interface.should_capture(fields) {
+            return;
+        }
+
+        let packet_len: u32 = u32::try_from(unsafe { c::packet_getTotalSize(packet) }).unwrap();
+        interface.capture(now, &packet, packet_len);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn options(
+        filter: Option<&str>,
+        flow_packet_limit: Option<u32>,
+        sample_probability: f64,
+    ) -> PcapOptions {
+        PcapOptions {
+            dir: PathBuf::new(),
+            capture_len: 65535,
+            filter: filter.map(|x| Arc::new(x.parse().unwrap())),
+            flow_packet_limit,
+            sample_probability,
+            seed: 1,
+        }
+    }
+
+    fn udp(src_port: u16, dst_port: u16) -> Option<PacketFields> {
+        Some(PacketFields {
+            protocol: Protocol::Udp,
+            src_ip: Ipv4Addr::new(11, 0, 0, 1),
+            src_port,
+            dst_ip: Ipv4Addr::new(11, 0, 0, 2),
+            dst_port,
+        })
+    }
+
+    /// A packet in the opposite direction.
+    fn reply(fields: Option<PacketFields>) -> Option<PacketFields> {
+        fields.map(|x| PacketFields {
+            src_ip: x.dst_ip,
+            src_port: x.dst_port,
+            dst_ip: x.src_ip,
+            dst_port: x.src_port,
+            ..x
+        })
+    }
+
+    #[test]
+    fn test_filter() {
+        let mut selector = PacketSelector::new("eth0", &options(Some("udp"), None, 1.0));
+
+        assert!(selector.should_capture(|| udp(1000, 80)));
+        assert!(!selector.should_capture(|| {
+            Some(PacketFields {
+                protocol: Protocol::Tcp,
+                ..udp(1000, 80).unwrap()
+            })
+        }));
+        // packets without fields can't match a filter
+        assert!(!selector.should_capture(|| None));
+
+        // without any options, every packet is captured
+        let mut selector = PacketSelector::new("eth0", &options(None, None, 1.0));
+        assert!(selector.should_capture(|| None));
+    }
+
+    #[test]
+    fn test_flow_packet_limit() {
+        let mut selector = PacketSelector::new("eth0", &options(None, Some(3), 1.0));
+
+        // both directions of a flow count towards the same limit
+        assert!(selector.should_capture(|| udp(1000, 80)));
+        assert!(selector.should_capture(|| reply(udp(1000, 80))));
+        assert!(selector.should_capture(|| udp(1000, 80)));
+        assert!(!selector.should_capture(|| reply(udp(1000, 80))));
+        assert!(!selector.should_capture(|| udp(1000, 80)));
+
+        // other flows have their own limit
+        assert!(selector.should_capture(|| udp(1001, 80)));
+
+        // packets without fields don't belong to a flow
+        for _ in 0..5 {
+            assert!(selector.should_capture(|| None));
+        }
+    }
+
+    #[test]
+    fn test_sampling() {
+        let sample = |name: &str, probability: f64| {
+            let mut selector = PacketSelector::new(name, &options(None, None, probability));
+            (0..1000)
+                .map(|_| selector.should_capture(|| udp(1000, 80)))
+                .collect::<Vec<_>>()
+        };
+
+        assert!(sample("eth0", 0.0).iter().all(|x| !x));
+        assert!(sample("eth0", 1.0).iter().all(|x| *x));
+
+        let sampled = sample("eth0", 0.5);
+        let count = sampled.iter().filter(|x| **x).count();
+        assert!((400..600).contains(&count), "{count}");
+
+        // the same interface samples the same packets in every run, and other interfaces sample
+        // different packets
+        assert_eq!(sampled, sample("eth0", 0.5));
+        assert_ne!(sampled, sample("lo", 0.5));
+    }
+
+    #[test]
+    fn test_sampling_before_flow_limit() {
+        // packets that aren't sampled don't count towards the flow limit
+        let mut selector = PacketSelector::new("eth0", &options(None, Some(10), 0.5));
+        let count = (0..1000)
+            .filter(|_| selector.should_capture(|| udp(1000, 80)))
+            .count();
+        assert_eq!(count, 10);
+    }
+}
@@ -0,0 +1,290 @@
+//! Filter expressions for packet captures.
+//!
+//! The syntax is a small subset of the pcap-filter(7) syntax used by tcpdump and wireshark:
+//!
+//! ```text
+//! expr      := and_expr { ("or" | "||") and_expr }
+//! and_expr  := unary { ("and" | "&&") unary }
+//! unary     := ("not" | "!") unary | "(" expr ")" | primitive
+//! primitive := "tcp" | "udp"
+//!            | [direction] "host" <ipv4 address>
+//!            | [direction] "net" <ipv4 address>/<prefix length>
+//!            | [direction] "port" <port>
+//! direction := "src" | "dst"
+//! ```
+//!
+//! For example `tcp and port 80 and not host 11.0.0.1`. Without a direction, `host`, `net`, and
+//! `port` match either the source or the destination.
+
+use std::net::Ipv4Addr;
+use std::str::FromStr;
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum Protocol {
+    Tcp,
+    Udp,
+}
+
+/// The packet fields that a filter can match on.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub struct PacketFields {
+    pub protocol: Protocol,
+    pub src_ip: Ipv4Addr,
+    pub src_port: u16,
+    pub dst_ip: Ipv4Addr,
+    pub dst_port: u16,
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum Direction {
+    Src,
+    Dst,
+    Either,
+}
+
+impl Direction {
+    fn matches<T>(
+        &self,
+        fields: &PacketFields,
+        field: impl Fn(&PacketFields, bool) -> T,
+        f: impl Fn(T) -> bool,
+    ) -> bool {
+        match self {
+            Self::Src => f(field(fields, true)),
+            Self::Dst => f(field(fields, false)),
+            Self::Either => f(field(fields, true)) || f(field(fields, false)),
+        }
+    }
+}
+
+/// A parsed capture filter expression.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum PcapFilter {
+    Protocol(Protocol),
+    Host(Direction, Ipv4Addr),
+    /// An address and netmask.
+    Net(Direction, u32, u32),
+    Port(Direction, u16),
+    Not(Box<PcapFilter>),
+    And(Box<PcapFilter>, Box<PcapFilter>),
+    Or(Box<PcapFilter>, Box<PcapFilter>),
+}
+
+impl PcapFilter {
+    /// Whether the packet matches the filter.
+    pub fn matches(&self, packet: &PacketFields) -> bool {
+        fn ip(x: &PacketFields, src: bool) -> Ipv4Addr {
+            if src {
+                x.src_ip
+            } else {
+                x.dst_ip
+            }
+        }
+
+        fn port(x: &PacketFields, src: bool) -> u16 {
+            if src {
+                x.src_port
+            } else {
+                x.dst_port
+            }
+        }
+
+        match self {
+            Self::Protocol(x) => packet.protocol == *x,
+            Self::Host(dir, addr) => dir.matches(packet, ip, |x| x == *addr),
+            Self::Net(dir, addr, mask) => dir.matches(packet, ip, |x| u32::from(x) & mask == *addr),
+            Self::Port(dir, p) => dir.matches(packet, port, |x| x == *p),
+            Self::Not(x) => !x.matches(packet),
+            Self::And(x, y) => x.matches(packet) && y.matches(packet),
+            Self::Or(x, y) => x.matches(packet) || y.matches(packet),
+        }
+    }
+}
+
+impl FromStr for PcapFilter {
+    type Err = String;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        // surround operators with spaces so that they're separate tokens
+        let mut s = s.to_string();
+        for op in ["(", ")", "&&", "||", "!"] {
+            s = s.replace(op, &format!(" {op} "));
+        }
+        let tokens: Vec<&str> = s.split_whitespace().collect();
+
+        let mut parser = Parser {
+            tokens: &tokens,
+            pos: 0,
+        };
+
+        let filter = parser.expr()?;
+        if let Some(token) = parser.peek() {
+            return Err(format!("Unexpected '{token}' in capture filter"));
+        }
+
+        Ok(filter)
+    }
+}
+
+struct Parser<'a> {
+    tokens: &'a [&'a str],
+    pos: usize,
+}
+
+impl<'a> Parser<'a> {
+    fn peek(&self) -> Option<&'a str> {
+        self.tokens.get(self.pos).copied()
+    }
+
+    fn next(&mut self) -> Result<&'a str, String> {
+        let token = self
+            .peek()
+            .ok_or_else(|| "Unexpected end of capture filter".to_string())?;
+        self.pos += 1;
+        Ok(token)
+    }
+
+    fn expr(&mut self) -> Result<PcapFilter, String> {
+        let mut filter = self.and_expr()?;
+        while matches!(self.peek(), Some("or" | "||")) {
+            self.pos += 1;
+            filter = PcapFilter::Or(Box::new(filter), Box::new(self.and_expr()?));
+        }
+        Ok(filter)
+    }
+
+    fn and_expr(&mut self) -> Result<PcapFilter, String> {
+        let mut filter = self.unary()?;
+        while matches!(self.peek(), Some("and" | "&&")) {
+            self.pos += 1;
+            filter = PcapFilter::And(Box::new(filter), Box::new(self.unary()?));
+        }
+        Ok(filter)
+    }
+
+    fn unary(&mut self) -> Result<PcapFilter, String> {
+        match self.next()? {
+            "not" | "!" => Ok(PcapFilter::Not(Box::new(self.unary()?))),
+            "(" => {
+                let filter = self.expr()?;
+                match self.next()? {
+                    ")" => Ok(filter),
+                    x => Err(format!("Expected ')' in capture filter, but found '{x}'")),
+                }
+            }
+            "tcp" => Ok(PcapFilter::Protocol(Protocol::Tcp)),
+            "udp" => Ok(PcapFilter::Protocol(Protocol::Udp)),
+            "src" => self.primitive(Direction::Src),
+            "dst" => self.primitive(Direction::Dst),
+            _ => {
+                self.pos -= 1;
+                self.primitive(Direction::Either)
+            }
+        }
+    }
+
+    fn primitive(&mut self, dir: Direction) -> Result<PcapFilter, String> {
+        let kind = self.next()?;
+        let value = self.next()?;
+
+        match kind {
+            "host" => {
+                let addr = value
+                    .parse()
+                    .map_err(|_| format!("Invalid address '{value}' in capture filter"))?;
+                Ok(PcapFilter::Host(dir, addr))
+            }
+            "net" => {
+                let invalid = || format!("Invalid network '{value}' in capture filter");
+                let (addr, prefix_len) = value.split_once('/').ok_or_else(invalid)?;
+                let addr: Ipv4Addr = addr.parse().map_err(|_| invalid())?;
+                let prefix_len: u32 = prefix_len.parse().map_err(|_| invalid())?;
+                if prefix_len > 32 {
+                    return Err(invalid());
+                }
+                let mask = u32::MAX.checked_shl(32 - prefix_len).unwrap_or(0);
+                Ok(PcapFilter::Net(dir, u32::from(addr) & mask, mask))
+            }
+            "port" => {
+                let port = value
+                    .parse()
+                    .map_err(|_| format!("Invalid port '{value}' in capture filter"))?;
+                Ok(PcapFilter::Port(dir, port))
+            }
+            x => Err(format!("Unknown capture filter primitive '{x}'")),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn packet(protocol: Protocol, src: (&str, u16), dst: (&str, u16)) -> PacketFields {
+        PacketFields {
+            protocol,
+            src_ip: src.0.parse().unwrap(),
+            src_port: src.1,
+            dst_ip: dst.0.parse().unwrap(),
+            dst_port: dst.1,
+        }
+    }
+
+    #[test]
+    fn test_parse() {
+        assert_eq!(
+            "tcp and not port 80".parse(),
+            Ok(PcapFilter::And(
+                Box::new(PcapFilter::Protocol(Protocol::Tcp)),
+                Box::new(PcapFilter::Not(Box::new(PcapFilter::Port(
+                    Direction::Either,
+                    80
+                ))))
+            ))
+        );
+        assert_eq!(
+            "src net 11.0.0.0/8".parse(),
+            Ok(PcapFilter::Net(Direction::Src, 0x0B000000, 0xFF000000))
+        );
+        assert_eq!(
+            "net 0.0.0.0/0".parse(),
+            Ok(PcapFilter::Net(Direction::Either, 0, 0))
+        );
+
+        for invalid in [
+            "",
+            "tcp and",
+            "(tcp",
+            "tcp)",
+            "port",
+            "port http",
+            "host 1.2.3",
+            "net 1.2.3.4/33",
+            "src tcp",
+            "icmp",
+        ] {
+            assert!(invalid.parse::<PcapFilter>().is_err(), "{invalid}");
+        }
+    }
+
+    #[test]
+    fn test_matches() {
+        let p = packet(Protocol::Tcp, ("11.0.0.1", 1000), ("11.0.0.2", 80));
+
+        let matches = |filter: &str| filter.parse::<PcapFilter>().unwrap().matches(&p);
+
+        assert!(matches("tcp"));
+        assert!(!matches("udp"));
+        assert!(matches("port 80"));
+        assert!(matches("port 1000"));
+        assert!(matches("dst port 80"));
+        assert!(!matches("src port 80"));
+        assert!(matches("host 11.0.0.1"));
+        assert!(!matches("dst host 11.0.0.1"));
+        assert!(matches("net 11.0.0.0/24"));
+        assert!(!matches("src net 12.0.0.0/8"));
+        assert!(matches("udp or (tcp and !port 443)"));
+        assert!(!matches("udp || not (tcp && port 80)"));
+        assert!(matches("(udp||tcp)&&!(port 443)"));
+    }
+}
@@ -1,3 +1,4 @@
+use crate::core::sim_stats::ObjectType;
 use crate::core::worker::Worker;
 use crate::cshadow as c;
 use crate::host::host::Host;
@@ -25,7 +26,7 @@ impl Router {
     pub fn new() -> Router {
         Router {
             magic: Magic::new(),
-            _counter: ObjectCounter::new("Router"),
+            _counter: ObjectCounter::new(ObjectType::Router),
             inbound_packets: CoDelQueue::new(),
         }
     }
@@ -115,7 +115,7 @@ Packet* packet_new(const Host* host) {
     guint hostID = host_getID(host);
     guint64 packetID = host_getNewPacketID(host);
     Packet* packet = packet_new_inner(hostID, packetID);
-    worker_count_allocation(Packet);
+    worker_count_allocation(PACKET);
     return packet;
 }
 
@@ -194,7 +194,7 @@ Packet* packet_copy(Packet* packet) {
         }
     }
 
-    worker_count_allocation(Packet);
+    worker_count_allocation(PACKET);
     return copy;
 }
 
@@ -221,7 +221,7 @@ static void _packet_free(Packet* packet) {
     MAGIC_CLEAR(packet);
     g_free(packet);
 
-    worker_count_deallocation(Packet);
+    worker_count_deallocation(PACKET);
 }
 
 void packet_ref(Packet* packet) {
@@ -721,7 +721,7 @@ void packet_addDeliveryStatus(Packet* packet, PacketDeliveryStatusFlags status)
 
     packet->allStatus |= status;
 
-    if(rustlogger_isEnabled(LOGLEVEL_TRACE)) {
+    if(logger_maybeEnabled(LOGLEVEL_TRACE) && rustlogger_isEnabled(LOGLEVEL_TRACE)) {
         g_queue_push_tail(packet->orderedStatus, GUINT_TO_POINTER(status));
         gchar* packetStr = packet_toString(packet);
         trace("[%s] %s", _packet_deliveryStatusToAscii(status), packetStr);
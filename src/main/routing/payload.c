@@ -40,7 +40,7 @@ Payload* payload_new(Thread* thread, PluginVirtualPtr data, gsize dataLength) {
     g_mutex_init(&(payload->lock));
     payload->referenceCount = 1;
 
-    worker_count_allocation(Payload);
+    worker_count_allocation(PAYLOAD);
 
     return payload;
 }
@@ -57,7 +57,7 @@ static void _payload_free(Payload* payload) {
     MAGIC_CLEAR(payload);
     g_free(payload);
 
-    worker_count_deallocation(Payload);
+    worker_count_deallocation(PAYLOAD);
 }
 
 static void _payload_lock(Payload* payload) {
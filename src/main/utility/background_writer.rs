@@ -0,0 +1,110 @@
+//! A thread that writes output in the background, so that worker threads only need to send it a
+//! message.
+//!
+//! The messages are handled in the order that they're sent. [`BackgroundWriter::finish`] waits for
+//! the thread to handle all of the messages sent before it, and for the thread to exit.
+
+use std::sync::Mutex;
+
+use crossbeam::channel::{Receiver, Sender};
+
+enum Message<T> {
+    Item(T),
+    Finish,
+}
+
+pub struct BackgroundWriter<T> {
+    /// Used in log messages.
+    name: &'static str,
+    sender: Sender<Message<T>>,
+    thread: Mutex<Option<std::thread::JoinHandle<()>>>,
+}
+
+impl<T: Send + 'static> BackgroundWriter<T> {
+    /// Start a thread called `name` that runs `f`, which should handle each message from
+    /// [`Messages`] and then return. Sending never blocks.
+    pub fn unbounded(name: &'static str, f: impl FnOnce(Messages<T>) + Send + 'static) -> Self {
+        Self::new(name, crossbeam::channel::unbounded(), f)
+    }
+
+    /// Like [`Self::unbounded`], but sending blocks while `capacity` messages are waiting to be
+    /// handled, so that a slow writer limits how much memory the messages use.
+    pub fn bounded(
+        name: &'static str,
+        capacity: usize,
+        f: impl FnOnce(Messages<T>) + Send + 'static,
+    ) -> Self {
+        Self::new(name, crossbeam::channel::bounded(capacity), f)
+    }
+
+    fn new(
+        name: &'static str,
+        (sender, receiver): (Sender<Message<T>>, Receiver<Message<T>>),
+        f: impl FnOnce(Messages<T>) + Send + 'static,
+    ) -> Self {
+        let thread = std::thread::Builder::new()
+            .name(name.to_string())
+            .spawn(move || f(Messages(receiver)))
+            .unwrap();
+
+        Self {
+            name,
+            sender,
+            thread: Mutex::new(Some(thread)),
+        }
+    }
+
+    /// Send a message to the thread. Panics if the thread has exited.
+    pub fn send(&self, item: T) {
+        self.sender.send(Message::Item(item)).unwrap();
+    }
+
+    /// Wait for the thread to handle all messages that have been sent, and to exit.
+    pub fn finish(&self) {
+        let Some(thread) = self.thread.lock().unwrap().take() else {
+            return;
+        };
+
+        // the thread may have already exited if it panicked
+        self.sender.send(Message::Finish).ok();
+        if thread.join().is_err() {
+            log::warn!("The {} thread panicked", self.name);
+        }
+    }
+}
+
+/// The messages sent to a [`BackgroundWriter`], until it's finished.
+pub struct Messages<T>(Receiver<Message<T>>);
+
+impl<T> Iterator for Messages<T> {
+    type Item = T;
+
+    fn next(&mut self) -> Option<T> {
+        match self.0.recv().ok()? {
+            Message::Item(x) => Some(x),
+            Message::Finish => None,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_finish_handles_all_messages() {
+        let (result_sender, result_receiver) = crossbeam::channel::unbounded();
+        let writer = BackgroundWriter::bounded("test-writer", 1, move |messages| {
+            result_sender.send(messages.sum::<u32>()).unwrap();
+        });
+
+        for x in 1..=100 {
+            writer.send(x);
+        }
+        writer.finish();
+        assert_eq!(result_receiver.try_recv(), Ok(5050));
+
+        // finishing again does nothing
+        writer.finish();
+    }
+}
@@ -11,6 +11,10 @@ count for that key increases. The state of the counter can be extracted by conve
 to a string, which lists the counts for all keys sorted with the heaviest hitters first.
 Currently, only String types are supported, but we may eventually support counting
 generic types.
+
+For keys that are small integers known ahead of time (such as syscall numbers), an
+[`IndexedCounter`] stores the counts in a fixed-size array and can be converted to a
+string-keyed [`Counter`] when the counts are output.
 */
 
 use std::collections::HashMap;
@@ -195,6 +199,72 @@ impl Sub for Counter {
     }
 }
 
+/// A counter for keys that are integers less than `N`. Counts are stored in a fixed-size array, so
+/// updating a count doesn't need to hash or allocate a key. The counter can be converted to a
+/// [`Counter`] with [`to_counter`](Self::to_counter), which should only be needed for output.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct IndexedCounter<const N: usize> {
+    counts: Box<[i64; N]>,
+}
+
+impl<const N: usize> IndexedCounter<N> {
+    /// Initializes a new counter with all counts set to 0.
+    pub fn new() -> Self {
+        Self {
+            counts: vec![0; N].into_boxed_slice().try_into().unwrap(),
+        }
+    }
+
+    /// Increment the counter value by one for the key `idx`. Panics if `idx >= N`.
+    /// Returns the value of the counter after it was incremented.
+    pub fn add_one(&mut self, idx: usize) -> i64 {
+        self.add_value(idx, 1)
+    }
+
+    /// Increment the counter value by the given value for the key `idx`. Panics if `idx >= N`.
+    /// Returns the value of the counter after it was incremented.
+    pub fn add_value(&mut self, idx: usize, value: i64) -> i64 {
+        let count = &mut self.counts[idx];
+        *count += value;
+        *count
+    }
+
+    /// Returns the counter value for the key `idx`. Panics if `idx >= N`.
+    pub fn get_value(&self, idx: usize) -> i64 {
+        self.counts[idx]
+    }
+
+    /// Add all values in `other` to this counter.
+    pub fn add_counter(&mut self, other: &Self) {
+        for (count, other) in self.counts.iter_mut().zip(other.counts.iter()) {
+            *count += other;
+        }
+    }
+
+    /// Set all values to 0.
+    pub fn clear(&mut self) {
+        self.counts.fill(0);
+    }
+
+    /// Convert to a string-keyed [`Counter`], using `name` to get the name of each key with a
+    /// non-zero count.
+    pub fn to_counter(&self, name: impl Fn(usize) -> String) -> Counter {
+        let mut counter = Counter::new();
+        for (idx, count) in self.counts.iter().enumerate() {
+            if *count != 0 {
+                counter.add_value(&name(idx), *count);
+            }
+        }
+        counter
+    }
+}
+
+impl<const N: usize> Default for IndexedCounter<N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
 mod export {
     use super::*;
     use std::ffi::CStr;
@@ -536,6 +606,36 @@ mod tests {
         );
     }
 
+    #[test]
+    fn test_indexed_counter() {
+        let mut counter_a = IndexedCounter::<4>::new();
+        assert_eq!(counter_a.add_one(1), 1);
+        assert_eq!(counter_a.add_one(1), 2);
+        assert_eq!(counter_a.add_value(3, 5), 5);
+        assert_eq!(counter_a.get_value(0), 0);
+        assert_eq!(counter_a.get_value(1), 2);
+
+        let mut counter_b = IndexedCounter::<4>::new();
+        counter_b.add_value(1, 3);
+        counter_b.add_value(2, 1);
+        counter_b.add_value(3, -5);
+
+        counter_a.add_counter(&counter_b);
+        assert_eq!(counter_a.get_value(1), 5);
+        assert_eq!(counter_a.get_value(2), 1);
+        assert_eq!(counter_a.get_value(3), 0);
+
+        // keys with a count of 0 aren't included
+        let names = ["close", "read", "write", "open"];
+        assert_eq!(
+            counter_a.to_counter(|x| names[x].to_string()).to_string(),
+            String::from("{read:5, write:1}")
+        );
+
+        counter_a.clear();
+        assert_eq!(counter_a, IndexedCounter::new());
+    }
+
     #[test]
     fn test_to_string_order() {
         let mut counter_a = Counter::new();
@@ -4,6 +4,7 @@ pub mod enum_passthrough;
 #[macro_use]
 pub mod macros;
 
+pub mod background_writer;
 pub mod byte_queue;
 pub mod callback_queue;
 pub mod childpid_watcher;
@@ -17,6 +18,7 @@ pub mod pod;
 pub mod proc_maps;
 pub mod shm_cleanup;
 pub mod sockaddr;
+pub mod stable_hash;
 pub mod status_bar;
 pub mod stream_len;
 pub mod synchronization;
@@ -29,6 +31,7 @@ use std::os::unix::fs::{DirBuilderExt, MetadataExt};
 use std::os::unix::prelude::OsStrExt;
 use std::path::{Path, PathBuf};
 
+use crate::core::sim_stats::ObjectType;
 use crate::core::worker::Worker;
 use shadow_shim_helper_rs::HostId;
 
@@ -172,26 +175,28 @@ impl<T> Clone for Magic<T> {
 /// Helper for tracking the number of allocated objects.
 #[derive(Debug)]
 pub struct ObjectCounter {
-    name: &'static str,
+    object_type: ObjectType,
 }
 
 impl ObjectCounter {
-    pub fn new(name: &'static str) -> Self {
-        Worker::increment_object_alloc_counter(name);
-        Self { name }
+    pub fn new(object_type: ObjectType) -> Self {
+        Worker::increment_object_alloc_counter(object_type);
+        Self { object_type }
     }
 }
 
 impl Drop for ObjectCounter {
     fn drop(&mut self) {
-        Worker::increment_object_dealloc_counter(self.name);
+        Worker::increment_object_dealloc_counter(self.object_type);
     }
 }
 
 impl Clone for ObjectCounter {
     fn clone(&self) -> Self {
-        Worker::increment_object_alloc_counter(self.name);
-        Self { name: self.name }
+        Worker::increment_object_alloc_counter(self.object_type);
+        Self {
+            object_type: self.object_type,
+        }
     }
 }
 
@@ -269,6 +274,14 @@ fn create_dir_with_mode(path: impl AsRef<Path>, mode: u32) -> std::io::Result<()
     dir_builder.create(&path)
 }
 
+/// The resident set size of the current process in bytes, as reported by `/proc/self/statm`.
+pub fn resident_set_bytes() -> Option<u64> {
+    let statm = std::fs::read_to_string("/proc/self/statm").ok()?;
+    let pages: u64 = statm.split_whitespace().nth(1)?.parse().ok()?;
+    let page_size = nix::unistd::sysconf(nix::unistd::SysconfVar::PAGE_SIZE).ok()??;
+    Some(pages * u64::try_from(page_size).ok()?)
+}
+
 /// Helper for converting a PathBuf to a CString
 pub fn pathbuf_to_nul_term_cstring(buf: PathBuf) -> CString {
     let mut bytes = buf.as_os_str().to_os_string().as_bytes().to_vec();
@@ -1,30 +1,56 @@
-use std::io::{Seek, SeekFrom, Write};
+use std::io::Write;
 
-use crate::cshadow as c;
-use crate::utility::give::Give;
+/// The precision of the timestamps in a pcap file.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum TimestampPrecision {
+    Micros,
+    Nanos,
+}
 
 pub struct PcapWriter<W: Write> {
     writer: W,
     capture_len: u32,
+    precision: TimestampPrecision,
 }
 
 impl<W: Write> PcapWriter<W> {
     /// A new packet capture writer. Each packet (header and payload) captured will be truncated to
     /// a length `capture_len`.
     pub fn new(writer: W, capture_len: u32) -> std::io::Result<Self> {
-        let mut rv = PcapWriter {
-            writer,
-            capture_len,
-        };
+        Self::new_with_precision(writer, capture_len, TimestampPrecision::Micros)
+    }
 
+    /// A new packet capture writer with timestamps of the given precision.
+    pub fn new_with_precision(
+        writer: W,
+        capture_len: u32,
+        precision: TimestampPrecision,
+    ) -> std::io::Result<Self> {
+        let mut rv = Self::resume(writer, capture_len, precision);
         rv.write_header()?;
-
         Ok(rv)
     }
 
+    /// A packet capture writer that appends to a capture that already has a header. The capture
+    /// length and precision must be the same as when the capture was created.
+    pub fn resume(writer: W, capture_len: u32, precision: TimestampPrecision) -> Self {
+        PcapWriter {
+            writer,
+            capture_len,
+            precision,
+        }
+    }
+
+    pub fn get_mut(&mut self) -> &mut W {
+        &mut self.writer
+    }
+
     fn write_header(&mut self) -> std::io::Result<()> {
-        // magic number to show endianness
-        const MAGIC_NUMBER: u32 = 0xA1B2C3D4;
+        // magic number to show endianness and timestamp precision
+        let magic_number: u32 = match self.precision {
+            TimestampPrecision::Micros => 0xA1B2C3D4,
+            TimestampPrecision::Nanos => 0xA1B23C4D,
+        };
         const VERSION_MAJOR: u16 = 2;
         const VERSION_MINOR: u16 = 4;
         // GMT to local correction
@@ -35,7 +61,7 @@ impl<W: Write> PcapWriter<W> {
         const NETWORK: u32 = 101;
 
         // magic number: 4 bytes
-        self.writer.write_all(&MAGIC_NUMBER.to_ne_bytes())?;
+        self.writer.write_all(&magic_number.to_ne_bytes())?;
         // major version: 2 bytes
         self.writer.write_all(&VERSION_MAJOR.to_ne_bytes())?;
         // minor version: 2 bytes
@@ -53,167 +79,182 @@ impl<W: Write> PcapWriter<W> {
         Ok(())
     }
 
-    /// Write a packet from a buffer.
+    /// Write a packet from a buffer. `ts_subsec` is in microseconds or nanoseconds, depending on
+    /// the writer's timestamp precision.
     pub fn write_packet(
         &mut self,
         ts_sec: u32,
-        ts_usec: u32,
+        ts_subsec: u32,
         packet: &[u8],
     ) -> std::io::Result<()> {
         let packet_len = u32::try_from(packet.len()).unwrap();
         let packet_trunc_len = std::cmp::min(packet_len, self.capture_len);
 
-        // timestamp (seconds): 4 bytes
-        self.writer.write_all(&ts_sec.to_ne_bytes())?;
-        // timestamp (microseconds): 4 bytes
-        self.writer.write_all(&ts_usec.to_ne_bytes())?;
-
-        // captured packet length: 4 bytes
-        self.writer.write_all(&packet_trunc_len.to_ne_bytes())?;
-        // original packet length: 4 bytes
-        self.writer.write_all(&packet_len.to_ne_bytes())?;
-
-        // packet data: `packet_trunc_len` bytes
-        self.writer
-            .write_all(&packet[..(packet_trunc_len.try_into().unwrap())])?;
-
-        Ok(())
+        self.write_captured_packet(
+            ts_sec,
+            ts_subsec,
+            packet_len,
+            &packet[..(packet_trunc_len.try_into().unwrap())],
+        )
     }
-}
 
-impl<W: Write + Seek> PcapWriter<W> {
-    /// Write a packet without requiring an intermediate buffer.
-    pub fn write_packet_fmt(
+    /// Write a packet that has already been truncated to the capture length. `packet_len` is the
+    /// length of the original packet.
+    pub fn write_captured_packet(
         &mut self,
         ts_sec: u32,
-        ts_usec: u32,
+        ts_subsec: u32,
         packet_len: u32,
-        write_packet_fn: impl FnOnce(&mut Give<&mut W>) -> std::io::Result<()>,
+        captured: &[u8],
     ) -> std::io::Result<()> {
+        let captured_len = u32::try_from(captured.len()).unwrap();
+        assert!(captured_len <= self.capture_len);
+        assert!(captured_len <= packet_len);
+
         // timestamp (seconds): 4 bytes
         self.writer.write_all(&ts_sec.to_ne_bytes())?;
-        // timestamp (microseconds): 4 bytes
-        self.writer.write_all(&ts_usec.to_ne_bytes())?;
-
-        // position of the captured packet length field
-        let pos_of_len = self.writer.stream_position()?;
+        // timestamp (microseconds or nanoseconds): 4 bytes
+        self.writer.write_all(&ts_subsec.to_ne_bytes())?;
 
         // captured packet length: 4 bytes
-        // (write initially as 0, we'll update it later)
-        self.writer.write_all(&0u32.to_ne_bytes())?;
+        self.writer.write_all(&captured_len.to_ne_bytes())?;
         // original packet length: 4 bytes
         self.writer.write_all(&packet_len.to_ne_bytes())?;
 
-        // position of the packet data
-        let pos_before_packet_data = self.writer.stream_position()?;
-
-        // packet data: a soft limit of `capture_len` bytes
-        match write_packet_fn(&mut Give::new(&mut self.writer, self.capture_len as u64)) {
-            Ok(()) => {}
-            // this should mean that the entire packet couldn't be written, which is fine since
-            // we'll use a smaller captured packet length value
-            Err(e) if e.kind() == std::io::ErrorKind::WriteZero => {}
-            Err(e) => return Err(e),
-        }
-
-        // position after the packet data
-        let pos_after_packet_data = self.writer.stream_position()?;
-        // the number of packet data bytes written
-        let bytes_written = pos_after_packet_data - pos_before_packet_data;
-
-        // it is still possible for 'write_payload_fn' to have written more bytes than it was
-        // supposed to, so double check here
-        if bytes_written > self.capture_len.into() {
-            log::warn!(
-                "Pcap writer wrote more bytes than intended: {bytes_written} > {}",
-                self.capture_len
-            );
-            return Err(std::io::ErrorKind::InvalidData.into());
-        }
-
-        // go back and update the captured packet length
-        let bytes_written = u32::try_from(bytes_written).unwrap();
-        self.writer.seek(SeekFrom::Start(pos_of_len))?;
-        // captured packet length: 4 bytes
-        self.writer.write_all(&bytes_written.to_ne_bytes())?;
-        self.writer.seek(SeekFrom::Start(pos_after_packet_data))?;
+        // packet data: `captured_len` bytes
+        self.writer.write_all(captured)?;
 
         Ok(())
     }
 }
 
-pub trait PacketDisplay {
-    /// Write the packet bytes.
-    fn display_bytes(&self, writer: impl Write) -> std::io::Result<()>;
+/// A writer for the pcapng format. All interfaces use a timestamp resolution of nanoseconds.
+pub struct PcapNgWriter<W: Write> {
+    writer: W,
+    num_interfaces: u32,
+    /// Reused buffer for building blocks.
+    buf: Vec<u8>,
 }
 
-mod export {
-    use super::*;
-    use std::ffi::{CStr, OsStr};
-    use std::fs::File;
-    use std::io::BufWriter;
-    use std::os::unix::ffi::OsStrExt;
+impl<W: Write> PcapNgWriter<W> {
+    // block types
+    const SECTION_HEADER: u32 = 0x0A0D0D0A;
+    const INTERFACE_DESCRIPTION: u32 = 0x00000001;
+    const ENHANCED_PACKET: u32 = 0x00000006;
 
-    /// A new packet capture writer. Each packet (header and payload) captured will be truncated to
-    /// a length `capture_len`.
-    #[no_mangle]
-    pub extern "C" fn pcapwriter_new(
-        path: *const libc::c_char,
-        capture_len: u32,
-    ) -> *mut PcapWriter<BufWriter<File>> {
-        assert!(!path.is_null());
-        let path = OsStr::from_bytes(unsafe { CStr::from_ptr(path) }.to_bytes());
-
-        let file = match File::create(path) {
-            Ok(f) => f,
-            Err(e) => {
-                log::warn!("Could not create pcap file: {}", e);
-                return std::ptr::null_mut();
-            }
+    // option codes
+    const OPT_ENDOFOPT: u16 = 0;
+    const IF_NAME: u16 = 2;
+    const IF_TSRESOL: u16 = 9;
+
+    /// A new pcapng writer. This writes a section header block.
+    pub fn new(writer: W) -> std::io::Result<Self> {
+        let mut rv = PcapNgWriter {
+            writer,
+            num_interfaces: 0,
+            buf: Vec::new(),
         };
-        let file = BufWriter::new(file);
-        Box::into_raw(Box::new(PcapWriter::new(file, capture_len).unwrap()))
+
+        // magic number to show endianness
+        const BYTE_ORDER_MAGIC: u32 = 0x1A2B3C4D;
+        const VERSION_MAJOR: u16 = 1;
+        const VERSION_MINOR: u16 = 0;
+        // the section length isn't specified
+        const SECTION_LEN: i64 = -1;
+
+        rv.buf.extend_from_slice(&BYTE_ORDER_MAGIC.to_ne_bytes());
+        rv.buf.extend_from_slice(&VERSION_MAJOR.to_ne_bytes());
+        rv.buf.extend_from_slice(&VERSION_MINOR.to_ne_bytes());
+        rv.buf.extend_from_slice(&SECTION_LEN.to_ne_bytes());
+        rv.write_block(Self::SECTION_HEADER)?;
+
+        Ok(rv)
     }
 
-    #[no_mangle]
-    pub extern "C" fn pcapwriter_free(pcap: *mut PcapWriter<BufWriter<File>>) {
-        if pcap.is_null() {
-            return;
-        }
-        unsafe { Box::from_raw(pcap) };
+    pub fn get_mut(&mut self) -> &mut W {
+        &mut self.writer
     }
 
-    /// If there's an error, returns 1. Otherwise returns 0. If there's an error, the pcap file is
-    /// likely to be corrupt.
-    #[no_mangle]
-    pub extern "C" fn pcapwriter_writePacket(
-        pcap: *mut PcapWriter<BufWriter<File>>,
-        ts_sec: u32,
-        ts_usec: u32,
-        packet: *const c::Packet,
-    ) -> libc::c_int {
-        assert!(!pcap.is_null());
-        assert!(!packet.is_null());
+    /// Write an interface description block, and return the interface's id. Each packet (header
+    /// and payload) captured on the interface should be truncated to a length `capture_len`.
+    pub fn add_interface(&mut self, name: &str, capture_len: u32) -> std::io::Result<u32> {
+        // data link type (LINKTYPE_RAW)
+        const LINK_TYPE: u16 = 101;
+        // timestamps are in units of 10^-9 seconds
+        const TS_RESOLUTION: u8 = 9;
+
+        self.buf.extend_from_slice(&LINK_TYPE.to_ne_bytes());
+        // reserved: 2 bytes
+        self.buf.extend_from_slice(&0u16.to_ne_bytes());
+        self.buf.extend_from_slice(&capture_len.to_ne_bytes());
+        Self::push_option(&mut self.buf, Self::IF_NAME, name.as_bytes());
+        Self::push_option(&mut self.buf, Self::IF_TSRESOL, &[TS_RESOLUTION]);
+        Self::push_option(&mut self.buf, Self::OPT_ENDOFOPT, &[]);
+        self.write_block(Self::INTERFACE_DESCRIPTION)?;
+
+        let id = self.num_interfaces;
+        self.num_interfaces += 1;
+        Ok(id)
+    }
 
-        let pcap = unsafe { pcap.as_mut() }.unwrap();
+    /// Write a packet that has already been truncated to the interface's capture length.
+    /// `packet_len` is the length of the original packet.
+    pub fn write_packet(
+        &mut self,
+        interface_id: u32,
+        ts_nanos: u64,
+        packet_len: u32,
+        captured: &[u8],
+    ) -> std::io::Result<()> {
+        assert!(interface_id < self.num_interfaces);
+        let captured_len = u32::try_from(captured.len()).unwrap();
+        assert!(captured_len <= packet_len);
+
+        self.buf.extend_from_slice(&interface_id.to_ne_bytes());
+        // timestamp (high and low 32 bits)
+        self.buf
+            .extend_from_slice(&((ts_nanos >> 32) as u32).to_ne_bytes());
+        self.buf.extend_from_slice(&(ts_nanos as u32).to_ne_bytes());
+        self.buf.extend_from_slice(&captured_len.to_ne_bytes());
+        self.buf.extend_from_slice(&packet_len.to_ne_bytes());
+        self.buf.extend_from_slice(captured);
+        Self::pad(&mut self.buf);
+        self.write_block(Self::ENHANCED_PACKET)
+    }
 
-        let packet_len: u32 = u32::try_from(unsafe { c::packet_getTotalSize(packet) }).unwrap();
+    fn push_option(buf: &mut Vec<u8>, code: u16, value: &[u8]) {
+        buf.extend_from_slice(&code.to_ne_bytes());
+        buf.extend_from_slice(&u16::try_from(value.len()).unwrap().to_ne_bytes());
+        buf.extend_from_slice(value);
+        Self::pad(buf);
+    }
 
-        if let Err(e) = pcap.write_packet_fmt(ts_sec, ts_usec, packet_len, |writer| {
-            packet.display_bytes(writer)
-        }) {
-            log::warn!("Unable to write packet to pcap output: {}", e);
-            return 1;
-        }
+    /// Pad to a multiple of 4 bytes.
+    fn pad(buf: &mut Vec<u8>) {
+        buf.resize(buf.len() + (4 - buf.len() % 4) % 4, 0);
+    }
 
-        return 0;
+    /// Write a block with the body in `self.buf`, and clear the buffer.
+    fn write_block(&mut self, block_type: u32) -> std::io::Result<()> {
+        // block type, block length, body, block length
+        let block_len = u32::try_from(self.buf.len() + 12).unwrap();
+        self.writer.write_all(&block_type.to_ne_bytes())?;
+        self.writer.write_all(&block_len.to_ne_bytes())?;
+        self.writer.write_all(&self.buf)?;
+        self.writer.write_all(&block_len.to_ne_bytes())?;
+        self.buf.clear();
+        Ok(())
     }
 }
 
+pub trait PacketDisplay {
+    /// Write the packet bytes.
+    fn display_bytes(&self, writer: impl Write) -> std::io::Result<()>;
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
-    use std::io::Cursor;
 
     #[test]
     fn test_empty_pcap_writer() {
@@ -256,27 +297,22 @@ mod tests {
     }
 
     #[test]
-    fn test_write_packet_fmt() {
-        let mut buf = Cursor::new(vec![]);
-        let mut pcap = PcapWriter::new(&mut buf, 65535).unwrap();
-        pcap.write_packet_fmt(32, 128, 3, |writer| {
-            writer.write_all(&[0x01])?;
-            writer.write_all(&[0x02])?;
-            writer.write_all(&[0x03])
-        })
-        .unwrap();
+    fn test_nanos_pcap_writer() {
+        let mut buf = vec![];
+        let mut pcap =
+            PcapWriter::new_with_precision(&mut buf, 2, TimestampPrecision::Nanos).unwrap();
+        pcap.write_captured_packet(32, 999_999_999, 3, &[0x01, 0x02])
+            .unwrap();
 
         let expected_header = [
-            0xD4, 0xC3, 0xB2, 0xA1, 0x02, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00, 0x65, 0x00, 0x00, 0x00,
+            0x4D, 0x3C, 0xB2, 0xA1, 0x02, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x65, 0x00, 0x00, 0x00,
         ];
         let expected_packet_header = [
-            0x20, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x03, 0x00,
+            0x20, 0x00, 0x00, 0x00, 0xFF, 0xC9, 0x9A, 0x3B, 0x02, 0x00, 0x00, 0x00, 0x03, 0x00,
             0x00, 0x00,
         ];
-        let expected_payload = [0x01, 0x02, 0x03];
-
-        let buf = buf.into_inner();
+        let expected_payload = [0x01, 0x02];
 
         assert_eq!(
             buf,
@@ -288,4 +324,38 @@ mod tests {
             .concat()
         );
     }
+
+    #[test]
+    fn test_pcapng_writer() {
+        let mut buf = vec![];
+        let mut pcap = PcapNgWriter::new(&mut buf).unwrap();
+        assert_eq!(pcap.add_interface("eth", 65535).unwrap(), 0);
+        pcap.write_packet(0, (1 << 32) + 5, 3, &[0x01, 0x02, 0x03])
+            .unwrap();
+
+        let expected_section_header = [
+            0x0A, 0x0D, 0x0D, 0x0A, 0x1C, 0x00, 0x00, 0x00, 0x4D, 0x3C, 0x2B, 0x1A, 0x01, 0x00,
+            0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x1C, 0x00, 0x00, 0x00,
+        ];
+        let expected_interface_description = [
+            0x01, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x65, 0x00, 0x00, 0x00, 0xFF, 0xFF,
+            0x00, 0x00, 0x02, 0x00, 0x03, 0x00, 0x65, 0x74, 0x68, 0x00, 0x09, 0x00, 0x01, 0x00,
+            0x09, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00,
+        ];
+        let expected_enhanced_packet = [
+            0x06, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+            0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+            0x01, 0x02, 0x03, 0x00, 0x24, 0x00, 0x00, 0x00,
+        ];
+
+        assert_eq!(
+            buf,
+            [
+                &expected_section_header[..],
+                &expected_interface_description[..],
+                &expected_enhanced_packet[..]
+            ]
+            .concat()
+        );
+    }
 }
@@ -1,5 +1,3 @@
-use once_cell::sync::Lazy;
-use regex::Regex;
 use std::error::Error;
 use std::fmt::Display;
 use std::path::PathBuf;
@@ -39,20 +37,19 @@ pub enum MappingPath {
 impl FromStr for MappingPath {
     type Err = Box<dyn Error>;
     fn from_str(s: &str) -> Result<Self, Self::Err> {
-        static SPECIAL_RE: Lazy<Regex> = Lazy::new(|| Regex::new(r"^\[(\S+)\]$").unwrap());
-        static THREAD_STACK_RE: Lazy<Regex> = Lazy::new(|| Regex::new(r"^stack:(\d+)$").unwrap());
-
         if s.starts_with('/') {
             return Ok(MappingPath::Path(PathBuf::from(s)));
         }
-        if let Some(caps) = SPECIAL_RE.captures(s) {
-            let s = caps.get(1).unwrap().as_str();
-            if let Some(caps) = THREAD_STACK_RE.captures(s) {
+        if let Some(s) = s.strip_prefix('[').and_then(|s| s.strip_suffix(']')) {
+            if s.is_empty() || s.bytes().any(|b| b.is_ascii_whitespace()) {
+                return Err(format!("Couldn't parse '[{}]'", s).into());
+            }
+            if let Some(tid) = s.strip_prefix("stack:") {
+                if tid.is_empty() || !tid.bytes().all(|b| b.is_ascii_digit()) {
+                    return Err(format!("Parsing thread id: invalid digit in '{}'", tid).into());
+                }
                 return Ok(MappingPath::ThreadStack(
-                    caps.get(1)
-                        .unwrap()
-                        .as_str()
-                        .parse::<i32>()
+                    tid.parse::<i32>()
                         .map_err(|e| format!("Parsing thread id: {}", e))?,
                 ));
             }
@@ -99,81 +96,72 @@ where
     }
 }
 
+// Parses a permission bit, which is either `set` or '-'.
+fn parse_perm_bit(b: u8, set: u8, name: &str) -> Result<bool, String> {
+    match b {
+        b if b == set => Ok(true),
+        b'-' => Ok(false),
+        _ => Err(format!("Couldn't parse {} bit {}", name, b as char)),
+    }
+}
+
 impl FromStr for Mapping {
     type Err = Box<dyn Error>;
     fn from_str(line: &str) -> Result<Self, Self::Err> {
-        static RE: Lazy<Regex> = Lazy::new(|| {
-            Regex::new(
-                r"^(\S+)-(\S+)\s+(\S)(\S)(\S)(\S)\s+(\S+)\s+(\S+):(\S+)\s+(\S+)\s*(\S*)\s*(\S*)$",
-            )
-            .unwrap()
-        });
-
-        let caps = RE
-            .captures(line)
-            .ok_or_else(|| format!("Didn't match regex: {}", line))?;
+        // Hand-rolled rather than using a regex, since processes can have tens
+        // of thousands of mappings. Only the path (if any) is allocated.
+        let mut fields = line.split_ascii_whitespace();
+        let mut next_field = |name: &str| {
+            fields
+                .next()
+                .ok_or_else(|| format!("Missing {} field: {}", name, line))
+        };
+
+        let (begin, end) = next_field("range")?
+            .split_once('-')
+            .ok_or_else(|| format!("Didn't find address range: {}", line))?;
+        let perms = next_field("perms")?.as_bytes();
+        if perms.len() != 4 {
+            return Err(format!("Couldn't parse permissions in: {}", line).into());
+        }
+        let offset = next_field("offset")?;
+        let (device_major, device_minor) = next_field("device")?
+            .split_once(':')
+            .ok_or_else(|| format!("Didn't find device: {}", line))?;
+        let inode = next_field("inode")?;
+        let path = fields.next();
+        let deleted = fields.next();
+        if let Some(extra) = fields.next() {
+            return Err(format!("Couldn't parse trailing field '{}'", extra).into());
+        }
 
         Ok(Mapping {
-            begin: parse_field(caps.get(1).unwrap().as_str(), "begin", |s| {
-                usize::from_str_radix(s, 16)
-            })?,
-            end: parse_field(caps.get(2).unwrap().as_str(), "end", |s| {
-                usize::from_str_radix(s, 16)
-            })?,
-            read: {
-                let s = caps.get(3).unwrap().as_str();
-                match s {
-                    "r" => true,
-                    "-" => false,
-                    _ => return Err(format!("Couldn't parse read bit {}", s).into()),
-                }
-            },
-            write: {
-                let s = caps.get(4).unwrap().as_str();
-                match s {
-                    "w" => true,
-                    "-" => false,
-                    _ => return Err(format!("Couldn't parse write bit {}", s).into()),
-                }
-            },
-            execute: {
-                let s = caps.get(5).unwrap().as_str();
-                match s {
-                    "x" => true,
-                    "-" => false,
-                    _ => return Err(format!("Couldn't parse execute bit {}", s).into()),
-                }
-            },
-            sharing: caps.get(6).unwrap().as_str().parse::<Sharing>()?,
-            offset: parse_field(caps.get(7).unwrap().as_str(), "offset", |s| {
-                usize::from_str_radix(s, 16)
-            })?,
-            device_major: parse_field(caps.get(8).unwrap().as_str(), "device_major", |s| {
+            begin: parse_field(begin, "begin", |s| usize::from_str_radix(s, 16))?,
+            end: parse_field(end, "end", |s| usize::from_str_radix(s, 16))?,
+            read: parse_perm_bit(perms[0], b'r', "read")?,
+            write: parse_perm_bit(perms[1], b'w', "write")?,
+            execute: parse_perm_bit(perms[2], b'x', "execute")?,
+            sharing: std::str::from_utf8(&perms[3..])?.parse::<Sharing>()?,
+            offset: parse_field(offset, "offset", |s| usize::from_str_radix(s, 16))?,
+            device_major: parse_field(device_major, "device_major", |s| {
                 i32::from_str_radix(s, 16)
             })?,
-            device_minor: parse_field(caps.get(9).unwrap().as_str(), "device_minor", |s| {
+            device_minor: parse_field(device_minor, "device_minor", |s| {
                 i32::from_str_radix(s, 16)
             })?,
             // Undocumented whether this is actually base 10; change to 16 if we find
             // counter-examples.
-            inode: parse_field(caps.get(10).unwrap().as_str(), "inode", |s| {
-                u64::from_str_radix(s, 10)
-            })?,
-            path: parse_field::<_, _, Box<dyn Error>>(
-                caps.get(11).unwrap().as_str(),
-                "path",
-                |s| match s {
-                    "" => Ok(None),
-                    s => Ok(Some(s.parse::<MappingPath>()?)),
-                },
-            )?,
-            deleted: {
-                let s = caps.get(12).unwrap().as_str();
-                match s {
-                    "" => false,
-                    "(deleted)" => true,
-                    _ => return Err(format!("Couldn't parse trailing field '{}'", s).into()),
-                }
+            inode: parse_field(inode, "inode", |s| u64::from_str_radix(s, 10))?,
+            path: match path {
+                None => None,
+                Some(s) => Some(parse_field::<_, _, Box<dyn Error>>(s, "path", |s| {
+                    s.parse::<MappingPath>()
+                })?),
+            },
+            deleted: match deleted {
+                None => false,
+                Some("(deleted)") => true,
+                Some(s) => return Err(format!("Couldn't parse trailing field '{}'", s).into()),
             },
         })
     }
@@ -190,13 +178,27 @@ pub fn parse_file_contents(mappings: &str) -> Result<Vec<Mapping>, Box<dyn Error
 
 /// Reads and parses the contents of a /proc/\[pid\]/maps file
 pub fn mappings_for_pid(pid: libc::pid_t) -> Result<Vec<Mapping>, Box<dyn Error>> {
+    let mut res = Vec::new();
+    for_each_mapping_for_pid(pid, |m| res.push(m))?;
+    Ok(res)
+}
+
+/// Reads and parses the contents of a /proc/\[pid\]/maps file, passing each
+/// mapping to `f` as it's parsed rather than collecting them.
+pub fn for_each_mapping_for_pid(
+    pid: libc::pid_t,
+    mut f: impl FnMut(Mapping),
+) -> Result<(), Box<dyn Error>> {
     use std::fs::File;
     use std::io::Read;
 
     let mut file = File::open(format!("/proc/{}/maps", pid))?;
     let mut contents = String::new();
     file.read_to_string(&mut contents)?;
-    parse_file_contents(&contents)
+    for line in contents.lines() {
+        f(Mapping::from_str(line).map_err(|e| format!("Parsing line: {}\n{}", line, e))?);
+    }
+    Ok(())
 }
 
 #[cfg(test)]
@@ -0,0 +1,78 @@
+//! A hash function whose output is the same in every run and on every platform, unlike
+//! [`std::collections::hash_map::DefaultHasher`], so that it can be used for seeds and for keys
+//! that are saved to files. It isn't resistant to deliberate collisions.
+
+/// The 64-bit FNV-1a hash function. Values are hashed as their bytes, so callers must write them
+/// in a fixed order and encoding (for example the `write_u64` little-endian encoding), and must
+/// delimit variable-length values.
+#[derive(Debug, Clone, Copy)]
+pub struct StableHasher(u64);
+
+impl StableHasher {
+    const OFFSET_BASIS: u64 = 0xcbf29ce484222325;
+    const PRIME: u64 = 0x100000001b3;
+
+    pub const fn new() -> Self {
+        Self(Self::OFFSET_BASIS)
+    }
+
+    pub fn write(&mut self, bytes: &[u8]) {
+        for b in bytes {
+            self.0 ^= u64::from(*b);
+            self.0 = self.0.wrapping_mul(Self::PRIME);
+        }
+    }
+
+    pub fn write_u64(&mut self, x: u64) {
+        self.write(&x.to_le_bytes());
+    }
+
+    /// Write the length of `bytes` followed by `bytes`, so that consecutive strings can't run
+    /// together.
+    pub fn write_delimited(&mut self, bytes: &[u8]) {
+        self.write_u64(bytes.len().try_into().unwrap());
+        self.write(bytes);
+    }
+
+    pub fn finish(&self) -> u64 {
+        self.0
+    }
+}
+
+impl Default for StableHasher {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn hash(bytes: &[u8]) -> u64 {
+        let mut hasher = StableHasher::new();
+        hasher.write(bytes);
+        hasher.finish()
+    }
+
+    #[test]
+    fn test_known_values() {
+        assert_eq!(hash(b""), 0xcbf29ce484222325);
+        assert_eq!(hash(b"a"), 0xaf63dc4c8601ec8c);
+        assert_eq!(hash(b"foobar"), 0x85944171f73967e8);
+    }
+
+    #[test]
+    fn test_delimited() {
+        let hash_strs = |strs: &[&str]| {
+            let mut hasher = StableHasher::new();
+            for s in strs {
+                hasher.write_delimited(s.as_bytes());
+            }
+            hasher.finish()
+        };
+
+        assert_ne!(hash_strs(&["ab", "c"]), hash_strs(&["a", "bc"]));
+        assert_eq!(hash_strs(&["ab", "c"]), hash_strs(&["ab", "c"]));
+    }
+}
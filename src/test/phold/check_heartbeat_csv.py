@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+
+'''
+Check the heartbeat CSV files written with
+`experimental.host_heartbeat_format: csv` in the current directory: that
+each file has the expected header, that every row has a value for each
+column, and that the columns which are derived from other columns agree with
+them.
+'''
+
+import csv
+import sys
+
+PREFIXES = ["in-local-", "out-local-", "in-remote-", "out-remote-"]
+
+COUNTERS = [
+    "packets-total", "bytes-total", "packets-control", "bytes-control-header",
+    "packets-control-retrans", "bytes-control-header-retrans", "packets-data",
+    "bytes-data-header", "bytes-data-payload", "packets-data-retrans",
+    "bytes-data-header-retrans", "bytes-data-payload-retrans",
+]
+
+INTERFACE_COUNTERS = [prefix + name for prefix in PREFIXES for name in COUNTERS]
+
+HEADERS = {
+    "heartbeat-node.csv": [
+        "time-nanos", "hostname", "interval-nanos", "recv-bytes", "send-bytes",
+        "processing-nanos", "delayed-count", "delay-nanos",
+    ] + INTERFACE_COUNTERS,
+    "heartbeat-socket.csv": [
+        "time-nanos", "hostname", "socket", "protocol", "peer-hostname", "peer-port",
+        "inbuflen-bytes", "inbufsize-bytes", "outbuflen-bytes", "outbufsize-bytes",
+        "recv-bytes", "send-bytes",
+    ] + INTERFACE_COUNTERS,
+    "heartbeat-ram.csv": [
+        "time-nanos", "hostname", "interval-nanos", "alloc-bytes", "dealloc-bytes",
+        "total-bytes", "pointers-count", "failfree-count",
+    ],
+}
+
+TEXT_COLUMNS = {"hostname", "protocol", "peer-hostname"}
+
+
+def check(condition, filename, line, message):
+    if not condition:
+        sys.exit(f"{filename}:{line}: {message}")
+
+
+def check_totals(row, filename, line):
+    for prefix in PREFIXES:
+        packets = sum(row[prefix + x] for x in COUNTERS if x.startswith("packets-")
+                      and x != "packets-total")
+        total_bytes = sum(row[prefix + x] for x in COUNTERS if x.startswith("bytes-")
+                          and x != "bytes-total")
+        check(row[prefix + "packets-total"] == packets, filename, line,
+              f"{prefix}packets-total isn't the sum of the packet counters")
+        check(row[prefix + "bytes-total"] == total_bytes, filename, line,
+              f"{prefix}bytes-total isn't the sum of the byte counters")
+
+
+def check_file(filename, header, hostnames):
+    with open(filename, newline="") as f:
+        reader = csv.reader(f)
+        check(next(reader, None) == header, filename, 1, "unexpected header")
+
+        last_time = 0
+        num_rows = 0
+        for line, values in enumerate(reader, start=2):
+            check(len(values) == len(header), filename, line, "wrong number of columns")
+            row = {name: value if name in TEXT_COLUMNS else int(value)
+                   for (name, value) in zip(header, values)}
+            num_rows += 1
+
+            # rows are written in order of time
+            check(row["time-nanos"] >= last_time, filename, line, "out of order")
+            last_time = row["time-nanos"]
+            hostnames.add(row["hostname"])
+
+            if "in-remote-bytes-total" in row:
+                check_totals(row, filename, line)
+
+            if filename == "heartbeat-node.csv":
+                check(row["interval-nanos"] > 0, filename, line, "empty interval")
+                check(row["recv-bytes"] == row["in-remote-bytes-total"], filename, line,
+                      "recv-bytes doesn't match the remote counters")
+                check(row["send-bytes"] == row["out-remote-bytes-total"], filename, line,
+                      "send-bytes doesn't match the remote counters")
+            elif filename == "heartbeat-socket.csv":
+                # sockets are numbered within their host, not by their address
+                check(row["socket"] < 1000, filename, line, "not a socket number")
+                check(row["recv-bytes"] == row["in-local-bytes-total"]
+                      + row["in-remote-bytes-total"], filename, line,
+                      "recv-bytes doesn't match the counters")
+                check(row["send-bytes"] == row["out-local-bytes-total"]
+                      + row["out-remote-bytes-total"], filename, line,
+                      "send-bytes doesn't match the counters")
+            elif filename == "heartbeat-ram.csv":
+                check(row["interval-nanos"] > 0, filename, line, "empty interval")
+
+        check(num_rows > 0, filename, 2, "no rows")
+
+
+def main():
+    expected_hostnames = set(sys.argv[1:])
+    for (filename, header) in HEADERS.items():
+        hostnames = set()
+        check_file(filename, header, hostnames)
+        check(expected_hostnames <= hostnames, filename, 0,
+              f"missing hosts {sorted(expected_hostnames - hostnames)}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+
+'''
+Check the host log records written to separate files in the current
+directory, with `--log-sharding` or `--use-binary-log`: that there are records
+from each of the given hosts, that each file only has records from the host or
+thread that it's for, and that each host's records are in order of simulation
+time.
+
+The binary log files must first be decoded to `shadow-log.txt` with
+src/tools/shadow-log-decode.py.
+'''
+
+import argparse
+import glob
+import os
+import re
+import sys
+
+# the start of a record: the wall time, thread, simulation time, level, and host
+RECORD = re.compile(r"^(\d+:\d+:\d+\.\d+) \[(\d+):[^\]]*\] (\S+) \[\w+\] \[([^\]:]+)")
+
+
+def fail(path, line, message):
+    sys.exit(f"{path}:{line}: {message}")
+
+
+def read_records(path):
+    '''Returns a list of (line number, wall time, thread id, simulation time, hostname).'''
+    records = []
+    with open(path) as f:
+        for (line, text) in enumerate(f, start=1):
+            match = RECORD.match(text)
+            # other lines are the continuations of multi-line messages
+            if match:
+                records.append((line, *match.groups()))
+    if not records:
+        fail(path, 0, "no records")
+    return records
+
+
+def check_in_order(path, records):
+    '''Check that each host's records are in order of simulation time.'''
+    last_times = {}
+    for (line, _, _, time, hostname) in records:
+        if time == "n/a":
+            continue
+        # the fixed-width times sort in the same order as strings
+        if time < last_times.get(hostname, ""):
+            fail(path, line, f"a record from host {hostname} is out of order")
+        last_times[hostname] = time
+
+
+def check_host_shards(hostnames):
+    for hostname in hostnames:
+        path = os.path.join("hosts", hostname, f"{hostname}.shadow.log")
+        if not os.path.exists(path):
+            fail(path, 0, "missing")
+
+        records = read_records(path)
+        for (line, _, _, _, record_host) in records:
+            if record_host != hostname:
+                fail(path, line, f"a record from host {record_host}")
+        check_in_order(path, records)
+
+
+def check_thread_shards(hostnames):
+    paths = glob.glob("shadow.*.log")
+    if not paths:
+        fail("shadow.*.log", 0, "no thread log files")
+
+    found_hostnames = set()
+    for path in paths:
+        thread_id = path.split(".")[-2]
+        records = read_records(path)
+        for (line, _, record_thread_id, _, record_host) in records:
+            if record_thread_id != thread_id:
+                fail(path, line, f"a record from thread {record_thread_id}")
+            if record_host == "n/a":
+                fail(path, line, "a record that isn't from a host")
+            found_hostnames.add(record_host)
+        check_in_order(path, records)
+
+    missing = set(hostnames) - found_hostnames
+    if missing:
+        fail("shadow.*.log", 0, f"no records from hosts {sorted(missing)}")
+
+
+def check_binary_log(hostnames):
+    num_files = len(glob.glob(os.path.join("shadow-log", "*.bin")))
+    if num_files == 0:
+        fail("shadow-log", 0, "no binary log files")
+
+    path = "shadow-log.txt"
+    records = read_records(path)
+
+    found_hostnames = set()
+    thread_ids = set()
+    last_wall_time = ""
+    for (line, wall_time, thread_id, _, record_host) in records:
+        if record_host == "n/a":
+            fail(path, line, "a record that isn't from a host")
+        # the decoder merges the files by wall time
+        if wall_time < last_wall_time:
+            fail(path, line, "out of order")
+        last_wall_time = wall_time
+        found_hostnames.add(record_host)
+        thread_ids.add(thread_id)
+    check_in_order(path, records)
+
+    missing = set(hostnames) - found_hostnames
+    if missing:
+        fail(path, 0, f"no records from hosts {sorted(missing)}")
+    # each thread writes its own file
+    if len(thread_ids) != num_files:
+        fail(path, 0, f"records from {len(thread_ids)} threads in {num_files} files")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("sharding", choices=["host", "thread", "binary"])
+    parser.add_argument("hostnames", nargs="+")
+    args = parser.parse_args()
+
+    if args.sharding == "host":
+        check_host_shards(args.hostnames)
+    elif args.sharding == "thread":
+        check_thread_shards(args.hostnames)
+    else:
+        check_binary_log(args.hostnames)
+
+
+if __name__ == "__main__":
+    main()
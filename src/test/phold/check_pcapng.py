@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+
+'''
+Check a pcapng file written with `--pcap-format pcapng`: that its blocks are
+well-formed, that its timestamps have nanosecond resolution and are in order,
+and that it has interfaces for the given hosts. With `--pcap-dir`, also check
+that it has the same packets as the pcap files written by a run of the same
+simulation with `--pcap-format pcap`. With `--unfiltered`, also check that it's
+a filtered subset of the packets captured in an unfiltered run.
+'''
+
+import argparse
+import collections
+import glob
+import os
+import struct
+import sys
+
+SECTION_HEADER = 0x0A0D0D0A
+INTERFACE_DESCRIPTION = 0x00000001
+ENHANCED_PACKET = 0x00000006
+
+IF_NAME = 2
+IF_TSRESOL = 9
+
+PROTOCOLS = {"tcp": 6, "udp": 17}
+
+# the magic number of pcap files with microsecond timestamps
+PCAP_MAGIC_MICROS = 0xA1B2C3D4
+
+
+def fail(path, message):
+    sys.exit(f"{path}: {message}")
+
+
+def parse_options(buf):
+    options = {}
+    while len(buf) >= 4:
+        (code, length) = struct.unpack_from("<HH", buf)
+        if code == 0:
+            break
+        options[code] = buf[4:4 + length]
+        buf = buf[4 + (length + 3) // 4 * 4:]
+    return options
+
+
+def read_pcapng(path):
+    '''Returns a list of (interface name, time in nanoseconds, packet data).'''
+    with open(path, "rb") as f:
+        buf = f.read()
+
+    interfaces = []
+    packets = []
+    offset = 0
+    while offset < len(buf):
+        if len(buf) - offset < 12:
+            fail(path, f"truncated block at offset {offset}")
+        (block_type, length) = struct.unpack_from("<II", buf, offset)
+        if length % 4 != 0 or length < 12 or offset + length > len(buf):
+            fail(path, f"bad block length {length} at offset {offset}")
+        if struct.unpack_from("<I", buf, offset + length - 4)[0] != length:
+            fail(path, f"mismatched block lengths at offset {offset}")
+        body = buf[offset + 8:offset + length - 4]
+
+        if offset == 0 and block_type != SECTION_HEADER:
+            fail(path, "doesn't start with a section header")
+        if block_type == SECTION_HEADER and struct.unpack_from("<I", body)[0] != 0x1A2B3C4D:
+            fail(path, "isn't little-endian")
+
+        if block_type == INTERFACE_DESCRIPTION:
+            options = parse_options(body[8:])
+            if options.get(IF_TSRESOL) != bytes([9]):
+                fail(path, f"interface {len(interfaces)} doesn't have nanosecond timestamps")
+            interfaces.append(options.get(IF_NAME, b"").decode())
+        elif block_type == ENHANCED_PACKET:
+            (interface_id, ts_high, ts_low, captured_len, packet_len) = \
+                struct.unpack_from("<IIIII", body)
+            if interface_id >= len(interfaces):
+                fail(path, f"packet at offset {offset} has an unknown interface")
+            if captured_len > packet_len:
+                fail(path, f"packet at offset {offset} is longer than its original length")
+            time = (ts_high << 32) | ts_low
+            if packets and time < packets[-1][1]:
+                fail(path, f"packet at offset {offset} is out of order")
+            packets.append((interfaces[interface_id], time, body[20:20 + captured_len]))
+
+        offset += length
+
+    return (interfaces, packets)
+
+
+def read_pcap(path):
+    '''Returns a list of (time in microseconds, packet data).'''
+    with open(path, "rb") as f:
+        buf = f.read()
+
+    if len(buf) < 24 or struct.unpack_from("<I", buf)[0] != PCAP_MAGIC_MICROS:
+        fail(path, "isn't a little-endian pcap file with microsecond timestamps")
+
+    packets = []
+    offset = 24
+    while offset < len(buf):
+        if len(buf) - offset < 16:
+            fail(path, f"truncated packet at offset {offset}")
+        (secs, micros, captured_len, _) = struct.unpack_from("<IIII", buf, offset)
+        if micros >= 1_000_000:
+            fail(path, f"packet at offset {offset} has more than a second of microseconds")
+        data = buf[offset + 16:offset + 16 + captured_len]
+        if len(data) != captured_len:
+            fail(path, f"truncated packet at offset {offset}")
+        packets.append((secs * 1_000_000 + micros, data))
+        offset += 16 + captured_len
+
+    return packets
+
+
+def check_same_as_pcap(path, interfaces, packets, pcap_dir):
+    '''Check that the packets are the same as in the pcap files under `pcap_dir`, which are
+    named after their interfaces.'''
+    pcap_paths = glob.glob(os.path.join(pcap_dir, "**", "*.pcap"), recursive=True)
+    if not pcap_paths:
+        fail(pcap_dir, "no pcap files")
+
+    pcap_packets = collections.Counter()
+    for pcap_path in pcap_paths:
+        interface = os.path.basename(pcap_path)[:-len(".pcap")]
+        pcap_packets.update((interface, time, data) for (time, data) in read_pcap(pcap_path))
+
+    # interfaces without any packets aren't added to the pcapng file
+    pcap_interfaces = {x[0] for x in pcap_packets}
+    if pcap_interfaces != set(interfaces):
+        fail(path, f"has interfaces {sorted(interfaces)}, "
+             f"but the pcap files have {sorted(pcap_interfaces)}")
+
+    pcapng_packets = collections.Counter((name, time // 1000, data)
+                                         for (name, time, data) in packets)
+    if pcapng_packets != pcap_packets:
+        fail(path, f"has {sum((pcapng_packets - pcap_packets).values())} packets that aren't in "
+             f"the pcap files, which have {sum((pcap_packets - pcapng_packets).values())} "
+             "packets that it doesn't")
+
+
+def flow(packet):
+    '''The protocol and the unordered pair of endpoints of an IPv4 packet.'''
+    data = packet[2]
+    header_len = (data[0] & 0x0F) * 4
+    protocol = data[9]
+    src = (data[12:16], struct.unpack_from(">H", data, header_len)[0])
+    dst = (data[16:20], struct.unpack_from(">H", data, header_len + 2)[0])
+    return (packet[0], protocol, min(src, dst), max(src, dst))
+
+
+def check_filtered(path, packets, unfiltered_path, unfiltered, protocol, flow_packet_limit):
+    if not packets:
+        fail(path, "no packets were captured")
+    if len(packets) >= len(unfiltered):
+        fail(path, f"{len(packets)} packets weren't filtered from {len(unfiltered)} packets")
+
+    # capturing doesn't change the simulation, so the filtered packets are the same as some of the
+    # unfiltered packets
+    missing = collections.Counter(packets) - collections.Counter(unfiltered)
+    if missing:
+        fail(path, f"{sum(missing.values())} packets aren't in {unfiltered_path}")
+
+    if protocol is not None:
+        if any(packet[2][9] != PROTOCOLS[protocol] for packet in packets):
+            fail(path, f"captured packets that aren't {protocol}")
+
+    if flow_packet_limit is not None:
+        counts = collections.Counter(flow(packet) for packet in packets)
+        if max(counts.values()) > flow_packet_limit:
+            fail(path, f"captured more than {flow_packet_limit} packets of a flow")
+
+    print(f"{path}: captured {len(packets)} of {len(unfiltered)} packets")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("path")
+    parser.add_argument("hostnames", nargs="*", help="hosts that should have interfaces")
+    parser.add_argument("--pcap-dir", help="a directory with pcap files from the same simulation")
+    parser.add_argument("--unfiltered", help="the pcapng file from an unfiltered run")
+    parser.add_argument("--protocol", choices=PROTOCOLS.keys(),
+                        help="the protocol that the capture was filtered to")
+    parser.add_argument("--flow-packet-limit", type=int,
+                        help="the most packets that should be captured for each flow")
+    args = parser.parse_args()
+
+    (interfaces, packets) = read_pcapng(args.path)
+
+    for hostname in args.hostnames:
+        if not any(name.startswith(f"{hostname}-") for name in interfaces):
+            fail(args.path, f"no interfaces for host {hostname}")
+
+    if args.pcap_dir is not None:
+        check_same_as_pcap(args.path, interfaces, packets, args.pcap_dir)
+
+    if args.unfiltered is not None:
+        (_, unfiltered) = read_pcapng(args.unfiltered)
+        check_filtered(args.path, packets, args.unfiltered, unfiltered, args.protocol,
+                       args.flow_packet_limit)
+
+
+if __name__ == "__main__":
+    main()
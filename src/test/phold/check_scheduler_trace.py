@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+
+'''
+Check the scheduler trace written with `--use-scheduler-trace true`: that it's
+valid JSON in the Chrome trace format, that each worker thread recorded its
+rounds and host executions, that every host was executed, and that packets sent
+between hosts were counted.
+'''
+
+import argparse
+import collections
+import json
+import sys
+
+REQUIRED_FIELDS = {
+    "M": ["pid", "tid", "name", "args"],
+    "X": ["pid", "tid", "name", "ts", "dur", "args"],
+    "i": ["pid", "tid", "name", "ts", "args"],
+    "C": ["pid", "tid", "name", "ts", "args"],
+}
+
+
+def fail(message):
+    sys.exit(f"scheduler-trace.json: {message}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--threads", type=int, required=True,
+                        help="the number of worker threads that should have run rounds")
+    parser.add_argument("--hosts", type=int, required=True,
+                        help="the number of hosts that should have been executed")
+    args = parser.parse_args()
+
+    with open("scheduler-trace.json") as f:
+        try:
+            trace = json.load(f)
+        except json.JSONDecodeError as e:
+            fail(f"invalid JSON: {e}")
+
+    events = trace.get("traceEvents")
+    if not isinstance(events, list):
+        fail("no traceEvents list")
+
+    events_by_name = collections.defaultdict(list)
+    for (i, event) in enumerate(events):
+        fields = REQUIRED_FIELDS.get(event.get("ph"))
+        if fields is None:
+            fail(f"event {i} has an unknown phase {event.get('ph')!r}")
+        missing = [x for x in fields if x not in event]
+        if missing:
+            fail(f"event {i} is missing {missing}")
+        if event["ph"] == "X" and event["dur"] < 0:
+            fail(f"event {i} has a negative duration")
+        events_by_name[event["name"]].append(event)
+
+    named_threads = {x["tid"] for x in events_by_name["thread_name"]}
+    round_threads = {x["tid"] for x in events_by_name["round"]}
+    if len(round_threads) < args.threads:
+        fail(f"only {len(round_threads)} threads ran rounds")
+    if not round_threads <= named_threads:
+        fail("some threads that ran rounds don't have names")
+
+    if not events_by_name["barrier"]:
+        fail("no barrier events")
+
+    hosts = {x["args"]["host"] for x in events_by_name["execute"]}
+    if len(hosts) != args.hosts:
+        fail(f"{len(hosts)} hosts were executed, not {args.hosts}")
+
+    packets = sum(x["args"]["packets"] for x in events_by_name["packets_sent"])
+    if packets <= 0:
+        fail("no packets were counted")
+
+    print(f"{len(events)} events, {len(round_threads)} threads, {len(hosts)} hosts, "
+          f"{packets} packets sent")
+
+
+if __name__ == "__main__":
+    main()
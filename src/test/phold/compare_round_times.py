@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+
+'''
+Run a simulation with each of the given schedulers, and compare how long they
+took and how long their scheduling rounds took using the scheduler trace.
+Fails if any scheduler is slower than the first (the baseline) by more than
+the given tolerance, in total or at the median or 99th percentile round time.
+'''
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import time
+
+
+def round_times_us(trace_path):
+    '''The duration of each round, from the manager's barrier events.'''
+    with open(trace_path) as f:
+        trace = json.load(f)
+    return sorted(e["dur"] for e in trace["traceEvents"] if e["name"] == "barrier")
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def run(shadow, config, scheduler, extra_args):
+    '''Returns the wall-clock time of the run in seconds, and the sorted round times.'''
+    data_dir = f"{scheduler}.data"
+    shutil.rmtree(data_dir, ignore_errors=True)
+    start = time.monotonic()
+    with open(f"{scheduler}.log", "w") as log:
+        subprocess.run([shadow, f"--data-directory={data_dir}", "--scheduler", scheduler,
+                        "--use-scheduler-trace", "true", *extra_args, config],
+                       stdout=log, check=True)
+    wall_time = time.monotonic() - start
+    times = round_times_us(os.path.join(data_dir, "scheduler-trace.json"))
+    if not times:
+        sys.exit(f"{scheduler}: the trace has no rounds")
+    return wall_time, times
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("shadow")
+    parser.add_argument("config")
+    parser.add_argument("--schedulers", default="thread-per-core,thread-per-core-lpt",
+                        help="comma-separated schedulers to run, starting with the baseline")
+    parser.add_argument("--tolerance", type=float, default=1.25,
+                        help="the largest allowed ratio of a scheduler's times to the baseline's")
+    parser.add_argument("shadow_args", nargs="*")
+    args = parser.parse_intermixed_args()
+
+    schedulers = args.schedulers.split(",")
+
+    stats = {}
+    for scheduler in schedulers:
+        wall_time, times = run(args.shadow, args.config, scheduler, args.shadow_args)
+        stats[scheduler] = {"total": wall_time, "p50": percentile(times, 50),
+                            "p99": percentile(times, 99)}
+        print(f"{scheduler}: {wall_time:.2f} s total, {len(times)} rounds, "
+              f"p50 {stats[scheduler]['p50']:.1f} us, p99 {stats[scheduler]['p99']:.1f} us")
+
+    baseline = schedulers[0]
+    failed = False
+    for scheduler in schedulers[1:]:
+        for stat in ("total", "p50", "p99"):
+            ratio = stats[scheduler][stat] / stats[baseline][stat]
+            print(f"{stat} ratio ({scheduler} / {baseline}): {ratio:.2f}")
+            if ratio > args.tolerance:
+                failed = True
+
+    if failed:
+        sys.exit(f"A scheduler was more than {args.tolerance}x slower than {baseline}")
+
+
+if __name__ == "__main__":
+    main()
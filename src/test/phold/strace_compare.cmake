@@ -0,0 +1,17 @@
+# Compare the strace files written in the "standard" and "deferred" strace logging modes.
+foreach(LOOPIDX RANGE 1 10)
+    set(STANDARD ${CMAKE_BINARY_DIR}/phold-strace-standard-shadow.data/hosts/peer${LOOPIDX}/peer${LOOPIDX}.test-phold.1000.strace)
+    set(DEFERRED ${CMAKE_BINARY_DIR}/phold-strace-deferred-shadow.data/hosts/peer${LOOPIDX}/peer${LOOPIDX}.test-phold.1000.strace)
+
+    file(READ ${STANDARD} STANDARD_START LIMIT 1)
+    if(STANDARD_START STREQUAL "")
+        message(FATAL_ERROR "'${STANDARD}' is empty")
+    endif()
+
+    execute_process(
+        COMMAND ${CMAKE_COMMAND} -E compare_files ${STANDARD} ${DEFERRED}
+        RESULT_VARIABLE RESULT)
+    if(RESULT)
+        message(FATAL_ERROR "'${STANDARD}' and '${DEFERRED}' differ")
+    endif()
+endforeach(LOOPIDX)
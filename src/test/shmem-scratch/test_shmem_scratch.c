@@ -0,0 +1,176 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+// Syscalls whose buffers are large enough for the shim to stage them in its
+// shared memory scratch area (see `use_shmem_scratch`).
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "test/test_glib_helpers.h"
+
+// Larger than the shim's staging threshold, and smaller than the scratch area.
+#define BUF_LEN 16384
+
+// An inaccessible buffer of `BUF_LEN` bytes.
+static void* _bad_buffer() {
+    void* buf = mmap(NULL, BUF_LEN, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert_true_errno(buf != MAP_FAILED);
+    return buf;
+}
+
+static void _udp_socketpair(int* client, int* server, struct sockaddr_in* addr) {
+    assert_nonneg_errno(*server = socket(AF_INET, SOCK_DGRAM, 0));
+
+    *addr = (struct sockaddr_in){.sin_family = AF_INET, .sin_addr = htonl(INADDR_LOOPBACK)};
+    assert_nonneg_errno(bind(*server, addr, sizeof(*addr)));
+
+    socklen_t addr_len = sizeof(*addr);
+    assert_nonneg_errno(getsockname(*server, addr, &addr_len));
+
+    assert_nonneg_errno(*client = socket(AF_INET, SOCK_DGRAM, 0));
+}
+
+static void test_write_bad_buffer() {
+    int fds[2];
+    assert_nonneg_errno(pipe(fds));
+
+    void* buf = _bad_buffer();
+    g_assert_cmpint(write(fds[1], buf, BUF_LEN), ==, -1);
+    assert_errno_is(EFAULT);
+
+    assert_nonneg_errno(munmap(buf, BUF_LEN));
+    assert_nonneg_errno(close(fds[0]));
+    assert_nonneg_errno(close(fds[1]));
+}
+
+static void test_sendto_bad_buffer() {
+    int client, server;
+    struct sockaddr_in addr = {0};
+    _udp_socketpair(&client, &server, &addr);
+
+    void* buf = _bad_buffer();
+    g_assert_cmpint(sendto(client, buf, BUF_LEN, 0, &addr, sizeof(addr)), ==, -1);
+    assert_errno_is(EFAULT);
+
+    assert_nonneg_errno(munmap(buf, BUF_LEN));
+    assert_nonneg_errno(close(server));
+    assert_nonneg_errno(close(client));
+}
+
+static void test_recvfrom_bad_buffer() {
+    int client, server;
+    struct sockaddr_in addr = {0};
+    _udp_socketpair(&client, &server, &addr);
+
+    char send_buf[BUF_LEN];
+    memset(send_buf, 42, sizeof(send_buf));
+    g_assert_cmpint(sendto(client, send_buf, sizeof(send_buf), 0, &addr, sizeof(addr)), ==,
+                    sizeof(send_buf));
+
+    void* buf = _bad_buffer();
+    g_assert_cmpint(recvfrom(server, buf, BUF_LEN, 0, NULL, NULL), ==, -1);
+    assert_errno_is(EFAULT);
+
+    assert_nonneg_errno(munmap(buf, BUF_LEN));
+    assert_nonneg_errno(close(server));
+    assert_nonneg_errno(close(client));
+}
+
+static int _main_pipe[2];
+static int _handler_pipe[2];
+static size_t _main_pipe_filled;
+static volatile sig_atomic_t _handler_ran;
+
+// Makes its own large write, then drains the main pipe so that the
+// interrupted write can be restarted.
+static void _large_write_handler(int signo) {
+    static char buf[BUF_LEN];
+    memset(buf, 'H', sizeof(buf));
+    g_assert_cmpint(write(_handler_pipe[1], buf, sizeof(buf)), ==, sizeof(buf));
+
+    while (_main_pipe_filled > 0) {
+        ssize_t rv = read(_main_pipe[0], buf, MIN(sizeof(buf), _main_pipe_filled));
+        g_assert_cmpint(rv, >, 0);
+        _main_pipe_filled -= rv;
+    }
+
+    _handler_ran = true;
+}
+
+// A signal handler that makes its own large write while a large write is
+// blocked must not change the data that's written when that write restarts.
+static void test_signal_handler_large_write() {
+    assert_nonneg_errno(pipe(_main_pipe));
+    assert_nonneg_errno(pipe(_handler_pipe));
+
+    // Fill the main pipe so that the next write blocks.
+    char buf[BUF_LEN];
+    memset(buf, 'F', sizeof(buf));
+    assert_nonneg_errno(fcntl(_main_pipe[1], F_SETFL, O_NONBLOCK));
+    _main_pipe_filled = 0;
+    while (true) {
+        ssize_t rv = write(_main_pipe[1], buf, 4096);
+        if (rv < 0) {
+            assert_errno_is(EAGAIN);
+            break;
+        }
+        _main_pipe_filled += rv;
+    }
+    assert_nonneg_errno(fcntl(_main_pipe[1], F_SETFL, 0));
+
+    struct sigaction action = {.sa_handler = _large_write_handler, .sa_flags = SA_RESTART};
+    assert_nonneg_errno(sigaction(SIGALRM, &action, NULL));
+    struct itimerval timer = {.it_value = {.tv_usec = 10000}};
+    assert_nonneg_errno(setitimer(ITIMER_REAL, &timer, NULL));
+
+    // Blocks until the handler has drained the pipe.
+    memset(buf, 'M', sizeof(buf));
+    size_t written = 0;
+    while (written < sizeof(buf)) {
+        ssize_t rv = write(_main_pipe[1], buf + written, sizeof(buf) - written);
+        assert_nonneg_errno(rv);
+        written += rv;
+    }
+    g_assert_true(_handler_ran);
+
+    char expected[BUF_LEN];
+    memset(expected, 'M', sizeof(expected));
+    size_t nread = 0;
+    while (nread < sizeof(buf)) {
+        ssize_t rv = read(_main_pipe[0], buf + nread, sizeof(buf) - nread);
+        g_assert_cmpint(rv, >, 0);
+        nread += rv;
+    }
+    g_assert_cmpmem(buf, sizeof(buf), expected, sizeof(expected));
+
+    memset(expected, 'H', sizeof(expected));
+    g_assert_cmpint(read(_handler_pipe[0], buf, sizeof(buf)), ==, sizeof(buf));
+    g_assert_cmpmem(buf, sizeof(buf), expected, sizeof(expected));
+
+    assert_nonneg_errno(sigaction(SIGALRM, &(struct sigaction){.sa_handler = SIG_DFL}, NULL));
+    for (int i = 0; i < 2; i++) {
+        assert_nonneg_errno(close(_main_pipe[i]));
+        assert_nonneg_errno(close(_handler_pipe[i]));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/shmem_scratch/write_bad_buffer", test_write_bad_buffer);
+    g_test_add_func("/shmem_scratch/sendto_bad_buffer", test_sendto_bad_buffer);
+    g_test_add_func("/shmem_scratch/recvfrom_bad_buffer", test_recvfrom_bad_buffer);
+    g_test_add_func("/shmem_scratch/signal_handler_large_write", test_signal_handler_large_write);
+    return g_test_run();
+}
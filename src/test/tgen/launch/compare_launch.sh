@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+
+# Runs a simulation with and without the zygote launcher, checks that all of
+# the tgen transfers succeeded in both, and reports the wall-clock times.
+#
+# Usage: compare_launch.sh <shadow> <config> <expected-stream-count>
+
+set -euo pipefail
+
+shadow=$1
+config=$2
+expected_count=$3
+
+# Runs shadow, and prints its wall-clock time in seconds.
+run() {
+    local name=$1
+    shift
+
+    rm -rf "${name}.data"
+    local start end
+    start="$(date +%s.%N)"
+    "${shadow}" --data-directory="${name}.data" --log-level=info "$@" "${config}" > "${name}.log"
+    end="$(date +%s.%N)"
+
+    local actual_count
+    actual_count="$(grep -r --include="client.tgen.*.stdout" "stream-success" "${name}.data" | wc -l)"
+    if [[ "${actual_count}" != "${expected_count}" ]]; then
+        printf "%s: only %s/%s tgen streams were successful\n" "${name}" "${actual_count}" "${expected_count}" >&2
+        exit 1
+    fi
+
+    if grep -q "Zygote [0-9]* \(exited abnormally\|stopped responding\|could not fork\)" "${name}.log"; then
+        printf "%s: a zygote failed\n" "${name}" >&2
+        exit 1
+    fi
+
+    awk "BEGIN { print ${end} - ${start} }"
+}
+
+direct="$(run tgen-launch-direct --use-zygote-launcher false)"
+zygote="$(run tgen-launch-zygote --use-zygote-launcher true)"
+
+printf "Direct launch: %.1f s\n" "${direct}"
+printf "Zygote launch: %.1f s\n" "${zygote}"
+awk "BEGIN { printf \"Speedup: %.2fx\\n\", ${direct} / ${zygote} }"
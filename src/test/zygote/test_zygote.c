@@ -0,0 +1,36 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+// Reports whether it was forked from a zygote (see `use_zygote_launcher`).
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ZYGOTE_FD_ENV_ENTRY "SHADOW_ZYGOTE_FD="
+
+int main(int argc, char* argv[], char* envp[]) {
+    // `envp` is the zygote's environment if we were forked from one, while
+    // `environ` should have been replaced by our own.
+    bool from_zygote = false;
+    for (char** entry = envp; *entry != NULL; entry++) {
+        if (strncmp(*entry, ZYGOTE_FD_ENV_ENTRY, strlen(ZYGOTE_FD_ENV_ENTRY)) == 0) {
+            from_zygote = true;
+        }
+    }
+
+    if (getenv("SHADOW_ZYGOTE_FD") != NULL) {
+        fprintf(stderr, "The zygote's environment wasn't replaced\n");
+        return EXIT_FAILURE;
+    }
+    if (getenv("ZYGOTE_TEST_VAR") == NULL || strcmp(getenv("ZYGOTE_TEST_VAR"), "1") != 0) {
+        fprintf(stderr, "Missing the configured environment\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%s\n", from_zygote ? "started from zygote" : "started directly");
+    return EXIT_SUCCESS;
+}
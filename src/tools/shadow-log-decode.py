@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+
+'''
+Convert the binary log files written with `experimental.use_binary_log` to
+Shadow's text log format. The records from all of the files are merged by
+their wall-clock time. The file format is described in
+src/main/core/logger/binary_log.rs.
+'''
+
+import argparse
+import heapq
+import os
+import struct
+import sys
+
+MAGIC = b"SHDWLOG\0"
+VERSION = 1
+
+TAG_STRING = 1
+TAG_HOST = 2
+TAG_RECORD = 3
+
+NONE = 0xFFFFFFFF
+NO_SIM_TIME = 0xFFFFFFFFFFFFFFFF
+
+# the display names of rust's `log::Level`, indexed by level
+LEVELS = [None, "ERROR", "WARN", "INFO", "DEBUG", "TRACE"]
+
+RECORD = struct.Struct("<BQQIIIIII")
+U32 = struct.Struct("<I")
+
+
+class DecodeError(Exception):
+    pass
+
+
+def read_exact(f, n):
+    data = f.read(n)
+    if len(data) != n:
+        raise DecodeError("unexpected end of file")
+    return data
+
+
+def read_u32(f):
+    return U32.unpack(read_exact(f, U32.size))[0]
+
+
+def read_bytes(f):
+    return read_exact(f, read_u32(f))
+
+
+def time_parts(nanos):
+    secs, nanos = divmod(nanos, 1_000_000_000)
+    mins, secs = divmod(secs, 60)
+    hours, mins = divmod(mins, 60)
+    return hours, mins, secs, nanos
+
+
+def format_record(thread_name, strings, hosts, record, message):
+    (level, wall_micros, sim_nanos, thread_id, host_id, file_id, module_id, line,
+     message_id) = record
+
+    if message_id != NONE:
+        message = strings[message_id]
+
+    hours, mins, secs, nanos = time_parts(wall_micros * 1000)
+    out = f"{hours:02}:{mins:02}:{secs:02}.{nanos // 1000:06}"
+    out += f" [{thread_id}:{thread_name}]"
+
+    if sim_nanos == NO_SIM_TIME:
+        out += " n/a"
+    else:
+        hours, mins, secs, nanos = time_parts(sim_nanos)
+        out += f" {hours:02}:{mins:02}:{secs:02}.{nanos:09}"
+
+    out += f" [{LEVELS[level]}]"
+
+    if host_id in hosts:
+        out += " [{}:{}]".format(*hosts[host_id])
+    else:
+        out += " [n/a]"
+
+    file_name = strings[file_id].rsplit('/', 1)[-1] if file_id != NONE else "n/a"
+    line = str(line) if line != NONE else "n/a"
+    module = strings[module_id] if module_id != NONE else "n/a"
+
+    return f"{out} [{file_name}:{line}] [{module}] {message}"
+
+
+def read_log(path):
+    '''Yields `(wall_time_micros, line)` for each record in the file.'''
+    with open(path, 'rb') as f:
+        if read_exact(f, len(MAGIC)) != MAGIC:
+            raise DecodeError(f"'{path}' is not a Shadow binary log file")
+        version = read_u32(f)
+        if version != VERSION:
+            raise DecodeError(f"'{path}' has unsupported version {version}")
+        thread_name = read_bytes(f).decode('utf-8', 'replace')
+
+        strings = {}
+        hosts = {}
+
+        while True:
+            tag = f.read(1)
+            if not tag:
+                # a file may be truncated if shadow didn't exit cleanly
+                return
+            tag = tag[0]
+
+            if tag == TAG_STRING:
+                string_id = read_u32(f)
+                strings[string_id] = read_bytes(f).decode('utf-8', 'replace')
+            elif tag == TAG_HOST:
+                host_id = read_u32(f)
+                ip = '.'.join(str(x) for x in read_exact(f, 4))
+                hosts[host_id] = (read_bytes(f).decode('utf-8', 'replace'), ip)
+            elif tag == TAG_RECORD:
+                record = RECORD.unpack(read_exact(f, RECORD.size))
+                message = None
+                if record[-1] == NONE:
+                    message = read_bytes(f).decode('utf-8', 'replace')
+                yield (record[1], format_record(thread_name, strings, hosts, record, message))
+            else:
+                raise DecodeError(f"'{path}' has unknown entry type {tag}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('paths', nargs='+',
+                        help="binary log files, or directories containing them (such as "
+                        "'shadow.data/shadow-log')")
+    args = parser.parse_args()
+
+    files = []
+    for path in args.paths:
+        if os.path.isdir(path):
+            files.extend(sorted(os.path.join(path, x) for x in os.listdir(path)
+                                if x.endswith('.bin')))
+        else:
+            files.append(path)
+
+    try:
+        # each file is already in wall-clock order
+        for (_, line) in heapq.merge(*[read_log(x) for x in files], key=lambda x: x[0]):
+            print(line)
+    except BrokenPipeError:
+        pass
+    except (DecodeError, OSError) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())